@@ -13,6 +13,9 @@ URL:            https://github.com/altlinux/ALTMediaWriter
 Source:         %oname-%version.tar
 
 BuildRequires:  liblzma-devel
+BuildRequires:  liburing-devel
+BuildRequires:  libzstd-devel
+BuildRequires:  zlib-devel
 BuildRequires:  libyaml-cpp-devel
 BuildRequires:  qt5-declarative-devel
 BuildRequires:  qt5-x11extras-devel
@@ -48,6 +51,7 @@ fi
 
 %check
 appstream-util validate-relax --nonet %buildroot/%_datadir/appdata/%name.appdata.xml
+helper/linux/helper selftest
 
 %files
 %_bindir/%name
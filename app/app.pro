@@ -7,6 +7,7 @@ TARGET = $$MEDIAWRITER_NAME
 QT += qml quick widgets network
 
 LIBS += -lisomd5
+include($$top_srcdir/lib/isomd5/digest.pri)
 linux {
     LIBS += -lyaml-cpp
 }
@@ -23,6 +24,12 @@ HEADERS += \
     network.h \
     notifications.h \
     image_download.h \
+    download_sink.h \
+    mirror_scheduler.h \
+    catalog_snapshot.h \
+    image_cache.h \
+    image_check.h \
+    job_scheduler.h \
     progress.h \
     file_type.h \
     architecture.h \
@@ -38,6 +45,12 @@ SOURCES += main.cpp \
     network.cpp \
     notifications.cpp \
     image_download.cpp \
+    download_sink.cpp \
+    mirror_scheduler.cpp \
+    catalog_snapshot.cpp \
+    image_cache.cpp \
+    image_check.cpp \
+    job_scheduler.cpp \
     progress.cpp \
     file_type.cpp \
     architecture.cpp \
@@ -58,8 +71,10 @@ lupdate_only {
         $$PWD/simple/*.qml \
         $$PWD/views/*.qml \
         linuxdrivemanager.cpp \
+        helper_job.cpp \
         windrivemanager.cpp
     HEADERS += linuxdrivemanager.h \
+        helper_job.h \
         windrivemanager.h
 }
 
@@ -69,8 +84,10 @@ INSTALLS += target
 linux {
     QT += dbus x11extras
 
-    HEADERS += linuxdrivemanager.h
-    SOURCES += linuxdrivemanager.cpp
+    HEADERS += linuxdrivemanager.h \
+        helper_job.h
+    SOURCES += linuxdrivemanager.cpp \
+        helper_job.cpp
 
     icon.path = "$$DATADIR/icons/hicolor"
     icon.files = assets/icon/16x16 \
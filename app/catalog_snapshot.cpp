@@ -0,0 +1,144 @@
+/*
+ * ALT Media Writer
+ * Copyright (C) 2016-2019 Martin Bříza <mbriza@redhat.com>
+ * Copyright (C) 2020-2022 Dmitry Degtyarev <kevl@basealt.ru>
+ *
+ * ALT Media Writer is a fork of Fedora Media Writer
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include "catalog_snapshot.h"
+
+#include <QDataStream>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+
+#define CATALOG_SNAPSHOT_VERSION 2
+
+QDataStream &operator<<(QDataStream &stream, const SnapshotVariant &variant);
+QDataStream &operator>>(QDataStream &stream, SnapshotVariant &variant);
+QDataStream &operator<<(QDataStream &stream, const SnapshotRelease &release);
+QDataStream &operator>>(QDataStream &stream, SnapshotRelease &release);
+QString enum_string(const QStringList &strings);
+
+bool CatalogSnapshot::load(const QString &path) {
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly) || file.size() == 0) {
+        return false;
+    }
+
+    // NOTE: data is read from the mapping without copying
+    // the file
+    const uchar *map = file.map(0, file.size());
+    if (map == nullptr) {
+        return false;
+    }
+
+    const QByteArray data = QByteArray::fromRawData((const char *) map, file.size());
+    QDataStream stream(data);
+    stream.setVersion(QDataStream::Qt_5_0);
+
+    qint32 version;
+    stream >> version;
+    if (stream.status() != QDataStream::Ok || version != CATALOG_SNAPSHOT_VERSION) {
+        return false;
+    }
+
+    CatalogSnapshot loaded;
+    stream >> loaded.metadataHash >> loaded.context >> loaded.releases;
+
+    const bool valid = (stream.status() == QDataStream::Ok && stream.atEnd());
+    if (!valid) {
+        return false;
+    }
+
+    *this = loaded;
+
+    return true;
+}
+
+bool CatalogSnapshot::save(const QString &path) const {
+    QDir().mkpath(QFileInfo(path).path());
+
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly)) {
+        return false;
+    }
+
+    QDataStream stream(&file);
+    stream.setVersion(QDataStream::Qt_5_0);
+    stream << (qint32) CATALOG_SNAPSHOT_VERSION << metadataHash << context << releases;
+
+    return (stream.status() == QDataStream::Ok && file.commit());
+}
+
+QDataStream &operator<<(QDataStream &stream, const SnapshotVariant &variant) {
+    const QString arch = enum_string(architecture_strings(variant.arch));
+    const QString platform = enum_string(platform_strings(variant.platform));
+    const QString file_type = enum_string(file_type_strings(variant.fileType));
+
+    stream << variant.url << variant.mirrorUrls << arch << platform << file_type << variant.board << variant.live << variant.md5sum << variant.bmapUrl << variant.segmentsUrl;
+
+    return stream;
+}
+
+QDataStream &operator>>(QDataStream &stream, SnapshotVariant &variant) {
+    QString arch;
+    QString platform;
+    QString file_type;
+
+    stream >> variant.url >> variant.mirrorUrls >> arch >> platform >> file_type >> variant.board >> variant.live >> variant.md5sum >> variant.bmapUrl >> variant.segmentsUrl;
+
+    // NOTE: unknown values are stored as empty strings,
+    // which map back to unknown
+    variant.arch = architecture_from_string(arch);
+    variant.platform = platform_from_string(platform);
+    variant.fileType = [&]() {
+        for (const FileType type : file_type_all) {
+            if (file_type_strings(type).contains(file_type)) {
+                return type;
+            }
+        }
+
+        return FileType_UNKNOWN;
+    }();
+
+    return stream;
+}
+
+QDataStream &operator<<(QDataStream &stream, const SnapshotRelease &release) {
+    stream << release.name << release.displayName << release.summary << release.description << release.icon << release.variants;
+
+    return stream;
+}
+
+QDataStream &operator>>(QDataStream &stream, SnapshotRelease &release) {
+    stream >> release.name >> release.displayName >> release.summary >> release.description >> release.icon >> release.variants;
+
+    return stream;
+}
+
+// First metadata string of an enum value, empty for
+// values that have none
+QString enum_string(const QStringList &strings) {
+    if (strings.isEmpty()) {
+        return QString();
+    } else {
+        return strings.first();
+    }
+}
@@ -0,0 +1,86 @@
+/*
+ * ALT Media Writer
+ * Copyright (C) 2016-2019 Martin Bříza <mbriza@redhat.com>
+ * Copyright (C) 2020-2022 Dmitry Degtyarev <kevl@basealt.ru>
+ *
+ * ALT Media Writer is a fork of Fedora Media Writer
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef CATALOG_SNAPSHOT_H
+#define CATALOG_SNAPSHOT_H
+
+/**
+ * Binary snapshot of the release catalog as it was loaded
+ * from metadata: releases in the order they are shown and
+ * their variants with checksums and mirrors already
+ * resolved. Loading it doesn't parse any YAML, so the app
+ * shows releases right away at start.
+ *
+ * Snapshot is a versioned QDataStream, which is read
+ * straight from a memory mapping of the file. Enums are
+ * stored by their metadata strings, not values, so
+ * changing an enum doesn't mislabel saved variants. It's saved
+ * with the hash of the metadata it was made from and the
+ * context that affects how metadata is loaded, so it's
+ * replaced once the metadata changes and ignored if the
+ * context is different.
+ */
+
+#include <QByteArray>
+#include <QList>
+#include <QString>
+
+#include "architecture.h"
+#include "file_type.h"
+#include "platform.h"
+
+struct SnapshotVariant {
+    QString url;
+    QList<QString> mirrorUrls;
+    Architecture arch;
+    Platform platform;
+    FileType fileType;
+    QString board;
+    bool live;
+    QString md5sum;
+    QString bmapUrl;
+    QString segmentsUrl;
+};
+
+struct SnapshotRelease {
+    QString name;
+    QString displayName;
+    QString summary;
+    QString description;
+    QString icon;
+    QList<SnapshotVariant> variants;
+};
+
+class CatalogSnapshot {
+public:
+    // Hash of metadata files the catalog was loaded from
+    QByteArray metadataHash;
+    // Metadata host, language and such, snapshot made in
+    // a different context is not used
+    QString context;
+    QList<SnapshotRelease> releases;
+
+    bool load(const QString &path);
+    bool save(const QString &path) const;
+};
+
+#endif // CATALOG_SNAPSHOT_H
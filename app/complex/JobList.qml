@@ -0,0 +1,77 @@
+/*
+ * ALT Media Writer
+ * Copyright (C) 2016-2019 Martin Bříza <mbriza@redhat.com>
+ * Copyright (C) 2020-2022 Dmitry Degtyarev <kevl@basealt.ru>
+ *
+ * ALT Media Writer is a fork of Fedora Media Writer
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+import QtQuick 2.3
+import QtQuick.Controls 1.2
+import QtQuick.Layouts 1.1
+
+import MediaWriter 1.0
+
+import "../simple"
+
+// Downloads, writes and restores in the job queue. Jobs
+// that didn't start yet can be removed from it.
+ColumnLayout {
+    id: root
+    spacing: 4
+    visible: jobs.length > 0
+
+    Text {
+        font.pointSize: 9
+        font.bold: true
+        text: qsTr("Queue")
+        color: palette.windowText
+    }
+
+    Repeater {
+        model: jobs
+        delegate: RowLayout {
+            Layout.fillWidth: true
+            spacing: 8
+
+            Text {
+                Layout.fillWidth: true
+                font.pointSize: 9
+                elide: Text.ElideRight
+                text: {
+                    switch (model.type) {
+                        case JobScheduler.DOWNLOAD: return qsTr("Download %1").arg(model.name)
+                        case JobScheduler.WRITE: return qsTr("Write %1").arg(model.name)
+                        case JobScheduler.RESTORE: return qsTr("Restore %1").arg(model.name)
+                    }
+                    return model.name
+                }
+                color: palette.windowText
+            }
+            Text {
+                font.pointSize: 9
+                text: model.state === JobScheduler.RUNNING ? qsTr("Running") : qsTr("Queued")
+                color: disabledPalette.windowText
+            }
+            AdwaitaButton {
+                visible: model.state === JobScheduler.QUEUED
+                text: qsTr("Remove")
+                onClicked: jobs.cancel(index)
+            }
+        }
+    }
+}
@@ -45,15 +45,20 @@ Dialog {
         writeArrow.color = palette.text
     }
 
+    // Whether the variant has a download or write that is
+    // queued or running
+    function variantIsBusy() {
+        return [Variant.DOWNLOAD_QUEUED, Variant.DOWNLOADING, Variant.DOWNLOAD_RESUMING, Variant.DOWNLOAD_VERIFYING, Variant.WRITE_QUEUED, Variant.WRITING, Variant.WRITE_VERIFYING].indexOf(releases.selected.variant.status) >= 0
+    }
+
     onVisibleChanged: {
-        // When dialog is closed via Cancel button or Close button, cancel current download or write
-        if (!visible) {
-            if (drives.selected) {
-                drives.selected.cancel()
-            }
-            releases.selected.variant.cancelDownload()
+        // NOTE: queued and running jobs keep going when the
+        // dialog is closed, so that more jobs can be lined
+        // up. They are cancelled with the Cancel button or
+        // removed from the queue, see JobList.
+        if (!variantIsBusy()) {
+            releases.selected.variant.resetStatus()
         }
-        releases.selected.variant.resetStatus()
         reset()
     }
 
@@ -72,6 +77,14 @@ Dialog {
                     value: 0.0/0.0
                 }
             },
+            State {
+                name: "download_queued"
+                when: releases.selected.variant.status === Variant.DOWNLOAD_QUEUED
+                PropertyChanges {
+                    target: progressBar;
+                    value: 0.0/0.0
+                }
+            },
             State {
                 name: "downloading"
                 when: releases.selected.variant.status === Variant.DOWNLOADING
@@ -120,7 +133,7 @@ Dialog {
                     target: rightButton;
                     enabled: releases.selected.variant.canWrite;
                     color: "red";
-                    onClicked: drives.selected.write(releases.selected.variant)
+                    onClicked: drives.write(releases.selected.variant)
                 }
             },
             State {
@@ -132,6 +145,18 @@ Dialog {
                     placeholderText: qsTr("Writing is not possible")
                 }
             },
+            State {
+                name: "write_queued"
+                when: releases.selected.variant.status === Variant.WRITE_QUEUED
+                PropertyChanges {
+                    target: driveCombo;
+                    enabled: false
+                }
+                PropertyChanges {
+                    target: progressBar;
+                    value: 0.0/0.0
+                }
+            },
             State {
                 name: "writing"
                 when: releases.selected.variant.status === Variant.WRITING
@@ -203,7 +228,7 @@ Dialog {
                     text: qsTr("Retry");
                     enabled: false;
                     color: "red";
-                    onClicked: drives.selected.write(releases.selected.variant);
+                    onClicked: drives.write(releases.selected.variant);
                 }
             },
             State {
@@ -218,7 +243,7 @@ Dialog {
                     text: qsTr("Retry");
                     enabled: true;
                     color: "red";
-                    onClicked: drives.selected.write(releases.selected.variant);
+                    onClicked: drives.write(releases.selected.variant);
                 }
             },
             State {
@@ -244,7 +269,7 @@ Dialog {
                     text: qsTr("Retry");
                     enabled: false;
                     color: "red";
-                    onClicked: drives.selected.write(releases.selected.variant)
+                    onClicked: drives.write(releases.selected.variant)
                 }
             },
             State {
@@ -259,15 +284,13 @@ Dialog {
                     text: qsTr("Retry");
                     enabled: true;
                     color: "red";
-                    onClicked: drives.selected.write(releases.selected.variant)
+                    onClicked: drives.write(releases.selected.variant)
                 }
             }
         ]
 
         Keys.onEscapePressed: {
-            if ([Variant.WRITING, Variant.WRITE_VERIFYING].indexOf(releases.selected.variant.status) < 0) {
-                dialog.visible = false
-            }
+            dialog.visible = false
         }
 
         ScrollView {
@@ -306,7 +329,7 @@ Dialog {
                             id: messageLoseData
                             visible: false
                             width: infoColumn.width
-                            text: qsTr("By writing, you will lose all of the data on %1.").arg(driveCombo.currentText)
+                            text: drives.checkedCount > 0 ? qsTr("By writing, you will lose all of the data on %n selected drive(s).", "", drives.checkedCount) : qsTr("By writing, you will lose all of the data on %1.").arg(driveCombo.currentText)
                         }
 
                         InfoMessage {
@@ -380,7 +403,7 @@ Dialog {
                         AdwaitaCheckBox {
                             id: delayedWriteCheck
                             text: qsTr("Write the image after downloading")
-                            enabled: drives.selected && ((releases.selected.variant.status == Variant.DOWNLOADING) || (releases.selected.variant.status == Variant.DOWNLOAD_RESUMING)) && releases.selected.variant.canWrite
+                            enabled: drives.selected && ((releases.selected.variant.status == Variant.DOWNLOAD_QUEUED) || (releases.selected.variant.status == Variant.DOWNLOADING) || (releases.selected.variant.status == Variant.DOWNLOAD_RESUMING)) && releases.selected.variant.canWrite
                             visible: enabled
 
                             onCheckedChanged: {
@@ -456,6 +479,58 @@ Dialog {
                         }
                     }
 
+                    // Drives checked here are written at once
+                    // instead of the one selected above
+                    ColumnLayout {
+                        id: batchColumn
+                        Layout.fillWidth: true
+                        visible: drives.length > 1
+                        spacing: 4
+
+                        Text {
+                            font.pointSize: 9
+                            text: qsTr("Write to several drives at once:")
+                            color: palette.windowText
+                        }
+
+                        Repeater {
+                            model: drives
+                            delegate: RowLayout {
+                                Layout.fillWidth: true
+                                spacing: 12
+
+                                AdwaitaCheckBox {
+                                    text: model.display
+                                    checked: model.checked
+                                    enabled: driveCombo.enabled
+                                    onCheckedChanged: {
+                                        drives.setChecked(index, checked)
+                                    }
+                                }
+                                Item {
+                                    Layout.fillWidth: true
+                                    height: childrenRect.height
+                                    visible: model.checked && [Variant.WRITING, Variant.WRITE_VERIFYING].indexOf(releases.selected.variant.status) >= 0
+                                    AdwaitaProgressBar {
+                                        width: parent.width
+                                        value: model.drive.progress.ratio
+                                        progressColor: releases.selected.variant.status == Variant.WRITE_VERIFYING ? Qt.lighter("green") : "red"
+                                    }
+                                }
+                                Text {
+                                    visible: model.checked && model.drive.errorString.length > 0
+                                    font.pointSize: 9
+                                    text: model.drive.errorString
+                                    color: "red"
+                                }
+                            }
+                        }
+                    }
+
+                    JobList {
+                        Layout.fillWidth: true
+                    }
+
                     ColumnLayout {
                         z: -1
                         Layout.maximumWidth: parent.width
@@ -474,7 +549,7 @@ Dialog {
                             color: "red"
                         }
                         Text {
-                            visible: releases.selected.variant.noMd5sum
+                            visible: !releases.selected.variant.canVerify && releases.selected.variant.noMd5sum
                             font.pointSize: 10
                             Layout.fillWidth: true
                             width: Layout.width
@@ -482,7 +557,7 @@ Dialog {
                             text: qsTr("This image won't be verified after writing because no MD5 sum was found.")
                         }
                         Text {
-                            visible: releases.selected.variant.isCompressed
+                            visible: !releases.selected.variant.canVerify && releases.selected.variant.isCompressed
                             font.pointSize: 10
                             Layout.fillWidth: true
                             width: Layout.width
@@ -500,6 +575,15 @@ Dialog {
                                 Layout.fillHeight: true
                             }
 
+                            AdwaitaButton {
+                                id: backgroundButton
+                                Layout.alignment: Qt.AlignRight
+                                visible: variantIsBusy()
+                                text: qsTr("Close")
+                                onClicked: {
+                                    dialog.close()
+                                }
+                            }
                             AdwaitaButton {
                                 id: leftButton
                                 Layout.alignment: Qt.AlignRight
@@ -508,6 +592,9 @@ Dialog {
                                 enabled: true
                                 onClicked: {
                                     delayedWriteCheck.checked = false
+                                    drives.cancelWrite(releases.selected.variant)
+                                    releases.selected.variant.cancelDownload()
+                                    releases.selected.variant.resetStatus()
                                     dialog.close()
                                 }
                             }
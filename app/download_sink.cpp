@@ -0,0 +1,599 @@
+/*
+ * ALT Media Writer
+ * Copyright (C) 2016-2019 Martin Bříza <mbriza@redhat.com>
+ * Copyright (C) 2020-2022 Dmitry Degtyarev <kevl@basealt.ru>
+ *
+ * ALT Media Writer is a fork of Fedora Media Writer
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include "download_sink.h"
+
+#include <QDataStream>
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QStorageInfo>
+
+#ifdef __linux__
+#include <errno.h>
+#include <fcntl.h>
+#endif
+
+// Max amount of data waiting to be written
+#define QUEUE_LIMIT (64L * 1024L * 1024L)
+
+#define PROGRESS_INTERVAL_MS 100
+
+// NOTE: saving hash state and part map takes a write, so
+// they are saved once per this much written data and when
+// sink stops
+#define STATE_SAVE_INTERVAL (64L * 1024L * 1024L)
+
+#define HASH_READ_SIZE (4L * 1024L * 1024L)
+
+// NOTE: data arrives from the network in small pieces, so
+// it's written in batches of this size
+#define WRITE_BATCH_SIZE (4L * 1024L * 1024L)
+#define WRITE_ALIGNMENT 4096
+
+// Max number of segments that are batched at once, others
+// are written right away
+#define MAX_WRITE_BUFFERS 16
+
+DownloadSink::DownloadSink(const QString &partPath_arg, const QString &hashStatePath_arg, const QString &partMapPath_arg, const PartMap &partMap_arg, Digest *hash_arg, const DigestAlgorithm hashAlgorithm_arg, QObject *parent)
+: QThread(parent)
+, partPath(partPath_arg)
+, hashStatePath(hashStatePath_arg)
+, partMapPath(partMapPath_arg)
+, partMap(partMap_arg)
+, hash(hash_arg)
+, hashAlgorithm(hashAlgorithm_arg)
+, ringHead(0)
+, ringTail(0)
+, queuedBytes(0)
+, queuedChunks(0)
+, producerBlocked(false)
+, aborted(false)
+, stopped(false)
+, failed(false)
+, hashedSize(0)
+, written(0)
+, savedWritten(0) {
+
+}
+
+DownloadSink::~DownloadSink() {
+    abort();
+    wait();
+}
+
+bool DownloadSink::hasRoom() const {
+    // NOTE: couple of slots are left for control chunks
+    return (ringTail - ringHead < RING_SIZE - 3 && queuedBytes < QUEUE_LIMIT);
+}
+
+bool DownloadSink::canPush() {
+    if (hasRoom()) {
+        return true;
+    }
+
+    // NOTE: writer could make room between the check above
+    // and setting the flag, so check again after setting
+    // it. Writer checks room after taking a chunk and then
+    // checks the flag, so one of the two sees the other.
+    producerBlocked = true;
+
+    return hasRoom();
+}
+
+void DownloadSink::push(const qint64 offset, const QByteArray &data) {
+    pushChunk(ChunkType_DATA, offset, data);
+}
+
+void DownloadSink::setTotalSize(const qint64 totalSize) {
+    pushChunk(ChunkType_TOTAL_SIZE, totalSize, QByteArray());
+}
+
+void DownloadSink::reserve(const qint64 size) {
+    pushChunk(ChunkType_RESERVE, size, QByteArray());
+}
+
+void DownloadSink::restart() {
+    pushChunk(ChunkType_RESTART, 0, QByteArray());
+}
+
+void DownloadSink::close() {
+    pushChunk(ChunkType_CLOSE, 0, QByteArray());
+}
+
+void DownloadSink::abort() {
+    aborted = true;
+
+    // Wake up writer if it's waiting for chunks
+    queuedChunks.release();
+}
+
+bool DownloadSink::hasFailed() const {
+    return failed;
+}
+
+QString DownloadSink::errorString() const {
+    return m_errorString;
+}
+
+QByteArray DownloadSink::checksum() const {
+    return m_checksum;
+}
+
+void DownloadSink::pushChunk(const ChunkType type, const qint64 offset, const QByteArray &data) {
+    // NOTE: control chunks can be pushed when the ring is
+    // "full", in which case there's still a free slot
+    while (ringTail - ringHead >= RING_SIZE) {
+        if (stopped) {
+            return;
+        }
+
+        QThread::yieldCurrentThread();
+    }
+
+    if (stopped) {
+        return;
+    }
+
+    const quint64 tail = ringTail;
+    ring[tail % RING_SIZE].type = type;
+    ring[tail % RING_SIZE].offset = offset;
+    ring[tail % RING_SIZE].data = data;
+    queuedBytes += data.size();
+    ringTail = tail + 1;
+
+    queuedChunks.release();
+}
+
+void DownloadSink::run() {
+    QFile file(partPath);
+
+    // NOTE: not opened in append mode because segments are
+    // written at their offsets. Writes are batched here, so
+    // file's own buffer is not needed.
+    const bool open_success = file.open(QIODevice::ReadWrite | QIODevice::Unbuffered);
+    if (!open_success) {
+        setFailed(tr("The downloaded file is not writable."));
+
+        return;
+    }
+
+    if (partMap.isEmpty()) {
+        written = file.size();
+    } else {
+        written = partMap.writtenSize();
+    }
+    savedWritten = written;
+
+    if (hash != nullptr) {
+        loadHashState(file.size());
+
+        // Hash data that was downloaded before and isn't
+        // covered by saved hash state
+        if (partMap.isEmpty()) {
+            hashFile(&file, file.size());
+        } else {
+            hashWrittenBlocks(&file);
+        }
+
+        if (aborted || failed) {
+            if (!failed) {
+                saveState(&file);
+            }
+
+            stopped = true;
+
+            return;
+        }
+    }
+
+    QElapsedTimer progressTimer;
+    progressTimer.start();
+    bool closed = false;
+
+    while (!closed && !failed) {
+        queuedChunks.acquire();
+
+        if (aborted) {
+            break;
+        }
+
+        const quint64 head = ringHead;
+        Chunk &chunk = ring[head % RING_SIZE];
+        const ChunkType type = chunk.type;
+        const qint64 offset = chunk.offset;
+        const QByteArray data = chunk.data;
+        chunk.data = QByteArray();
+        queuedBytes -= data.size();
+        ringHead = head + 1;
+
+        if (producerBlocked && hasRoom()) {
+            producerBlocked = false;
+            emit spaceAvailable();
+        }
+
+        switch (type) {
+            case ChunkType_DATA: {
+                writeData(&file, offset, data);
+
+                break;
+            }
+            case ChunkType_TOTAL_SIZE: {
+                preallocate(&file, offset);
+
+                break;
+            }
+            case ChunkType_RESERVE: {
+                allocate(&file, offset, true);
+
+                break;
+            }
+            case ChunkType_RESTART: {
+                writeBuffers.clear();
+                file.resize(0);
+                written = 0;
+                savedWritten = 0;
+
+                partMap = PartMap();
+                QFile::remove(partMapPath);
+
+                if (hash != nullptr) {
+                    resetHash();
+                    QFile::remove(hashStatePath);
+                }
+
+                break;
+            }
+            case ChunkType_CLOSE: {
+                closed = true;
+
+                break;
+            }
+        }
+
+        if (written - savedWritten >= STATE_SAVE_INTERVAL) {
+            saveState(&file);
+        }
+
+        if (progressTimer.elapsed() >= PROGRESS_INTERVAL_MS || closed) {
+            emit progress(written);
+            progressTimer.restart();
+        }
+    }
+
+    // NOTE: aborted download can be resumed, so batched
+    // data is written out too
+    if (!failed) {
+        flushWriteBuffers(&file);
+    }
+
+    if (closed && hash != nullptr && !failed) {
+        // NOTE: in a segmented download, all of the file
+        // has to be hashed by now
+        const bool hashed_all = (partMap.isEmpty() || hashedSize == partMap.totalSize());
+
+        if (hashed_all) {
+            m_checksum = hash->result();
+        } else {
+            setFailed(tr("Failed to read from file while verifying"));
+        }
+    }
+
+    if (!failed) {
+        saveState(&file);
+    }
+
+    file.close();
+
+    stopped = true;
+}
+
+// Hash file from the end of hashed part to given end.
+// Returns false if sink was aborted or failed.
+bool DownloadSink::hashFile(QFile *file, const qint64 end) {
+    if (hashedSize >= end) {
+        return true;
+    }
+
+    // NOTE: written data may still be batched
+    const bool flush_success = flushWriteBuffers(file);
+    if (!flush_success) {
+        return false;
+    }
+
+    QFile readFile(partPath);
+
+    const bool open_success = readFile.open(QIODevice::ReadOnly) && readFile.seek(hashedSize);
+    if (!open_success) {
+        setFailed(tr("Failed to read from file while verifying"));
+
+        return false;
+    }
+
+    while (hashedSize < end) {
+        if (aborted) {
+            return false;
+        }
+
+        const QByteArray bytes = readFile.read(qMin((qint64) HASH_READ_SIZE, end - hashedSize));
+        if (bytes.size() <= 0) {
+            setFailed(tr("Failed to read from file while verifying"));
+
+            return false;
+        }
+
+        hash->addData(bytes.constData(), bytes.size());
+        hashedSize += bytes.size();
+    }
+
+    return true;
+}
+
+// Hash written blocks that continue the hashed part. These
+// are blocks of other segments, which are written before
+// the hashed part reaches them.
+void DownloadSink::hashWrittenBlocks(QFile *file) {
+    if (hash == nullptr || partMap.isEmpty()) {
+        return;
+    }
+
+    qint64 end = hashedSize;
+    while (end < partMap.totalSize() && partMap.isDone(end)) {
+        end = qMin((end / PART_MAP_BLOCK_SIZE + 1) * PART_MAP_BLOCK_SIZE, partMap.totalSize());
+    }
+
+    if (end > hashedSize) {
+        hashFile(file, end);
+    }
+}
+
+bool DownloadSink::writeData(QFile *file, const qint64 offset, const QByteArray &data) {
+    // Find batch of the segment that this data continues
+    int index = -1;
+    for (int i = 0; i < writeBuffers.size(); i++) {
+        const WriteBuffer &buffer = writeBuffers[i];
+
+        if (buffer.offset + buffer.data.size() == offset) {
+            index = i;
+        }
+    }
+
+    if (index == -1) {
+        if (writeBuffers.size() >= MAX_WRITE_BUFFERS) {
+            const bool flush_success = flushWriteBuffers(file);
+            if (!flush_success) {
+                return false;
+            }
+        }
+
+        WriteBuffer buffer;
+        buffer.offset = offset;
+        buffer.data.reserve(WRITE_BATCH_SIZE + WRITE_ALIGNMENT);
+        writeBuffers.append(buffer);
+
+        index = writeBuffers.size() - 1;
+    }
+
+    writeBuffers[index].data.append(data);
+
+    if (writeBuffers[index].data.size() >= WRITE_BATCH_SIZE) {
+        const bool flush_success = flushWriteBuffer(file, index, false);
+        if (!flush_success) {
+            return false;
+        }
+    }
+
+    written += data.size();
+
+    if (!partMap.isEmpty()) {
+        partMap.markWritten(offset, data.size());
+    }
+
+    if (hash != nullptr) {
+        // NOTE: chunk may start before the end of hashed
+        // part if a partially written block is downloaded
+        // again, in which case only the rest is hashed
+        const qint64 chunkEnd = offset + data.size();
+        if (offset <= hashedSize && hashedSize < chunkEnd) {
+            const qint64 skip = hashedSize - offset;
+
+            hash->addData(data.constData() + skip, data.size() - skip);
+            hashedSize = chunkEnd;
+        }
+
+        hashWrittenBlocks(file);
+    }
+
+    return true;
+}
+
+// Write out batched data of a segment. Unless all of it is
+// written, write ends at an aligned offset and the rest
+// stays in the batch.
+bool DownloadSink::flushWriteBuffer(QFile *file, const int index, const bool all) {
+    WriteBuffer &buffer = writeBuffers[index];
+
+    const qint64 buffer_end = buffer.offset + buffer.data.size();
+    const qint64 write_end = all ? buffer_end : (buffer_end / WRITE_ALIGNMENT * WRITE_ALIGNMENT);
+    const qint64 write_size = write_end - buffer.offset;
+
+    if (write_size <= 0) {
+        return true;
+    }
+
+    const bool seek_success = (file->pos() == buffer.offset || file->seek(buffer.offset));
+    const qint64 written_size = seek_success ? file->write(buffer.data.constData(), write_size) : -1;
+    const bool write_success = (written_size == write_size);
+
+    if (!write_success) {
+        setFailed(writeErrorString());
+
+        return false;
+    }
+
+    buffer.data.remove(0, write_size);
+    buffer.offset = write_end;
+
+    if (buffer.data.isEmpty()) {
+        writeBuffers.removeAt(index);
+    }
+
+    return true;
+}
+
+bool DownloadSink::flushWriteBuffers(QFile *file) {
+    for (int i = writeBuffers.size() - 1; i >= 0; i--) {
+        const bool flush_success = flushWriteBuffer(file, i, true);
+        if (!flush_success) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void DownloadSink::preallocate(QFile *file, const qint64 totalSize) {
+    qDebug() << this->metaObject()->className() << "Preallocating" << totalSize << "bytes";
+
+    // NOTE: part map is saved before the file grows, so
+    // that if the download is interrupted, the resumed
+    // download knows that the file is not contiguous
+    partMap = PartMap(totalSize);
+    partMap.markWritten(0, written);
+    saveState(file);
+
+    allocate(file, totalSize, false);
+}
+
+// Allocate disk space for the file. If file is kept at its
+// size, space is only reserved, which is skipped if the
+// filesystem can't do that.
+bool DownloadSink::allocate(QFile *file, const qint64 size, const bool keepSize) {
+#ifdef __linux__
+    const int mode = keepSize ? FALLOC_FL_KEEP_SIZE : 0;
+    const int result = fallocate(file->handle(), mode, 0, size);
+
+    if (result == 0) {
+        return true;
+    } else if (errno == ENOSPC) {
+        setFailed(tr("You ran out of space in your Downloads folder."));
+
+        return false;
+    }
+
+    qDebug() << this->metaObject()->className() << "Filesystem doesn't support fallocate, errno =" << errno;
+#endif
+
+    if (keepSize) {
+        return true;
+    }
+
+    const bool resize_success = file->resize(size);
+    if (!resize_success) {
+        setFailed(tr("You ran out of space in your Downloads folder."));
+    }
+
+    return resize_success;
+}
+
+QString DownloadSink::writeErrorString() const {
+    QStorageInfo storage(partPath);
+
+    if (storage.bytesAvailable() < 5L * 1024L * 1024L) {
+        return tr("You ran out of space in your Downloads folder.");
+    } else {
+        return tr("The downloaded file is not writable.");
+    }
+}
+
+// Restore hash of the beginning of ".part" file. If there
+// is no saved state or it's invalid, the whole file is
+// hashed again.
+void DownloadSink::loadHashState(const qint64 fileSize) {
+    QFile stateFile(hashStatePath);
+    if (!stateFile.open(QIODevice::ReadOnly)) {
+        return;
+    }
+
+    QDataStream stream(&stateFile);
+    qint64 stateHashedSize;
+    QByteArray digestState;
+    stream >> stateHashedSize >> digestState;
+
+    const bool state_valid = (stream.status() == QDataStream::Ok && stateHashedSize <= fileSize);
+    const bool restore_success = state_valid && hash->restoreState(digestState);
+
+    if (restore_success) {
+        qDebug() << this->metaObject()->className() << "Restored hash state of first" << stateHashedSize << "bytes";
+
+        hashedSize = stateHashedSize;
+    } else {
+        qDebug() << this->metaObject()->className() << "Saved hash state is invalid, will hash downloaded part again";
+
+        resetHash();
+    }
+}
+
+// Save part map and hash state, so that an interrupted
+// download can be resumed
+void DownloadSink::saveState(QFile *file) {
+    // NOTE: state must not cover data that's not in the
+    // file yet
+    const bool flush_success = flushWriteBuffers(file);
+    if (!flush_success) {
+        return;
+    }
+
+    savedWritten = written;
+
+    if (!partMap.isEmpty()) {
+        partMap.save(partMapPath);
+    }
+
+    if (hash == nullptr) {
+        return;
+    }
+
+    const QByteArray digestState = hash->saveState();
+    if (digestState.isEmpty()) {
+        return;
+    }
+
+    QFile stateFile(hashStatePath);
+    if (!stateFile.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        return;
+    }
+
+    QDataStream stream(&stateFile);
+    stream << hashedSize << digestState;
+}
+
+void DownloadSink::resetHash() {
+    hash.reset(Digest::create(hashAlgorithm));
+    hashedSize = 0;
+}
+
+void DownloadSink::setFailed(const QString &errorString) {
+    failed = true;
+    m_errorString = errorString;
+    stopped = true;
+}
@@ -0,0 +1,197 @@
+/*
+ * ALT Media Writer
+ * Copyright (C) 2016-2019 Martin Bříza <mbriza@redhat.com>
+ * Copyright (C) 2020-2022 Dmitry Degtyarev <kevl@basealt.ru>
+ *
+ * ALT Media Writer is a fork of Fedora Media Writer
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef DOWNLOAD_SINK_H
+#define DOWNLOAD_SINK_H
+
+/**
+ * Writes downloaded image data to the ".part" file and
+ * hashes it on a separate thread, so that the GUI thread
+ * only moves data from the network reply into the queue.
+ *
+ * Chunks are passed through a single-producer
+ * single-consumer ring. Each end of the ring is only moved
+ * by one thread, so no lock is needed, a semaphore is only
+ * used to let the writer thread sleep while the ring is
+ * empty. The ring is limited in bytes, when it's full the
+ * GUI thread stops reading from the reply, which makes the
+ * reply stop reading from the network until writer catches
+ * up and emits spaceAvailable().
+ *
+ * If hash is given, data that is already in the ".part"
+ * file is hashed first, starting from the saved hash state
+ * if there is one. Hash state is saved periodically and
+ * when the sink stops, so that an interrupted download can
+ * be resumed without hashing all of it again.
+ *
+ * Data is written at given offsets, so that several
+ * segments of the image can be downloaded at once. Once
+ * total size is known, the file is preallocated and a
+ * PartMap of written blocks is kept and saved next to the
+ * image. Data is still hashed in order: chunks that
+ * continue the hashed part are hashed as they arrive,
+ * other segments are read back from the file once the
+ * hashed part reaches them.
+ *
+ * Space for the image is allocated upfront once its size
+ * is known, so that running out of space is found before
+ * downloading and the file is not fragmented. Writes are
+ * collected into batches of WRITE_BATCH_SIZE per segment,
+ * which are written at aligned offsets. Batches are written
+ * out before the file is read back or state is saved.
+ *
+ * Sink stops after close() or abort() or on a write error.
+ * QThread::finished() is emitted once it stops.
+ */
+
+#include "isomd5/digest.h"
+#include "isomd5/partmap.h"
+
+#include <QByteArray>
+#include <QList>
+#include <QSemaphore>
+#include <QString>
+#include <QThread>
+
+#include <atomic>
+#include <memory>
+
+class QFile;
+
+class DownloadSink final : public QThread {
+    Q_OBJECT
+
+public:
+    // Hash may be null if there is no checksum to check.
+    // Part map is empty unless a segmented download is
+    // resumed.
+    DownloadSink(const QString &partPath_arg, const QString &hashStatePath_arg, const QString &partMapPath_arg, const PartMap &partMap_arg, Digest *hash_arg, const DigestAlgorithm hashAlgorithm_arg, QObject *parent);
+    ~DownloadSink();
+
+    // Called from GUI thread. If there's no room,
+    // spaceAvailable() is emitted once there is.
+    bool canPush();
+    void push(const qint64 offset, const QByteArray &data);
+    // Preallocate the file and start tracking written
+    // blocks, data written so far is the beginning of the
+    // file
+    void setTotalSize(const qint64 totalSize);
+    // Allocate space for a file of given size without
+    // changing the file's size
+    void reserve(const qint64 size);
+    // Truncate the file, forget written blocks and start
+    // hashing from scratch
+    void restart();
+    // Write the rest of the queue and stop
+    void close();
+    // Stop as soon as possible, rest of the queue is not
+    // written
+    void abort();
+
+    // Valid after sink stopped
+    bool hasFailed() const;
+    QString errorString() const;
+    // Hex digest of the whole file, empty if there is no
+    // hash
+    QByteArray checksum() const;
+
+signals:
+    // Size of data written so far, emitted at most every
+    // PROGRESS_INTERVAL_MS
+    void progress(const qint64 value);
+    void spaceAvailable();
+
+protected:
+    void run() override;
+
+private:
+    enum ChunkType {
+        ChunkType_DATA,
+        ChunkType_TOTAL_SIZE,
+        ChunkType_RESERVE,
+        ChunkType_RESTART,
+        ChunkType_CLOSE,
+    };
+
+    struct Chunk {
+        ChunkType type;
+        // Offset of data or size
+        qint64 offset;
+        QByteArray data;
+    };
+
+    // Data of one segment that is not written yet
+    struct WriteBuffer {
+        qint64 offset;
+        QByteArray data;
+    };
+
+    static const int RING_SIZE = 64;
+
+    QString partPath;
+    QString hashStatePath;
+    QString partMapPath;
+    PartMap partMap;
+    std::unique_ptr<Digest> hash;
+    DigestAlgorithm hashAlgorithm;
+
+    Chunk ring[RING_SIZE];
+    // Next chunk to read, only moved by writer thread
+    std::atomic<quint64> ringHead;
+    // Next chunk to write, only moved by GUI thread
+    std::atomic<quint64> ringTail;
+    std::atomic<qint64> queuedBytes;
+    QSemaphore queuedChunks;
+    // Set if GUI thread found the ring full
+    std::atomic<bool> producerBlocked;
+    std::atomic<bool> aborted;
+    // Set once writer thread stops, after that pushes are
+    // ignored
+    std::atomic<bool> stopped;
+
+    QList<WriteBuffer> writeBuffers;
+
+    bool failed;
+    QString m_errorString;
+    QByteArray m_checksum;
+
+    qint64 hashedSize;
+    qint64 written;
+    qint64 savedWritten;
+
+    bool hasRoom() const;
+    void pushChunk(const ChunkType type, const qint64 offset, const QByteArray &data);
+    bool hashFile(QFile *file, const qint64 end);
+    void hashWrittenBlocks(QFile *file);
+    bool writeData(QFile *file, const qint64 offset, const QByteArray &data);
+    bool flushWriteBuffer(QFile *file, const int index, const bool all);
+    bool flushWriteBuffers(QFile *file);
+    void preallocate(QFile *file, const qint64 totalSize);
+    bool allocate(QFile *file, const qint64 size, const bool keepSize);
+    QString writeErrorString() const;
+    void loadHashState(const qint64 fileSize);
+    void saveState(QFile *file);
+    void resetHash();
+    void setFailed(const QString &errorString);
+};
+
+#endif // DOWNLOAD_SINK_H
@@ -21,6 +21,7 @@
  */
 
 #include "drivemanager.h"
+#include "job_scheduler.h"
 #include "progress.h"
 #include "variant.h"
 
@@ -107,6 +108,9 @@ QVariant DriveManager::headerData(int section, Qt::Orientation orientation, int
     if (role == Qt::UserRole + 2) {
         return "display";
     }
+    if (role == Qt::UserRole + 3) {
+        return "checked";
+    }
 
     return QVariant();
 }
@@ -115,6 +119,7 @@ QHash<int, QByteArray> DriveManager::roleNames() const {
     QHash<int, QByteArray> ret;
     ret.insert(Qt::UserRole + 1, "drive");
     ret.insert(Qt::UserRole + 2, "display");
+    ret.insert(Qt::UserRole + 3, "checked");
     return ret;
 }
 
@@ -136,6 +141,10 @@ QVariant DriveManager::data(const QModelIndex &index, int role) const {
         return QVariant::fromValue(m_drives[index.row()]->name());
     }
 
+    if (role == Qt::UserRole + 3) {
+        return QVariant::fromValue(m_checked.contains(m_drives[index.row()]));
+    }
+
     return QVariant();
 }
 
@@ -157,6 +166,60 @@ void DriveManager::setSelectedIndex(const int index) {
     }
 }
 
+int DriveManager::checkedCount() const {
+    return m_checked.count();
+}
+
+void DriveManager::setChecked(const int index, const bool checked) {
+    if (index < 0 || index >= m_drives.count()) {
+        return;
+    }
+
+    Drive *drive = m_drives[index];
+
+    if (checked == m_checked.contains(drive)) {
+        return;
+    }
+
+    if (checked) {
+        m_checked.append(drive);
+    } else {
+        m_checked.removeAll(drive);
+    }
+
+    const QModelIndex modelIndex = this->index(index);
+    emit dataChanged(modelIndex, modelIndex, {Qt::UserRole + 3});
+    emit checkedChanged();
+}
+
+bool DriveManager::write(Variant *variant) {
+    // NOTE: batch is in the order drives are listed
+    QList<Drive *> batch;
+    for (Drive *drive : m_drives) {
+        if (m_checked.contains(drive)) {
+            batch.append(drive);
+        }
+    }
+
+    if (batch.isEmpty() && selected() != nullptr) {
+        batch.append(selected());
+    }
+
+    if (batch.isEmpty()) {
+        return false;
+    }
+
+    return batch.first()->writeBatch(variant, batch);
+}
+
+void DriveManager::cancelWrite(Variant *variant) {
+    for (Drive *drive : m_drives) {
+        if (drive->variant() == variant) {
+            drive->cancel();
+        }
+    }
+}
+
 int DriveManager::length() const {
     return m_drives.count();
 }
@@ -213,6 +276,10 @@ void DriveManager::onDriveRemoved(Drive *drive) {
         if (drive == m_lastRestoreable) {
             setLastRestoreable(nullptr);
         }
+
+        if (m_checked.removeAll(drive) > 0) {
+            emit checkedChanged();
+        }
     }
 }
 
@@ -253,6 +320,7 @@ Drive::Drive(DriveProvider *parent, const QString &name, const uint64_t size, co
         }
     }();
     m_variant = nullptr;
+    m_job = 0;
 }
 
 Progress *Drive::progress() const {
@@ -296,15 +364,17 @@ Drive::RestoreStatus Drive::restoreStatus() {
 }
 
 bool Drive::write(Variant *variant) {
+    // NOTE: drive that is written again while waiting in
+    // the queue is queued again
+    if (JobScheduler::instance()->isQueued(m_job)) {
+        finishJob();
+    }
+
     m_variant = variant;
     m_variant->setErrorString(QString());
+    setErrorString(QString());
 
-    const QFile file(m_variant->filePath());
-
-    // TODO: this won't work for delayed write. When delayed
-    // write is turned on, this write() f-n is called and
-    // file size is not known yet.
-    if (file.size() > size()) {
+    if (!isLargeEnough(m_variant)) {
         m_variant->setErrorString(tr("This drive is not large enough."));
         cancel();
         return false;
@@ -313,16 +383,87 @@ bool Drive::write(Variant *variant) {
     return true;
 }
 
+bool Drive::isLargeEnough(Variant *variant) const {
+    const QFile file(variant->filePath());
+    const QFile part_file(variant->filePath() + ".part");
+    const qint64 image_size = qMax(file.size(), part_file.size());
+
+    return image_size <= size();
+}
+
 void Drive::cancel() {
-    m_error = QString();
+    finishJob();
+    setErrorString(QString());
     m_restoreStatus = CLEAN;
     emit restoreStatusChanged();
 }
 
+QString Drive::controller() const {
+    return QString();
+}
+
+QString Drive::errorString() const {
+    return m_error;
+}
+
+Variant *Drive::variant() const {
+    return m_variant;
+}
+
+bool Drive::writeBatch(Variant *variant, const QList<Drive *> &batch) {
+    bool any_success = false;
+
+    for (Drive *drive : batch) {
+        if (drive->write(variant)) {
+            any_success = true;
+        }
+    }
+
+    return any_success;
+}
+
+// Resources used by a write of the variant to this drive,
+// see JobScheduler
+QStringList Drive::writeResources(Variant *variant) const {
+    QStringList out = {"source"};
+
+    if (variant->isCompressed()) {
+        out.append("decompression");
+    }
+
+    out.append(restoreResources());
+
+    return out;
+}
+
+QStringList Drive::restoreResources() const {
+    const QString controllerPath = controller();
+
+    if (!controllerPath.isEmpty()) {
+        return {"controller:" + controllerPath};
+    } else {
+        return {};
+    }
+}
+
+// Free resources of the current job or remove it from the
+// queue
+void Drive::finishJob() {
+    JobScheduler::instance()->finish(m_job);
+    m_job = 0;
+}
+
 bool Drive::operator==(const Drive &other) const {
     return name() == other.name() && size() == other.size();
 }
 
+void Drive::setErrorString(const QString &error) {
+    if (m_error != error) {
+        m_error = error;
+        emit errorStringChanged();
+    }
+}
+
 void Drive::setRestoreStatus(const Drive::RestoreStatus status) {
     if (m_restoreStatus != status) {
         m_restoreStatus = status;
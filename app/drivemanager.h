@@ -25,6 +25,8 @@
 
 #include <QAbstractListModel>
 #include <QDebug>
+#include <QPointer>
+#include <QStringList>
 
 class DriveManager;
 class DriveProvider;
@@ -45,6 +47,7 @@ QString getHelperPath();
  * @property length count of the drives
  * @property selected the selected drive
  * @property selectedIndex the index of the selected drive
+ * @property checkedCount count of drives checked for writing together, see @ref write
  * @property lastRestoreable the most recently connected restoreable drive
  */
 class DriveManager : public QAbstractListModel {
@@ -52,6 +55,7 @@ class DriveManager : public QAbstractListModel {
     Q_PROPERTY(int length READ length NOTIFY drivesChanged)
     Q_PROPERTY(Drive *selected READ selected NOTIFY selectedChanged)
     Q_PROPERTY(int selectedIndex READ selectedIndex WRITE setSelectedIndex NOTIFY selectedChanged)
+    Q_PROPERTY(int checkedCount READ checkedCount NOTIFY checkedChanged)
     Q_PROPERTY(bool isBroken READ isBackendBroken NOTIFY isBackendBrokenChanged)
     Q_PROPERTY(QString errorString READ errorString NOTIFY isBackendBrokenChanged)
 
@@ -68,6 +72,15 @@ public:
     int selectedIndex() const;
     Q_INVOKABLE void setSelectedIndex(const int index);
 
+    int checkedCount() const;
+    Q_INVOKABLE void setChecked(const int index, const bool checked);
+
+    // Write the variant to all checked drives at once, or
+    // to the selected drive if none are checked
+    Q_INVOKABLE bool write(Variant *variant);
+    // Cancel queued and running writes of the variant
+    Q_INVOKABLE void cancelWrite(Variant *variant);
+
     int length() const;
 
     Drive *lastRestoreable();
@@ -86,6 +99,7 @@ private slots:
 signals:
     void drivesChanged();
     void selectedChanged();
+    void checkedChanged();
     void restoreableDriveChanged();
     void isBackendBrokenChanged();
 
@@ -95,6 +109,7 @@ private:
     static DriveManager *_self;
     QList<Drive *> m_drives;
     int m_selectedIndex;
+    QList<Drive *> m_checked;
     Drive *m_lastRestoreable;
     DriveProvider *m_provider;
     QString m_errorString;
@@ -137,10 +152,15 @@ protected:
  *
  * Should be reimplemented for every platform. The child instances should be created and handled by the @ref DriveProvider class.
  *
+ * Writes and restores are queued in @ref JobScheduler and start once the resources they use are free.
+ *
+ * Several drives can be written with one image at once, see @ref writeBatch. Each drive of the batch reports its own progress and error.
+ *
  * @property progress the @ref Progress object reporting the progress of writing the image
  * @property name name of the drive, should be human-readable, in ideal case the model of the drive and its size
  * @property size the size of the drive, in bytes
  * @property restoreStatus the status of restoring the drive
+ * @property errorString why the last write to this drive failed, empty if it didn't
  */
 class Drive : public QObject {
     Q_OBJECT
@@ -150,6 +170,7 @@ class Drive : public QObject {
     Q_PROPERTY(QString readableSize READ readableSize CONSTANT)
     Q_PROPERTY(qreal size READ size CONSTANT)
     Q_PROPERTY(RestoreStatus restoreStatus READ restoreStatus NOTIFY restoreStatusChanged)
+    Q_PROPERTY(QString errorString READ errorString NOTIFY errorStringChanged)
 public:
     enum RestoreStatus {
         CLEAN = 0,
@@ -170,8 +191,20 @@ public:
     virtual QString readableSize() const;
     virtual qreal size() const;
     virtual RestoreStatus restoreStatus();
+    // USB controller the drive is connected to, drives on
+    // the same controller share its bandwidth. Empty if
+    // not known.
+    virtual QString controller() const;
+    QString errorString() const;
+    // Variant that is written or queued to be written to
+    // this drive, if any
+    Variant *variant() const;
 
     Q_INVOKABLE virtual bool write(Variant *variant);
+    // Write the variant to all drives of the batch, which
+    // includes this one. By default each drive is written
+    // by itself.
+    virtual bool writeBatch(Variant *variant, const QList<Drive *> &batch);
     Q_INVOKABLE virtual void cancel();
     Q_INVOKABLE virtual void restore() = 0;
 
@@ -179,12 +212,27 @@ public:
 
 public slots:
     void setRestoreStatus(const RestoreStatus status);
+    void setErrorString(const QString &error);
 
 signals:
     void restoreStatusChanged();
+    void errorStringChanged();
 
 protected:
-    Variant *m_variant;
+    // NOTE: with delayed write the image is still
+    // downloading, in which case its part file may already
+    // have the full size, see DownloadSink
+    bool isLargeEnough(Variant *variant) const;
+    QStringList writeResources(Variant *variant) const;
+    QStringList restoreResources() const;
+    void finishJob();
+
+    // NOTE: variant may be removed by a reload of releases
+    // while its write is queued
+    QPointer<Variant> m_variant;
+    // Scheduler job of the current write or restore, 0 if
+    // there is none
+    int m_job;
     Progress *m_progress;
     QString m_name;
     uint64_t m_size;
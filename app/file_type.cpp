@@ -23,6 +23,7 @@ QStringList file_type_strings(const FileType file_type) {
         case FileType_IMG: return {"img"};
         case FileType_IMG_GZ: return {"igz", "img.gz"};
         case FileType_IMG_XZ: return {"ixz", "img.xz"};
+        case FileType_IMG_ZST: return {"izst", "img.zst"};
         case FileType_RECOVERY_TAR: return {"trc", "recovery.tar"};
         case FileType_UNKNOWN: return {};
         case FileType_COUNT: return {};
@@ -39,6 +40,7 @@ QString file_type_name(const FileType file_type) {
         case FileType_IMG: return QObject::tr("IMG");
         case FileType_IMG_GZ: return QObject::tr("GZIP IMG");
         case FileType_IMG_XZ: return QObject::tr("LZMA IMG");
+        case FileType_IMG_ZST: return QObject::tr("ZSTD IMG");
         case FileType_RECOVERY_TAR: return QObject::tr("Recovery TAR Archive");
         case FileType_UNKNOWN: return QObject::tr("Unknown");
         case FileType_COUNT: return QString();
@@ -73,6 +75,11 @@ bool file_type_can_write(const FileType file_type) {
         FileType_ISO,
         FileType_IMG,
         FileType_IMG_XZ,
+// NOTE: only linux helper can decompress gzip and zstd
+#ifdef __linux__
+        FileType_IMG_GZ,
+        FileType_IMG_ZST,
+#endif // __linux__
     };
 
     return supported_file_types.contains(file_type);
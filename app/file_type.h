@@ -34,6 +34,7 @@ enum FileType {
     FileType_IMG,
     FileType_IMG_GZ,
     FileType_IMG_XZ,
+    FileType_IMG_ZST,
     FileType_RECOVERY_TAR,
     FileType_UNKNOWN,
     FileType_COUNT,
@@ -0,0 +1,424 @@
+/*
+ * ALT Media Writer
+ * Copyright (C) 2016-2019 Martin Bříza <mbriza@redhat.com>
+ * Copyright (C) 2020-2022 Dmitry Degtyarev <kevl@basealt.ru>
+ *
+ * ALT Media Writer is a fork of Fedora Media Writer
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include "helper_job.h"
+#include "drivemanager.h"
+
+#include <QDebug>
+#include <QLocalSocket>
+#include <QTimer>
+
+#include <string.h>
+
+#define CONNECT_TIMEOUT_MS 1000
+// Attempts to connect to a daemon that was just started,
+// made DAEMON_RETRY_MS apart
+#define DAEMON_START_ATTEMPTS 50
+#define DAEMON_RETRY_MS 100
+
+HelperJob::HelperJob(QObject *parent)
+: QIODevice(parent) {
+    m_process = nullptr;
+    m_id = 0;
+
+    open(QIODevice::ReadOnly);
+}
+
+HelperJob::~HelperJob() {
+    if (m_id != 0) {
+        HelperDaemonClient::instance()->cancel(m_id);
+    }
+}
+
+void HelperJob::start(const QStringList &arguments) {
+    HelperDaemonClient *client = HelperDaemonClient::instance();
+
+    if (client->isUsed()) {
+        client->start(this, arguments);
+
+        return;
+    }
+
+    startProcess(arguments);
+}
+
+void HelperJob::startProcess(const QStringList &arguments) {
+    m_process = new QProcess(this);
+    m_process->setProgram(getHelperPath());
+    m_process->setArguments(arguments);
+
+    connect(
+        m_process, &QProcess::readyReadStandardOutput,
+        [this]() {
+            appendOutput(m_process->readAllStandardOutput());
+        });
+    connect(
+        m_process, &QProcess::readyReadStandardError,
+        [this]() {
+            appendError(m_process->readAllStandardError());
+        });
+    connect(
+        m_process, static_cast<void (QProcess::*)(int, QProcess::ExitStatus)>(&QProcess::finished),
+        [this](const int exitCode, const QProcess::ExitStatus status) {
+            // NOTE: output may arrive together with exit
+            appendOutput(m_process->readAllStandardOutput());
+            appendError(m_process->readAllStandardError());
+
+            emit finished(exitCode, status);
+        });
+#if QT_VERSION >= 0x050600
+    connect(
+        m_process, &QProcess::errorOccurred,
+        [this](const QProcess::ProcessError error) {
+            setErrorString(m_process->errorString());
+
+            emit errorOccurred(error);
+        });
+#endif
+
+    m_process->start(QIODevice::ReadOnly);
+}
+
+void HelperJob::kill() {
+    if (m_process != nullptr) {
+        m_process->kill();
+    } else if (m_id != 0) {
+        HelperDaemonClient::instance()->cancel(m_id);
+        m_id = 0;
+    }
+}
+
+QByteArray HelperJob::readAllStandardError() {
+    const QByteArray out = m_error;
+    m_error.clear();
+
+    return out;
+}
+
+bool HelperJob::isSequential() const {
+    return true;
+}
+
+qint64 HelperJob::bytesAvailable() const {
+    return m_output.size() + QIODevice::bytesAvailable();
+}
+
+bool HelperJob::canReadLine() const {
+    return m_output.contains('\n') || QIODevice::canReadLine();
+}
+
+qint64 HelperJob::readData(char *data, qint64 maxSize) {
+    const qint64 size = qMin(maxSize, (qint64) m_output.size());
+    memcpy(data, m_output.constData(), size);
+    m_output.remove(0, size);
+
+    return size;
+}
+
+qint64 HelperJob::writeData(const char *data, qint64 maxSize) {
+    Q_UNUSED(data);
+    Q_UNUSED(maxSize);
+
+    return -1;
+}
+
+void HelperJob::appendOutput(const QByteArray &data) {
+    if (data.isEmpty()) {
+        return;
+    }
+
+    m_output.append(data);
+    emit readyRead();
+}
+
+void HelperJob::appendError(const QByteArray &data) {
+    m_error.append(data);
+}
+
+HelperDaemonClient *HelperDaemonClient::_self = nullptr;
+
+HelperDaemonClient::HelperDaemonClient(QObject *parent)
+: QObject(parent) {
+    m_socket = new QLocalSocket(this);
+    m_state = State_DISCONNECTED;
+    m_nextId = 1;
+    m_failed = false;
+    m_daemonStarted = false;
+    m_attempts = 0;
+
+    m_connectTimer = new QTimer(this);
+    m_connectTimer->setSingleShot(true);
+    m_connectTimer->setInterval(CONNECT_TIMEOUT_MS);
+
+    const QString baseName = qgetenv("MEDIAWRITER_HELPER_DAEMON_ENV");
+    if (!baseName.isEmpty()) {
+        m_baseName = baseName;
+    }
+
+    connect(
+        m_socket, &QLocalSocket::connected,
+        this, &HelperDaemonClient::onConnected);
+#if QT_VERSION >= 0x050F00
+    connect(
+        m_socket, &QLocalSocket::errorOccurred,
+        this, &HelperDaemonClient::onConnectFailed);
+#else
+    connect(
+        m_socket, static_cast<void (QLocalSocket::*)(QLocalSocket::LocalSocketError)>(&QLocalSocket::error),
+        this, &HelperDaemonClient::onConnectFailed);
+#endif
+    connect(
+        m_connectTimer, &QTimer::timeout,
+        this, &HelperDaemonClient::onConnectFailed);
+    connect(
+        m_socket, &QLocalSocket::readyRead,
+        this, &HelperDaemonClient::onReadyRead);
+    connect(
+        m_socket, &QLocalSocket::disconnected,
+        this, &HelperDaemonClient::onDisconnected);
+}
+
+HelperDaemonClient *HelperDaemonClient::instance() {
+    if (!_self) {
+        _self = new HelperDaemonClient();
+    }
+    return _self;
+}
+
+bool HelperDaemonClient::isUsed() const {
+    return !m_baseName.isEmpty() && !m_failed;
+}
+
+void HelperDaemonClient::start(HelperJob *job, const QStringList &arguments) {
+    const qint32 id = m_nextId;
+    m_nextId++;
+
+    // NOTE: set id before connecting, because a failed
+    // connection may start the job in a process right away
+    m_jobs[id] = job;
+    job->m_id = id;
+
+    if (m_state == State_CONNECTED) {
+        sendStart(id, arguments);
+    } else {
+        m_pending.append({id, arguments});
+
+        if (m_state == State_DISCONNECTED) {
+            connectToDaemon();
+        }
+    }
+}
+
+void HelperDaemonClient::cancel(const qint32 id) {
+    if (!m_jobs.contains(id)) {
+        return;
+    }
+
+    m_jobs.remove(id);
+
+    // NOTE: job that is still waiting for the connection
+    // was never sent to the daemon
+    for (int i = 0; i < m_pending.size(); i++) {
+        if (m_pending[i].first == id) {
+            m_pending.removeAt(i);
+
+            return;
+        }
+    }
+
+    const HelperMessage message = helperMessage(HelperMessageType_CANCEL, id);
+    m_socket->write(helperMessageEncode(message));
+}
+
+void HelperDaemonClient::connectToDaemon() {
+    const QString name = helperSocketName(m_baseName);
+    if (name.isEmpty()) {
+        fail();
+        return;
+    }
+
+    m_state = State_CONNECTING;
+
+    // NOTE: start timer before connecting, because error
+    // may be emitted right away
+    m_connectTimer->start();
+    m_socket->abort();
+    m_socket->connectToServer(name);
+}
+
+void HelperDaemonClient::sendStart(const qint32 id, const QStringList &arguments) {
+    HelperMessage message = helperMessage(HelperMessageType_START, id);
+    message.arguments = arguments;
+    m_socket->write(helperMessageEncode(message));
+}
+
+// NOTE: don't wait for the daemon again on every job, jobs
+// that were waiting for it run in new processes
+void HelperDaemonClient::fail() {
+    qDebug() << this->metaObject()->className() << "Failed to connect to helper daemon, running jobs in new processes";
+
+    m_connectTimer->stop();
+    m_state = State_DISCONNECTED;
+    m_failed = true;
+
+    const QList<QPair<qint32, QStringList>> pending = m_pending;
+    m_pending.clear();
+
+    for (const QPair<qint32, QStringList> &job_pending : pending) {
+        HelperJob *job = m_jobs.take(job_pending.first);
+        if (job == nullptr) {
+            continue;
+        }
+
+        job->m_id = 0;
+        job->startProcess(job_pending.second);
+    }
+}
+
+void HelperDaemonClient::onConnected() {
+    if (m_state != State_CONNECTING) {
+        return;
+    }
+
+    m_connectTimer->stop();
+
+    // NOTE: check that the daemon is run by this user,
+    // otherwise it may be someone else's process that took
+    // the socket's name
+    if (!helperPeerIsTrusted(m_socket->socketDescriptor())) {
+        qDebug() << this->metaObject()->className() << "Helper daemon socket belongs to another user";
+
+        // NOTE: fail before abort, so that waiting jobs are
+        // not reported as lost on disconnect
+        fail();
+        m_socket->abort();
+
+        return;
+    }
+
+    m_state = State_CONNECTED;
+    m_daemonStarted = false;
+    m_attempts = 0;
+
+    const QList<QPair<qint32, QStringList>> pending = m_pending;
+    m_pending.clear();
+
+    for (const QPair<qint32, QStringList> &job_pending : pending) {
+        sendStart(job_pending.first, job_pending.second);
+    }
+}
+
+void HelperDaemonClient::onConnectFailed() {
+    if (m_state != State_CONNECTING) {
+        return;
+    }
+
+    m_connectTimer->stop();
+    m_socket->abort();
+
+    // NOTE: daemon is detached so that it stays warm for
+    // the next run of the app
+    if (!m_daemonStarted) {
+        const QString helperPath = getHelperPath();
+        const bool start_success = !helperPath.isEmpty() && QProcess::startDetached(helperPath, {"daemon", m_baseName});
+
+        if (!start_success) {
+            fail();
+            return;
+        }
+
+        qDebug() << this->metaObject()->className() << "Started helper daemon" << m_baseName;
+        m_daemonStarted = true;
+        m_attempts = 0;
+    }
+
+    if (m_attempts >= DAEMON_START_ATTEMPTS) {
+        fail();
+        return;
+    }
+
+    m_attempts++;
+
+    // NOTE: state stays connecting until the retry, so new
+    // jobs keep waiting
+    QTimer::singleShot(DAEMON_RETRY_MS, this, &HelperDaemonClient::connectToDaemon);
+}
+
+void HelperDaemonClient::onReadyRead() {
+    m_buffer.append(m_socket->readAll());
+
+    QList<HelperMessage> messageList;
+    const bool decodeSuccess = helperMessageDecode(&m_buffer, &messageList);
+
+    for (const HelperMessage &message : messageList) {
+        HelperJob *job = m_jobs.value(message.job, nullptr);
+        if (job == nullptr) {
+            continue;
+        }
+
+        switch (message.type) {
+            case HelperMessageType_OUTPUT: {
+                job->appendOutput(message.data);
+                break;
+            }
+            case HelperMessageType_ERROR: {
+                job->appendError(message.data);
+                break;
+            }
+            case HelperMessageType_FINISHED: {
+                m_jobs.remove(message.job);
+                job->m_id = 0;
+
+                emit job->finished(message.exit_code, QProcess::NormalExit);
+                break;
+            }
+            default: break;
+        }
+    }
+
+    if (!decodeSuccess) {
+        qDebug() << this->metaObject()->className() << "Received malformed message from helper daemon";
+        m_socket->abort();
+    }
+}
+
+// NOTE: jobs that were running in the daemon are lost
+void HelperDaemonClient::onDisconnected() {
+    if (m_state != State_CONNECTED) {
+        return;
+    }
+
+    m_state = State_DISCONNECTED;
+
+    const QHash<qint32, HelperJob *> jobs = m_jobs;
+    m_jobs.clear();
+    m_buffer.clear();
+
+    for (HelperJob *job : jobs) {
+        job->m_id = 0;
+        job->setErrorString(tr("Helper daemon stopped unexpectedly."));
+
+        // NOTE: same signals as a crashed process
+        emit job->errorOccurred(QProcess::Crashed);
+        emit job->finished(-1, QProcess::CrashExit);
+    }
+}
@@ -0,0 +1,149 @@
+/*
+ * ALT Media Writer
+ * Copyright (C) 2016-2019 Martin Bříza <mbriza@redhat.com>
+ * Copyright (C) 2020-2022 Dmitry Degtyarev <kevl@basealt.ru>
+ *
+ * ALT Media Writer is a fork of Fedora Media Writer
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef HELPER_JOB_H
+#define HELPER_JOB_H
+
+/**
+ * Runs a job of the Linux helper, either in a new helper
+ * process or in the helper daemon. Output of the job is
+ * read the same way in both cases, like output of a
+ * process: stdout through QIODevice and stderr through
+ * readAllStandardError().
+ *
+ * Daemon is used if MEDIAWRITER_HELPER_DAEMON_ENV is set,
+ * the value is the name of the daemon's socket in the
+ * user's runtime directory, see helperprotocol.h. If no
+ * daemon is listening, the app starts one, which keeps
+ * running after the app exits until it's idle for a
+ * while. Connecting doesn't block, jobs wait for the
+ * connection and if the daemon can't be reached, they run
+ * in new processes.
+ */
+
+#include "isomd5/helperprotocol.h"
+
+#include <QHash>
+#include <QIODevice>
+#include <QList>
+#include <QPair>
+#include <QProcess>
+#include <QStringList>
+
+class QLocalSocket;
+class QTimer;
+
+class HelperJob final : public QIODevice {
+    Q_OBJECT
+
+public:
+    explicit HelperJob(QObject *parent);
+    ~HelperJob();
+
+    // Arguments are the same as for the helper process
+    void start(const QStringList &arguments);
+    void kill();
+    QByteArray readAllStandardError();
+
+    bool isSequential() const override;
+    qint64 bytesAvailable() const override;
+    bool canReadLine() const override;
+
+signals:
+    void finished(const int exitCode, const QProcess::ExitStatus status);
+    void errorOccurred(const QProcess::ProcessError error);
+
+protected:
+    qint64 readData(char *data, qint64 maxSize) override;
+    qint64 writeData(const char *data, qint64 maxSize) override;
+
+private:
+    friend class HelperDaemonClient;
+
+    // Null if the job runs in the daemon
+    QProcess *m_process;
+    // Id of the job in the daemon, 0 if the job doesn't
+    // run there
+    qint32 m_id;
+    QByteArray m_output;
+    QByteArray m_error;
+
+    void startProcess(const QStringList &arguments);
+    void appendOutput(const QByteArray &data);
+    void appendError(const QByteArray &data);
+};
+
+/**
+ * Connection to the helper daemon, shared by all jobs
+ */
+class HelperDaemonClient final : public QObject {
+    Q_OBJECT
+
+public:
+    static HelperDaemonClient *instance();
+
+    // Returns false if the daemon is not used or couldn't
+    // be reached
+    bool isUsed() const;
+    // Sets id of the job. If not connected yet, the job
+    // waits for the connection and if that fails, it is
+    // started in a new process.
+    void start(HelperJob *job, const QStringList &arguments);
+    void cancel(const qint32 id);
+
+private:
+    enum State {
+        State_DISCONNECTED,
+        State_CONNECTING,
+        State_CONNECTED,
+    };
+
+    explicit HelperDaemonClient(QObject *parent = nullptr);
+
+    static HelperDaemonClient *_self;
+    // Empty if daemon is not used
+    QString m_baseName;
+    QLocalSocket *m_socket;
+    QTimer *m_connectTimer;
+    State m_state;
+    // True if daemon couldn't be reached
+    bool m_failed;
+    bool m_daemonStarted;
+    int m_attempts;
+    QByteArray m_buffer;
+    // Id => job
+    QHash<qint32, HelperJob *> m_jobs;
+    // Id and arguments of jobs waiting for the connection,
+    // in order of start
+    QList<QPair<qint32, QStringList>> m_pending;
+    qint32 m_nextId;
+
+    void connectToDaemon();
+    void sendStart(const qint32 id, const QStringList &arguments);
+    void fail();
+    void onConnected();
+    void onConnectFailed();
+    void onReadyRead();
+    void onDisconnected();
+};
+
+#endif // HELPER_JOB_H
@@ -0,0 +1,326 @@
+/*
+ * ALT Media Writer
+ * Copyright (C) 2016-2019 Martin Bříza <mbriza@redhat.com>
+ * Copyright (C) 2020-2022 Dmitry Degtyarev <kevl@basealt.ru>
+ *
+ * ALT Media Writer is a fork of Fedora Media Writer
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include "image_cache.h"
+
+#include "isomd5/digest.h"
+
+#include <QDateTime>
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <QTextStream>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#define DEFAULT_MAX_CACHE_SIZE (32LL * 1024LL * 1024LL * 1024LL)
+
+QString cache_key(const QString &checksum);
+qint64 image_cache_max_size();
+bool link_file(const QString &from, const QString &to);
+bool same_file(const QString &a, const QString &b);
+
+ImageCache::ImageCache() {
+    dir = QDir(QStandardPaths::writableLocation(QStandardPaths::CacheLocation)).filePath("images");
+    maxSize = image_cache_max_size();
+
+    load();
+}
+
+bool ImageCache::restore(const QString &checksum, const QString &path, const QList<QString> &extraSuffixes) {
+    const QString key = cache_key(checksum);
+    if (key.isEmpty() || !entries.contains(key)) {
+        return false;
+    }
+
+    Entry &entry = entries[key];
+
+    // NOTE: cached file may have been removed or damaged
+    // outside of the app
+    const qint64 cached_size = QFileInfo(entryPath(key)).size();
+    if (cached_size != entry.size) {
+        qDebug() << "ImageCache: removing broken entry" << key;
+
+        remove(key);
+        save();
+
+        return false;
+    }
+
+    // NOTE: file with the image's name may be a different
+    // image or an incomplete copy, even of the same size,
+    // it's replaced unless it's a link to the entry
+    const bool already_there = same_file(entryPath(key), path);
+
+    if (!already_there) {
+        QFile::remove(path);
+
+        const bool link_success = link_file(entryPath(key), path);
+        if (!link_success) {
+            qDebug() << "ImageCache: failed to link" << key << "to" << path;
+
+            return false;
+        }
+
+        for (const QString &suffix : extraSuffixes) {
+            QFile::remove(path + suffix);
+
+            if (QFile::exists(entryPath(key) + suffix)) {
+                link_file(entryPath(key) + suffix, path + suffix);
+            }
+        }
+    }
+
+    qDebug() << "ImageCache: restored" << path << "from" << key;
+
+    entry.lastUsed = QDateTime::currentSecsSinceEpoch();
+    save();
+
+    return true;
+}
+
+void ImageCache::insert(const QString &checksum, const QString &path, const QList<QString> &extraSuffixes) {
+    const QString key = cache_key(checksum);
+    if (key.isEmpty() || maxSize == 0) {
+        return;
+    }
+
+    const qint64 size = QFileInfo(path).size();
+    if (size > maxSize) {
+        return;
+    }
+
+    QDir().mkpath(dir);
+
+    remove(key);
+
+    const bool link_success = link_file(path, entryPath(key));
+    if (!link_success) {
+        qDebug() << "ImageCache: failed to link" << path << "into" << dir;
+
+        save();
+
+        return;
+    }
+
+    for (const QString &suffix : extraSuffixes) {
+        if (QFile::exists(path + suffix)) {
+            link_file(path + suffix, entryPath(key) + suffix);
+        }
+    }
+
+    qDebug() << "ImageCache: added" << path << "as" << key;
+
+    entries[key] = {size, QDateTime::currentSecsSinceEpoch()};
+
+    evict(key);
+    save();
+}
+
+QString ImageCache::entryPath(const QString &key) const {
+    return QDir(dir).filePath(key);
+}
+
+void ImageCache::load() {
+    QFile file(QDir(dir).filePath("index"));
+    const bool open_success = file.open(QIODevice::ReadOnly);
+    if (!open_success) {
+        return;
+    }
+
+    QTextStream stream(&file);
+
+    while (!stream.atEnd()) {
+        const QString line = stream.readLine();
+        const QList<QString> parts = line.split(' ', QString::SkipEmptyParts);
+        if (parts.size() != 3) {
+            continue;
+        }
+
+        bool size_ok;
+        bool last_used_ok;
+        const QString key = parts[0];
+        const qint64 size = parts[1].toLongLong(&size_ok);
+        const qint64 last_used = parts[2].toLongLong(&last_used_ok);
+
+        if (size_ok && last_used_ok && !key.contains('/')) {
+            entries[key] = {size, last_used};
+        }
+    }
+}
+
+void ImageCache::save() const {
+    // NOTE: written atomically, so that index never lists
+    // only a part of the entries
+    QSaveFile file(QDir(dir).filePath("index"));
+    const bool open_success = file.open(QIODevice::WriteOnly);
+    if (!open_success) {
+        return;
+    }
+
+    QTextStream stream(&file);
+
+    for (const QString &key : entries.keys()) {
+        const Entry &entry = entries[key];
+
+        stream << key << " " << entry.size << " " << entry.lastUsed << "\n";
+    }
+
+    stream.flush();
+    file.commit();
+}
+
+// Remove least recently used entries until cache fits
+// into max size, entry that was just added is kept
+void ImageCache::evict(const QString &keep) {
+    const auto total_size = [&]() {
+        qint64 out = 0;
+
+        for (const Entry &entry : entries) {
+            out += entry.size;
+        }
+
+        return out;
+    };
+
+    while (total_size() > maxSize) {
+        QString oldest;
+
+        for (const QString &key : entries.keys()) {
+            if (key == keep) {
+                continue;
+            }
+
+            if (oldest.isEmpty() || entries[key].lastUsed < entries[oldest].lastUsed) {
+                oldest = key;
+            }
+        }
+
+        if (oldest.isEmpty()) {
+            break;
+        }
+
+        qDebug() << "ImageCache: evicting" << oldest;
+
+        remove(oldest);
+    }
+}
+
+void ImageCache::remove(const QString &key) {
+    entries.remove(key);
+
+    // NOTE: extra files are named after the entry
+    const QDir cache_dir(dir);
+    const QList<QString> files = cache_dir.entryList({key, key + ".*"}, QDir::Files);
+    for (const QString &file : files) {
+        QFile::remove(cache_dir.filePath(file));
+    }
+}
+
+// Name of the cache entry for checksum, empty if checksum
+// can't be used. Bare MD5 checksums stay bare, others are
+// prefixed by algorithm.
+QString cache_key(const QString &checksum) {
+    DigestAlgorithm algorithm;
+    QByteArray hex;
+    const bool parse_success = digestParseChecksum(checksum.toLatin1(), &algorithm, &hex);
+    if (!parse_success || hex.isEmpty()) {
+        return QString();
+    }
+
+    // NOTE: key is used as a file name
+    for (const char c : hex) {
+        const bool is_hex = ('0' <= c && c <= '9') || ('a' <= c && c <= 'f');
+        if (!is_hex) {
+            return QString();
+        }
+    }
+
+    const QString formatted = QString::fromLatin1(digestFormatChecksum(algorithm, hex));
+
+    return QString(formatted).replace(':', '-');
+}
+
+qint64 image_cache_max_size() {
+    const QByteArray envValue = qgetenv("MEDIAWRITER_IMAGE_CACHE_SIZE_ENV");
+
+    bool ok;
+    const qint64 value = envValue.toLongLong(&ok);
+
+    if (ok && value >= 0) {
+        return value;
+    } else {
+        return DEFAULT_MAX_CACHE_SIZE;
+    }
+}
+
+bool link_file(const QString &from, const QString &to) {
+#ifdef _WIN32
+    return CreateHardLinkW((LPCWSTR) to.utf16(), (LPCWSTR) from.utf16(), nullptr);
+#else
+    const QByteArray from_bytes = QFile::encodeName(from);
+    const QByteArray to_bytes = QFile::encodeName(to);
+
+    return (link(from_bytes.constData(), to_bytes.constData()) == 0);
+#endif
+}
+
+// True if both paths are links to the same file
+bool same_file(const QString &a, const QString &b) {
+#ifdef _WIN32
+    const auto file_id = [](const QString &path, BY_HANDLE_FILE_INFORMATION *info) -> bool {
+        const HANDLE handle = CreateFileW((LPCWSTR) path.utf16(), 0, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (handle == INVALID_HANDLE_VALUE) {
+            return false;
+        }
+
+        const bool success = GetFileInformationByHandle(handle, info);
+        CloseHandle(handle);
+
+        return success;
+    };
+
+    BY_HANDLE_FILE_INFORMATION a_info;
+    BY_HANDLE_FILE_INFORMATION b_info;
+    if (!file_id(a, &a_info) || !file_id(b, &b_info)) {
+        return false;
+    }
+
+    return (a_info.dwVolumeSerialNumber == b_info.dwVolumeSerialNumber && a_info.nFileIndexHigh == b_info.nFileIndexHigh && a_info.nFileIndexLow == b_info.nFileIndexLow);
+#else
+    struct stat a_stat;
+    struct stat b_stat;
+    if (stat(QFile::encodeName(a).constData(), &a_stat) != 0 || stat(QFile::encodeName(b).constData(), &b_stat) != 0) {
+        return false;
+    }
+
+    return (a_stat.st_dev == b_stat.st_dev && a_stat.st_ino == b_stat.st_ino);
+#endif
+}
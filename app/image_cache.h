@@ -0,0 +1,84 @@
+/*
+ * ALT Media Writer
+ * Copyright (C) 2016-2019 Martin Bříza <mbriza@redhat.com>
+ * Copyright (C) 2020-2022 Dmitry Degtyarev <kevl@basealt.ru>
+ *
+ * ALT Media Writer is a fork of Fedora Media Writer
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef IMAGE_CACHE_H
+#define IMAGE_CACHE_H
+
+/**
+ * Cache of downloaded images, keyed by their checksums.
+ * Images are only added after their checksum was checked
+ * by the download, so a cached image is written without
+ * downloading or checking it again. An image with the
+ * same checksum under a different name is taken from the
+ * cache as well.
+ *
+ * Cached images are hard links to downloaded files, so
+ * they don't take extra space while the download is kept.
+ * Cache is in the app's cache directory, if it's on a
+ * different filesystem than the download directory,
+ * images are not cached. Block maps and segment manifests
+ * are cached next to their images.
+ *
+ * Index file lists cached images with their sizes and the
+ * time they were last used, one per line:
+ *
+ * <key> <size> <last used, seconds since epoch>
+ *
+ * When the total size goes over the limit, least recently
+ * used images are removed.
+ */
+
+#include <QHash>
+#include <QList>
+#include <QString>
+
+class ImageCache {
+public:
+    ImageCache();
+
+    // Puts the cached image with given checksum at path,
+    // replacing a different file that is there. Returns
+    // false if image is not cached.
+    bool restore(const QString &checksum, const QString &path, const QList<QString> &extraSuffixes);
+
+    // Adds a checked image to the cache, along with the
+    // extra files next to it
+    void insert(const QString &checksum, const QString &path, const QList<QString> &extraSuffixes);
+
+private:
+    struct Entry {
+        qint64 size;
+        qint64 lastUsed;
+    };
+
+    QString dir;
+    qint64 maxSize;
+    QHash<QString, Entry> entries;
+
+    QString entryPath(const QString &key) const;
+    void load();
+    void save() const;
+    void evict(const QString &keep);
+    void remove(const QString &key);
+};
+
+#endif // IMAGE_CACHE_H
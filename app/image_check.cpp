@@ -0,0 +1,117 @@
+/*
+ * ALT Media Writer
+ * Copyright (C) 2016-2019 Martin Bříza <mbriza@redhat.com>
+ * Copyright (C) 2020-2022 Dmitry Degtyarev <kevl@basealt.ru>
+ *
+ * ALT Media Writer is a fork of Fedora Media Writer
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include "image_check.h"
+
+#include "isomd5/digest.h"
+
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QFile>
+
+#include <memory>
+
+#define READ_SIZE (4 * 1024 * 1024)
+#define PROGRESS_INTERVAL_MS 100
+
+ImageCheck::ImageCheck(const QString &filePath_arg, const QString &checksum_arg, QObject *parent)
+: QThread(parent)
+, filePath(filePath_arg)
+, checksum(checksum_arg)
+, aborted(false)
+, checkPassed(false) {
+
+}
+
+ImageCheck::~ImageCheck() {
+    abort();
+    wait();
+}
+
+bool ImageCheck::canCheck(const QString &checksum) {
+    DigestAlgorithm algorithm;
+    QByteArray hex;
+    const bool parse_success = digestParseChecksum(checksum.toLatin1(), &algorithm, &hex);
+
+    return (parse_success && !hex.isEmpty() && Digest::isSupported(algorithm));
+}
+
+void ImageCheck::abort() {
+    aborted = true;
+}
+
+bool ImageCheck::passed() const {
+    return checkPassed;
+}
+
+bool ImageCheck::wasAborted() const {
+    return aborted;
+}
+
+void ImageCheck::run() {
+    DigestAlgorithm algorithm;
+    QByteArray expected;
+    const bool parse_success = digestParseChecksum(checksum.toLatin1(), &algorithm, &expected);
+    const std::unique_ptr<Digest> hash(parse_success ? Digest::create(algorithm) : nullptr);
+    if (hash == nullptr) {
+        return;
+    }
+
+    QFile file(filePath);
+    const bool open_success = file.open(QIODevice::ReadOnly);
+    if (!open_success) {
+        qDebug() << "ImageCheck: failed to open" << filePath;
+
+        return;
+    }
+
+    QByteArray buffer(READ_SIZE, '\0');
+    qint64 total = 0;
+    QElapsedTimer progressTimer;
+    progressTimer.start();
+
+    while (!aborted) {
+        const qint64 len = file.read(buffer.data(), buffer.size());
+        if (len < 0) {
+            qDebug() << "ImageCheck: failed to read" << filePath;
+
+            return;
+        }
+        if (len == 0) {
+            break;
+        }
+
+        hash->addData(buffer.constData(), len);
+        total += len;
+
+        if (progressTimer.elapsed() >= PROGRESS_INTERVAL_MS) {
+            emit progress(total);
+            progressTimer.restart();
+        }
+    }
+
+    if (aborted) {
+        return;
+    }
+
+    checkPassed = (hash->result() == expected);
+}
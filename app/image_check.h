@@ -0,0 +1,75 @@
+/*
+ * ALT Media Writer
+ * Copyright (C) 2016-2019 Martin Bříza <mbriza@redhat.com>
+ * Copyright (C) 2020-2022 Dmitry Degtyarev <kevl@basealt.ru>
+ *
+ * ALT Media Writer is a fork of Fedora Media Writer
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef IMAGE_CHECK_H
+#define IMAGE_CHECK_H
+
+/**
+ * Checks an image that is already in the download
+ * directory, but not in the ImageCache, against its
+ * checksum on a separate thread. Such a file may be left
+ * from an older version of the app or put there by the
+ * user, so it's not trusted until checked.
+ *
+ * QThread::finished() is emitted once the check is done or
+ * aborted.
+ */
+
+#include <QByteArray>
+#include <QString>
+#include <QThread>
+
+#include <atomic>
+
+class ImageCheck final : public QThread {
+    Q_OBJECT
+
+public:
+    ImageCheck(const QString &filePath_arg, const QString &checksum_arg, QObject *parent);
+    ~ImageCheck();
+
+    // Returns false if there is no checksum or its
+    // algorithm is not supported
+    static bool canCheck(const QString &checksum);
+
+    // Can be called from any thread
+    void abort();
+
+    // Valid after the check finished
+    bool passed() const;
+    bool wasAborted() const;
+
+signals:
+    // Size of data checked so far
+    void progress(const qint64 value);
+
+protected:
+    void run() override;
+
+private:
+    QString filePath;
+    QString checksum;
+    std::atomic<bool> aborted;
+    bool checkPassed;
+};
+
+#endif // IMAGE_CHECK_H
@@ -18,37 +18,160 @@
  */
 
 #include "image_download.h"
+#include "download_sink.h"
+#include "image_cache.h"
 #include "network.h"
+#include "isomd5/digest.h"
+#include "isomd5/partmap.h"
 
 #include <QDir>
 #include <QFile>
+#include <QFileInfo>
 #include <QNetworkAccessManager>
 #include <QNetworkProxyFactory>
 #include <QNetworkReply>
 #include <QNetworkRequest>
+#include <QRegularExpression>
 #include <QStandardPaths>
-#include <QStorageInfo>
 #include <QTimer>
 
-ImageDownload::ImageDownload(const QUrl &url_arg, const QString &filePath_arg, const QString &md5sum_arg)
+// NOTE: data is moved from reply to the sink in chunks of
+// this size, so that the sink can start writing before
+// the whole reply buffer is read
+#define READ_CHUNK_SIZE (4L * 1024L * 1024L)
+
+// NOTE: 64MB buffer in case the user is on a very fast
+// network, shared by all segments
+#define REPLY_BUFFER_SIZE (64L * 1024L * 1024L)
+
+#define DOWNLOAD_SEGMENTS 4
+#define MAX_DOWNLOAD_SEGMENTS 16
+
+// Images are not split into segments smaller than this,
+// since starting a request costs a couple of round trips
+#define MIN_SEGMENT_SIZE (16L * 1024L * 1024L)
+
+#define CHECK_INTERVAL_MS 1000
+
+// Segment that received nothing for this long is moved to
+// another mirror
+#define STALL_TIMEOUT_MS 15000
+
+// Segment on a slow mirror is only moved if it ran at
+// least this long, so that the mirror is measured
+#define SLOW_MIRROR_GRACE_MS 5000
+
+int download_segment_count();
+QList<QPair<qint64, qint64>> split_range(const qint64 offset, const qint64 end, const int count);
+qint64 content_range_total(QNetworkReply *reply);
+
+ImageDownload::ImageDownload(const QList<QUrl> &urls_arg, const QString &filePath_arg, const QString &md5sum_arg, const QHash<QString, QUrl> &extraFileUrls_arg)
 : QObject()
-, hash(QCryptographicHash::Md5) {
-    url = url_arg;
+, mirrors(urls_arg) {
     filePath = filePath_arg;
     md5sum = md5sum_arg;
-    file = nullptr;
-    startingImageDownload = false;
+    extraFileUrls = extraFileUrls_arg;
+    sink = nullptr;
+    totalSize = -1;
+    maxSegmentCount = download_segment_count();
     wasCancelled = false;
+    extraFilesDownloading = 0;
+    waitingForExtraFiles = false;
+
+    DigestAlgorithm hashAlgorithm = DigestAlgorithm_MD5;
+    Digest *hash = nullptr;
 
-    qDebug() << this->metaObject()->className() << "created for" << url;
+    if (!md5sum.isEmpty()) {
+        const bool parse_success = digestParseChecksum(md5sum.toLatin1(), &hashAlgorithm, &expectedSum);
+
+        if (parse_success) {
+            hash = Digest::create(hashAlgorithm);
+        }
+
+        if (hash == nullptr) {
+            qDebug() << this->metaObject()->className() << "Checksum algorithm is not supported:" << md5sum;
+
+            expectedSum.clear();
+        }
+    }
+
+    qDebug() << this->metaObject()->className() << "created for" << urls_arg;
 
     QNetworkProxyFactory::setUseSystemConfiguration(true);
 
-    const QString tempFilePath = filePath + ".part";
-    file = new QFile(tempFilePath, this);
-    file->open(QIODevice::WriteOnly | QIODevice::Append);
+    // NOTE: remove extra files left from a previous image
+    // with the same name
+    for (const QString &suffix : extraFileUrls.keys()) {
+        QFile::remove(filePath + suffix);
+    }
+
+    // NOTE: if there's a partially downloaded file, the
+    // sink hashes it first while the rest is downloaded.
+    // If it was downloaded in segments, only missing
+    // blocks are downloaded.
+    const PartMap partMap = loadPartMap();
+
+    if (partMap.isEmpty()) {
+        const qint64 downloadedSize = QFileInfo(partPath()).size();
+
+        segments.append(makeSegment(downloadedSize, -1));
+    } else {
+        totalSize = partMap.totalSize();
+
+        const QList<QPair<qint64, qint64>> missingRanges = partMap.missingRanges();
+
+        qint64 missingSize = 0;
+        for (const QPair<qint64, qint64> &range : missingRanges) {
+            missingSize += range.second - range.first;
+        }
+
+        for (const QPair<qint64, qint64> &range : missingRanges) {
+            const int count = qMax(1, (int) (maxSegmentCount * (range.second - range.first) / missingSize));
+
+            for (const QPair<qint64, qint64> &piece : split_range(range.first, range.second, count)) {
+                segments.append(makeSegment(piece.first, piece.second));
+            }
+        }
+
+        qDebug() << this->metaObject()->className() << "Resuming" << missingSize << "bytes in" << segments.size() << "segments";
+    }
+
+    sink = new DownloadSink(partPath(), hashStatePath(), partMapPath(), partMap, hash, hashAlgorithm, this);
+
+    connect(
+        sink, &DownloadSink::progress,
+        this, &ImageDownload::progress);
+    connect(
+        sink, &DownloadSink::spaceAvailable,
+        this, &ImageDownload::readSegments);
+    connect(
+        sink, &QThread::finished,
+        this, &ImageDownload::onSinkFinished);
+
+    sink->start();
 
-    startImageDownload();
+    clock.start();
+
+    checkTimer = new QTimer(this);
+    checkTimer->setInterval(CHECK_INTERVAL_MS);
+    connect(
+        checkTimer, &QTimer::timeout,
+        this, &ImageDownload::checkSegments);
+    checkTimer->start();
+
+    // NOTE: all blocks may be written already if previous
+    // download was interrupted right before finishing
+    if (segments.isEmpty()) {
+        sink->close();
+    }
+
+    for (int i = 0; i < segments.size(); i++) {
+        startSegment(i);
+    }
+
+    for (const QString &suffix : extraFileUrls.keys()) {
+        startExtraFileDownload(suffix);
+    }
 }
 
 ImageDownload::Result ImageDownload::result() const {
@@ -74,137 +197,539 @@ void ImageDownload::cancel() {
 
 void ImageDownload::onImageDownloadReadyRead() {
     QNetworkReply *reply = qobject_cast<QNetworkReply *>(sender());
+    const int index = segmentIndex(reply);
+    if (index == -1) {
+        return;
+    }
 
-    if (startingImageDownload) {
+    if (segments[index].replyStarting) {
         qDebug() << "Request started successfully";
-        startingImageDownload = false;
+        segments[index].replyStarting = false;
+        segments[index].lastDataTime = clock.elapsed();
+
+        const int status = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+
+        // NOTE: error replies, like 404, also have data
+        if (status == 200 || status == 206) {
+            mirrors.addLatency(segments[index].mirror, clock.elapsed() - segments[index].requestTime);
+        }
+        const bool is_range_request = (segments[index].position > 0 || segments[index].end != -1);
+
+        // NOTE: if server ignored the range and is sending
+        // the whole file, start over
+        if (status == 200 && is_range_request) {
+            if (totalSize != -1) {
+                qDebug() << this->metaObject()->className() << "Server doesn't support ranges:" << reply->url();
+
+                dropMirror(index);
+
+                return;
+            } else {
+                qDebug() << this->metaObject()->className() << "Server doesn't support resuming, restarting download";
+
+                sink->restart();
+                segments[index].position = 0;
+            }
+        }
+
+        // NOTE: the first request asks for the rest of the
+        // file, if server replies with a range, the rest
+        // can be split into segments
+        if (status == 206 && totalSize == -1) {
+            const qint64 replyTotalSize = content_range_total(reply);
 
-        const QVariant remainingSize = reply->header(QNetworkRequest::ContentLengthHeader);
-        if (remainingSize.isValid()) {
-            const qint64 totalSize = file->size() + remainingSize.toULongLong();
+            if (replyTotalSize != -1) {
+                splitIntoSegments(replyTotalSize);
+            }
+        } else if (status == 206 && content_range_total(reply) != totalSize) {
+            // NOTE: mirror is out of date or has a
+            // different image with the same name
+            qDebug() << this->metaObject()->className() << "Mirror has a different file:" << reply->url();
 
+            dropMirror(index);
+
+            return;
+        }
+
+        if (totalSize != -1) {
             emit progressMaxChanged(totalSize);
+        } else {
+            const QVariant remainingSize = reply->header(QNetworkRequest::ContentLengthHeader);
+            if (remainingSize.isValid()) {
+                const qint64 imageSize = segments[index].position + remainingSize.toLongLong();
+
+                // NOTE: segmented download allocates space
+                // when it's split, see splitIntoSegments()
+                sink->reserve(imageSize);
+
+                emit progressMaxChanged(imageSize);
+            }
         }
 
         emit started();
     }
 
-    const QByteArray data = reply->readAll();
-    if (reply->error() == QNetworkReply::NoError && data.size() > 0) {
-        if (reply->header(QNetworkRequest::ContentLengthHeader).isValid()) {
-            ;
-        }
+    readSegment(index);
+}
 
-        const qint64 writeSize = file->write(data);
-        const bool writeSuccess = (writeSize != -1);
-        if (writeSuccess) {
-            emit progress(file->size());
-        } else {
-            QStorageInfo storage(file->fileName());
-            const QString errorString = [storage]() {
-                if (storage.bytesAvailable() < 5L * 1024L * 1024L) {
-                    return tr("You ran out of space in your Downloads folder.");
+void ImageDownload::onImageDownloadFinished() {
+    QNetworkReply *reply = qobject_cast<QNetworkReply *>(sender());
+    const int index = segmentIndex(reply);
+    if (index == -1) {
+        return;
+    }
+
+    segments[index].replyFinished = true;
+
+    // NOTE: there may be data left in the reply if the sink
+    // was full, in which case reply is done once the sink
+    // takes the rest
+    readSegment(index);
+}
+
+// Called once sink has room again
+void ImageDownload::readSegments() {
+    for (int i = 0; i < segments.size(); i++) {
+        readSegment(i);
+    }
+}
+
+// Pass data from reply to the sink while it has room. If
+// it's full, this is called again once there is room.
+void ImageDownload::readSegment(const int index) {
+    QNetworkReply *reply = segments[index].reply;
+
+    if (reply == nullptr || wasCancelled) {
+        return;
+    }
+
+    if (reply->error() == QNetworkReply::NoError) {
+        while (reply->bytesAvailable() > 0 && sink->canPush()) {
+            Segment &segment = segments[index];
+
+            const qint64 readSize = [segment]() {
+                if (segment.end == -1) {
+                    return (qint64) READ_CHUNK_SIZE;
                 } else {
-                    return tr("The downloaded file is not writable.");
+                    return qMin((qint64) READ_CHUNK_SIZE, segment.end - segment.position);
                 }
             }();
 
-            finish(ImageDownload::DiskError, errorString);
+            const QByteArray data = reply->read(readSize);
+
+            sink->push(segment.position, data);
+            segment.position += data.size();
+            segment.checkBytes += data.size();
+            segment.lastDataTime = clock.elapsed();
+
+            // NOTE: first segment was requested until the
+            // end of the file before it was split, so it's
+            // stopped once it reaches its end
+            const bool reached_end = (segment.end != -1 && segment.position >= segment.end);
+            if (reached_end) {
+                stopSegmentReply(index);
+                onSegmentReplyDone(index, true);
+
+                return;
+            }
+        }
+    }
+
+    const bool reply_done = (segments[index].replyFinished && (reply->bytesAvailable() == 0 || reply->error() != QNetworkReply::NoError));
+    if (reply_done) {
+        releaseSegmentReply(index);
+
+        const bool success = (reply->error() == QNetworkReply::NoError);
+        if (!success) {
+            qDebug() << "Download was interrupted by an error:" << reply->errorString();
+
+            mirrors.addFailure(segments[index].mirror);
         }
+
+        onSegmentReplyDone(index, success);
     }
 }
 
-void ImageDownload::onImageDownloadFinished() {
-    QNetworkReply *reply = qobject_cast<QNetworkReply *>(sender());
-    reply->deleteLater();
+void ImageDownload::onSegmentReplyDone(const int index, const bool success) {
+    Segment &segment = segments[index];
+
+    segment.replyFinished = false;
 
     if (wasCancelled) {
         return;
-    } else if (reply->error() == QNetworkReply::NoError) {
-        qDebug() << this->metaObject()->className() << "Finished successfully";
+    }
 
-        if (md5sum.isEmpty()) {
-            // If md5sum doesn't exist, be lenient and
-            // don't treat this as a failed check.
-            // Instead, skip the check.
-            qDebug() << this->metaObject()->className() << "No md5sum found, so skipping md5 check";
+    // NOTE: reply without error may still end early if the
+    // connection was closed
+    const bool complete = success && (segment.end == -1 || segment.position >= segment.end);
 
-            rename_to_final_name();
-        } else {
-            file->close();
-            const bool open_success = file->open(QIODevice::ReadOnly);
-            if (open_success) {
-                emit startedMd5Check();
-                QTimer::singleShot(0, this, &ImageDownload::computeMd5);
-            } else {
-                qDebug() << this->metaObject()->className() << "Failed to open file for md5 check";
+    if (complete) {
+        segment.done = true;
+
+        for (const Segment &other : segments) {
+            if (!other.done) {
+                // NOTE: keep the connection busy by taking
+                // half of the remaining work
+                splitLargestSegment();
 
-                finish(ImageDownload::Md5CheckFail);
+                return;
             }
         }
+
+        qDebug() << this->metaObject()->className() << "Finished successfully";
+
+        // NOTE: result is checked once the sink writes
+        // and hashes the rest of the data, see
+        // onSinkFinished()
+        if (!expectedSum.isEmpty()) {
+            emit startedMd5Check();
+        }
+
+        sink->close();
     } else {
-        qDebug() << "Download was interrupted by an error:" << reply->errorString();
         qDebug() << "Attempting to resume";
 
+        // NOTE: retry on another mirror if there is one
+        segment.mirror = mirrors.pick(segment.mirror);
+
         emit interrupted();
 
         QTimer::singleShot(1000, this,
-            [this]() {
-                startImageDownload();
+            [this, index]() {
+                startSegment(index);
             });
     }
 }
 
-void ImageDownload::computeMd5() {
+void ImageDownload::releaseSegmentReply(const int index) {
+    Segment &segment = segments[index];
+
+    segment.reply->deleteLater();
+    segment.reply = nullptr;
+    segment.replyFinished = false;
+
+    mirrors.requestStopped(segment.mirror);
+}
+
+void ImageDownload::stopSegmentReply(const int index) {
+    QNetworkReply *reply = segments[index].reply;
+    if (reply == nullptr) {
+        return;
+    }
+
+    reply->disconnect(this);
+    reply->abort();
+    releaseSegmentReply(index);
+}
+
+// Check running segments for stalls and slow mirrors.
+// Throughput is also measured here.
+void ImageDownload::checkSegments() {
     if (wasCancelled) {
         return;
     }
 
-    const QByteArray bytes = file->read(64L * 1024L);
-    const bool read_success = (bytes.size() > 0);
+    const qint64 now = clock.elapsed();
 
-    if (read_success) {
-        hash.addData(bytes);
-        emit progress(file->pos());
+    for (int i = 0; i < segments.size(); i++) {
+        Segment &segment = segments[i];
 
-        if (file->atEnd()) {
-            const QByteArray sum_bytes = hash.result().toHex();
-            const QString computedMd5 = QString(sum_bytes);
+        if (segment.reply == nullptr) {
+            continue;
+        }
 
-            const bool checkPassed = (computedMd5 == md5sum);
+        // NOTE: no data may also mean that the sink is
+        // full, in which case mirror is not at fault
+        if (segment.checkBytes > 0) {
+            mirrors.addSample(segment.mirror, segment.checkBytes, CHECK_INTERVAL_MS);
+            segment.checkBytes = 0;
+        }
 
-            if (checkPassed) {
-                qDebug() << "MD5 check passed";
+        const bool stalled = (now - segment.lastDataTime >= STALL_TIMEOUT_MS && segment.reply->bytesAvailable() == 0);
+        const bool slow = (segment.end != -1 && now - segment.requestTime >= SLOW_MIRROR_GRACE_MS && mirrors.isSlow(segment.mirror) && mirrors.hasOther(segment.mirror));
 
-                rename_to_final_name();
-            } else {
-                qDebug() << "MD5 mismatch";
-                qDebug() << "sum should be =" << md5sum;
-                qDebug() << "computed sum  =" << computedMd5;
+        if (stalled) {
+            qDebug() << this->metaObject()->className() << "Segment at" << segment.position << "stalled on" << mirrors.url(segment.mirror);
 
-                finish(ImageDownload::Md5CheckFail);
-            }
+            mirrors.addFailure(segment.mirror);
+            moveSegment(i, segment.mirror);
+        } else if (slow) {
+            qDebug() << this->metaObject()->className() << "Segment at" << segment.position << "is on a slow mirror" << mirrors.url(segment.mirror);
+
+            moveSegment(i, segment.mirror);
+        }
+    }
+}
+
+// Restart segment from its position, preferably on another
+// mirror
+void ImageDownload::moveSegment(const int index, const int excludedMirror) {
+    stopSegmentReply(index);
+
+    const int mirror = mirrors.pick(excludedMirror);
+    if (mirror == -1) {
+        return;
+    }
+
+    segments[index].mirror = mirror;
+    startSegment(index);
+}
+
+// Stop using the segment's mirror because it can't serve
+// segments of this file. If there are no other mirrors, the
+// download falls back to a single stream.
+void ImageDownload::dropMirror(const int index) {
+    const int mirror = segments[index].mirror;
+
+    if (mirrors.hasOther(mirror)) {
+        mirrors.disable(mirror);
+        moveSegment(index, mirror);
+    } else {
+        qDebug() << this->metaObject()->className() << "No mirrors support ranges, falling back to single stream";
+
+        fallBackToSingleStream();
+    }
+}
+
+// Split remaining part of the largest segment in half and
+// start downloading the second half
+void ImageDownload::splitLargestSegment() {
+    if (totalSize == -1) {
+        return;
+    }
+
+    int largest = -1;
+    qint64 largest_remaining = 0;
+
+    for (int i = 0; i < segments.size(); i++) {
+        const Segment &segment = segments[i];
+        const qint64 remaining = segment.end - segment.position;
+
+        if (!segment.done && segment.end != -1 && remaining > largest_remaining) {
+            largest = i;
+            largest_remaining = remaining;
+        }
+    }
+
+    if (largest == -1 || largest_remaining < 2 * MIN_SEGMENT_SIZE) {
+        return;
+    }
+
+    Segment &segment = segments[largest];
+
+    // NOTE: split point is aligned to part map blocks, the
+    // running reply is stopped once it reaches it
+    const qint64 middle = segment.position + largest_remaining / 2;
+    const qint64 split = (middle + PART_MAP_BLOCK_SIZE - 1) / PART_MAP_BLOCK_SIZE * PART_MAP_BLOCK_SIZE;
+    const qint64 end = segment.end;
+
+    segment.end = split;
+
+    qDebug() << this->metaObject()->className() << "Splitting segment at" << split;
+
+    segments.append(makeSegment(split, end));
+    startSegment(segments.size() - 1);
+}
+
+// Split the rest of the single stream into segments once
+// total size is known. The single stream becomes the first
+// segment.
+void ImageDownload::splitIntoSegments(const qint64 totalSize_arg) {
+    const QList<QPair<qint64, qint64>> ranges = split_range(segments[0].position, totalSize_arg, maxSegmentCount);
+    if (ranges.size() <= 1) {
+        return;
+    }
+
+    qDebug() << this->metaObject()->className() << "Splitting download into" << ranges.size() << "segments";
+
+    totalSize = totalSize_arg;
+    sink->setTotalSize(totalSize);
+
+    segments[0].end = ranges[0].second;
+
+    for (int i = 1; i < ranges.size(); i++) {
+        segments.append(makeSegment(ranges[i].first, ranges[i].second));
+        startSegment(segments.size() - 1);
+    }
+}
+
+void ImageDownload::fallBackToSingleStream() {
+    for (int i = 0; i < segments.size(); i++) {
+        stopSegmentReply(i);
+    }
+
+    totalSize = -1;
+    maxSegmentCount = 1;
+    sink->restart();
+
+    segments.clear();
+    segments.append(makeSegment(0, -1));
+
+    startSegment(0);
+}
+
+int ImageDownload::segmentIndex(QNetworkReply *reply) const {
+    for (int i = 0; i < segments.size(); i++) {
+        if (segments[i].reply == reply) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+ImageDownload::Segment ImageDownload::makeSegment(const qint64 position, const qint64 end) {
+    Segment out;
+    out.reply = nullptr;
+    out.replyStarting = false;
+    out.replyFinished = false;
+    out.position = position;
+    out.end = end;
+    out.done = false;
+    // NOTE: mirror is picked when segment starts
+    out.mirror = -1;
+    out.requestTime = 0;
+    out.lastDataTime = 0;
+    out.checkBytes = 0;
+
+    return out;
+}
+
+// Load part map of a download that was interrupted. If the
+// map is invalid, blocks written before are unknown, so
+// download starts from scratch.
+PartMap ImageDownload::loadPartMap() {
+    if (!QFile::exists(partMapPath())) {
+        return PartMap();
+    }
+
+    PartMap out;
+    const bool load_success = out.load(partMapPath());
+    const bool valid = load_success && QFileInfo(partPath()).size() == out.totalSize();
+
+    if (valid) {
+        return out;
+    } else {
+        qDebug() << this->metaObject()->className() << "Part map is invalid, restarting download";
+
+        QFile::remove(partMapPath());
+        QFile::remove(partPath());
+        QFile::remove(hashStatePath());
+
+        return PartMap();
+    }
+}
+
+void ImageDownload::onSinkFinished() {
+    if (wasCancelled) {
+        return;
+    }
+
+    if (sink->hasFailed()) {
+        finish(ImageDownload::DiskError, sink->errorString());
+    } else if (expectedSum.isEmpty()) {
+        // If md5sum doesn't exist, be lenient and
+        // don't treat this as a failed check.
+        // Instead, skip the check.
+        qDebug() << this->metaObject()->className() << "No md5sum found, so skipping md5 check";
+
+        rename_to_final_name();
+    } else {
+        // NOTE: all data was hashed as it arrived
+        const QByteArray computedMd5 = sink->checksum();
+
+        const bool checkPassed = (computedMd5 == expectedSum);
+
+        if (checkPassed) {
+            qDebug() << "MD5 check passed";
+
+            rename_to_final_name();
+        } else {
+            qDebug() << "MD5 mismatch";
+            qDebug() << "sum should be =" << expectedSum;
+            qDebug() << "computed sum  =" << computedMd5;
+
+            finish(ImageDownload::Md5CheckFail);
+        }
+    }
+}
+
+void ImageDownload::onExtraFileDownloadFinished() {
+    QNetworkReply *reply = qobject_cast<QNetworkReply *>(sender());
+    reply->deleteLater();
+
+    extraFilesDownloading--;
+
+    const QString suffix = reply->property("suffix").toString();
+
+    if (wasCancelled) {
+        return;
+    } else if (reply->error() == QNetworkReply::NoError) {
+        QFile extraFile(filePath + suffix);
+
+        const bool open_success = extraFile.open(QIODevice::WriteOnly);
+        const bool write_success = open_success && (extraFile.write(reply->readAll()) != -1);
+
+        if (write_success) {
+            qDebug() << this->metaObject()->className() << "Saved" << extraFile.fileName();
         } else {
-            QTimer::singleShot(0, this, &ImageDownload::computeMd5);
+            qDebug() << this->metaObject()->className() << "Failed to save" << extraFile.fileName();
+
+            extraFile.remove();
         }
     } else {
-        finish(ImageDownload::Md5CheckFail, tr("Failed to read from file while verifying"));
+        qDebug() << this->metaObject()->className() << "Failed to download" << reply->url() << reply->errorString();
+    }
+
+    if (waitingForExtraFiles && extraFilesDownloading == 0) {
+        rename_to_final_name();
     }
 }
 
-void ImageDownload::startImageDownload() {
-    qDebug() << this->metaObject()->className() << "startImageDownload()";
+void ImageDownload::startSegment(const int index) {
+    // NOTE: retries of segments that are gone after falling
+    // back to single stream are ignored
+    if (index >= segments.size() || segments[index].done || segments[index].reply != nullptr || wasCancelled) {
+        return;
+    }
+
+    Segment &segment = segments[index];
+
+    if (segment.mirror == -1) {
+        segment.mirror = mirrors.pick();
+    }
+    if (segment.mirror == -1) {
+        return;
+    }
+
+    const QUrl url = mirrors.url(segment.mirror);
 
-    startingImageDownload = true;
+    qDebug() << this->metaObject()->className() << "Starting segment at" << segment.position << "from" << url;
+
+    const QString range = [segment]() {
+        if (segment.end == -1) {
+            return QString("bytes=%1-").arg(segment.position);
+        } else {
+            return QString("bytes=%1-%2").arg(segment.position).arg(segment.end - 1);
+        }
+    }();
 
     QNetworkRequest request;
     request.setAttribute(QNetworkRequest::FollowRedirectsAttribute, true);
     request.setUrl(url);
-    request.setRawHeader("Range", QString("bytes=%1-").arg(file->size()).toLocal8Bit());
+    request.setRawHeader("Range", range.toLocal8Bit());
 
     QNetworkReply *reply = network_access_manager->get(request);
-    // NOTE: 64MB buffer in case the user is on a very fast network
-    reply->setReadBufferSize(64L * 1024L * 1024L);
+    reply->setReadBufferSize(qMax(READ_CHUNK_SIZE, REPLY_BUFFER_SIZE / maxSegmentCount));
+
+    segment.reply = reply;
+    segment.replyStarting = true;
+    segment.replyFinished = false;
+    segment.requestTime = clock.elapsed();
+    segment.lastDataTime = segment.requestTime;
+    segment.checkBytes = 0;
+
+    mirrors.requestStarted(segment.mirror);
 
     connect(
         reply, &QNetworkReply::readyRead,
@@ -217,12 +742,61 @@ void ImageDownload::startImageDownload() {
         reply, &QNetworkReply::abort);
 }
 
+void ImageDownload::startExtraFileDownload(const QString &suffix) {
+    const QUrl extraFileUrl = extraFileUrls[suffix];
+
+    qDebug() << this->metaObject()->className() << "Downloading" << extraFileUrl;
+
+    extraFilesDownloading++;
+
+    QNetworkRequest request;
+    request.setAttribute(QNetworkRequest::FollowRedirectsAttribute, true);
+    request.setUrl(extraFileUrl);
+
+    QNetworkReply *reply = network_access_manager->get(request);
+    reply->setProperty("suffix", suffix);
+
+    connect(
+        reply, &QNetworkReply::finished,
+        this, &ImageDownload::onExtraFileDownloadFinished);
+    connect(
+        this, &ImageDownload::cancelled,
+        reply, &QNetworkReply::abort);
+}
+
+QString ImageDownload::partPath() const {
+    return filePath + ".part";
+}
+
+QString ImageDownload::hashStatePath() const {
+    return filePath + ".hashstate";
+}
+
+QString ImageDownload::partMapPath() const {
+    return filePath + ".partmap";
+}
+
 void ImageDownload::rename_to_final_name() {
+    // NOTE: helper looks for extra files when the image
+    // appears, so they have to be saved first
+    if (extraFilesDownloading > 0) {
+        qDebug() << this->metaObject()->className() << "Waiting for extra files";
+
+        waitingForExtraFiles = true;
+
+        return;
+    }
+
     qDebug() << this->metaObject()->className() << "Renaming to final filename";
 
-    const bool rename_success = file->rename(filePath);
+    const bool rename_success = QFile::rename(partPath(), filePath);
 
     if (rename_success) {
+        // NOTE: only checked images are cached
+        if (!expectedSum.isEmpty()) {
+            ImageCache().insert(md5sum, filePath, extraFileUrls.keys());
+        }
+
         finish(ImageDownload::Success);
     } else {
         finish(ImageDownload::DiskError, tr("Unable to rename the temporary file."));
@@ -238,13 +812,83 @@ void ImageDownload::finish(const Result result_arg, const QString &errorString_a
         qDebug() << "Error string:" << m_errorString;
     }
 
-    if (m_result == ImageDownload::Success || m_result == ImageDownload::Cancelled) {
-        file->close();
-    } else {
-        file->remove();
+    // NOTE: replies are still running if writing failed
+    for (int i = 0; i < segments.size(); i++) {
+        stopSegmentReply(i);
+    }
+
+    checkTimer->stop();
+
+    // NOTE: sink saves hash state and part map when it
+    // stops. Cancelled download can be resumed later, so
+    // keep them for it.
+    sink->abort();
+    sink->wait();
+
+    if (m_result != ImageDownload::Cancelled) {
+        QFile::remove(hashStatePath());
+        QFile::remove(partMapPath());
+    }
+
+    if (m_result != ImageDownload::Success && m_result != ImageDownload::Cancelled) {
+        QFile::remove(partPath());
+
+        for (const QString &suffix : extraFileUrls.keys()) {
+            QFile::remove(filePath + suffix);
+        }
     }
 
     emit finished();
 
     deleteLater();
 }
+
+int download_segment_count() {
+    const QByteArray envValue = qgetenv("MEDIAWRITER_DOWNLOAD_SEGMENTS_ENV");
+
+    bool ok;
+    const int value = envValue.toInt(&ok);
+
+    if (ok && value > 0) {
+        return qMin(value, MAX_DOWNLOAD_SEGMENTS);
+    } else {
+        return DOWNLOAD_SEGMENTS;
+    }
+}
+
+// Split range into at most count pieces. Boundaries
+// between pieces are aligned to part map blocks, so that
+// each block is written by one segment.
+QList<QPair<qint64, qint64>> split_range(const qint64 offset, const qint64 end, const int count) {
+    const qint64 size = end - offset;
+    const int piece_count = qBound((qint64) 1, size / MIN_SEGMENT_SIZE, (qint64) count);
+    const qint64 piece_size = size / piece_count;
+
+    QList<QPair<qint64, qint64>> out;
+
+    qint64 pos = offset;
+    while (pos < end) {
+        const qint64 aligned_end = (pos + piece_size + PART_MAP_BLOCK_SIZE - 1) / PART_MAP_BLOCK_SIZE * PART_MAP_BLOCK_SIZE;
+        const qint64 piece_end = qMin(aligned_end, end);
+
+        out.append({pos, piece_end});
+        pos = piece_end;
+    }
+
+    return out;
+}
+
+// Total size from "Content-Range: bytes 0-99/1000" header,
+// -1 if it's not there or size is unknown
+qint64 content_range_total(QNetworkReply *reply) {
+    static const QRegularExpression regex("^bytes \\d+-\\d+/(\\d+)$");
+
+    const QString contentRange = QString::fromLatin1(reply->rawHeader("Content-Range"));
+    const QRegularExpressionMatch match = regex.match(contentRange);
+
+    if (match.hasMatch()) {
+        return match.captured(1).toLongLong();
+    } else {
+        return -1;
+    }
+}
@@ -20,7 +20,11 @@
 #ifndef IMAGE_DOWNLOAD_H
 #define IMAGE_DOWNLOAD_H
 
-#include <QCryptographicHash>
+#include "mirror_scheduler.h"
+
+#include <QElapsedTimer>
+#include <QHash>
+#include <QList>
 #include <QObject>
 #include <QUrl>
 
@@ -32,16 +36,55 @@
  * image download completes. When the download is finished,
  * an attempt to check md5 is made. Md5 sum is downloaded
  * from the MD5SUM file which should be located next to the
- * image file. If md5sum download fails due to error or
- * MD5SUM file not being present, the check is skipped. If
- * the download is interrupted by an error or time out,
+ * image file. The sum can also be a SHA-256 or BLAKE3
+ * checksum, see digest.h. If md5sum download fails due to
+ * error, MD5SUM file not being present or the checksum
+ * algorithm not being supported, the check is skipped.
+ * Downloaded data is written and hashed as it arrives on a
+ * separate thread, see DownloadSink, so the check
+ * completes together with the download. Hash state is
+ * saved next to the image with ".hashstate" suffix so that
+ * a resumed download doesn't need to hash the already
+ * downloaded part again.
+ *
+ * If the server supports ranges and the image is large
+ * enough, the image is split into segments which are
+ * downloaded at the same time, since a single connection
+ * to a distant mirror is often much slower than the link.
+ * Written blocks are saved in a PartMap next to the image
+ * with ".partmap" suffix and a resumed download only
+ * fetches blocks that are missing. If the server ignores
+ * ranges, download falls back to a single stream. Number of
+ * segments is set by MEDIAWRITER_DOWNLOAD_SEGMENTS_ENV,
+ * 1 disables segmented download.
+ *
+ * Image may have several mirrors, in which case segments
+ * are spread over them by a MirrorScheduler. Segments are
+ * checked every second: a segment that stalled or is on a
+ * mirror that is much slower than the best one is moved to
+ * another mirror. When a segment finishes, the largest
+ * remaining segment is split in half, so that fast mirrors
+ * end up downloading more of the image.
+ *
+ * If the download is interrupted by an error or time out,
  * periodic attempts to resume are made. If the download
  * finishes unsuccessfully, partially downloaded image is
  * deleted. Image download schedules itself for deletion
  * when it finishes.
+ *
+ * Extra files, like a block map or a segment manifest,
+ * are downloaded in parallel and saved next to the image,
+ * with the image's path plus a suffix (".bmap",
+ * ".segments"). The image is renamed to its final name
+ * only after extra files are saved, so that the helper can
+ * find them. Failing to download an extra file is not an
+ * error, since they are all optional.
  */
 
-class QFile;
+class DownloadSink;
+class PartMap;
+class QNetworkReply;
+class QTimer;
 
 class ImageDownload final : public QObject {
     Q_OBJECT
@@ -54,7 +97,7 @@ public:
         Cancelled
     };
 
-    ImageDownload(const QUrl &url_arg, const QString &filePath_arg, const QString &md5sum_arg);
+    ImageDownload(const QList<QUrl> &urls_arg, const QString &filePath_arg, const QString &md5sum_arg, const QHash<QString, QUrl> &extraFileUrls_arg);
     Result result() const;
     QString errorString() const;
 
@@ -69,6 +112,7 @@ signals:
     void interrupted();
 
     // An md5 check for the downloaded image started. Note that md5 checks happen only if a valid md5 sum could be downloaded for this. Otherwise this check is skipped.
+    // Since data is hashed as it's downloaded, this is only emitted when the download finished but hashing is not done yet.
     void startedMd5Check();
 
     // Emitted when the download finishes
@@ -86,22 +130,72 @@ public slots:
 private slots:
     void onImageDownloadReadyRead();
     void onImageDownloadFinished();
-    void computeMd5();
+    void onExtraFileDownloadFinished();
+    void onSinkFinished();
+    void readSegments();
+    void checkSegments();
 
 private:
+    struct Segment {
+        QNetworkReply *reply;
+        bool replyStarting;
+        bool replyFinished;
+        // Next byte to download
+        qint64 position;
+        // End of range, -1 if downloading until the end of
+        // the file
+        qint64 end;
+        bool done;
+        int mirror;
+        // Times from the start of the download, in ms
+        qint64 requestTime;
+        qint64 lastDataTime;
+        // Data received since last check
+        qint64 checkBytes;
+    };
+
     Result m_result;
     QString m_errorString;
 
-    QUrl url;
+    MirrorScheduler mirrors;
     QString filePath;
     QString md5sum;
-    QFile *file;
-    bool startingImageDownload;
+    // Hex digest part of md5sum, empty if there is no sum
+    // or it can't be checked
+    QByteArray expectedSum;
+    // Suffix => url
+    QHash<QString, QUrl> extraFileUrls;
+    DownloadSink *sink;
+    // Single segment without an end until server's
+    // support for ranges is known
+    QList<Segment> segments;
+    // -1 if not known yet
+    qint64 totalSize;
+    int maxSegmentCount;
+    QElapsedTimer clock;
+    QTimer *checkTimer;
     bool wasCancelled;
-    QCryptographicHash hash;
+    int extraFilesDownloading;
+    bool waitingForExtraFiles;
 
     QString getFilePath() const;
-    void startImageDownload();
+    void startSegment(const int index);
+    void startExtraFileDownload(const QString &suffix);
+    void readSegment(const int index);
+    void onSegmentReplyDone(const int index, const bool success);
+    void releaseSegmentReply(const int index);
+    void stopSegmentReply(const int index);
+    void moveSegment(const int index, const int excludedMirror);
+    void dropMirror(const int index);
+    void splitLargestSegment();
+    void splitIntoSegments(const qint64 totalSize_arg);
+    void fallBackToSingleStream();
+    int segmentIndex(QNetworkReply *reply) const;
+    static Segment makeSegment(const qint64 position, const qint64 end);
+    PartMap loadPartMap();
+    QString partPath() const;
+    QString hashStatePath() const;
+    QString partMapPath() const;
     void rename_to_final_name();
     void finish(const Result result_arg, const QString &errorString_arg = QString());
 };
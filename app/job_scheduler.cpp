@@ -0,0 +1,289 @@
+/*
+ * ALT Media Writer
+ * Copyright (C) 2016-2019 Martin Bříza <mbriza@redhat.com>
+ * Copyright (C) 2020-2022 Dmitry Degtyarev <kevl@basealt.ru>
+ *
+ * ALT Media Writer is a fork of Fedora Media Writer
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include "job_scheduler.h"
+
+#include <QDebug>
+#include <QTimer>
+
+#define DEFAULT_MAX_DOWNLOADS 2
+#define DEFAULT_MAX_SOURCE_READS 2
+#define DEFAULT_MAX_DECOMPRESSIONS 1
+#define DEFAULT_MAX_CONTROLLER_JOBS 2
+
+int resource_limit(const QString &resource);
+int env_limit(const char *name, const int default_value);
+
+JobScheduler *JobScheduler::_self = nullptr;
+
+JobScheduler::JobScheduler(QObject *parent)
+: QAbstractListModel(parent)
+, m_nextId(1)
+, m_scheduleQueued(false) {
+
+}
+
+JobScheduler *JobScheduler::instance() {
+    if (!_self) {
+        _self = new JobScheduler();
+    }
+    return _self;
+}
+
+QHash<int, QByteArray> JobScheduler::roleNames() const {
+    QHash<int, QByteArray> ret;
+    ret.insert(Qt::UserRole + 1, "type");
+    ret.insert(Qt::UserRole + 2, "name");
+    ret.insert(Qt::UserRole + 3, "state");
+    return ret;
+}
+
+int JobScheduler::rowCount(const QModelIndex &parent) const {
+    Q_UNUSED(parent)
+    return m_jobs.count();
+}
+
+QVariant JobScheduler::data(const QModelIndex &index, int role) const {
+    if (!index.isValid()) {
+        return QVariant();
+    }
+
+    const Job &job = m_jobs[index.row()];
+
+    if (role == Qt::UserRole + 1) {
+        return QVariant::fromValue((int) job.type);
+    }
+
+    if (role == Qt::UserRole + 2) {
+        return QVariant::fromValue(job.name);
+    }
+
+    if (role == Qt::UserRole + 3) {
+        return QVariant::fromValue((int) job.state);
+    }
+
+    return QVariant();
+}
+
+int JobScheduler::length() const {
+    return m_jobs.count();
+}
+
+int JobScheduler::enqueue(const Type type, const QString &name, const QStringList &resources, const std::function<void()> &start, const std::function<void()> &cancel, const int after, const bool afterFinish) {
+    const int id = m_nextId;
+    m_nextId++;
+
+    const Job job = {id, type, name, resources, start, cancel, after, afterFinish, QUEUED};
+
+    beginInsertRows(QModelIndex(), m_jobs.count(), m_jobs.count());
+    m_jobs.append(job);
+    endInsertRows();
+    emit jobsChanged();
+
+    qDebug() << this->metaObject()->className() << "Queued" << name << "using" << resources;
+
+    // NOTE: jobs are started later so that the owner knows
+    // the id by the time the job starts
+    queueSchedule();
+
+    return id;
+}
+
+void JobScheduler::finish(const int id) {
+    const int index = indexOf(id);
+    if (index == -1) {
+        return;
+    }
+
+    const bool started = (m_jobs[index].state == RUNNING);
+
+    if (started) {
+        for (const QString &resource : m_jobs[index].resources) {
+            m_usage[resource]--;
+        }
+    }
+
+    qDebug() << this->metaObject()->className() << "Finished" << m_jobs[index].name;
+
+    beginRemoveRows(QModelIndex(), index, index);
+    m_jobs.removeAt(index);
+    endRemoveRows();
+    emit jobsChanged();
+
+    // NOTE: jobs that wait for a job that never started,
+    // like a write of an image whose download was removed
+    // from the queue, would start without it
+    if (!started) {
+        cancelWaiting(id);
+    }
+
+    queueSchedule();
+}
+
+bool JobScheduler::isQueued(const int id) const {
+    const int index = indexOf(id);
+
+    return (index != -1 && m_jobs[index].state == QUEUED);
+}
+
+void JobScheduler::cancel(const int row) {
+    if (row < 0 || row >= m_jobs.count() || m_jobs[row].state != QUEUED) {
+        return;
+    }
+
+    const std::function<void()> cancelCallback = m_jobs[row].cancel;
+
+    finish(m_jobs[row].id);
+
+    if (cancelCallback) {
+        cancelCallback();
+    }
+}
+
+// Cancel queued jobs that wait for the given job
+void JobScheduler::cancelWaiting(const int id) {
+    // NOTE: cancelling a job may cancel other jobs, so look
+    // for the next job from the start each time
+    while (true) {
+        const int row = [this, id]() {
+            for (int i = 0; i < m_jobs.count(); i++) {
+                if (m_jobs[i].state == QUEUED && m_jobs[i].after == id) {
+                    return i;
+                }
+            }
+
+            return -1;
+        }();
+
+        if (row == -1) {
+            break;
+        }
+
+        cancel(row);
+    }
+}
+
+int JobScheduler::indexOf(const int id) const {
+    for (int i = 0; i < m_jobs.count(); i++) {
+        if (m_jobs[i].id == id) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+bool JobScheduler::canStart(const Job &job) const {
+    if (job.after != 0 && isQueued(job.after)) {
+        return false;
+    }
+
+    if (job.after != 0 && job.afterFinish && indexOf(job.after) != -1) {
+        return false;
+    }
+
+    for (const QString &resource : job.resources) {
+        if (m_usage.value(resource, 0) >= resource_limit(resource)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void JobScheduler::queueSchedule() {
+    if (m_scheduleQueued) {
+        return;
+    }
+
+    m_scheduleQueued = true;
+    QTimer::singleShot(0, this,
+        [this]() {
+            schedule();
+        });
+}
+
+// Start queued jobs that can run
+void JobScheduler::schedule() {
+    m_scheduleQueued = false;
+
+    // NOTE: starting a job may finish or queue other jobs,
+    // so look for the next job from the start each time
+    while (true) {
+        const int index = [this]() {
+            for (int i = 0; i < m_jobs.count(); i++) {
+                if (m_jobs[i].state == QUEUED && canStart(m_jobs[i])) {
+                    return i;
+                }
+            }
+
+            return -1;
+        }();
+
+        if (index == -1) {
+            break;
+        }
+
+        Job &job = m_jobs[index];
+        job.state = RUNNING;
+        for (const QString &resource : job.resources) {
+            m_usage[resource]++;
+        }
+
+        const QModelIndex modelIndex = this->index(index);
+        emit dataChanged(modelIndex, modelIndex);
+
+        qDebug() << this->metaObject()->className() << "Starting" << job.name;
+
+        const std::function<void()> start = job.start;
+        start();
+    }
+}
+
+// Resources of the same kind share a limit, for example
+// each controller is a separate resource named
+// "controller:<sysfs path>"
+int resource_limit(const QString &resource) {
+    static const QHash<QString, int> limits = {
+        {"network", env_limit("MEDIAWRITER_MAX_DOWNLOADS_ENV", DEFAULT_MAX_DOWNLOADS)},
+        {"source", env_limit("MEDIAWRITER_MAX_SOURCE_READS_ENV", DEFAULT_MAX_SOURCE_READS)},
+        {"decompression", env_limit("MEDIAWRITER_MAX_DECOMPRESSIONS_ENV", DEFAULT_MAX_DECOMPRESSIONS)},
+        {"controller", env_limit("MEDIAWRITER_MAX_CONTROLLER_JOBS_ENV", DEFAULT_MAX_CONTROLLER_JOBS)},
+    };
+
+    const QString kind = resource.section(':', 0, 0);
+
+    return limits.value(kind, 1);
+}
+
+int env_limit(const char *name, const int default_value) {
+    const QByteArray envValue = qgetenv(name);
+
+    bool ok;
+    const int value = envValue.toInt(&ok);
+
+    if (ok && value > 0) {
+        return value;
+    } else {
+        return default_value;
+    }
+}
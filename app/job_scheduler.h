@@ -0,0 +1,149 @@
+/*
+ * ALT Media Writer
+ * Copyright (C) 2016-2019 Martin Bříza <mbriza@redhat.com>
+ * Copyright (C) 2020-2022 Dmitry Degtyarev <kevl@basealt.ru>
+ *
+ * ALT Media Writer is a fork of Fedora Media Writer
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef JOB_SCHEDULER_H
+#define JOB_SCHEDULER_H
+
+/**
+ * Queue of downloads, writes and restores. A job is
+ * started once the resources it uses are free, so several
+ * jobs can be lined up without slowing each other down.
+ * Each resource has a limit of jobs that may use it at
+ * once, which can be changed with environment variables:
+ *
+ * network - downloads, MEDIAWRITER_MAX_DOWNLOADS_ENV,
+ *     default is 2
+ * source - writes, which read images from the download
+ *     directory, MEDIAWRITER_MAX_SOURCE_READS_ENV, default
+ *     is 2
+ * decompression - writes of compressed images, decoder
+ *     already uses all cores, so by default one at a time,
+ *     MEDIAWRITER_MAX_DECOMPRESSIONS_ENV
+ * controller - writes and restores of drives on the same
+ *     USB controller, which share its bandwidth,
+ *     MEDIAWRITER_MAX_CONTROLLER_JOBS_ENV, default is 2
+ *
+ * Jobs are started in the order they were queued, but a
+ * job that waits for a resource doesn't hold back later
+ * jobs that use other resources. A job can also wait for
+ * another job to start, for example a write of an image
+ * waits for the image's download to start, after which
+ * the image is written while it's downloaded. On Windows,
+ * where the helper needs the whole image, the write waits
+ * for the download to finish instead.
+ *
+ * Note that the written data is checked by the helper
+ * right after writing, so the check is a part of the write
+ * job.
+ *
+ * Owner of a job is responsible for calling finish() once
+ * a started job ends. Jobs that didn't start yet can be
+ * removed from the queue in the UI, in which case owner is
+ * notified through the cancel callback.
+ *
+ * @property length count of the jobs
+ */
+
+#include <QAbstractListModel>
+#include <QHash>
+#include <QList>
+#include <QStringList>
+
+#include <functional>
+
+class JobScheduler final : public QAbstractListModel {
+    Q_OBJECT
+    Q_PROPERTY(int length READ length NOTIFY jobsChanged)
+
+public:
+    enum Type {
+        DOWNLOAD = 0,
+        WRITE,
+        RESTORE,
+    };
+    Q_ENUMS(Type)
+
+    enum State {
+        QUEUED = 0,
+        RUNNING,
+    };
+    Q_ENUMS(State)
+
+    static JobScheduler *instance();
+
+    QHash<int, QByteArray> roleNames() const override;
+    int rowCount(const QModelIndex &parent = QModelIndex()) const override;
+    QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const override;
+
+    int length() const;
+
+    // Queues a job and returns its id. Start is called once
+    // resources are free and the job given by "after" has
+    // started, or finished if afterFinish is true. Cancel is
+    // called if the job is removed from the queue before it
+    // started.
+    int enqueue(const Type type, const QString &name, const QStringList &resources, const std::function<void()> &start, const std::function<void()> &cancel, const int after = 0, const bool afterFinish = false);
+
+    // Removes the job and frees its resources. Does nothing
+    // if there is no such job, so it's safe to call with an
+    // id of a job that already finished. If the job didn't
+    // start, jobs that wait for it are cancelled.
+    void finish(const int id);
+
+    bool isQueued(const int id) const;
+
+    // Removes a job that didn't start yet
+    Q_INVOKABLE void cancel(const int row);
+
+signals:
+    void jobsChanged();
+
+private:
+    struct Job {
+        int id;
+        Type type;
+        QString name;
+        QStringList resources;
+        std::function<void()> start;
+        std::function<void()> cancel;
+        int after;
+        bool afterFinish;
+        State state;
+    };
+
+    explicit JobScheduler(QObject *parent = nullptr);
+
+    static JobScheduler *_self;
+    QList<Job> m_jobs;
+    // Resource => number of running jobs using it
+    QHash<QString, int> m_usage;
+    int m_nextId;
+    bool m_scheduleQueued;
+
+    int indexOf(const int id) const;
+    void cancelWaiting(const int id);
+    bool canStart(const Job &job) const;
+    void queueSchedule();
+    void schedule();
+};
+
+#endif // JOB_SCHEDULER_H
@@ -21,6 +21,8 @@
  */
 
 #include "linuxdrivemanager.h"
+#include "isomd5/helperevent.h"
+#include "job_scheduler.h"
 #include "progress.h"
 #include "variant.h"
 
@@ -42,6 +44,18 @@ LinuxDriveProvider::LinuxDriveProvider(DriveManager *parent)
     QTimer::singleShot(0, this, SLOT(delayedConstruct()));
 }
 
+// Error of one drive of a batch, errors of the whole write
+// come with stderr, see LinuxDrive::onFinished()
+static QString drive_error_string(const HelperError error) {
+    switch (error) {
+        case HelperError_DRIVE_UNAVAILABLE: return LinuxDrive::tr("The drive couldn't be opened.");
+        case HelperError_DRIVE_UNWRITABLE: return LinuxDrive::tr("Writing to the drive failed.");
+        case HelperError_CHECK_MISMATCH: return LinuxDrive::tr("Written data doesn't match the image. Your drive is probably damaged.");
+        case HelperError_CHECK_FAILED: return LinuxDrive::tr("The drive couldn't be read back.");
+        default: return LinuxDrive::tr("Writing failed.");
+    }
+}
+
 void LinuxDriveProvider::delayedConstruct() {
     m_objManager = new QDBusInterface("org.freedesktop.UDisks2", "/org/freedesktop/UDisks2", "org.freedesktop.DBus.ObjectManager", QDBusConnection::systemBus());
 
@@ -188,55 +202,163 @@ LinuxDrive::LinuxDrive(LinuxDriveProvider *parent, const QString &device, const
 }
 
 LinuxDrive::~LinuxDrive() {
-    if (m_variant && m_variant->status() == Variant::WRITING) {
+    if (m_variant && (m_variant->status() == Variant::WRITING || m_variant->status() == Variant::WRITE_QUEUED)) {
         m_variant->setErrorString(tr("The drive was removed while it was written to."));
         m_variant->setStatus(Variant::WRITING_FAILED);
     }
+
+    finishJob();
+    releaseBatch();
 }
 
 bool LinuxDrive::write(Variant *variant) {
-    qDebug() << this->metaObject()->className() << "Will now write" << variant->fileName() << "to" << this->m_device;
+    return writeBatch(variant, {this});
+}
+
+// Drives of the batch are written by one helper, which
+// reads and decompresses the image once for all of them
+bool LinuxDrive::writeBatch(Variant *variant, const QList<Drive *> &batch) {
+    QList<LinuxDrive *> drives = {this};
+    QStringList names = {name()};
+    for (Drive *drive : batch) {
+        LinuxDrive *linuxDrive = qobject_cast<LinuxDrive *>(drive);
+
+        if (linuxDrive != nullptr && !drives.contains(linuxDrive)) {
+            drives.append(linuxDrive);
+            names.append(linuxDrive->name());
+        }
+    }
+
+    // NOTE: drives that are too small are left out of the
+    // batch with an error of their own, the rest are
+    // written. If this drive is left out, the first one
+    // left leads the batch.
+    QList<Drive *> fitting;
+    for (LinuxDrive *drive : drives) {
+        if (drive->isLargeEnough(variant)) {
+            fitting.append(drive);
+        } else {
+            drive->setErrorString(tr("This drive is not large enough."));
+        }
+    }
 
-    if (!Drive::write(variant)) {
+    if (fitting.isEmpty()) {
+        variant->setErrorString(tr("This drive is not large enough."));
         return false;
     }
 
-    if (!m_process) {
-        m_process = new QProcess(this);
+    if (fitting.first() != this) {
+        return fitting.first()->writeBatch(variant, fitting);
     }
 
-    const QString helperPath = getHelperPath();
-    if (!helperPath.isEmpty()) {
-        m_process->setProgram(helperPath);
-    } else {
+    if (fitting.size() < drives.size()) {
+        drives.clear();
+        names.clear();
+        for (Drive *drive : fitting) {
+            drives.append(qobject_cast<LinuxDrive *>(drive));
+            names.append(drive->name());
+        }
+    }
+
+    qDebug() << this->metaObject()->className() << "Will now write" << variant->fileName() << "to" << names;
+
+    for (LinuxDrive *drive : drives) {
+        drive->Drive::write(variant);
+    }
+
+    if (getHelperPath().isEmpty()) {
         variant->setErrorString(tr("Could not find the helper binary. Check your installation."));
         variant->setStatus(Variant::WRITING_FAILED);
         return false;
     }
 
+    // NOTE: image that is still downloading keeps its
+    // download status, see onReadyRead()
+    if (!variant->isDownloading()) {
+        variant->setStatus(Variant::WRITE_QUEUED);
+    }
+
+    releaseBatch();
+
+    QStringList resources;
+    for (LinuxDrive *drive : drives) {
+        m_batch.append(drive);
+        if (drive != this) {
+            drive->m_leader = this;
+        }
+
+        resources.append(drive->writeResources(variant));
+    }
+    resources.removeDuplicates();
+
+    // NOTE: image is written while it's downloading, so the
+    // write waits only for the download to start
+    m_job = JobScheduler::instance()->enqueue(JobScheduler::WRITE, tr("%1 to %2").arg(variant->fileName(), names.join(", ")), resources,
+        [this]() {
+            if (m_variant == nullptr) {
+                finishJob();
+                releaseBatch();
+                return;
+            }
+
+            startWrite();
+        },
+        [this]() {
+            m_job = 0;
+            if (m_variant != nullptr && m_variant->status() == Variant::WRITE_QUEUED) {
+                m_variant->resetStatus();
+            }
+            m_variant = nullptr;
+            releaseBatch();
+        },
+        variant->downloadJob());
+
+    return true;
+}
+
+void LinuxDrive::startWrite() {
+    if (!m_process) {
+        m_process = new HelperJob(this);
+    }
+    m_events.clear();
+
+    // NOTE: drives removed while the write was queued are
+    // left out
+    QList<QPointer<LinuxDrive>> batch;
+    QStringList devices;
+    for (const QPointer<LinuxDrive> &drive : m_batch) {
+        if (drive != nullptr) {
+            batch.append(drive);
+            devices.append(drive->m_device);
+        }
+    }
+    m_batch = batch;
+
     QStringList args;
     args << "write";
-    args << variant->filePath();
-    args << m_device;
-    args << variant->md5sum();
+    args << m_variant->filePath();
+    args << devices.join(",");
+    args << m_variant->md5sum();
 
     qDebug() << this->metaObject()->className() << "Helper command will be" << args;
-    m_process->setArguments(args);
-
-    connect(m_process, &QProcess::readyRead, this, &LinuxDrive::onReadyRead);
-    connect(m_process, SIGNAL(finished(int, QProcess::ExitStatus)), this, SLOT(onFinished(int, QProcess::ExitStatus)));
-#if QT_VERSION >= 0x050600
-    // TODO check if this is actually necessary - it should work just fine even without it
-    connect(m_process, &QProcess::errorOccurred, this, &LinuxDrive::onErrorOccurred);
-#endif
 
-    m_process->start(QIODevice::ReadOnly);
+    connect(m_process, &HelperJob::readyRead, this, &LinuxDrive::onReadyRead);
+    connect(m_process, &HelperJob::finished, this, &LinuxDrive::onFinished);
+    connect(m_process, &HelperJob::errorOccurred, this, &LinuxDrive::onErrorOccurred);
 
-    return true;
+    m_process->start(args);
 }
 
 void LinuxDrive::cancel() {
     Drive::cancel();
+
+    // NOTE: drive of a batch is written by the helper of
+    // the batch, so the whole batch is cancelled
+    if (m_leader != nullptr) {
+        m_leader->cancel();
+        return;
+    }
+
     static bool beingCancelled = false;
     if (m_process != nullptr && !beingCancelled) {
         beingCancelled = true;
@@ -245,37 +367,62 @@ void LinuxDrive::cancel() {
         m_process = nullptr;
         beingCancelled = false;
     }
+
+    releaseBatch();
+    m_variant = nullptr;
+}
+
+// Stop writing drives of the batch with the helper of this
+// drive
+void LinuxDrive::releaseBatch() {
+    for (const QPointer<LinuxDrive> &drive : m_batch) {
+        if (drive != nullptr && drive != this) {
+            drive->m_leader = nullptr;
+            drive->m_variant = nullptr;
+        }
+    }
+
+    m_batch.clear();
 }
 
 void LinuxDrive::restore() {
     qDebug() << this->metaObject()->className() << "Will now restore" << this->m_device;
 
-    if (!m_process) {
-        m_process = new QProcess(this);
-    }
+    const RestoreStatus previousStatus = m_restoreStatus;
 
     m_restoreStatus = RESTORING;
     emit restoreStatusChanged();
 
-    const QString helperPath = getHelperPath();
-    if (!helperPath.isEmpty()) {
-        m_process->setProgram(helperPath);
-    } else {
+    if (getHelperPath().isEmpty()) {
         qDebug() << "Couldn't find the helper binary.";
         setRestoreStatus(RESTORE_ERROR);
         return;
     }
 
+    m_job = JobScheduler::instance()->enqueue(JobScheduler::RESTORE, name(), restoreResources(),
+        [this]() {
+            startRestore();
+        },
+        [this, previousStatus]() {
+            m_job = 0;
+            setRestoreStatus(previousStatus);
+        });
+}
+
+void LinuxDrive::startRestore() {
+    if (!m_process) {
+        m_process = new HelperJob(this);
+    }
+
     QStringList args;
     args << "restore";
     args << m_device;
     qDebug() << this->metaObject()->className() << "Helper command will be" << args;
-    m_process->setArguments(args);
 
-    connect(m_process, &QProcess::readyRead, this, &LinuxDrive::onReadyRead);
-    connect(m_process, SIGNAL(finished(int, QProcess::ExitStatus)), this, SLOT(onRestoreFinished(int, QProcess::ExitStatus)));
+    connect(m_process, &HelperJob::readyRead, this, &LinuxDrive::onReadyRead);
+    connect(m_process, &HelperJob::finished, this, &LinuxDrive::onRestoreFinished);
 
-    m_process->start(QIODevice::ReadOnly);
+    m_process->start(args);
 }
 
 void LinuxDrive::onReadyRead() {
@@ -283,37 +430,118 @@ void LinuxDrive::onReadyRead() {
         return;
     }
 
-    m_progress->setCurrent(NAN);
+    // Progress of all drives of the batch
+    const QList<Progress *> batchProgress = [&]() {
+        QList<Progress *> out;
+        for (const QPointer<LinuxDrive> &drive : m_batch) {
+            if (drive != nullptr) {
+                out.append(drive->progress());
+            }
+        }
+        return out;
+    }();
+
+    for (Progress *progress : batchProgress) {
+        progress->setCurrent(NAN);
+    }
+
+    // NOTE: helper writes the image while it's downloading,
+    // status is switched to writing once download finishes
+    const bool downloading = m_variant->isDownloading();
+
+    if (!downloading && m_variant->status() != Variant::WRITE_VERIFYING && m_variant->status() != Variant::WRITING) {
+        const QFile file(m_variant->filePath());
+        for (Progress *progress : batchProgress) {
+            progress->setMax(file.size());
+        }
 
-    if (m_variant->status() != Variant::WRITE_VERIFYING && m_variant->status() != Variant::WRITING) {
         m_variant->setStatus(Variant::WRITING);
     }
 
-    while (m_process->bytesAvailable() > 0) {
-        QString line = m_process->readLine().trimmed();
-        qDebug() << "helper:" << line;
-        if (line == "WRITE") {
-            // Set progress bar max value at start of writing
-            const QFile file(m_variant->filePath());
-            m_progress->setMax(file.size());
-
-            m_progress->setCurrent(0);
-
-            m_variant->setStatus(Variant::WRITING);
-        } else if (line == "CHECK") {
-            qDebug() << this->metaObject()->className() << "Helper finished writing, now it will check the written data";
-            const QFile file(m_variant->filePath());
-            m_progress->setMax(file.size());
-            m_progress->setCurrent(0);
-            m_variant->setStatus(Variant::WRITE_VERIFYING);
-        } else if (line == "DONE") {
-            m_variant->setStatus(Variant::WRITING_FINISHED);
-            Notifications::notify(tr("Finished!"), tr("Writing %1 was successful").arg(m_variant->fileName()));
-        } else {
-            bool ok = false;
-            qreal val = line.toULongLong(&ok);
-            if (ok && val > 0.0) {
-                m_progress->setCurrent(val);
+    m_events.append(m_process->readAll());
+
+    QList<HelperEvent> eventList;
+    const bool decodeSuccess = helperEventDecode(&m_events, &eventList);
+    if (!decodeSuccess) {
+        qDebug() << this->metaObject()->className() << "Helper sent a malformed progress event";
+        m_events.clear();
+    }
+
+    for (const HelperEvent &event : eventList) {
+        // NOTE: helper doesn't know the size of an image
+        // that is still downloading
+        const qint64 total = [&]() -> qint64 {
+            if (event.bytes_total > 0) {
+                return event.bytes_total;
+            } else {
+                return QFile(m_variant->filePath()).size();
+            }
+        }();
+
+        // NOTE: events with drive -1 start a stage, others
+        // report progress of one drive of the batch
+        const bool stageStarted = (event.drive == -1);
+        LinuxDrive *eventDrive = [&]() -> LinuxDrive * {
+            if (event.drive >= 0 && event.drive < m_batch.size()) {
+                return m_batch[event.drive];
+            } else {
+                return nullptr;
+            }
+        }();
+
+        const auto startProgress =
+            [&]() {
+                for (Progress *progress : batchProgress) {
+                    progress->setMax(total);
+                    progress->setCurrent(0);
+                }
+            };
+        const auto updateProgress =
+            [&]() {
+                if (eventDrive != nullptr) {
+                    eventDrive->progress()->setCurrent(event.bytes_done);
+                    eventDrive->progress()->setRate(event.rate);
+                }
+            };
+
+        switch (event.stage) {
+            case HelperStage_WRITE: {
+                if (stageStarted) {
+                    startProgress();
+
+                    if (!downloading) {
+                        m_variant->setStatus(Variant::WRITING);
+                    }
+                } else {
+                    updateProgress();
+                }
+                break;
+            }
+            case HelperStage_CHECK: {
+                if (stageStarted) {
+                    qDebug() << this->metaObject()->className() << "Helper finished writing, now it will check the written data";
+                    startProgress();
+                    m_variant->setStatus(Variant::WRITE_VERIFYING);
+                } else {
+                    updateProgress();
+                }
+                break;
+            }
+            case HelperStage_DONE: {
+                m_variant->setStatus(Variant::WRITING_FINISHED);
+                Notifications::notify(tr("Finished!"), tr("Writing %1 was successful").arg(m_variant->fileName()));
+                break;
+            }
+            case HelperStage_FAILED: {
+                // NOTE: error message of the whole write comes
+                // with stderr once the helper exits, see
+                // onFinished()
+                qDebug() << this->metaObject()->className() << "Helper failed with error" << event.error << "for drive" << event.drive;
+
+                if (eventDrive != nullptr) {
+                    eventDrive->setErrorString(drive_error_string(event.error));
+                }
+                break;
             }
         }
     }
@@ -326,17 +554,23 @@ void LinuxDrive::onFinished(const int exitCode, const QProcess::ExitStatus statu
         return;
     }
 
+    finishJob();
+
     if (exitCode != 0) {
         QString errorMessage = m_process->readAllStandardError();
         qDebug() << "Writing failed:" << errorMessage;
         Notifications::notify(tr("Error"), tr("Writing %1 failed").arg(m_variant->fileName()));
 
-        m_variant->setErrorString(errorMessage);
+        // NOTE: if download failed, helper fails too, keep
+        // download's error
+        if (m_variant->status() != Variant::DOWNLOAD_FAILED) {
+            m_variant->setErrorString(errorMessage);
 
-        if (m_variant->status() == Variant::WRITE_VERIFYING) {
-            m_variant->setStatus(Variant::WRITE_VERIFYING_FAILED);
-        } else {
-            m_variant->setStatus(Variant::WRITING_FAILED);
+            if (m_variant->status() == Variant::WRITE_VERIFYING) {
+                m_variant->setStatus(Variant::WRITE_VERIFYING_FAILED);
+            } else {
+                m_variant->setStatus(Variant::WRITING_FAILED);
+            }
         }
     } else {
         Notifications::notify(tr("Finished!"), tr("Writing %1 was successful").arg(m_variant->fileName()));
@@ -347,11 +581,14 @@ void LinuxDrive::onFinished(const int exitCode, const QProcess::ExitStatus statu
         m_process = nullptr;
         m_variant = nullptr;
     }
+    releaseBatch();
 }
 
 void LinuxDrive::onRestoreFinished(const int exitCode, const QProcess::ExitStatus status) {
     qDebug() << this->metaObject()->className() << "Helper process finished with status" << status;
 
+    finishJob();
+
     if (exitCode != 0) {
         if (m_process) {
             qDebug() << "Drive restoration failed:" << m_process->readAllStandardError();
@@ -375,6 +612,8 @@ void LinuxDrive::onErrorOccurred(const QProcess::ProcessError e) {
         return;
     }
 
+    finishJob();
+
     QString errorMessage = m_process->errorString();
     qDebug() << "Restoring failed:" << errorMessage;
     m_variant->setErrorString(errorMessage);
@@ -382,6 +621,20 @@ void LinuxDrive::onErrorOccurred(const QProcess::ProcessError e) {
     m_process = nullptr;
     m_variant->setStatus(Variant::WRITING_FAILED);
     m_variant = nullptr;
+    releaseBatch();
+}
+
+// NOTE: sysfs path of a USB drive goes through its host
+// controller and then the root hub, "usbN"
+QString LinuxDrive::controller() const {
+    const QString sysfsPath = QFileInfo("/sys/class/block" + m_device.mid(m_device.lastIndexOf("/"))).canonicalFilePath();
+    const int hubIndex = sysfsPath.indexOf(QRegExp("/usb[0-9]+/"));
+
+    if (hubIndex != -1) {
+        return sysfsPath.left(hubIndex);
+    } else {
+        return QString();
+    }
 }
 
 QString LinuxDrive::devicePath() const {
@@ -24,11 +24,13 @@
 #define LINUXDRIVEMANAGER_H
 
 #include "drivemanager.h"
+#include "helper_job.h"
 
 #include <QDBusArgument>
 #include <QDBusInterface>
 #include <QDBusObjectPath>
 #include <QDBusPendingCall>
+#include <QPointer>
 #include <QProcess>
 
 typedef QHash<QString, QVariantMap> InterfacesAndProperties;
@@ -68,9 +70,11 @@ public:
     ~LinuxDrive();
 
     Q_INVOKABLE virtual bool write(Variant *variant) override;
+    bool writeBatch(Variant *variant, const QList<Drive *> &batch) override;
     Q_INVOKABLE virtual void cancel() override;
     Q_INVOKABLE virtual void restore() override;
 
+    QString controller() const override;
     QString devicePath() const;
 
 private slots:
@@ -80,9 +84,24 @@ private slots:
     void onErrorOccurred(QProcess::ProcessError e);
 
 private:
+    void startWrite();
+    void startRestore();
+    void releaseBatch();
+
     QString m_device;
 
-    QProcess *m_process;
+    // Drives written by the helper of this drive, in the
+    // order they are passed to it, which is how helper
+    // events refer to them. First one is this drive.
+    // Removed drives become null.
+    QList<QPointer<LinuxDrive>> m_batch;
+    // Drive whose helper writes this one, if it's not this
+    // drive
+    QPointer<LinuxDrive> m_leader;
+
+    HelperJob *m_process;
+    // Incomplete progress event from the helper
+    QByteArray m_events;
 };
 
 #endif // LINUXDRIVEMANAGER_H
@@ -21,6 +21,7 @@
  */
 
 #include "drivemanager.h"
+#include "job_scheduler.h"
 #include "progress.h"
 #include "release.h"
 #include "release_model.h"
@@ -115,6 +116,7 @@ int main(int argc, char **argv) {
     QQmlApplicationEngine engine;
     engine.rootContext()->setContextProperty("drives", DriveManager::instance());
     engine.rootContext()->setContextProperty("releases", new ReleaseManager());
+    engine.rootContext()->setContextProperty("jobs", JobScheduler::instance());
     engine.rootContext()->setContextProperty("mediawriterVersion", MEDIAWRITER_VERSION);
     engine.rootContext()->setContextProperty("units", Units::instance());
 
@@ -123,6 +125,7 @@ int main(int argc, char **argv) {
     qmlRegisterUncreatableType<Variant>("MediaWriter", 1, 0, "Variant", "");
     qmlRegisterUncreatableType<Progress>("MediaWriter", 1, 0, "Progress", "");
     qmlRegisterUncreatableType<Drive>("MediaWriter", 1, 0, "Drive", "");
+    qmlRegisterUncreatableType<JobScheduler>("MediaWriter", 1, 0, "JobScheduler", "");
 
     qDebug() << "Loading the QML source code";
     engine.load(QUrl(QStringLiteral("qrc:/main.qml")));
@@ -98,7 +98,7 @@ ApplicationWindow {
             top: deviceNotification.bottom
             left: parent.left
             right: parent.right
-            bottom: parent.bottom
+            bottom: jobPanel.top
         }
 
         color: palette.window
@@ -143,6 +143,28 @@ ApplicationWindow {
         }
     }
 
+    Rectangle {
+        id: jobPanel
+        anchors {
+            left: parent.left
+            right: parent.right
+            bottom: parent.bottom
+        }
+        height: jobList.visible ? jobList.height + 24 : 0
+        color: palette.background
+        clip: true
+
+        JobList {
+            id: jobList
+            anchors {
+                top: parent.top
+                left: parent.left
+                right: parent.right
+                margins: 12
+            }
+        }
+    }
+
     RestoreDialog {
         id: restoreDialog
     }
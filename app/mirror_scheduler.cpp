@@ -0,0 +1,185 @@
+/*
+ * ALT Media Writer
+ * Copyright (C) 2016-2019 Martin Bříza <mbriza@redhat.com>
+ * Copyright (C) 2020-2022 Dmitry Degtyarev <kevl@basealt.ru>
+ *
+ * ALT Media Writer is a fork of Fedora Media Writer
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include "mirror_scheduler.h"
+
+#include <QDebug>
+
+// Mirrors that failed this many times in a row are avoided
+#define MAX_FAILURES 3
+
+// Weight of a new throughput sample
+#define THROUGHPUT_SMOOTHING 0.3
+
+// Mirror is slow if it's this many times slower than the
+// best one
+#define SLOW_FACTOR 4.0
+
+MirrorScheduler::MirrorScheduler(const QList<QUrl> &urls) {
+    for (const QUrl &url : urls) {
+        Mirror mirror;
+        mirror.url = url;
+        mirror.activeRequests = 0;
+        mirror.latencyMs = -1;
+        mirror.throughput = -1;
+        mirror.failures = 0;
+        mirror.disabled = false;
+
+        mirrors.append(mirror);
+    }
+}
+
+int MirrorScheduler::count() const {
+    return mirrors.size();
+}
+
+QUrl MirrorScheduler::url(const int mirror) const {
+    return mirrors[mirror].url;
+}
+
+int MirrorScheduler::pick(const int excluded) const {
+    const double best = bestThroughput();
+
+    // NOTE: failing mirrors are only used if all mirrors
+    // are failing
+    const bool all_failing = [this, excluded]() {
+        for (int i = 0; i < mirrors.size(); i++) {
+            if (i != excluded && !mirrors[i].disabled && mirrors[i].failures < MAX_FAILURES) {
+                return false;
+            }
+        }
+
+        return true;
+    }();
+
+    int out = -1;
+    double out_score = 0;
+
+    for (int i = 0; i < mirrors.size(); i++) {
+        const Mirror &mirror = mirrors[i];
+
+        const bool usable = (i != excluded && !mirror.disabled && (all_failing || mirror.failures < MAX_FAILURES));
+        if (!usable) {
+            continue;
+        }
+
+        const double throughput = (mirror.throughput >= 0) ? mirror.throughput : best;
+        const double score = throughput / (mirror.activeRequests + 1);
+
+        // NOTE: on equal score, mirror with lower latency
+        // wins, then the one that's listed first
+        const bool is_better = [&]() {
+            if (out == -1 || score > out_score) {
+                return true;
+            } else if (score < out_score) {
+                return false;
+            } else {
+                return (mirror.latencyMs != -1 && mirrors[out].latencyMs != -1 && mirror.latencyMs < mirrors[out].latencyMs);
+            }
+        }();
+
+        if (is_better) {
+            out = i;
+            out_score = score;
+        }
+    }
+
+    if (out == -1 && excluded != -1 && !mirrors[excluded].disabled) {
+        return excluded;
+    }
+
+    return out;
+}
+
+bool MirrorScheduler::hasOther(const int mirror) const {
+    const int other = pick(mirror);
+
+    return (other != -1 && other != mirror);
+}
+
+void MirrorScheduler::requestStarted(const int mirror) {
+    mirrors[mirror].activeRequests++;
+}
+
+void MirrorScheduler::requestStopped(const int mirror) {
+    mirrors[mirror].activeRequests--;
+}
+
+void MirrorScheduler::addLatency(const int mirror, const qint64 latencyMs) {
+    mirrors[mirror].latencyMs = latencyMs;
+
+    // NOTE: mirror replied, so it's working again
+    mirrors[mirror].failures = 0;
+}
+
+void MirrorScheduler::addSample(const int mirror, const qint64 bytes, const qint64 elapsedMs) {
+    if (elapsedMs <= 0) {
+        return;
+    }
+
+    const double sample = (double) bytes / elapsedMs;
+    double &throughput = mirrors[mirror].throughput;
+
+    if (throughput < 0) {
+        throughput = sample;
+    } else {
+        throughput = THROUGHPUT_SMOOTHING * sample + (1.0 - THROUGHPUT_SMOOTHING) * throughput;
+    }
+}
+
+void MirrorScheduler::addFailure(const int mirror) {
+    mirrors[mirror].failures++;
+
+    if (mirrors[mirror].failures == MAX_FAILURES) {
+        qDebug() << "Mirror failed" << MAX_FAILURES << "times, avoiding it:" << mirrors[mirror].url;
+    }
+}
+
+void MirrorScheduler::disable(const int mirror) {
+    qDebug() << "Disabling mirror" << mirrors[mirror].url;
+
+    mirrors[mirror].disabled = true;
+}
+
+bool MirrorScheduler::isSlow(const int mirror) const {
+    const double throughput = mirrors[mirror].throughput;
+
+    return (throughput >= 0 && throughput * SLOW_FACTOR < bestThroughput());
+}
+
+// Best throughput of mirrors that can be used, 1 if none
+// are measured yet
+double MirrorScheduler::bestThroughput() const {
+    double out = -1;
+
+    for (const Mirror &mirror : mirrors) {
+        if (!mirror.disabled && mirror.failures < MAX_FAILURES && mirror.throughput > out) {
+            out = mirror.throughput;
+        }
+    }
+
+    if (out <= 0) {
+        return 1.0;
+    } else {
+        return out;
+    }
+}
@@ -0,0 +1,87 @@
+/*
+ * ALT Media Writer
+ * Copyright (C) 2016-2019 Martin Bříza <mbriza@redhat.com>
+ * Copyright (C) 2020-2022 Dmitry Degtyarev <kevl@basealt.ru>
+ *
+ * ALT Media Writer is a fork of Fedora Media Writer
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef MIRROR_SCHEDULER_H
+#define MIRROR_SCHEDULER_H
+
+/**
+ * Chooses mirrors for requests of a segmented download.
+ * Mirrors are rated by latency of the first byte and by
+ * throughput of each connection, which ImageDownload
+ * measures while downloading. A new request goes to the
+ * mirror with best throughput per active request. Mirrors
+ * that weren't measured yet are assumed to be as fast as
+ * the best one, so each mirror gets probed by the first
+ * requests.
+ *
+ * Mirrors that fail several times in a row are avoided
+ * until they are the only ones left. Mirrors that serve a
+ * different file or don't support ranges are disabled.
+ */
+
+#include <QList>
+#include <QUrl>
+
+class MirrorScheduler {
+public:
+    // First url is the main one, it's preferred while
+    // mirrors are not measured yet
+    MirrorScheduler(const QList<QUrl> &urls);
+
+    int count() const;
+    QUrl url(const int mirror) const;
+
+    // Mirror for a new request, -1 if all mirrors are
+    // disabled. Excluded mirror is only returned if there
+    // are no other mirrors.
+    int pick(const int excluded = -1) const;
+    bool hasOther(const int mirror) const;
+
+    void requestStarted(const int mirror);
+    void requestStopped(const int mirror);
+    void addLatency(const int mirror, const qint64 latencyMs);
+    void addSample(const int mirror, const qint64 bytes, const qint64 elapsedMs);
+    void addFailure(const int mirror);
+    void disable(const int mirror);
+
+    // Whether the mirror is much slower than the best one
+    bool isSlow(const int mirror) const;
+
+private:
+    struct Mirror {
+        QUrl url;
+        int activeRequests;
+        // -1 if not measured yet
+        qint64 latencyMs;
+        // Bytes per ms of one connection, -1 if not
+        // measured yet
+        double throughput;
+        int failures;
+        bool disabled;
+    };
+
+    QList<Mirror> mirrors;
+
+    double bestThroughput() const;
+};
+
+#endif // MIRROR_SCHEDULER_H
@@ -22,18 +22,21 @@
 
 #include "network.h"
 
+#include <QDir>
 #include <QNetworkAccessManager>
+#include <QNetworkDiskCache>
 #include <QNetworkReply>
+#include <QStandardPaths>
 #include <QTimer>
 
 QNetworkAccessManager *network_access_manager = new QNetworkAccessManager();
 
-NetworkReplyGroup::NetworkReplyGroup(const QList<QString> &url_list, QObject *parent)
+NetworkReplyGroup::NetworkReplyGroup(const QList<QString> &url_list, const bool cached, QObject *parent)
 : QObject(parent) {
     reply_list = [&]() {
         QHash<QString, QNetworkReply *> out;
         for (const QString &url : url_list) {
-            QNetworkReply *reply = makeNetworkRequest(url, 5000);
+            QNetworkReply *reply = makeNetworkRequest(url, 5000, cached);
 
             out[url] = reply;
         }
@@ -81,11 +84,22 @@ void NetworkReplyGroup::on_reply_finished() {
     }
 }
 
-QNetworkReply *makeNetworkRequest(const QString &url, const int time_out_millis) {
+QNetworkReply *makeNetworkRequest(const QString &url, const int time_out_millis, const bool cached) {
     QNetworkRequest request(url);
     request.setAttribute(QNetworkRequest::FollowRedirectsAttribute, true);
 
-    QNetworkReply *reply = network_access_manager->get(request);
+    if (cached) {
+        request.setAttribute(QNetworkRequest::CacheLoadControlAttribute, QNetworkRequest::AlwaysCache);
+    } else {
+        // NOTE: cache sends validators of the cached file,
+        // server replies with "304 Not Modified" if it
+        // didn't change. "no-cache" asks proxies to
+        // revalidate as well.
+        request.setAttribute(QNetworkRequest::CacheLoadControlAttribute, QNetworkRequest::PreferNetwork);
+        request.setRawHeader("Cache-Control", "no-cache");
+    }
+
+    QNetworkReply *reply = metadata_access_manager()->get(request);
 
     // TODO: Qt 5.15 added QNetworkRequest::setTransferTimeout()
     // Abort download if it takes more than 5s
@@ -101,3 +115,21 @@ QNetworkReply *makeNetworkRequest(const QString &url, const int time_out_millis)
 
     return reply;
 }
+
+// Access manager for metadata, which keeps downloaded
+// files in the app's cache directory. Images are not
+// downloaded through it, so they don't go into the cache.
+QNetworkAccessManager *metadata_access_manager() {
+    static QNetworkAccessManager *manager = []() {
+        auto out = new QNetworkAccessManager();
+
+        auto cache = new QNetworkDiskCache(out);
+        const QString cache_dir = QDir(QStandardPaths::writableLocation(QStandardPaths::CacheLocation)).filePath("metadata");
+        cache->setCacheDirectory(cache_dir);
+        out->setCache(cache);
+
+        return out;
+    }();
+
+    return manager;
+}
@@ -31,11 +31,19 @@ class QNetworkReply;
 
 extern QNetworkAccessManager *network_access_manager;
 
+/*
+ * Metadata requests go through a disk cache, see
+ * metadata_access_manager(). Cached requests only load
+ * from the cache and fail if url is not cached. Other
+ * requests revalidate cached files with the server using
+ * ETag and Last-Modified, so unchanged files are not
+ * downloaded again.
+ */
 class NetworkReplyGroup final : public QObject {
     Q_OBJECT
 
 public:
-    NetworkReplyGroup(const QList<QString> &url_list, QObject *parent);
+    NetworkReplyGroup(const QList<QString> &url_list, const bool cached, QObject *parent);
     ~NetworkReplyGroup();
 
     QHash<QString, QNetworkReply *> get_reply_list() const;
@@ -49,6 +57,7 @@ private:
     void on_reply_finished();
 };
 
-QNetworkReply *makeNetworkRequest(const QString &url, const int time_out_millis = 0);
+QNetworkReply *makeNetworkRequest(const QString &url, const int time_out_millis = 0, const bool cached = false);
+QNetworkAccessManager *metadata_access_manager();
 
 #endif // NETWORK_H
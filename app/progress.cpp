@@ -30,6 +30,10 @@ qreal Progress::leftSize() const {
     return (m_max - m_current);
 }
 
+qreal Progress::rate() const {
+    return m_rate;
+}
+
 void Progress::setCurrent(const qreal newCurrent) {
     if (m_current != newCurrent) {
         m_current = newCurrent;
@@ -47,3 +51,11 @@ void Progress::setMax(const qreal newMax) {
         emit leftSizeChanged();
     }
 }
+
+void Progress::setRate(const qreal newRate) {
+    if (m_rate != newRate) {
+        m_rate = newRate;
+
+        emit rateChanged();
+    }
+}
@@ -32,28 +32,34 @@
  *
  * @property ratio in the range [0.0, 1.0]
  * @property leftSize how much size is left until completion 
+ * @property rate bytes per second, 0 if not known
  */
 class Progress : public QObject {
     Q_OBJECT
     Q_PROPERTY(qreal ratio READ ratio NOTIFY ratioChanged)
     Q_PROPERTY(qreal leftSize READ leftSize NOTIFY leftSizeChanged)
+    Q_PROPERTY(qreal rate READ rate NOTIFY rateChanged)
 
 public:
     using QObject::QObject;
 
     qreal ratio() const;
     qreal leftSize() const;
+    qreal rate() const;
 
     void setCurrent(const qreal newCurrent);
     void setMax(const qreal newMax);
+    void setRate(const qreal newRate);
 
 signals:
     void ratioChanged();
     void leftSizeChanged();
+    void rateChanged();
 
 private:
     qreal m_current;
     qreal m_max;
+    qreal m_rate = 0;
 };
 
 #endif // PROGRESS_H
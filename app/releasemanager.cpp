@@ -22,19 +22,26 @@
 
 #include "releasemanager.h"
 #include "architecture.h"
+#include "catalog_snapshot.h"
 #include "platform.h"
 #include "file_type.h"
 #include "network.h"
 #include "release.h"
 #include "release_model.h"
 #include "variant.h"
+#include "isomd5/digest.h"
 
 #include <yaml-cpp/yaml.h>
 
 #include <QAbstractEventDispatcher>
 #include <QApplication>
+#include <QCryptographicHash>
+#include <QDir>
+#include <QStandardPaths>
 #include <QtQml>
 
+#include <algorithm>
+
 QString getMetadataUrl();
 const QString METADATA_URLS_HOST = getMetadataUrl();
 const QString METADATA_URLS_BACKUP_HOST = "http://kvel2d.github.io/posts";
@@ -42,15 +49,26 @@ const QString METADATA_URLS_BACKUP_HOST = "http://kvel2d.github.io/posts";
 QList<QString> load_list_from_file(const QString &filepath);
 QString yml_get(const YAML::Node &node, const QString &key);
 QList<QString> get_metadata_urls_list(const QString &host);
+QString get_mirror_list_url(const QString &host);
+QList<QPair<QString, QString>> parse_mirror_list(const QString &file);
+QList<QString> yml_get_list(const YAML::Node &node, const QString &key);
+QList<QString> checksum_file_names();
+DigestAlgorithm checksum_file_algorithm(const QString &filename);
+QList<VariantData> parse_variants(const QString &variantsFile);
+QList<QString> variant_checksum_urls(const QString &image_url);
+QString metadata_language();
+QString snapshot_path();
+QString snapshot_context();
 
 
 ReleaseManager::ReleaseManager(QObject *parent)
 : QObject(parent) {
     m_downloadingMetadata = true;
+    loading_cached = true;
     metadata_urls_reply_group = nullptr;
     metadata_urls_backup_reply_group = nullptr;
-    metadata_reply_group = nullptr;
-    md5sum_reply_group = nullptr;
+    loaded_section_count = 0;
+    rendering_incrementally = true;
 
     qDebug() << this->metaObject()->className() << "construction";
 
@@ -62,17 +80,21 @@ ReleaseManager::ReleaseManager(QObject *parent)
     addReleaseToModel(0, customRelease);
     setSelectedIndex(0);
 
-    QTimer::singleShot(0, this, &ReleaseManager::downloadMetadataUrls);
+    QTimer::singleShot(0, this, &ReleaseManager::loadSnapshot);
 }
 
 void ReleaseManager::downloadMetadataUrls() {
-    qDebug() << "Downloading metadata urls";
+    qDebug() << "Downloading metadata urls" << (loading_cached ? "from cache" : "");
 
-    setDownloadingMetadata(true);
+    // NOTE: releases loaded from cache stay usable while
+    // metadata is revalidated
+    if (loaded_metadata_hash.isEmpty()) {
+        setDownloadingMetadata(true);
+    }
 
     const QList<QString> url_list = get_metadata_urls_list(METADATA_URLS_HOST);
 
-    metadata_urls_reply_group = new NetworkReplyGroup(url_list, this);
+    metadata_urls_reply_group = new NetworkReplyGroup(url_list, loading_cached, this);
 
     connect(
         metadata_urls_reply_group, &NetworkReplyGroup::finished,
@@ -104,7 +126,14 @@ void ReleaseManager::onMetadataUrlsDownloaded() {
         // 
         // TODO: when usage of backup is removed, fail
         // and restart here
-        if (download_failed) {
+        if (download_failed && loading_cached) {
+            delete metadata_urls_reply_group;
+            metadata_urls_reply_group = nullptr;
+
+            loadFromNetwork();
+
+            return;
+        } else if (download_failed) {
             qDebug() << "Failed to download metadata urls:" << reply->errorString() << reply->error() << "Downloading from backup";
             QTimer::singleShot(100, this, &ReleaseManager::downloadMetadataUrlsBackup);
 
@@ -157,11 +186,15 @@ void ReleaseManager::onMetadataUrlsDownloaded() {
     metadata_urls_reply_group = nullptr;
 
     if (success) {
+        mirror_list_url = get_mirror_list_url(METADATA_URLS_HOST);
+
         qDebug() << "Processed metadata urls";
         qDebug() << "section_urls = " << section_urls;
         qDebug() << "image_urls = " << image_urls;
 
         downloadMetadata();
+    } else if (loading_cached) {
+        loadFromNetwork();
     } else {
         qDebug() << "Metadata urls are invalid or empty";
     }
@@ -172,7 +205,7 @@ void ReleaseManager::downloadMetadataUrlsBackup() {
 
     const QList<QString> url_list = get_metadata_urls_list(METADATA_URLS_BACKUP_HOST);
     
-    metadata_urls_backup_reply_group = new NetworkReplyGroup(url_list, this);
+    metadata_urls_backup_reply_group = new NetworkReplyGroup(url_list, loading_cached, this);
 
     connect(
         metadata_urls_backup_reply_group, &NetworkReplyGroup::finished,
@@ -245,6 +278,8 @@ void ReleaseManager::onMetadataUrlsBackupDownloaded() {
     metadata_urls_backup_reply_group = nullptr;
 
     if (success) {
+        mirror_list_url = get_mirror_list_url(METADATA_URLS_BACKUP_HOST);
+
         qDebug() << "Processed metadata urls";
         qDebug() << "section_urls = " << section_urls;
         qDebug() << "image_urls = " << image_urls;
@@ -255,227 +290,509 @@ void ReleaseManager::onMetadataUrlsBackupDownloaded() {
     }
 }
 
+// Metadata files are downloaded as a pipeline instead of
+// in phases. Each file is processed as soon as it
+// arrives: releases from section files are added in
+// order, image files are parsed right away and start
+// downloads of checksum files for their images. A variant
+// is added once its release, its checksum files and the
+// mirror list are there. A failed file is retried by
+// itself, so other files don't wait for it.
 void ReleaseManager::downloadMetadata() {
     qDebug() << "Downloading metadata";
 
-    const QList<QString> all_urls = section_urls + image_urls;
+    // NOTE: if releases were already loaded from cache,
+    // they are only reloaded at the end if metadata
+    // changed
+    rendering_incrementally = loaded_metadata_hash.isEmpty();
+
+    metadata_files.clear();
+    metadata_pending_urls.clear();
+    checksum_urls.clear();
+    checksum_map.clear();
+    checksum_algorithm_map.clear();
+    pending_variants.clear();
+    loaded_section_count = 0;
+
+    for (const QString &url : section_urls) {
+        fetchMetadataFile(url, MetadataFile_SECTION);
+    }
+
+    for (const QString &url : image_urls) {
+        fetchMetadataFile(url, MetadataFile_IMAGE);
+    }
+
+    // NOTE: mirror list is optional, it's fine if it's not
+    // found
+    fetchMetadataFile(mirror_list_url, MetadataFile_MIRROR_LIST);
+}
+
+void ReleaseManager::fetchMetadataFile(const QString &url, const MetadataFile type) {
+    QNetworkReply *reply = makeNetworkRequest(url, 5000, loading_cached);
 
-    metadata_reply_group = new NetworkReplyGroup(all_urls, this);
+    metadata_pending_urls.insert(url);
+    metadata_replies[url] = reply;
 
     connect(
-        metadata_reply_group, &NetworkReplyGroup::finished,
-        this, &ReleaseManager::onMetadataDownloaded);
+        reply, &QNetworkReply::finished,
+        this, [this, url, type, reply]() {
+            onMetadataFileDownloaded(url, type, reply);
+        });
 }
 
-void ReleaseManager::onMetadataDownloaded() {
-    const QHash<QString, QNetworkReply *> replies = metadata_reply_group->get_reply_list();
-    
-    // Check that all replies suceeded
-    // If not, retry
-    for (const QNetworkReply *reply : replies.values()) {
-        // NOTE: ignore ContentNotFoundError for
-        // metadata since it can happen if one of
-        // the files was moved or renamed. In that
-        // case it's fine to process other
-        // downloads and ignore this failed one.
-        const QNetworkReply::NetworkError error = reply->error();
-        const bool download_failed = (error != QNetworkReply::NoError && error != QNetworkReply::ContentNotFoundError);
+void ReleaseManager::onMetadataFileDownloaded(const QString &url, const MetadataFile type, QNetworkReply *reply) {
+    metadata_replies.remove(url);
+    reply->deleteLater();
 
-        if (download_failed) {
-            qDebug() << "Failed to download metadata:" << reply->errorString() << reply->error() << "Retrying in 10 seconds.";
-            QTimer::singleShot(10000, this, &ReleaseManager::downloadMetadata);
+    // NOTE: ignore ContentNotFoundError for metadata since
+    // it can happen if one of the files was moved or
+    // renamed. In that case it's fine to process other
+    // downloads and ignore this failed one.
+    const QNetworkReply::NetworkError error = reply->error();
+    const bool download_failed = (error != QNetworkReply::NoError && error != QNetworkReply::ContentNotFoundError);
 
-            delete metadata_reply_group;
-            metadata_reply_group = nullptr;
+    if (download_failed && loading_cached) {
+        loadFromNetwork();
 
-            return;
+        return;
+    } else if (download_failed && type == MetadataFile_MIRROR_LIST) {
+        // NOTE: mirror list is optional, so variants don't
+        // wait for it. It's recorded as empty and retried
+        // by itself, mirrors are added to variants once it
+        // arrives, see onMirrorListRetried().
+        qDebug() << "Failed to download" << url << reply->errorString() << reply->error() << "Loading variants without mirror list, retrying in 10 seconds.";
+
+        QTimer::singleShot(10000, this, &ReleaseManager::retryMirrorList);
+
+        metadata_files[url] = QString();
+        metadata_pending_urls.remove(url);
+
+        loadReadyVariants();
+
+        if (metadata_pending_urls.isEmpty()) {
+            onMetadataDownloaded();
         }
-    }
 
-    qDebug() << "Downloaded metadata, loading it";
+        return;
+    } else if (download_failed) {
+        qDebug() << "Failed to download" << url << reply->errorString() << reply->error() << "Retrying in 10 seconds.";
 
-    // Collect results
-    QHash<QString, QString> url_to_file;
+        QTimer::singleShot(
+            10000, this,
+            [this, url, type]() {
+                fetchMetadataFile(url, type);
+            });
 
-    for (const QString &url : replies.keys()) {
-        QNetworkReply *reply = replies[url];
+        return;
+    }
 
-        if (reply->error() == QNetworkReply::NoError) {
+    const QString file = [&]() {
+        if (error == QNetworkReply::NoError) {
             const QByteArray bytes = reply->readAll();
-            url_to_file[url] = QString(bytes);
+
+            return QString(bytes);
         } else {
             qDebug() << "Failed to download metadata from" << url;
-            qDebug() << "Error:" << reply->error();
+            qDebug() << "Error:" << error;
+
+            return QString();
         }
-    }
+    }();
+
+    metadata_files[url] = file;
+    metadata_pending_urls.remove(url);
 
-    const QList<QString> sectionsFiles = [&]() {
-        QList<QString> out;
+    switch (type) {
+        case MetadataFile_SECTION: {
+            loadReadySections();
 
-        for (const QString &section_url : section_urls) {
-            const QString section = url_to_file[section_url];
-            out.append(section);
+            break;
         }
-        return out;
-    }();
+        case MetadataFile_IMAGE: {
+            const QList<VariantData> variants = parse_variants(file);
+
+            // NOTE: checksum files are in the folders of
+            // images
+            for (const VariantData &variant : variants) {
+                for (const QString &checksum_url : variant_checksum_urls(variant.url)) {
+                    if (!checksum_urls.contains(checksum_url)) {
+                        checksum_urls.insert(checksum_url);
+                        fetchMetadataFile(checksum_url, MetadataFile_CHECKSUM);
+                    }
+                }
+            }
 
-    qDebug() << "Loading releases";
+            pending_variants.append(variants);
 
-    loadReleases(sectionsFiles);
+            break;
+        }
+        case MetadataFile_MIRROR_LIST: {
+            mirror_prefixes = parse_mirror_list(file);
 
-    imagesFiles = [&]() {
-        QList<QString> out;
+            break;
+        }
+        case MetadataFile_CHECKSUM: {
+            addChecksums(url, file);
 
-        for (const QString &image_url : image_urls) {
-            const QString image = url_to_file[image_url];
-            out.append(image);
+            break;
         }
-        return out;
-    }();
+    }
 
-    // NOTE: images/variants are loaded later after
-    // md5sum is downloaded
+    loadReadyVariants();
 
-    delete metadata_reply_group;
-    metadata_reply_group = nullptr;
+    if (metadata_pending_urls.isEmpty()) {
+        onMetadataDownloaded();
+    }
+}
+
+void ReleaseManager::retryMirrorList() {
+    // NOTE: a new metadata download fetches the mirror
+    // list itself
+    if (metadata_replies.contains(mirror_list_url)) {
+        return;
+    }
 
-    const QList<QString> md5sum_url_list = [&]() {
-        const QList<QString> image_url_list = [&]() {
-            QList<QString> out;
+    QNetworkReply *reply = makeNetworkRequest(mirror_list_url, 5000, false);
 
-            for (const QString &imagesFile : imagesFiles) {
-                YAML::Node variants = YAML::Load(imagesFile.toStdString());
+    metadata_replies[mirror_list_url] = reply;
 
-                if (!variants["entries"]) {
-                    continue;
-                }
+    connect(
+        reply, &QNetworkReply::finished,
+        this, [this, reply]() {
+            onMirrorListRetried(reply);
+        });
+}
+
+void ReleaseManager::onMirrorListRetried(QNetworkReply *reply) {
+    metadata_replies.remove(mirror_list_url);
+    reply->deleteLater();
 
-                for (const YAML::Node &variantData : variants["entries"]) {
-                    const QString url = yml_get(variantData, "link");
-                    out.append(url);
+    const QNetworkReply::NetworkError error = reply->error();
+
+    if (error == QNetworkReply::ContentNotFoundError) {
+        return;
+    } else if (error != QNetworkReply::NoError) {
+        qDebug() << "Failed to download" << mirror_list_url << reply->errorString() << error << "Retrying in 10 seconds.";
+
+        QTimer::singleShot(10000, this, &ReleaseManager::retryMirrorList);
+
+        return;
+    }
+
+    const QString file = QString(reply->readAll());
+
+    metadata_files[mirror_list_url] = file;
+    mirror_prefixes = parse_mirror_list(file);
+
+    // Add mirrors to variants that were loaded without
+    // them
+    for (int i = 0; i < sourceModel->rowCount(); i++) {
+        Release *release = sourceModel->get(i);
+
+        for (Variant *variant : release->variantList()) {
+            variant->addMirrorUrls(prefixMirrorUrls(variant->url()));
+        }
+    }
+
+    if (!downloadingMetadata()) {
+        saveSnapshot();
+    }
+}
+
+// Load section files in their order, up to the first one
+// that isn't downloaded yet
+void ReleaseManager::loadReadySections() {
+    if (!rendering_incrementally) {
+        return;
+    }
+
+    while (loaded_section_count < section_urls.size() && metadata_files.contains(section_urls[loaded_section_count])) {
+        const QString &section = metadata_files[section_urls[loaded_section_count]];
+
+        loadReleases({section});
+
+        loaded_section_count++;
+    }
+}
+
+// Add variants that have everything they need
+void ReleaseManager::loadReadyVariants() {
+    if (!rendering_incrementally || !metadata_files.contains(mirror_list_url)) {
+        return;
+    }
+
+    const bool sections_loaded = (loaded_section_count == section_urls.size());
+
+    QList<VariantData> still_pending;
+
+    for (const VariantData &variant : pending_variants) {
+        const bool checksums_ready = [&]() {
+            for (const QString &checksum_url : variant_checksum_urls(variant.url)) {
+                if (!metadata_files.contains(checksum_url)) {
+                    return false;
                 }
             }
 
-            return out;
+            return true;
         }();
 
-        const QList<QString> out = [&]() {
-            // NOTE: using set because there will be
-            // duplicates due to there being multiple
-            // images per folder
-            QSet<QString> out_set;
+        // NOTE: if all sections are loaded and there's
+        // still no release, addVariant() drops it
+        const bool release_ready = (sections_loaded || findRelease(variant.releaseName) != nullptr);
 
-            for (const QString &image_url : image_url_list) {
-                // TODO: duplicating code in
-                // image_download.cpp
-                const QString md5sum_url = QUrl(image_url).adjusted(QUrl::RemoveFilename).toString() + "/MD5SUM";
+        if (checksums_ready && release_ready) {
+            addVariant(variant);
+        } else {
+            still_pending.append(variant);
+        }
+    }
 
-                out_set.insert(md5sum_url);
-            }
+    pending_variants = still_pending;
+}
 
-            const QList<QString> out = out_set.toList();
+// NOTE: if there are multiple checksums for an image,
+// strongest one is used, see checksum_file_names()
+void ReleaseManager::addChecksums(const QString &url, const QString &file) {
+    const DigestAlgorithm algorithm = checksum_file_algorithm(QUrl(url).fileName());
+    const QList<QString> line_list = file.split("\n");
 
-            return out;
+    // MD5SUM is of the form "sum image \n sum image \n
+    // ...", other sum files are the same except that
+    // binary mode images are marked with "*"
+    for (const QString &line : line_list) {
+        const QList<QString> elements = line.trimmed().split(QRegExp("\\s+"));
+
+        if (elements.size() != 2) {
+            continue;
+        }
+
+        const QString sum = elements[0];
+        const QString filename = [&]() {
+            if (elements[1].startsWith("*")) {
+                return elements[1].mid(1);
+            } else {
+                return elements[1];
+            }
         }();
 
-        return out;
+        const bool is_stronger = (!checksum_algorithm_map.contains(filename) || algorithm > checksum_algorithm_map[filename]);
+
+        if (is_stronger) {
+            checksum_map[filename] = digestFormatChecksum(algorithm, sum.toLatin1());
+            checksum_algorithm_map[filename] = algorithm;
+        }
+    }
+}
+
+void ReleaseManager::onMetadataDownloaded() {
+    qDebug() << "Downloaded metadata";
+
+    // NOTE: releases are only reloaded if metadata changed
+    // since it was loaded from cache
+    const QByteArray metadata_hash = [&]() {
+        QCryptographicHash hash(QCryptographicHash::Sha256);
+
+        QList<QString> checksum_url_list = checksum_urls.toList();
+        std::sort(checksum_url_list.begin(), checksum_url_list.end());
+
+        const QList<QString> url_list = section_urls + image_urls + QList<QString>({mirror_list_url}) + checksum_url_list;
+
+        for (const QString &url : url_list) {
+            hash.addData(url.toUtf8());
+            hash.addData(metadata_files[url].toUtf8());
+        }
+
+        return hash.result();
     }();
 
-    downloadMD5SUM(md5sum_url_list);
+    const bool was_cached = loading_cached;
+
+    if (rendering_incrementally) {
+        loaded_metadata_hash = metadata_hash;
+
+        saveSnapshot();
+    } else if (metadata_hash == loaded_metadata_hash) {
+        qDebug() << "Metadata didn't change";
+    } else if (isBusy()) {
+        // NOTE: changed metadata is in the cache and will
+        // be loaded on next start
+        qDebug() << "Metadata changed, not reloading it while an image is downloaded or written";
+    } else {
+        qDebug() << "Metadata changed, reloading releases";
+
+        const QString selected_name = selected()->name();
+
+        removeReleases();
+
+        rendering_incrementally = true;
+        loadReadySections();
+        loadReadyVariants();
+
+        loaded_metadata_hash = metadata_hash;
+
+        saveSnapshot();
+
+        selectRelease(selected_name);
+    }
+
+    pending_variants.clear();
+
+    setDownloadingMetadata(false);
+
+    // NOTE: metadata loaded from cache is revalidated
+    // right away
+    if (was_cached) {
+        loadFromNetwork();
+    }
 }
 
-void ReleaseManager::downloadMD5SUM(const QList<QString> &md5sum_url_list) {
-    qDebug() << "Downloading MD5SUM's";
+void ReleaseManager::loadFromNetwork() {
+    qDebug() << "Loading metadata from network";
 
-    md5sum_reply_group = new NetworkReplyGroup(md5sum_url_list, this);
+    // NOTE: stop loading from cache if it failed midway
+    for (QNetworkReply *reply : metadata_replies) {
+        disconnect(reply, nullptr, this, nullptr);
+        reply->abort();
+        reply->deleteLater();
+    }
+    metadata_replies.clear();
 
-    connect(
-        md5sum_reply_group, &NetworkReplyGroup::finished,
-        this, &ReleaseManager::onMD5SUMDownloaded);
+    if (loaded_metadata_hash.isEmpty()) {
+        removeReleases();
+    }
+
+    loading_cached = false;
+
+    QTimer::singleShot(0, this, &ReleaseManager::downloadMetadataUrls);
 }
 
-void ReleaseManager::onMD5SUMDownloaded() {
-    const QHash<QString, QNetworkReply *> replies = md5sum_reply_group->get_reply_list();
+// Show releases from the snapshot of the last loaded
+// catalog, if there is one. Then metadata is revalidated
+// with the server, see onMetadataDownloaded().
+void ReleaseManager::loadSnapshot() {
+    CatalogSnapshot snapshot;
+    const bool load_success = snapshot.load(snapshot_path());
 
-    // Check that all replies suceeded
-    // If not, retry
-    // TODO: duplicating code
-    for (const QNetworkReply *reply : replies.values()) {
-        // NOTE: ignore ContentNotFoundError for
-        // metadata since it can happen if one of
-        // the files was moved or renamed. In that
-        // case it's fine to process other
-        // downloads and ignore this failed one.
-        const QNetworkReply::NetworkError error = reply->error();
-        const bool download_failed = (error != QNetworkReply::NoError && error != QNetworkReply::ContentNotFoundError);
+    if (!load_success || snapshot.context != snapshot_context()) {
+        qDebug() << "No catalog snapshot, loading metadata";
 
-        if (download_failed) {
-            qDebug() << "Failed to download md5sum:" << reply->errorString() << reply->error() << "Retrying in 10 seconds.";
-            QTimer::singleShot(10000, this, &ReleaseManager::downloadMetadata);
+        downloadMetadataUrls();
 
-            delete md5sum_reply_group;
-            md5sum_reply_group = nullptr;
+        return;
+    }
 
-            return;
+    qDebug() << "Loading catalog snapshot";
+
+    for (const SnapshotRelease &release_data : snapshot.releases) {
+        const auto release = new Release(release_data.name, release_data.displayName, release_data.summary, release_data.description, release_data.icon, QStringList(), this);
+
+        for (const SnapshotVariant &data : release_data.variants) {
+            Variant *variant = new Variant(data.url, data.mirrorUrls, data.arch, data.platform, data.fileType, data.board, data.live, data.md5sum, data.bmapUrl, data.segmentsUrl, this);
+            release->addVariant(variant);
         }
+
+        addReleaseToModel(sourceModel->rowCount(), release);
     }
 
-    qDebug() << "Downloaded md5sum, loading it";
+    filterModel->invalidateCustom();
 
-    const QList<QString> md5sum_file_list = [&]() {
-        QList<QString> out;
+    loaded_metadata_hash = snapshot.metadataHash;
 
-        for (const QString &url : replies.keys()) {
-            QNetworkReply *reply = replies[url];
+    setDownloadingMetadata(false);
 
-            if (reply->error() == QNetworkReply::NoError) {
-                const QByteArray bytes = reply->readAll();
-                const QString string = QString(bytes);
-                out.append(string);
-            } else {
-                qDebug() << "Failed to download metadata from" << url;
-                qDebug() << "Error:" << reply->error();
-            }
-        }
+    // NOTE: snapshot replaces loading metadata from cache
+    loadFromNetwork();
+}
 
-        return out;
-    }();
+void ReleaseManager::saveSnapshot() const {
+    CatalogSnapshot snapshot;
+    snapshot.metadataHash = loaded_metadata_hash;
+    snapshot.context = snapshot_context();
 
-    const QHash<QString, QString> md5sum_map = [&]() {
-        QHash<QString, QString> out;
+    // NOTE: custom release is not saved
+    for (int i = 0; i < sourceModel->rowCount(); i++) {
+        const Release *release = sourceModel->get(i);
 
-        for (const QString &file : md5sum_file_list) {
-            const QList<QString> line_list = file.split("\n");
+        if (release->isCustom()) {
+            continue;
+        }
 
-            // MD5SUM is of the form "sum image \n sum
-            // image \n ..."
-            for (const QString &line : line_list) {
-                const QList<QString> elements = line.split(QRegExp("\\s+"));
+        SnapshotRelease release_data = {release->name(), release->displayName(), release->summary(), release->description(), release->icon(), QList<SnapshotVariant>()};
 
-                if (elements.size() != 2) {
-                    continue;
-                }
+        for (const Variant *variant : release->variantList()) {
+            const SnapshotVariant data = {variant->url(), variant->mirrorUrls(), variant->arch(), variant->platform(), variant->fileType(), variant->board(), variant->live(), variant->md5sum(), variant->bmapUrl(), variant->segmentsUrl()};
+            release_data.variants.append(data);
+        }
 
-                const QString md5sum = elements[0];
-                const QString filename = elements[1];
+        snapshot.releases.append(release_data);
+    }
 
-                out[filename] = md5sum;
+    const bool save_success = snapshot.save(snapshot_path());
+    if (!save_success) {
+        qDebug() << "Failed to save catalog snapshot";
+    }
+}
+
+// Whether some image is downloading or being written, or
+// waits for it in the job queue, in which case releases
+// can't be reloaded
+bool ReleaseManager::isBusy() const {
+    for (int i = 0; i < sourceModel->rowCount(); i++) {
+        const Release *release = sourceModel->get(i);
+
+        for (const Variant *variant : release->variantList()) {
+            // NOTE: status of a download that is starting
+            // may still be PREPARING
+            if (variant->downloadJob() != 0) {
+                return true;
+            }
+
+            switch (variant->status()) {
+                case Variant::DOWNLOAD_QUEUED: return true;
+                case Variant::DOWNLOADING: return true;
+                case Variant::DOWNLOAD_RESUMING: return true;
+                case Variant::DOWNLOAD_VERIFYING: return true;
+                case Variant::WRITE_QUEUED: return true;
+                case Variant::WRITING: return true;
+                case Variant::WRITE_VERIFYING: return true;
+                default: break;
             }
         }
+    }
 
-        return out;
-    }();
+    return false;
+}
+
+// Remove all releases except the custom one
+void ReleaseManager::removeReleases() {
+    while (sourceModel->rowCount() > 1) {
+        Release *release = sourceModel->get(1);
 
-    qDebug() << "Loading variants";
+        sourceModel->removeRow(1);
 
-    for (const QString &imagesFile : imagesFiles) {
-        loadVariants(imagesFile, md5sum_map);
+        for (Variant *variant : release->variantList()) {
+            variant->deleteLater();
+        }
+        release->deleteLater();
     }
 
-    delete md5sum_reply_group;
-    md5sum_reply_group = nullptr;
+    // NOTE: custom release is the first one
+    m_selectedIndex = 0;
+    emit selectedChanged();
+}
 
-    setDownloadingMetadata(false);
+// Select release by name, if it's still there
+void ReleaseManager::selectRelease(const QString &name) {
+    for (int i = 0; i < sourceModel->rowCount(); i++) {
+        if (sourceModel->get(i)->name() == name) {
+            if (m_selectedIndex != i) {
+                m_selectedIndex = i;
+                emit selectedChanged();
+            }
+
+            return;
+        }
+    }
 }
 
 void ReleaseManager::setDownloadingMetadata(const bool value) {
@@ -513,105 +830,61 @@ ReleaseFilterModel *ReleaseManager::getFilterModel() const {
     return filterModel;
 }
 
-void ReleaseManager::loadVariants(const QString &variantsFile, const QHash<QString, QString> &md5sum_map) {
-    YAML::Node variants = YAML::Load(variantsFile.toStdString());
+void ReleaseManager::addVariant(const VariantData &data) {
+    const QString md5sum = [&]() {
+        const QString filename = QUrl(data.url).fileName();
+        const QString out = checksum_map[filename];
 
-    if (!variants["entries"]) {
-        return;
-    }
-
-    for (const YAML::Node &variantData : variants["entries"]) {
-        const QString url = yml_get(variantData, "link");
-        if (url.isEmpty()) {
-            qDebug() << "Variant has no url";
-            continue;
-        }
-
-        const QString releaseName = yml_get(variantData, "solution");
-        if (releaseName.isEmpty()) {
-            qDebug() << "Variant has no releaseName" << url;
-            continue;
-        }
+        return out;
+    }();
 
-        const QString arch_string = yml_get(variantData, "arch");
-        const Architecture arch = [arch_string, url]() -> Architecture {
-            if (!arch_string.isEmpty()) {
-                return architecture_from_string(arch_string);
-            } else {
-                return architecture_from_filename(url);
-            }
-        }();
-        if (arch == Architecture_UNKNOWN) {
-            qDebug() << "Variant has unknown architecture" << arch_string << url;
-            continue;
-        }
+    // NOTE: mirrors are listed in the image metadata
+    // and in the mirror list, main url goes first
+    const QList<QString> mirrorUrls = [&]() {
+        QList<QString> out = data.mirrorUrls + prefixMirrorUrls(data.url);
 
-        const QString platform_string = yml_get(variantData, "platform");
-        const Platform platform = [platform_string, url]() -> Platform {
-            if (!platform_string.isEmpty()) {
-                return platform_from_string(platform_string);
-            } else {
-                return Platform_UNKNOWN;
-            }
-        }();
-        if (platform == Platform_UNKNOWN) {
-            qDebug() << "Variant has unknown platform" << platform << url;
-            continue;
-        }
+        out.removeAll(data.url);
+        out.removeDuplicates();
 
-        // NOTE: yml file doesn't define "board" for pc32/pc64, so default to "PC"
-        const QString board = [variantData]() -> QString {
-            const QString out = yml_get(variantData, "board");
-            if (!out.isEmpty()) {
-                return out;
-            } else {
-                return "PC";
-            }
-        }();
+        return out;
+    }();
 
-        const FileType fileType = file_type_from_filename(url);
-        if (fileType == FileType_UNKNOWN) {
-            qDebug() << "Variant has unknown file type" << url;
-            continue;
-        }
+    // qDebug() << QUrl(data.url).fileName() << data.releaseName << architecture_name(data.arch) << data.board << file_type_name(data.fileType) << (data.live ? "LIVE" : "");
 
-        const bool live = [variantData]() {
-            const QString live_string = yml_get(variantData, "live");
-            if (!live_string.isEmpty()) {
-                return (live_string == "1");
-            } else {
-                return false;
-            }
-        }();
+    // Find a release that has the same name as this variant
+    Release *release = findRelease(data.releaseName);
 
-        const QString md5sum = [&]() {
-            const QString filename = QUrl(url).fileName();
-            const QString out = md5sum_map[filename];
+    if (release != nullptr) {
+        Variant *variant = new Variant(data.url, mirrorUrls, data.arch, data.platform, data.fileType, data.board, data.live, md5sum, data.bmapUrl, data.segmentsUrl, this);
+        release->addVariant(variant);
+    } else {
+        qDebug() << "Failed to find a release for this variant!" << data.url;
+    }
+}
 
-            return out;
-        }();
+// Mirrors of an image url from the mirror list
+QList<QString> ReleaseManager::prefixMirrorUrls(const QString &url) const {
+    QList<QString> out;
 
-        // qDebug() << QUrl(url).fileName() << releaseName << architecture_name(arch) << board << file_type_name(fileType) << (live ? "LIVE" : "");
+    for (const QPair<QString, QString> &prefix : mirror_prefixes) {
+        if (url.startsWith(prefix.first)) {
+            out.append(prefix.second + url.mid(prefix.first.size()));
+        }
+    }
 
-        // Find a release that has the same name as this variant
-        Release *release = [this, releaseName]() -> Release * {
-            for (int i = 0; i < sourceModel->rowCount(); i++) {
-                Release *release = sourceModel->get(i);
+    return out;
+}
 
-                if (release->name() == releaseName) {
-                    return release;
-                }
-            }
-            return nullptr;
-        }();
+Release *ReleaseManager::findRelease(const QString &name) const {
+    for (int i = 0; i < sourceModel->rowCount(); i++) {
+        Release *release = sourceModel->get(i);
 
-        if (release != nullptr) {
-            Variant *variant = new Variant(url, arch, platform, fileType, board, live, md5sum, this);
-            release->addVariant(variant);
-        } else {
-            qDebug() << "Failed to find a release for this variant!" << url;
+        if (release->name() == name) {
+            return release;
         }
     }
+
+    return nullptr;
 }
 
 QStringList ReleaseManager::architectures() const {
@@ -684,13 +957,7 @@ void ReleaseManager::loadReleases(const QList<QString> &sectionsFiles) {
                 continue;
             }
 
-            const QString language = []() {
-                if (QLocale().language() == QLocale::Russian) {
-                    return "_ru";
-                } else {
-                    return "_en";
-                }
-            }();
+            const QString language = metadata_language();
 
             const QString display_name = yml_get(releaseData, "name" + language);
             if (display_name.isEmpty()) {
@@ -800,6 +1067,26 @@ QString yml_get(const YAML::Node &node, const QString &key) {
     return value;
 }
 
+QList<QString> yml_get_list(const YAML::Node &node, const QString &key) {
+    const std::string key_std = key.toStdString();
+    const YAML::Node value_yml = node[key_std];
+
+    QList<QString> out;
+
+    if (value_yml.IsSequence()) {
+        for (const YAML::Node &element : value_yml) {
+            const std::string fallback = std::string();
+            const std::string element_std = element.as<std::string>(fallback);
+
+            if (!element_std.empty()) {
+                out.append(QString::fromStdString(element_std));
+            }
+        }
+    }
+
+    return out;
+}
+
 // TODO: this f-n might become unneeded when usage of
 // backup host is removed
 QList<QString> get_metadata_urls_list(const QString &host) {
@@ -814,6 +1101,140 @@ QList<QString> get_metadata_urls_list(const QString &host) {
     return out;
 }
 
+QString get_mirror_list_url(const QString &host) {
+    const QString MIRROR_LIST_FILENAME = "altmediawriter_mirror_list.txt";
+
+    return QString("%1/%2").arg(host, MIRROR_LIST_FILENAME);
+}
+
+// Mirror list is of the form "image_prefix mirror_prefix \n
+// ...". Images with urls starting with image_prefix can
+// also be downloaded from the same path under
+// mirror_prefix. Lines starting with "#" are comments.
+QList<QPair<QString, QString>> parse_mirror_list(const QString &file) {
+    QList<QPair<QString, QString>> out;
+
+    const QList<QString> line_list = file.split("\n");
+
+    for (const QString &line : line_list) {
+        if (line.trimmed().startsWith("#")) {
+            continue;
+        }
+
+        const QList<QString> elements = line.trimmed().split(QRegExp("\\s+"));
+
+        if (elements.size() != 2) {
+            continue;
+        }
+
+        out.append({elements[0], elements[1]});
+    }
+
+    return out;
+}
+
+// Parse variants from an images file, skipping invalid
+// ones. Checksums and mirrors from the mirror list are
+// added later, see addVariant().
+QList<VariantData> parse_variants(const QString &variantsFile) {
+    QList<VariantData> out;
+
+    YAML::Node variants = YAML::Load(variantsFile.toStdString());
+
+    if (!variants["entries"]) {
+        return out;
+    }
+
+    for (const YAML::Node &variantData : variants["entries"]) {
+        const QString url = yml_get(variantData, "link");
+        if (url.isEmpty()) {
+            qDebug() << "Variant has no url";
+            continue;
+        }
+
+        const QString releaseName = yml_get(variantData, "solution");
+        if (releaseName.isEmpty()) {
+            qDebug() << "Variant has no releaseName" << url;
+            continue;
+        }
+
+        const QString arch_string = yml_get(variantData, "arch");
+        const Architecture arch = [arch_string, url]() -> Architecture {
+            if (!arch_string.isEmpty()) {
+                return architecture_from_string(arch_string);
+            } else {
+                return architecture_from_filename(url);
+            }
+        }();
+        if (arch == Architecture_UNKNOWN) {
+            qDebug() << "Variant has unknown architecture" << arch_string << url;
+            continue;
+        }
+
+        const QString platform_string = yml_get(variantData, "platform");
+        const Platform platform = [platform_string, url]() -> Platform {
+            if (!platform_string.isEmpty()) {
+                return platform_from_string(platform_string);
+            } else {
+                return Platform_UNKNOWN;
+            }
+        }();
+        if (platform == Platform_UNKNOWN) {
+            qDebug() << "Variant has unknown platform" << platform << url;
+            continue;
+        }
+
+        // NOTE: yml file doesn't define "board" for pc32/pc64, so default to "PC"
+        const QString board = [variantData]() -> QString {
+            const QString out = yml_get(variantData, "board");
+            if (!out.isEmpty()) {
+                return out;
+            } else {
+                return "PC";
+            }
+        }();
+
+        const FileType fileType = file_type_from_filename(url);
+        if (fileType == FileType_UNKNOWN) {
+            qDebug() << "Variant has unknown file type" << url;
+            continue;
+        }
+
+        const bool live = [variantData]() {
+            const QString live_string = yml_get(variantData, "live");
+            if (!live_string.isEmpty()) {
+                return (live_string == "1");
+            } else {
+                return false;
+            }
+        }();
+
+        // NOTE: block map is optional
+        const QString bmapUrl = yml_get(variantData, "bmap");
+        const QString segmentsUrl = yml_get(variantData, "segments");
+
+        const QList<QString> mirrorUrls = yml_get_list(variantData, "mirrors");
+
+        const VariantData variant = {url, releaseName, arch, platform, board, fileType, live, bmapUrl, segmentsUrl, mirrorUrls};
+        out.append(variant);
+    }
+
+    return out;
+}
+
+// Urls of checksum files for an image
+QList<QString> variant_checksum_urls(const QString &image_url) {
+    const QString dir_url = QUrl(image_url).adjusted(QUrl::RemoveFilename).toString();
+
+    QList<QString> out;
+
+    for (const QString &sums_filename : checksum_file_names()) {
+        out.append(dir_url + "/" + sums_filename);
+    }
+
+    return out;
+}
+
 QString getMetadataUrl() {
     QByteArray envValue = qgetenv("METADATA_URLS_HOST_ENV");
     if (!envValue.isEmpty()) {
@@ -822,3 +1243,46 @@ QString getMetadataUrl() {
         return "http://getalt.org";
     }
 }
+
+// Names of checksum files located next to images. BLAKE3
+// sums are only downloaded if they can be checked.
+QList<QString> checksum_file_names() {
+    QList<QString> out = {"MD5SUM", "SHA256SUMS"};
+
+    if (Digest::isSupported(DigestAlgorithm_BLAKE3)) {
+        out.append("B3SUMS");
+    }
+
+    return out;
+}
+
+DigestAlgorithm checksum_file_algorithm(const QString &filename) {
+    if (filename == "SHA256SUMS") {
+        return DigestAlgorithm_SHA256;
+    } else if (filename == "B3SUMS") {
+        return DigestAlgorithm_BLAKE3;
+    } else {
+        return DigestAlgorithm_MD5;
+    }
+}
+
+// Suffix of localized fields in metadata
+QString metadata_language() {
+    if (QLocale().language() == QLocale::Russian) {
+        return "_ru";
+    } else {
+        return "_en";
+    }
+}
+
+QString snapshot_path() {
+    return QDir(QStandardPaths::writableLocation(QStandardPaths::CacheLocation)).filePath("catalog.snapshot");
+}
+
+// Everything besides metadata that affects the loaded
+// catalog
+QString snapshot_context() {
+    const QString blake3_string = Digest::isSupported(DigestAlgorithm_BLAKE3) ? "blake3" : "";
+
+    return QString("%1 %2 %3").arg(METADATA_URLS_HOST, metadata_language(), blake3_string);
+}
@@ -28,13 +28,36 @@
  * the qml portion of the app.
  */
 
+#include "architecture.h"
+#include "file_type.h"
+#include "platform.h"
+#include "isomd5/digest.h"
+
 #include <QObject>
 #include <QHash>
+#include <QList>
+#include <QPair>
+#include <QSet>
 
 class Release;
 class ReleaseModel;
 class ReleaseFilterModel;
 class NetworkReplyGroup;
+class QNetworkReply;
+
+// Variant as listed in an images file
+struct VariantData {
+    QString url;
+    QString releaseName;
+    Architecture arch;
+    Platform platform;
+    QString board;
+    FileType fileType;
+    bool live;
+    QString bmapUrl;
+    QString segmentsUrl;
+    QList<QString> mirrorUrls;
+};
 
 class ReleaseManager : public QObject {
     Q_OBJECT
@@ -71,26 +94,69 @@ private:
     ReleaseFilterModel *filterModel;
     int m_selectedIndex;
     bool m_downloadingMetadata;
-    NetworkReplyGroup *metadata_reply_group;
+    // Whether metadata is being loaded from cache, which
+    // happens once at start
+    bool loading_cached;
+    // Hash of metadata that releases were loaded from
+    QByteArray loaded_metadata_hash;
     NetworkReplyGroup *metadata_urls_reply_group;
     NetworkReplyGroup *metadata_urls_backup_reply_group;
-    NetworkReplyGroup *md5sum_reply_group;
     QList<QString> section_urls;
     QList<QString> image_urls;
-    QList<QString> imagesFiles;
+    QString mirror_list_url;
+    // Image url prefix => mirror url prefix
+    QList<QPair<QString, QString>> mirror_prefixes;
+
+    enum MetadataFile {
+        MetadataFile_SECTION,
+        MetadataFile_IMAGE,
+        MetadataFile_MIRROR_LIST,
+        MetadataFile_CHECKSUM,
+    };
+
+    // Whether releases and variants are added as their
+    // files arrive, otherwise they are added at the end
+    bool rendering_incrementally;
+    // Url => contents of downloaded metadata files, failed
+    // files are empty
+    QHash<QString, QString> metadata_files;
+    QHash<QString, QNetworkReply *> metadata_replies;
+    // Urls that are downloading or waiting for a retry
+    QSet<QString> metadata_pending_urls;
+    QSet<QString> checksum_urls;
+    // Image filename => checksum
+    QHash<QString, QString> checksum_map;
+    QHash<QString, DigestAlgorithm> checksum_algorithm_map;
+    // Variants that are waiting for their release or
+    // checksums
+    QList<VariantData> pending_variants;
+    int loaded_section_count;
 
-    void loadVariants(const QString &variantsFile, const QHash<QString, QString> &md5sum_map);
     void setDownloadingMetadata(const bool value);
     void downloadMetadataUrls();
     void onMetadataUrlsDownloaded();
     void downloadMetadataUrlsBackup();
     void onMetadataUrlsBackupDownloaded();
     void downloadMetadata();
-    void downloadMD5SUM(const QList<QString> &md5sum_url_list);
+    void fetchMetadataFile(const QString &url, const MetadataFile type);
+    void onMetadataFileDownloaded(const QString &url, const MetadataFile type, QNetworkReply *reply);
+    void retryMirrorList();
+    void onMirrorListRetried(QNetworkReply *reply);
+    void loadReadySections();
+    void loadReadyVariants();
+    void addChecksums(const QString &url, const QString &file);
     void loadReleases(const QList<QString> &sectionsFiles);
     void addReleaseToModel(const int index, Release *release);
+    void addVariant(const VariantData &data);
+    QList<QString> prefixMirrorUrls(const QString &url) const;
+    Release *findRelease(const QString &name) const;
     void onMetadataDownloaded();
-    void onMD5SUMDownloaded();
+    void loadFromNetwork();
+    void loadSnapshot();
+    void saveSnapshot() const;
+    bool isBusy() const;
+    void removeReleases();
+    void selectRelease(const QString &name);
 };
 
 #endif // RELEASEMANAGER_H
@@ -23,7 +23,10 @@
 #include "variant.h"
 #include "architecture.h"
 #include "drivemanager.h"
+#include "image_cache.h"
+#include "image_check.h"
 #include "image_download.h"
+#include "job_scheduler.h"
 #include "network.h"
 #include "progress.h"
 #include "release.h"
@@ -33,36 +36,57 @@
 #include <QFileInfo>
 #include <QStandardPaths>
 
-Variant::Variant(const QString &url, const Architecture arch, const Platform platform, const FileType fileType, const QString &board, const bool live, const QString &md5sum, QObject *parent)
+Variant::Variant(const QString &url, const QList<QString> &mirrorUrls, const Architecture arch, const Platform platform, const FileType fileType, const QString &board, const bool live, const QString &md5sum, const QString &bmapUrl, const QString &segmentsUrl, QObject *parent)
 : QObject(parent) {
     m_url = url;
+    m_mirrorUrls = mirrorUrls;
     m_fileName = QUrl(url).fileName();
     m_filePath = QDir(QStandardPaths::writableLocation(QStandardPaths::DownloadLocation)).filePath(fileName());
     m_board = board;
     m_live = live;
     m_md5sum = md5sum;
+    m_bmapUrl = bmapUrl;
+    m_segmentsUrl = segmentsUrl;
     m_arch = arch;
     m_platform = platform;
     m_fileType = fileType;
     m_status = Variant::PREPARING;
+    m_downloadJob = 0;
     m_progress = new Progress(this);
 }
 
 Variant::Variant(const QString &path, QObject *parent)
 : QObject(parent) {
     m_url = QString();
+    m_mirrorUrls = QList<QString>();
     m_fileName = QFileInfo(path).fileName();
     m_filePath = path;
     m_board = QString();
     m_live = false;
     m_md5sum = QString();
+    m_bmapUrl = QString();
+    m_segmentsUrl = QString();
     m_arch = Architecture_UNKNOWN;
     m_platform = Platform_UNKNOWN;
     m_fileType = file_type_from_filename(path);
     m_status = Variant::READY_FOR_WRITING;
+    m_downloadJob = 0;
     m_progress = new Progress(this);
 }
 
+// NOTE: variants are removed when releases are reloaded,
+// their download job must not start after that and a
+// running download must not call back into the removed
+// variant
+Variant::~Variant() {
+    if (m_download != nullptr) {
+        m_download->disconnect(this);
+        m_download->cancel();
+    }
+
+    JobScheduler::instance()->finish(m_downloadJob);
+}
+
 Architecture Variant::arch() const {
     return m_arch;
 }
@@ -71,14 +95,34 @@ QString Variant::fileName() const {
     return m_fileName;
 }
 
+FileType Variant::fileType() const {
+    return m_fileType;
+}
+
 QString Variant::fileTypeName() const {
     return file_type_name(m_fileType);
 }
 
+QString Variant::board() const {
+    return m_board;
+}
+
+bool Variant::live() const {
+    return m_live;
+}
+
 QString Variant::md5sum() const {
     return m_md5sum;
 }
 
+QString Variant::bmapUrl() const {
+    return m_bmapUrl;
+}
+
+QString Variant::segmentsUrl() const {
+    return m_segmentsUrl;
+}
+
 QString Variant::name() const {
     QString out = architecture_name(m_arch) + " | " + m_board;
 
@@ -101,6 +145,19 @@ QString Variant::url() const {
     return m_url;
 }
 
+QList<QString> Variant::mirrorUrls() const {
+    return m_mirrorUrls;
+}
+
+// NOTE: added mirrors are used by the next download
+void Variant::addMirrorUrls(const QList<QString> &urls) {
+    for (const QString &url : urls) {
+        if (url != m_url && !m_mirrorUrls.contains(url)) {
+            m_mirrorUrls.append(url);
+        }
+    }
+}
+
 QString Variant::filePath() const {
     return m_filePath;
 }
@@ -114,23 +171,50 @@ bool Variant::noMd5sum() const {
 }
 
 bool Variant::isCompressed() const {
-    return (m_fileType == FileType_TAR_XZ || m_fileType == FileType_IMG_XZ);
+    static const QList<FileType> compressed_file_types = {
+        FileType_TAR_GZ,
+        FileType_TAR_XZ,
+        FileType_IMG_GZ,
+        FileType_IMG_XZ,
+        FileType_IMG_ZST,
+    };
+
+    return compressed_file_types.contains(m_fileType);
+}
+
+bool Variant::canVerify() const {
+#ifdef __linux__
+    return true;
+#else
+    return !noMd5sum() && !isCompressed();
+#endif
+}
+
+bool Variant::hasBlockMap() const {
+    return !m_bmapUrl.isEmpty();
+}
+
+bool Variant::hasSegmentManifest() const {
+    return !m_segmentsUrl.isEmpty();
 }
 
 Progress *Variant::progress() {
     return m_progress;
 }
 
+int Variant::downloadJob() const {
+    return m_downloadJob;
+}
+
 void Variant::setDelayedWrite(const bool value) {
     delayedWrite = value;
 
-    Drive *drive = DriveManager::instance()->selected();
-    if (drive != nullptr) {
-        if (value) {
-            drive->write(this);
-        } else {
-            drive->cancel();
-        }
+    // NOTE: written to the same drives as a write started
+    // from the dialog, see DriveManager::write()
+    if (value) {
+        DriveManager::instance()->write(this);
+    } else {
+        DriveManager::instance()->cancelWrite(this);
     }
 }
 
@@ -141,6 +225,17 @@ Variant::Status Variant::status() const {
     return m_status;
 }
 
+bool Variant::isDownloading() const {
+    switch (m_status) {
+        case DOWNLOAD_QUEUED: return true;
+        case PREPARING: return true;
+        case DOWNLOADING: return true;
+        case DOWNLOAD_RESUMING: return true;
+        case DOWNLOAD_VERIFYING: return true;
+        default: return false;
+    }
+}
+
 QString Variant::statusString() const {
     if (m_statusStrings.contains(status())) {
         return m_statusStrings[status()];
@@ -184,55 +279,180 @@ void Variant::download() {
 
     resetStatus();
 
-    const bool already_downloaded = QFile::exists(filePath());
+    // NOTE: suffixes are what the helper looks for
+    const QHash<QString, QUrl> extraFileUrls = [this]() {
+        QHash<QString, QUrl> out;
 
-    if (already_downloaded) {
+        if (hasBlockMap()) {
+            out[".bmap"] = QUrl(bmapUrl());
+        }
+        if (hasSegmentManifest()) {
+            out[".segments"] = QUrl(segmentsUrl());
+        }
+
+        return out;
+    }();
+
+    // NOTE: cached image with the same checksum was already
+    // checked, it also replaces a different file with the
+    // image's name
+    const bool cached = ImageCache().restore(md5sum(), filePath(), extraFileUrls.keys());
+
+    if (cached) {
         // Already downloaded so skip download step
-        qDebug() << this->metaObject()->className() << fileName() << "is already downloaded";
+        qDebug() << this->metaObject()->className() << fileName() << "is in the image cache";
+        setStatus(READY_FOR_WRITING);
+    } else if (QFile::exists(filePath()) && ImageCheck::canCheck(md5sum())) {
+        checkExistingImage(extraFileUrls);
+    } else if (QFile::exists(filePath())) {
+        // NOTE: file can't be checked without a checksum, so
+        // it's used as is, same as before there was a cache.
+        // Downloading it again wouldn't make it more
+        // trusted.
+        qDebug() << this->metaObject()->className() << fileName() << "is already downloaded and can't be checked";
         setStatus(READY_FOR_WRITING);
     } else {
-        // Download image
-        auto download = new ImageDownload(QUrl(url()), filePath(), md5sum());
-
-        connect(
-            download, &ImageDownload::started,
-            [this]() {
-                setErrorString(QString());
-                setStatus(DOWNLOADING);
-            });
-        connect(
-            download, &ImageDownload::interrupted,
-            [this]() {
-                setErrorString(tr("Connection was interrupted, attempting to resume"));
-                setStatus(DOWNLOAD_RESUMING);
-            });
-        connect(
-            download, &ImageDownload::startedMd5Check,
-            [this]() {
-                setErrorString(QString());
-                setStatus(DOWNLOAD_VERIFYING);
-            });
-        connect(
-            download, &ImageDownload::finished,
-            this, &Variant::onImageDownloadFinished);
-        connect(
-            download, &ImageDownload::progress,
-            [this](const qint64 value) {
-                m_progress->setCurrent(value);
-            });
-        connect(
-            download, &ImageDownload::progressMaxChanged,
-            [this](const qint64 value) {
-                m_progress->setMax(value);
-            });
-
-        connect(
-            this, &Variant::cancelledDownload,
-            download, &ImageDownload::cancel);
+        queueDownload(extraFileUrls);
     }
 }
 
+void Variant::queueDownload(const QHash<QString, QUrl> &extraFileUrls) {
+    // NOTE: main url goes first, see MirrorScheduler
+    const QList<QUrl> urls = [this]() {
+        QList<QUrl> out = {QUrl(url())};
+
+        for (const QString &mirrorUrl : mirrorUrls()) {
+            out.append(QUrl(mirrorUrl));
+        }
+
+        return out;
+    }();
+
+    // NOTE: download starts once other downloads leave
+    // room for it, see JobScheduler
+    setStatus(DOWNLOAD_QUEUED);
+
+    m_downloadJob = JobScheduler::instance()->enqueue(JobScheduler::DOWNLOAD, fileName(), {"network"},
+        [this, urls, extraFileUrls]() {
+            startDownload(urls, extraFileUrls);
+        },
+        [this]() {
+            m_downloadJob = 0;
+            resetStatus();
+        });
+}
+
+// Check a file with the image's name that is not in the
+// cache. If it matches the checksum, it's added to the
+// cache, otherwise it's downloaded again.
+void Variant::checkExistingImage(const QHash<QString, QUrl> &extraFileUrls) {
+    qDebug() << this->metaObject()->className() << fileName() << "is already downloaded, checking it";
+
+    setErrorString(QString());
+    setStatus(DOWNLOAD_VERIFYING);
+    m_progress->setMax(QFileInfo(filePath()).size());
+    m_progress->setCurrent(0);
+
+    auto check = new ImageCheck(filePath(), md5sum(), this);
+
+    connect(
+        check, &ImageCheck::progress,
+        this,
+        [this](const qint64 value) {
+            m_progress->setCurrent(value);
+        });
+    connect(
+        this, &Variant::cancelledDownload,
+        check, &ImageCheck::abort, Qt::DirectConnection);
+    connect(
+        check, &QThread::finished,
+        this,
+        [this, check, extraFileUrls]() {
+            check->deleteLater();
+
+            if (check->wasAborted()) {
+                setStatus(PREPARING);
+            } else if (check->passed()) {
+                ImageCache().insert(md5sum(), filePath(), extraFileUrls.keys());
+                setStatus(READY_FOR_WRITING);
+            } else {
+                qDebug() << this->metaObject()->className() << fileName() << "doesn't match its checksum, downloading it again";
+                erase();
+                queueDownload(extraFileUrls);
+            }
+        });
+
+    check->start();
+}
+
+void Variant::startDownload(const QList<QUrl> &urls, const QHash<QString, QUrl> &extraFileUrls) {
+    setStatus(PREPARING);
+
+    auto download = new ImageDownload(urls, filePath(), md5sum(), extraFileUrls);
+    m_download = download;
+
+    const int job = m_downloadJob;
+    connect(
+        download, &ImageDownload::finished,
+        this,
+        [this, job]() {
+            JobScheduler::instance()->finish(job);
+
+            if (m_downloadJob == job) {
+                m_downloadJob = 0;
+            }
+        });
+
+    connect(
+        download, &ImageDownload::started,
+        this,
+        [this]() {
+            setErrorString(QString());
+            setStatus(DOWNLOADING);
+        });
+    connect(
+        download, &ImageDownload::interrupted,
+        this,
+        [this]() {
+            setErrorString(tr("Connection was interrupted, attempting to resume"));
+            setStatus(DOWNLOAD_RESUMING);
+        });
+    connect(
+        download, &ImageDownload::startedMd5Check,
+        this,
+        [this]() {
+            setErrorString(QString());
+            setStatus(DOWNLOAD_VERIFYING);
+        });
+    connect(
+        download, &ImageDownload::finished,
+        this, &Variant::onImageDownloadFinished);
+    connect(
+        download, &ImageDownload::progress,
+        this,
+        [this](const qint64 value) {
+            m_progress->setCurrent(value);
+        });
+    connect(
+        download, &ImageDownload::progressMaxChanged,
+        this,
+        [this](const qint64 value) {
+            m_progress->setMax(value);
+        });
+
+    connect(
+        this, &Variant::cancelledDownload,
+        download, &ImageDownload::cancel);
+}
+
 void Variant::cancelDownload() {
+    // NOTE: download that didn't start yet is only removed
+    // from the queue
+    if (JobScheduler::instance()->isQueued(m_downloadJob)) {
+        JobScheduler::instance()->finish(m_downloadJob);
+        m_downloadJob = 0;
+    }
+
     emit cancelledDownload();
 }
 
@@ -249,6 +469,9 @@ void Variant::resetStatus() {
 }
 
 bool Variant::erase() {
+    QFile::remove(filePath() + ".bmap");
+    QFile::remove(filePath() + ".segments");
+
     if (QFile(filePath()).remove()) {
         qDebug() << this->metaObject()->className() << "Deleted" << filePath();
         return true;
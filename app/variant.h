@@ -31,12 +31,21 @@
  * @property filePath path to the image's file (after it is downloaded)
  * @property fileName the name of the image's file
  * @property fileTypeName display filetype name of the image's file
+ * @property canVerify whether the written data will be checked. The
+ *     Linux helper checks any image against data hashed while writing,
+ *     other platforms need an md5 sum and an uncompressed image.
+ * @property hasBlockMap whether the metadata lists a block map for
+ *     the image, which allows writing only the used parts of it
+ * @property hasSegmentManifest whether the metadata lists segment
+ *     checksums for the image, which are used to find the bad part
+ *     of the drive if the check fails
  * @property canWrite whether this image can be written, some file
  *     types aren't supported
  * @property progress the progress object of the image - reports the
  *     progress of download
  * @property status status of the variant - if it's downloading, being
- *     written, etc.
+ *     written, etc. Downloads and writes may wait in the queue of
+ *     @ref JobScheduler before they start.
  * @property statusString string representation of the @ref status
  * @property errorString a string better describing the current error
  *     @ref status of the variant
@@ -49,8 +58,11 @@
 #include <QHash>
 #include <QList>
 #include <QObject>
+#include <QPointer>
 #include <QString>
+#include <QUrl>
 
+class ImageDownload;
 class Progress;
 
 class Variant final : public QObject {
@@ -62,6 +74,9 @@ class Variant final : public QObject {
     Q_PROPERTY(bool canWrite READ canWrite CONSTANT)
     Q_PROPERTY(bool noMd5sum READ noMd5sum CONSTANT)
     Q_PROPERTY(bool isCompressed READ isCompressed CONSTANT)
+    Q_PROPERTY(bool canVerify READ canVerify CONSTANT)
+    Q_PROPERTY(bool hasBlockMap READ hasBlockMap CONSTANT)
+    Q_PROPERTY(bool hasSegmentManifest READ hasSegmentManifest CONSTANT)
     Q_PROPERTY(Progress *progress READ progress CONSTANT)
 
     Q_PROPERTY(Status status READ status NOTIFY statusChanged)
@@ -83,7 +98,9 @@ public:
         WRITING_FINISHED,
         WRITE_VERIFYING,
         WRITE_VERIFYING_FAILED,
-        WRITING_FAILED
+        WRITING_FAILED,
+        DOWNLOAD_QUEUED,
+        WRITE_QUEUED
     };
     Q_ENUMS(Status)
     const QHash<Status, QString> m_statusStrings = {
@@ -99,12 +116,15 @@ public:
         {WRITE_VERIFYING, tr("Checking the written data")},
         {WRITE_VERIFYING_FAILED, tr("The written data is corrupted")},
         {WRITING_FAILED, tr("Error")},
+        {DOWNLOAD_QUEUED, tr("Waiting for other downloads to finish")},
+        {WRITE_QUEUED, tr("Waiting for other writes to finish")},
     };
 
-    Variant(const QString &url, const Architecture arch, const Platform platform, const FileType fileType, const QString &board, const bool live, const QString &md5sum, QObject *parent);
+    Variant(const QString &url, const QList<QString> &mirrorUrls, const Architecture arch, const Platform platform, const FileType fileType, const QString &board, const bool live, const QString &md5sum, const QString &bmapUrl, const QString &segmentsUrl, QObject *parent);
 
     // Constructor for local file
     Variant(const QString &path, QObject *parent);
+    ~Variant();
 
     Q_INVOKABLE void setDelayedWrite(const bool value);
 
@@ -115,16 +135,30 @@ public:
     QString platformName() const;
 
     QString url() const;
+    QList<QString> mirrorUrls() const;
+    void addMirrorUrls(const QList<QString> &urls);
     QString filePath() const;
     QString fileName() const;
+    FileType fileType() const;
     QString fileTypeName() const;
+    QString board() const;
+    bool live() const;
     QString md5sum() const;
+    QString bmapUrl() const;
+    QString segmentsUrl() const;
     bool canWrite() const;
     bool noMd5sum() const;
     bool isCompressed() const;
+    bool canVerify() const;
+    bool hasBlockMap() const;
+    bool hasSegmentManifest() const;
     Progress *progress();
+    // Scheduler job of the download, 0 if not downloading
+    int downloadJob() const;
 
     Status status() const;
+    // Whether the image is still queued or downloading
+    bool isDownloading() const;
     QString statusString() const;
     void setStatus(const Status status);
     QString errorString() const;
@@ -146,19 +180,29 @@ public slots:
 
 private:
     QString m_url;
+    QList<QString> m_mirrorUrls;
     QString m_fileName;
     QString m_filePath;
     QString m_board;
     bool m_live;
     QString m_md5sum;
+    QString m_bmapUrl;
+    QString m_segmentsUrl;
     Architecture m_arch;
     Platform m_platform;
     FileType m_fileType;
     Status m_status;
     QString m_error;
     bool delayedWrite;
+    int m_downloadJob;
+    // Download that is running, if any
+    QPointer<ImageDownload> m_download;
 
     Progress *m_progress;
+
+    void queueDownload(const QHash<QString, QUrl> &extraFileUrls);
+    void startDownload(const QList<QUrl> &urls, const QHash<QString, QUrl> &extraFileUrls);
+    void checkExistingImage(const QHash<QString, QUrl> &extraFileUrls);
 };
 
 #endif // VARIANT_H
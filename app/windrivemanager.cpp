@@ -21,6 +21,7 @@
  */
 
 #include "windrivemanager.h"
+#include "job_scheduler.h"
 #include "notifications.h"
 #include "progress.h"
 #include "variant.h"
@@ -263,6 +264,8 @@ WinDrive::~WinDrive() {
     if (m_child) {
         m_child->kill();
     }
+
+    finishJob();
 }
 
 bool WinDrive::write(Variant *variant) {
@@ -271,6 +274,50 @@ bool WinDrive::write(Variant *variant) {
         return false;
     }
 
+    if (getHelperPath().isEmpty()) {
+        variant->setErrorString(tr("Could not find the helper binary. Check your installation."));
+        return false;
+    }
+
+    // NOTE: image that is still downloading keeps its
+    // download status
+    if (!variant->isDownloading()) {
+        variant->setStatus(Variant::WRITE_QUEUED);
+    }
+
+    // NOTE: helper writes the image only once it's
+    // downloaded, so the write doesn't hold its resources
+    // while waiting for the download to finish
+    m_job = JobScheduler::instance()->enqueue(JobScheduler::WRITE, tr("%1 to %2").arg(variant->fileName(), name()), writeResources(variant),
+        [this]() {
+            if (m_variant == nullptr) {
+                finishJob();
+                return;
+            }
+
+            // NOTE: download that failed or was cancelled
+            // keeps its status
+            if (!QFile::exists(m_variant->filePath())) {
+                finishJob();
+                m_variant = nullptr;
+                return;
+            }
+
+            startWrite();
+        },
+        [this]() {
+            m_job = 0;
+            if (m_variant != nullptr && m_variant->status() == Variant::WRITE_QUEUED) {
+                m_variant->resetStatus();
+            }
+            m_variant = nullptr;
+        },
+        variant->downloadJob(), true);
+
+    return true;
+}
+
+void WinDrive::startWrite() {
     if (m_child) {
         // TODO some handling of an already present process
         m_child->deleteLater();
@@ -279,24 +326,17 @@ bool WinDrive::write(Variant *variant) {
     connect(m_child, static_cast<void (QProcess::*)(int, QProcess::ExitStatus)>(&QProcess::finished), this, &WinDrive::onFinished);
     connect(m_child, &QProcess::readyRead, this, &WinDrive::onReadyRead);
 
-    const QString helperPath = getHelperPath();
-    if (!helperPath.isEmpty()) {
-        m_child->setProgram(helperPath);
-    } else {
-        variant->setErrorString(tr("Could not find the helper binary. Check your installation."));
-        return false;
-    }
+    m_child->setProgram(getHelperPath());
 
     QStringList args;
     args << "write";
-    args << variant->filePath();
+    args << m_variant->filePath();
     args << QString("%1").arg(m_device);
-    args << variant->md5sum();
+    args << m_variant->md5sum();
     m_child->setArguments(args);
 
     qDebug() << this->metaObject()->className() << "Starting" << m_child->program() << args;
     m_child->start();
-    return true;
 }
 
 void WinDrive::cancel() {
@@ -310,23 +350,36 @@ void WinDrive::cancel() {
 
 void WinDrive::restore() {
     qDebug() << this->metaObject()->className() << "Preparing to restore disk" << m_device;
-    if (m_child) {
-        m_child->deleteLater();
-    }
 
-    m_child = new QProcess(this);
+    const RestoreStatus previousStatus = m_restoreStatus;
 
     m_restoreStatus = RESTORING;
     emit restoreStatusChanged();
 
-    const QString helperPath = getHelperPath();
-    if (!helperPath.isEmpty()) {
-        m_child->setProgram(helperPath);
-    } else {
+    if (getHelperPath().isEmpty()) {
         m_restoreStatus = RESTORE_ERROR;
         return;
     }
 
+    m_job = JobScheduler::instance()->enqueue(JobScheduler::RESTORE, name(), restoreResources(),
+        [this]() {
+            startRestore();
+        },
+        [this, previousStatus]() {
+            m_job = 0;
+            setRestoreStatus(previousStatus);
+        });
+}
+
+void WinDrive::startRestore() {
+    if (m_child) {
+        m_child->deleteLater();
+    }
+
+    m_child = new QProcess(this);
+
+    m_child->setProgram(getHelperPath());
+
     QStringList args;
     args << "restore";
     args << QString("%1").arg(m_device);
@@ -353,6 +406,8 @@ void WinDrive::onFinished(const int exitCode, const QProcess::ExitStatus exitSta
         return;
     }
 
+    finishJob();
+
     qDebug() << "Child finished" << exitCode << exitStatus;
     qDebug() << m_child->errorString();
 
@@ -378,6 +433,8 @@ void WinDrive::onRestoreFinished(const int exitCode, const QProcess::ExitStatus
         return;
     }
 
+    finishJob();
+
     qDebug() << "Process finished" << exitCode << exitStatus;
     qDebug() << m_child->readAllStandardError();
 
@@ -66,6 +66,9 @@ private slots:
     void onReadyRead();
 
 private:
+    void startWrite();
+    void startRestore();
+
     int m_device;
     QString m_serialNo;
     QProcess *m_child;
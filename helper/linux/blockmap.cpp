@@ -0,0 +1,241 @@
+/*
+ * ALT Media Writer
+ * Copyright (C) 2016-2019 Martin Bříza <mbriza@redhat.com>
+ * Copyright (C) 2020-2022 Dmitry Degtyarev <kevl@basealt.ru>
+ *
+ * ALT Media Writer is a fork of Fedora Media Writer
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include "blockmap.h"
+
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QXmlStreamReader>
+
+QString BlockMap::find(const QString &image_path) {
+    const QFileInfo image_info(image_path);
+
+    const QList<QString> candidate_list = {
+        image_path + ".bmap",
+        image_info.dir().filePath(image_info.completeBaseName() + ".bmap"),
+    };
+
+    for (const QString &candidate : candidate_list) {
+        if (QFile::exists(candidate)) {
+            return candidate;
+        }
+    }
+
+    return QString();
+}
+
+BlockMap::BlockMap()
+: image_size(0)
+, block_size(0)
+, checksum_type(QCryptographicHash::Sha1) {
+
+}
+
+bool BlockMap::load(const QString &path) {
+    QFile file(path);
+    const bool open_success = file.open(QIODevice::ReadOnly);
+    if (!open_success) {
+        error_string = tr("Failed to open block map file %1").arg(path);
+        return false;
+    }
+
+    const QByteArray bytes = file.readAll();
+
+    QByteArray file_checksum;
+    const bool parse_success = parse(bytes, &file_checksum);
+    if (!parse_success) {
+        return false;
+    }
+
+    // NOTE: checksum of the block map file is calculated
+    // with the checksum itself replaced by zeroes
+    if (!file_checksum.isEmpty()) {
+        QByteArray zeroed_bytes = bytes;
+        const int checksum_index = zeroed_bytes.indexOf(file_checksum);
+        zeroed_bytes.replace(checksum_index, file_checksum.size(), QByteArray(file_checksum.size(), '0'));
+
+        const QByteArray computed_checksum = QCryptographicHash::hash(zeroed_bytes, checksum_type).toHex();
+
+        if (computed_checksum != file_checksum.toLower()) {
+            error_string = tr("Block map file is corrupted.");
+            return false;
+        }
+    }
+
+    return true;
+}
+
+QString BlockMap::errorString() const {
+    return error_string;
+}
+
+qint64 BlockMap::imageSize() const {
+    return image_size;
+}
+
+qint64 BlockMap::mappedSize() const {
+    qint64 out = 0;
+
+    for (const Range &range : range_list) {
+        out += range.size;
+    }
+
+    return out;
+}
+
+QCryptographicHash::Algorithm BlockMap::checksumType() const {
+    return checksum_type;
+}
+
+const QList<BlockMap::Range> &BlockMap::ranges() const {
+    return range_list;
+}
+
+bool BlockMap::parse(const QByteArray &bytes, QByteArray *file_checksum) {
+    QXmlStreamReader xml(bytes);
+
+    // NOTE: versions before 1.4 don't have ChecksumType and
+    // always use sha1
+    QString checksum_type_string = "sha1";
+
+    const auto read_number =
+        [&xml](qint64 *out) -> bool {
+            bool ok = false;
+            *out = xml.readElementText().trimmed().toLongLong(&ok);
+
+            return (ok && *out >= 0);
+        };
+
+    while (!xml.atEnd()) {
+        xml.readNext();
+
+        if (!xml.isStartElement()) {
+            continue;
+        }
+
+        const QString name = xml.name().toString();
+
+        if (name == "bmap") {
+            const QString version = xml.attributes().value("version").toString();
+            const int major_version = version.section('.', 0, 0).toInt();
+
+            if (major_version != 1 && major_version != 2) {
+                error_string = tr("Unsupported block map version %1").arg(version);
+                return false;
+            }
+        } else if (name == "ImageSize") {
+            if (!read_number(&image_size)) {
+                error_string = tr("Block map has invalid image size.");
+                return false;
+            }
+        } else if (name == "BlockSize") {
+            if (!read_number(&block_size) || block_size == 0) {
+                error_string = tr("Block map has invalid block size.");
+                return false;
+            }
+        } else if (name == "ChecksumType") {
+            checksum_type_string = xml.readElementText().trimmed();
+        } else if (name == "BmapFileChecksum" || name == "BmapFileSHA1") {
+            *file_checksum = xml.readElementText().trimmed().toLatin1();
+        } else if (name == "Range") {
+            const QXmlStreamAttributes attributes = xml.attributes();
+            const QByteArray checksum = [&]() {
+                if (attributes.hasAttribute("chksum")) {
+                    return attributes.value("chksum").toLatin1();
+                } else {
+                    return attributes.value("sha1").toLatin1();
+                }
+            }();
+
+            const QString text = xml.readElementText().trimmed();
+
+            if (!parseRange(text, checksum)) {
+                error_string = tr("Block map has invalid range %1").arg(text);
+                return false;
+            }
+        }
+    }
+
+    if (xml.hasError()) {
+        error_string = tr("Failed to parse block map: %1").arg(xml.errorString());
+        return false;
+    }
+
+    if (checksum_type_string == "sha1") {
+        checksum_type = QCryptographicHash::Sha1;
+    } else if (checksum_type_string == "sha256") {
+        checksum_type = QCryptographicHash::Sha256;
+    } else {
+        error_string = tr("Unsupported block map checksum type %1").arg(checksum_type_string);
+        return false;
+    }
+
+    if (image_size == 0 || block_size == 0) {
+        error_string = tr("Block map is incomplete.");
+        return false;
+    }
+
+    return true;
+}
+
+// Range is "first-last" or "first" in blocks
+bool BlockMap::parseRange(const QString &text, const QByteArray &checksum) {
+    if (block_size == 0 || image_size == 0) {
+        return false;
+    }
+
+    const QList<QString> elements = text.split('-');
+    if (elements.size() != 1 && elements.size() != 2) {
+        return false;
+    }
+
+    bool first_ok = false;
+    bool last_ok = false;
+    const qint64 first = elements.first().trimmed().toLongLong(&first_ok);
+    const qint64 last = elements.last().trimmed().toLongLong(&last_ok);
+    if (!first_ok || !last_ok || first < 0 || last < first) {
+        return false;
+    }
+
+    Range range;
+    range.offset = first * block_size;
+    // NOTE: last block may be partial
+    range.size = qMin((last + 1) * block_size, image_size) - range.offset;
+    range.checksum = checksum.toLower();
+
+    // Ranges have to be sorted and can't overlap
+    const qint64 previous_end = [this]() -> qint64 {
+        if (range_list.isEmpty()) {
+            return 0;
+        } else {
+            return range_list.last().offset + range_list.last().size;
+        }
+    }();
+    if (range.size <= 0 || range.offset < previous_end) {
+        return false;
+    }
+
+    range_list.append(range);
+
+    return true;
+}
@@ -0,0 +1,83 @@
+/*
+ * ALT Media Writer
+ * Copyright (C) 2016-2019 Martin Bříza <mbriza@redhat.com>
+ * Copyright (C) 2020-2022 Dmitry Degtyarev <kevl@basealt.ru>
+ *
+ * ALT Media Writer is a fork of Fedora Media Writer
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef BLOCKMAP_H
+#define BLOCKMAP_H
+
+/**
+ * Block map of an image in bmaptool's XML format. A block
+ * map lists ranges of the image that contain data, with a
+ * checksum for each range. Ranges that aren't mapped are
+ * unused by the image's filesystems, so they don't need
+ * to be written or checked.
+ *
+ * The block map file is looked up next to the image, both
+ * as "image.img.xz.bmap" and "image.img.bmap". Versions 1.x
+ * and 2.x of the format are supported. The checksum of the
+ * block map file itself is checked when it's loaded.
+ */
+
+#include <QByteArray>
+#include <QCoreApplication>
+#include <QCryptographicHash>
+#include <QList>
+#include <QString>
+
+class BlockMap {
+    Q_DECLARE_TR_FUNCTIONS(BlockMap)
+
+public:
+    struct Range {
+        // In bytes
+        qint64 offset;
+        qint64 size;
+        // Hex checksum of the range, may be empty for old
+        // versions of the format
+        QByteArray checksum;
+    };
+
+    // Returns the path of block map for this image or an
+    // empty string if there is none
+    static QString find(const QString &image_path);
+
+    BlockMap();
+
+    bool load(const QString &path);
+    QString errorString() const;
+
+    qint64 imageSize() const;
+    qint64 mappedSize() const;
+    QCryptographicHash::Algorithm checksumType() const;
+    const QList<Range> &ranges() const;
+
+private:
+    qint64 image_size;
+    qint64 block_size;
+    QCryptographicHash::Algorithm checksum_type;
+    QList<Range> range_list;
+    QString error_string;
+
+    bool parse(const QByteArray &bytes, QByteArray *file_checksum);
+    bool parseRange(const QString &text, const QByteArray &checksum);
+};
+
+#endif // BLOCKMAP_H
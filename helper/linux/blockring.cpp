@@ -0,0 +1,260 @@
+/*
+ * ALT Media Writer
+ * Copyright (C) 2016-2019 Martin Bříza <mbriza@redhat.com>
+ * Copyright (C) 2020-2022 Dmitry Degtyarev <kevl@basealt.ru>
+ *
+ * ALT Media Writer is a fork of Fedora Media Writer
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include "blockring.h"
+
+#include <unistd.h>
+
+#include <algorithm>
+
+BlockRing::Block::Block(const size_t page_count)
+: buffer(page_count)
+, size(0)
+, offset(0)
+, progress(0)
+, zero(false) {
+
+}
+
+BlockRing::BlockRing(const size_t depth, const size_t block_size, const int consumer_count, const int stall_timeout_sec)
+: write_count(0)
+, read_count(consumer_count, 0)
+, release_count(consumer_count, 0)
+, detached_list(consumer_count, false)
+, stalled_list(consumer_count, false)
+, finished_list(consumer_count, false)
+, activity_time(consumer_count, Clock::now())
+, stall_timeout(std::chrono::seconds(stall_timeout_sec))
+, closed(false)
+, was_aborted(false) {
+    static const size_t page_size = getpagesize();
+    const size_t page_count = qMax(block_size / page_size, (size_t) 1);
+
+    for (size_t i = 0; i < depth; i++) {
+        block_list.emplace_back(new Block(page_count));
+    }
+}
+
+size_t BlockRing::depth() const {
+    return block_list.size();
+}
+
+BlockRing::Block *BlockRing::beginWrite() {
+    std::unique_lock<std::mutex> lock(mutex);
+
+    waitChecking(lock,
+        [this]() {
+            const size_t used_count = write_count - slowestRelease();
+            return (was_aborted || used_count < block_list.size());
+        });
+
+    if (was_aborted) {
+        return nullptr;
+    }
+
+    return block_list[write_count % block_list.size()].get();
+}
+
+void BlockRing::endWrite() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        // NOTE: consumers that were waiting for this block
+        // weren't stalled, their stall time starts now
+        const Clock::time_point now = Clock::now();
+        for (size_t i = 0; i < release_count.size(); i++) {
+            if (release_count[i] == write_count) {
+                activity_time[i] = now;
+            }
+        }
+
+        write_count++;
+    }
+    condition.notify_all();
+}
+
+void BlockRing::close() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        closed = true;
+
+        const Clock::time_point now = Clock::now();
+        for (size_t i = 0; i < release_count.size(); i++) {
+            if (release_count[i] == write_count) {
+                activity_time[i] = now;
+            }
+        }
+    }
+    condition.notify_all();
+}
+
+BlockRing::Block *BlockRing::beginRead(const int consumer) {
+    std::unique_lock<std::mutex> lock(mutex);
+
+    condition.wait(lock,
+        [this, consumer]() {
+            return (was_aborted || detached_list[consumer] || closed || read_count[consumer] < write_count);
+        });
+
+    if (was_aborted || detached_list[consumer] || read_count[consumer] == write_count) {
+        return nullptr;
+    }
+
+    Block *block = block_list[read_count[consumer] % block_list.size()].get();
+    read_count[consumer]++;
+    activity_time[consumer] = Clock::now();
+
+    return block;
+}
+
+void BlockRing::endRead(const int consumer) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        release_count[consumer]++;
+        activity_time[consumer] = Clock::now();
+    }
+    condition.notify_all();
+}
+
+void BlockRing::detach(const int consumer) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        detachLocked(consumer);
+    }
+    condition.notify_all();
+}
+
+bool BlockRing::detached(const int consumer) {
+    std::lock_guard<std::mutex> lock(mutex);
+    return detached_list[consumer];
+}
+
+bool BlockRing::stalled(const int consumer) {
+    std::lock_guard<std::mutex> lock(mutex);
+    return stalled_list[consumer];
+}
+
+void BlockRing::finishRead(const int consumer) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        finished_list[consumer] = true;
+    }
+    condition.notify_all();
+}
+
+void BlockRing::waitFinished() {
+    std::unique_lock<std::mutex> lock(mutex);
+
+    waitChecking(lock,
+        [this]() {
+            for (size_t i = 0; i < finished_list.size(); i++) {
+                if (!finished_list[i] && !stalled_list[i]) {
+                    return false;
+                }
+            }
+
+            return true;
+        });
+}
+
+void BlockRing::abort() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        was_aborted = true;
+    }
+    condition.notify_all();
+}
+
+bool BlockRing::aborted() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return was_aborted;
+}
+
+// Release count of the consumer that is furthest behind,
+// blocks after it are still in use. Must be called with
+// mutex locked.
+size_t BlockRing::slowestRelease() const {
+    size_t out = write_count;
+
+    for (size_t i = 0; i < release_count.size(); i++) {
+        if (!detached_list[i]) {
+            out = qMin(out, release_count[i]);
+        }
+    }
+
+    return out;
+}
+
+// Must be called with mutex locked
+void BlockRing::detachLocked(const int consumer) {
+    detached_list[consumer] = true;
+
+    // NOTE: nobody is left to write the data, so stop
+    // the producer
+    const bool all_detached = (std::find(detached_list.begin(), detached_list.end(), false) == detached_list.end());
+    if (all_detached) {
+        was_aborted = true;
+    }
+}
+
+// Detach consumers that are behind and haven't read or
+// returned a block for the stall timeout. A consumer that
+// has nothing to read is waiting for the producer, so it's
+// not stalled. Once the ring is closed, flushing the drive
+// also counts. Must be called with mutex locked.
+void BlockRing::detachStalled() {
+    const Clock::time_point now = Clock::now();
+    bool any_stalled = false;
+
+    for (size_t i = 0; i < stalled_list.size(); i++) {
+        const bool waiting_for_producer = (release_count[i] == write_count && !closed);
+        const bool is_stalled = (!detached_list[i] && !finished_list[i] && !waiting_for_producer && now - activity_time[i] >= stall_timeout);
+
+        if (is_stalled) {
+            stalled_list[i] = true;
+            detachLocked(i);
+            any_stalled = true;
+        }
+    }
+
+    if (any_stalled) {
+        condition.notify_all();
+    }
+}
+
+// Wait on the condition until predicate is true, detaching
+// stalled consumers along the way. Must be called with
+// mutex locked.
+void BlockRing::waitChecking(std::unique_lock<std::mutex> &lock, const std::function<bool()> &predicate) {
+    if (stall_timeout == Clock::duration::zero()) {
+        condition.wait(lock, predicate);
+
+        return;
+    }
+
+    const Clock::duration check_interval = qMin(stall_timeout, (Clock::duration) std::chrono::seconds(1));
+
+    while (!predicate()) {
+        condition.wait_for(lock, check_interval);
+        detachStalled();
+    }
+}
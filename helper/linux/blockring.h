@@ -0,0 +1,147 @@
+/*
+ * ALT Media Writer
+ * Copyright (C) 2016-2019 Martin Bříza <mbriza@redhat.com>
+ * Copyright (C) 2020-2022 Dmitry Degtyarev <kevl@basealt.ru>
+ *
+ * ALT Media Writer is a fork of Fedora Media Writer
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef BLOCKRING_H
+#define BLOCKRING_H
+
+/**
+ * A fixed ring of page aligned blocks shared between
+ * a producer thread, which fills blocks with image data,
+ * and consumer threads, which write them to drives.
+ * The producer blocks when all blocks are full and a
+ * consumer blocks when it has no blocks left to read, so
+ * source reads and device writes overlap while memory use
+ * stays bounded by ring depth * block size.
+ *
+ * Blocks are handed out and returned in FIFO order. A
+ * consumer may hold several blocks at once (for engines
+ * that keep multiple writes in flight), but must return
+ * them in the same order they were taken.
+ *
+ * When writing to several drives, each drive has its own
+ * consumer which reads every block. A block is reused
+ * once all consumers returned it, so the fastest drive is
+ * at most ring depth blocks ahead of the slowest one. A
+ * consumer that fails is detached, after which the others
+ * don't wait for it.
+ *
+ * A drive can also hang in a write without ever failing.
+ * A consumer that is behind the others and hasn't read or
+ * returned a block for the stall timeout is detached as
+ * stalled, so a hung drive only holds the others back for
+ * that long. Its thread may still be stuck in the kernel,
+ * so the thread has to keep the ring alive by itself, see
+ * waitFinished().
+ *
+ * When the producer is done it closes the ring, after
+ * which consumers drain the remaining blocks. The producer
+ * can abort the ring on error, which wakes up and stops
+ * all consumers. Ring is also aborted once all consumers
+ * are detached, which stops the producer.
+ */
+
+#include "pagealignedbuffer.h"
+
+#include <QtGlobal>
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+class BlockRing {
+public:
+    struct Block {
+        Block(const size_t page_count);
+
+        PageAlignedBuffer buffer;
+        // Amount of valid data in buffer
+        size_t size;
+        // Position of this block on the drive
+        qint64 offset;
+        // Source progress to report once this block is
+        // written, relative to the image file, see
+        // HelperEvent
+        qint64 progress;
+        // True if all data in this block is zero, in which
+        // case the writer may zero the range on the drive
+        // instead of writing the buffer
+        bool zero;
+    };
+
+    // Stall timeout of 0 means that consumers are never
+    // detached as stalled
+    BlockRing(const size_t depth, const size_t block_size, const int consumer_count = 1, const int stall_timeout_sec = 0);
+
+    size_t depth() const;
+
+    // Producer side
+    Block *beginWrite();
+    void endWrite();
+    void close();
+
+    // Consumer side. beginRead() returns nullptr when
+    // the ring is closed and empty for this consumer or
+    // when it's aborted or the consumer is detached.
+    Block *beginRead(const int consumer);
+    void endRead(const int consumer);
+    // Stop waiting for the consumer, blocks it holds are
+    // considered returned
+    void detach(const int consumer);
+    bool detached(const int consumer);
+    bool stalled(const int consumer);
+    // Called by the consumer once it's done with the ring,
+    // including flushing the drive
+    void finishRead(const int consumer);
+    // Wait until every consumer is finished or stalled
+    void waitFinished();
+
+    void abort();
+    bool aborted();
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    std::vector<std::unique_ptr<Block>> block_list;
+    std::mutex mutex;
+    std::condition_variable condition;
+    size_t write_count;
+    std::vector<size_t> read_count;
+    std::vector<size_t> release_count;
+    std::vector<bool> detached_list;
+    std::vector<bool> stalled_list;
+    std::vector<bool> finished_list;
+    // Last time each consumer read or returned a block
+    std::vector<Clock::time_point> activity_time;
+    Clock::duration stall_timeout;
+    bool closed;
+    bool was_aborted;
+
+    size_t slowestRelease() const;
+    void detachLocked(const int consumer);
+    void detachStalled();
+    void waitChecking(std::unique_lock<std::mutex> &lock, const std::function<bool()> &predicate);
+};
+
+#endif // BLOCKRING_H
@@ -0,0 +1,379 @@
+/*
+ * ALT Media Writer
+ * Copyright (C) 2016-2019 Martin Bříza <mbriza@redhat.com>
+ * Copyright (C) 2020-2022 Dmitry Degtyarev <kevl@basealt.ru>
+ *
+ * ALT Media Writer is a fork of Fedora Media Writer
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include "decompressor.h"
+
+#include <QList>
+#include <QPair>
+
+#include <string.h>
+
+#include <lzma.h>
+#include <zlib.h>
+#include <zstd.h>
+
+enum Compression {
+    Compression_NONE,
+    Compression_XZ,
+    Compression_GZIP,
+    Compression_ZSTD,
+};
+
+static Compression compression_from_filename(const QString &path);
+
+class LzmaDecompressor : public Decompressor {
+public:
+    LzmaDecompressor(const WriteOptions &options);
+    ~LzmaDecompressor();
+
+    bool start() override;
+    Result decode(DecompressorStream *stream, const bool input_finished) override;
+
+private:
+    lzma_stream strm;
+    unsigned int threads;
+    bool started;
+};
+
+class GzipDecompressor : public Decompressor {
+public:
+    GzipDecompressor();
+    ~GzipDecompressor();
+
+    bool start() override;
+    Result decode(DecompressorStream *stream, const bool input_finished) override;
+
+private:
+    z_stream strm;
+    bool started;
+    // Whether the last gzip member ended and next one
+    // didn't start yet
+    bool member_finished;
+};
+
+class ZstdDecompressor : public Decompressor {
+public:
+    ZstdDecompressor();
+    ~ZstdDecompressor();
+
+    bool start() override;
+    Result decode(DecompressorStream *stream, const bool input_finished) override;
+
+private:
+    ZSTD_DStream *dstream;
+    // Whether last decoded frame was complete
+    bool frame_complete;
+};
+
+Decompressor *Decompressor::create(const QString &path, const WriteOptions &options) {
+    const Compression compression = compression_from_filename(path);
+
+    switch (compression) {
+        case Compression_XZ: return new LzmaDecompressor(options);
+        case Compression_GZIP: return new GzipDecompressor();
+        case Compression_ZSTD: return new ZstdDecompressor();
+        case Compression_NONE: return nullptr;
+    }
+
+    return nullptr;
+}
+
+Decompressor::Decompressor()
+: m_error(Error_NONE) {
+
+}
+
+Decompressor::~Decompressor() {
+
+}
+
+Decompressor::Error Decompressor::error() const {
+    return m_error;
+}
+
+LzmaDecompressor::LzmaDecompressor(const WriteOptions &options)
+: strm(LZMA_STREAM_INIT)
+, threads(options.decoder_threads)
+, started(false) {
+
+}
+
+LzmaDecompressor::~LzmaDecompressor() {
+    if (started) {
+        lzma_end(&strm);
+    }
+}
+
+// NOTE: multithreaded decoder splits work by xz blocks,
+// so it only helps for files compressed in multiple
+// blocks, like the ones made by "xz -T". Single block
+// files are decoded in one thread.
+bool LzmaDecompressor::start() {
+#if LZMA_VERSION >= 50040002
+    lzma_mt mt;
+    memset(&mt, 0, sizeof(mt));
+    mt.flags = LZMA_CONCATENATED;
+    mt.threads = [&]() -> uint32_t {
+        if (threads > 0) {
+            return threads;
+        } else {
+            return qMax(lzma_cputhreads(), (uint32_t) 1);
+        }
+    }();
+    // NOTE: if threads would need more memory than this,
+    // decoder falls back to single thread mode
+    mt.memlimit_threading = qMax(lzma_physmem() / 4, (uint64_t) MEDIAWRITER_LZMA_LIMIT);
+    mt.memlimit_stop = mt.memlimit_threading;
+
+    const lzma_ret ret = lzma_stream_decoder_mt(&strm, &mt);
+#else
+    const lzma_ret ret = lzma_stream_decoder(&strm, MEDIAWRITER_LZMA_LIMIT, LZMA_CONCATENATED);
+#endif
+
+    started = (ret == LZMA_OK);
+
+    return started;
+}
+
+Decompressor::Result LzmaDecompressor::decode(DecompressorStream *stream, const bool input_finished) {
+    strm.next_in = stream->next_in;
+    strm.avail_in = stream->avail_in;
+    strm.next_out = stream->next_out;
+    strm.avail_out = stream->avail_out;
+
+    const lzma_ret ret = lzma_code(&strm, input_finished ? LZMA_FINISH : LZMA_RUN);
+
+    stream->next_in = strm.next_in;
+    stream->avail_in = strm.avail_in;
+    stream->next_out = strm.next_out;
+    stream->avail_out = strm.avail_out;
+
+    switch (ret) {
+        case LZMA_OK: return Result_OK;
+        case LZMA_STREAM_END: return Result_STREAM_END;
+        case LZMA_MEM_ERROR:
+        case LZMA_MEMLIMIT_ERROR:
+            m_error = Error_MEMORY;
+            break;
+        case LZMA_FORMAT_ERROR:
+        case LZMA_DATA_ERROR:
+        case LZMA_BUF_ERROR:
+            m_error = Error_CORRUPTED;
+            break;
+        case LZMA_OPTIONS_ERROR:
+            m_error = Error_OPTIONS;
+            break;
+        default:
+            m_error = Error_UNKNOWN;
+            break;
+    }
+
+    return Result_ERROR;
+}
+
+GzipDecompressor::GzipDecompressor()
+: started(false)
+, member_finished(false) {
+    memset(&strm, 0, sizeof(strm));
+}
+
+GzipDecompressor::~GzipDecompressor() {
+    if (started) {
+        inflateEnd(&strm);
+    }
+}
+
+bool GzipDecompressor::start() {
+    // NOTE: 32 added to window bits enables gzip header
+    // detection
+    const int ret = inflateInit2(&strm, 15 + 32);
+
+    started = (ret == Z_OK);
+
+    return started;
+}
+
+Decompressor::Result GzipDecompressor::decode(DecompressorStream *stream, const bool input_finished) {
+    if (member_finished && input_finished && stream->avail_in == 0) {
+        return Result_STREAM_END;
+    }
+
+    // NOTE: zlib's avail fields are 32bit, so feed it at
+    // most 1GB at a time
+    const uInt max_chunk = 1024 * 1024 * 1024;
+    const uInt avail_in = (uInt) qMin(stream->avail_in, (size_t) max_chunk);
+    const uInt avail_out = (uInt) qMin(stream->avail_out, (size_t) max_chunk);
+
+    strm.next_in = (Bytef *) stream->next_in;
+    strm.avail_in = avail_in;
+    strm.next_out = stream->next_out;
+    strm.avail_out = avail_out;
+
+    const int ret = inflate(&strm, Z_NO_FLUSH);
+
+    if (strm.avail_in != avail_in) {
+        member_finished = false;
+    }
+
+    stream->next_in += avail_in - strm.avail_in;
+    stream->avail_in -= avail_in - strm.avail_in;
+    stream->next_out += avail_out - strm.avail_out;
+    stream->avail_out -= avail_out - strm.avail_out;
+
+    switch (ret) {
+        case Z_OK: {
+            return Result_OK;
+        }
+        case Z_STREAM_END: {
+            // NOTE: gzip files can consist of multiple
+            // members, continue decoding if there's more
+            // input
+            if (stream->avail_in > 0 || !input_finished) {
+                inflateReset(&strm);
+                member_finished = true;
+
+                return Result_OK;
+            } else {
+                return Result_STREAM_END;
+            }
+        }
+        case Z_BUF_ERROR: {
+            // No progress possible. Not an error unless input
+            // ended in the middle of the stream.
+            if (input_finished && stream->avail_in == 0) {
+                m_error = Error_CORRUPTED;
+
+                return Result_ERROR;
+            } else {
+                return Result_OK;
+            }
+        }
+        case Z_MEM_ERROR: {
+            m_error = Error_MEMORY;
+
+            return Result_ERROR;
+        }
+        case Z_DATA_ERROR:
+        case Z_NEED_DICT: {
+            m_error = Error_CORRUPTED;
+
+            return Result_ERROR;
+        }
+        default: {
+            m_error = Error_UNKNOWN;
+
+            return Result_ERROR;
+        }
+    }
+}
+
+ZstdDecompressor::ZstdDecompressor()
+: dstream(nullptr)
+, frame_complete(false) {
+
+}
+
+ZstdDecompressor::~ZstdDecompressor() {
+    if (dstream != nullptr) {
+        ZSTD_freeDStream(dstream);
+    }
+}
+
+bool ZstdDecompressor::start() {
+    dstream = ZSTD_createDStream();
+    if (dstream == nullptr) {
+        return false;
+    }
+
+    const size_t ret = ZSTD_initDStream(dstream);
+
+    return !ZSTD_isError(ret);
+}
+
+Decompressor::Result ZstdDecompressor::decode(DecompressorStream *stream, const bool input_finished) {
+    ZSTD_inBuffer in = {stream->next_in, stream->avail_in, 0};
+    ZSTD_outBuffer out = {stream->next_out, stream->avail_out, 0};
+
+    const size_t ret = ZSTD_decompressStream(dstream, &out, &in);
+
+    stream->next_in += in.pos;
+    stream->avail_in -= in.pos;
+    stream->next_out += out.pos;
+    stream->avail_out -= out.pos;
+
+    if (ZSTD_isError(ret)) {
+        const ZSTD_ErrorCode code = ZSTD_getErrorCode(ret);
+        if (code == ZSTD_error_memory_allocation) {
+            m_error = Error_MEMORY;
+        } else if (code == ZSTD_error_frameParameter_windowTooLarge || code == ZSTD_error_frameParameter_unsupported) {
+            m_error = Error_OPTIONS;
+        } else {
+            m_error = Error_CORRUPTED;
+        }
+
+        return Result_ERROR;
+    }
+
+    // NOTE: ret is 0 when a frame is completely decoded
+    // and flushed. Concatenated frames are decoded
+    // transparently by the same dstream. Calls that made
+    // no progress return a hint for the next frame, so
+    // they don't change frame state.
+    if (in.pos > 0 || out.pos > 0) {
+        frame_complete = (ret == 0);
+    }
+
+    const bool all_input_consumed = (input_finished && stream->avail_in == 0);
+    if (all_input_consumed) {
+        if (frame_complete) {
+            return Result_STREAM_END;
+        } else if (out.pos == 0 && stream->avail_out > 0) {
+            // Input ended in the middle of a frame
+            m_error = Error_CORRUPTED;
+
+            return Result_ERROR;
+        }
+    }
+
+    return Result_OK;
+}
+
+Compression compression_from_filename(const QString &path) {
+    // NOTE: suffixes are the same as compressed file types
+    // of the app, see file_type_strings()
+    static const QList<QPair<QString, Compression>> suffix_list = {
+        {".xz", Compression_XZ},
+        {".ixz", Compression_XZ},
+        {".gz", Compression_GZIP},
+        {".igz", Compression_GZIP},
+        {".zst", Compression_ZSTD},
+        {".izst", Compression_ZSTD},
+    };
+
+    for (const QPair<QString, Compression> &pair : suffix_list) {
+        if (path.endsWith(pair.first, Qt::CaseInsensitive)) {
+            return pair.second;
+        }
+    }
+
+    return Compression_NONE;
+}
@@ -0,0 +1,94 @@
+/*
+ * ALT Media Writer
+ * Copyright (C) 2016-2019 Martin Bříza <mbriza@redhat.com>
+ * Copyright (C) 2020-2022 Dmitry Degtyarev <kevl@basealt.ru>
+ *
+ * ALT Media Writer is a fork of Fedora Media Writer
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef DECOMPRESSOR_H
+#define DECOMPRESSOR_H
+
+/**
+ * Streaming decompressor interface used by the helper to
+ * write compressed images. Input and output are passed
+ * in the style of lzma_stream/z_stream: decode() consumes
+ * as much input and fills as much output as it can and
+ * advances the pointers. Implementations exist for xz
+ * (liblzma), gzip (zlib) and zstd (libzstd).
+ *
+ * Concatenated streams are decoded as one image for all
+ * formats.
+ */
+
+#include "writeoptions.h"
+
+#include <QString>
+
+#include <stdint.h>
+
+#ifndef MEDIAWRITER_LZMA_LIMIT
+// 256MB memory limit for the decompressor
+#define MEDIAWRITER_LZMA_LIMIT (1024 * 1024 * 256)
+#endif
+
+struct DecompressorStream {
+    const uint8_t *next_in;
+    size_t avail_in;
+    uint8_t *next_out;
+    size_t avail_out;
+};
+
+class Decompressor {
+public:
+    enum Result {
+        Result_OK,
+        Result_STREAM_END,
+        Result_ERROR,
+    };
+
+    enum Error {
+        Error_NONE,
+        Error_MEMORY,
+        Error_CORRUPTED,
+        Error_OPTIONS,
+        Error_UNKNOWN,
+    };
+
+    // Creates decompressor based on file extension or
+    // returns nullptr if file is not compressed
+    static Decompressor *create(const QString &path, const WriteOptions &options);
+
+    Decompressor();
+    virtual ~Decompressor();
+
+    virtual bool start() = 0;
+    // input_finished should be true once all input was
+    // passed to decoder
+    virtual Result decode(DecompressorStream *stream, const bool input_finished) = 0;
+
+    Error error() const;
+
+protected:
+    Error m_error;
+
+private:
+    Decompressor(const Decompressor &) = delete;
+    Decompressor &operator=(const Decompressor &) = delete;
+};
+
+#endif // DECOMPRESSOR_H
@@ -0,0 +1,178 @@
+/*
+ * ALT Media Writer
+ * Copyright (C) 2016-2019 Martin Bříza <mbriza@redhat.com>
+ * Copyright (C) 2020-2022 Dmitry Degtyarev <kevl@basealt.ru>
+ *
+ * ALT Media Writer is a fork of Fedora Media Writer
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include "devicewriter.h"
+
+#ifdef HAVE_LIBURING
+#include "uringdevicewriter.h"
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/falloc.h>
+#include <linux/fs.h>
+#include <stdint.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+DeviceWriter *DeviceWriter::create(const WriteOptions &options, const int fd) {
+#ifdef HAVE_LIBURING
+    if (options.engine == WriteEngine_IO_URING || options.engine == WriteEngine_AUTO) {
+        UringDeviceWriter *uring_writer = new UringDeviceWriter(fd, options.sparse_mode, options.checkpoint_size, options.queue_depth);
+
+        if (uring_writer->isValid()) {
+            return uring_writer;
+        } else {
+            delete uring_writer;
+        }
+    }
+#endif
+
+    return new SyncDeviceWriter(fd, options.sparse_mode, options.checkpoint_size);
+}
+
+DeviceWriter::DeviceWriter(const int fd_arg, const SparseMode sparse_mode_arg, const long long checkpoint_size_arg)
+: fd(fd_arg)
+, sparse_mode(sparse_mode_arg)
+, checkpoint_size(checkpoint_size_arg)
+, unflushed_size(0) {
+
+}
+
+DeviceWriter::~DeviceWriter() {
+
+}
+
+bool DeviceWriter::finish() {
+    const bool flush_success = (fdatasync(fd) == 0);
+    unflushed_size = 0;
+
+    // NOTE: BLKFLSBUF needs CAP_SYS_ADMIN, which the helper
+    // may not have, in which case the cache is dropped
+    // with fadvise instead
+    const int ioctl_result = ioctl(fd, BLKFLSBUF, 0);
+    if (ioctl_result != 0) {
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    }
+
+    return flush_success;
+}
+
+bool DeviceWriter::blockDone(const BlockRing::Block *block) {
+    unflushed_size += block->size;
+
+    if (checkpoint_size == 0 || unflushed_size < checkpoint_size) {
+        return true;
+    }
+
+    unflushed_size = 0;
+
+    return (fdatasync(fd) == 0);
+}
+
+bool DeviceWriter::writeZeroes(const BlockRing::Block *block) {
+    // NOTE: ioctl's require ranges aligned to 512 bytes
+    if (!block->zero || block->size % 512 != 0) {
+        return false;
+    }
+
+    uint64_t range[2] = {(uint64_t) block->offset, (uint64_t) block->size};
+
+    switch (sparse_mode) {
+        case SparseMode_OFF: return false;
+        case SparseMode_SKIP: return true;
+        case SparseMode_ZEROOUT: return (ioctl(fd, BLKZEROOUT, &range) == 0);
+        case SparseMode_DISCARD: {
+            // NOTE: punching a hole in a block device unmaps
+            // the range, but only if the drive guarantees
+            // that it reads back as zeroes, otherwise it
+            // fails without writing anything. BLKDISCARD
+            // gives no such guarantee and BLKDISCARDZEROES
+            // is always 0 on current kernels.
+            const int punch_result = fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, block->offset, block->size);
+            if (punch_result == 0) {
+                return true;
+            }
+
+            // NOTE: drive (or kernel older than 4.9) can't
+            // do it, don't try again for every block
+            sparse_mode = SparseMode_ZEROOUT;
+
+            return (ioctl(fd, BLKZEROOUT, &range) == 0);
+        }
+    }
+
+    return false;
+}
+
+const char *SyncDeviceWriter::name() const {
+    return "sync";
+}
+
+bool SyncDeviceWriter::drain(BlockRing *ring, const int consumer, const BlockWrittenCallback &on_block_written) {
+    // NOTE: one EIO is retried per drive and write
+    bool retried_eio = false;
+
+    while (true) {
+        BlockRing::Block *block = ring->beginRead(consumer);
+        if (block == nullptr) {
+            break;
+        }
+
+        if (writeZeroes(block)) {
+            if (!blockDone(block)) {
+                ring->detach(consumer);
+                return false;
+            }
+
+            on_block_written(block);
+            ring->endRead(consumer);
+
+            continue;
+        }
+
+        const qint64 len = block->size;
+    try_again:
+        const qint64 written = ::pwrite(fd, block->buffer.buffer, len, block->offset);
+        if (written != len) {
+            if (written < 0) {
+                if (errno == EIO && !retried_eio) {
+                    retried_eio = true;
+                    goto try_again;
+                }
+            }
+            ring->detach(consumer);
+            return false;
+        }
+
+        if (!blockDone(block)) {
+            ring->detach(consumer);
+            return false;
+        }
+
+        on_block_written(block);
+
+        ring->endRead(consumer);
+    }
+
+    return !ring->aborted();
+}
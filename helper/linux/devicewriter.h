@@ -0,0 +1,113 @@
+/*
+ * ALT Media Writer
+ * Copyright (C) 2016-2019 Martin Bříza <mbriza@redhat.com>
+ * Copyright (C) 2020-2022 Dmitry Degtyarev <kevl@basealt.ru>
+ *
+ * ALT Media Writer is a fork of Fedora Media Writer
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef DEVICEWRITER_H
+#define DEVICEWRITER_H
+
+/**
+ * Writes blocks from a BlockRing to the drive. Different
+ * engines implement different ways of submitting writes
+ * to the kernel:
+ *
+ * sync - one blocking write at a time
+ * io_uring - several writes in flight at once, which is
+ *     needed to saturate drives that are slow at queue
+ *     depth 1. Only available if the helper was built with
+ *     liburing and the running kernel supports it.
+ *
+ * Blocks are always completed in the order they were
+ * taken from the ring, so progress is reported in order
+ * regardless of the engine.
+ *
+ * Blocks marked as zero are handled according to the
+ * sparse mode, see WriteOptions. If the drive doesn't
+ * support zeroing, they are written like other blocks.
+ *
+ * Drive is opened without O_SYNC, so writes may stay in
+ * the drive's write cache. Instead, the drive is flushed
+ * with fdatasync() every checkpoint size of written data
+ * and once more by finish(). Only the drive's fd is
+ * flushed, other filesystems of the host are not touched.
+ */
+
+#include "blockring.h"
+#include "writeoptions.h"
+
+#include <functional>
+
+class DeviceWriter {
+public:
+    typedef std::function<void(const BlockRing::Block *block)> BlockWrittenCallback;
+
+    // Creates the engine selected in options. Falls back to
+    // sync engine if the selected engine is unavailable.
+    static DeviceWriter *create(const WriteOptions &options, const int fd);
+
+    DeviceWriter(const int fd, const SparseMode sparse_mode, const long long checkpoint_size);
+    virtual ~DeviceWriter();
+
+    virtual const char *name() const = 0;
+
+    // Write blocks until the ring is closed and drained,
+    // reading them as the given ring consumer. Callback is
+    // called after each block is written. Returns false on
+    // write failure, in which case the consumer is
+    // detached from the ring so that writes to other
+    // drives can continue.
+    virtual bool drain(BlockRing *ring, const int consumer, const BlockWrittenCallback &on_block_written) = 0;
+
+    // Flush everything written so far to the drive and
+    // drop cached data of the drive, so that the check
+    // reads what is actually on the drive. Returns false
+    // if the flush failed.
+    bool finish();
+
+protected:
+    const int fd;
+
+    // Zero the range of a zero block on the drive without
+    // writing the buffer. Returns false if the block has
+    // to be written normally.
+    bool writeZeroes(const BlockRing::Block *block);
+
+    // Engines call this once a block is written, in the
+    // order blocks were taken. Flushes the drive if a
+    // checkpoint was reached. Returns false if the flush
+    // failed.
+    bool blockDone(const BlockRing::Block *block);
+
+private:
+    SparseMode sparse_mode;
+    long long checkpoint_size;
+    // Written since the last flush
+    long long unflushed_size;
+};
+
+class SyncDeviceWriter : public DeviceWriter {
+public:
+    using DeviceWriter::DeviceWriter;
+
+    const char *name() const override;
+    bool drain(BlockRing *ring, const int consumer, const BlockWrittenCallback &on_block_written) override;
+};
+
+#endif // DEVICEWRITER_H
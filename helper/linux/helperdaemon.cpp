@@ -0,0 +1,287 @@
+/*
+ * ALT Media Writer
+ * Copyright (C) 2016-2019 Martin Bříza <mbriza@redhat.com>
+ * Copyright (C) 2020-2022 Dmitry Degtyarev <kevl@basealt.ru>
+ *
+ * ALT Media Writer is a fork of Fedora Media Writer
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include "helperdaemon.h"
+
+#include <QCoreApplication>
+#include <QLocalServer>
+#include <QLocalSocket>
+#include <QThread>
+#include <QTimer>
+
+#include "job.h"
+
+// Daemon exits after being idle for this long
+#define IDLE_TIMEOUT_MS (10 * 60 * 1000)
+
+HelperDaemon::HelperDaemon(const QString &base_name_arg)
+: QObject(nullptr)
+, base_name(base_name_arg) {
+    server = new QLocalServer(this);
+    server->setSocketOptions(QLocalServer::UserAccessOption);
+    connect(
+        server, &QLocalServer::newConnection,
+        this, &HelperDaemon::onNewConnection);
+
+    idle_timer = new QTimer(this);
+    idle_timer->setSingleShot(true);
+    idle_timer->setInterval(IDLE_TIMEOUT_MS);
+    connect(
+        idle_timer, &QTimer::timeout,
+        qApp, &QCoreApplication::quit);
+}
+
+bool HelperDaemon::listen() {
+    const QString name = helperSocketName(base_name);
+    if (name.isEmpty()) {
+        return false;
+    }
+
+    // NOTE: socket of a daemon that crashed is left behind
+    // and has to be removed, but only if nobody is
+    // listening on it
+    QLocalSocket probe;
+    probe.connectToServer(name);
+    if (probe.waitForConnected(1000)) {
+        return false;
+    }
+    QLocalServer::removeServer(name);
+
+    const bool listen_success = server->listen(name);
+    if (!listen_success) {
+        return false;
+    }
+
+    updateIdleTimer();
+
+    return true;
+}
+
+void HelperDaemon::onNewConnection() {
+    while (server->hasPendingConnections()) {
+        QLocalSocket *socket = server->nextPendingConnection();
+
+        // NOTE: only the user that runs the daemon may
+        // start jobs
+        if (!helperPeerIsTrusted(socket->socketDescriptor())) {
+            socket->abort();
+            socket->deleteLater();
+            continue;
+        }
+
+        buffers[socket] = QByteArray();
+
+        connect(
+            socket, &QLocalSocket::readyRead,
+            this,
+            [this, socket]() {
+                onReadyRead(socket);
+            });
+        connect(
+            socket, &QLocalSocket::disconnected,
+            this,
+            [this, socket]() {
+                onDisconnected(socket);
+            });
+    }
+
+    updateIdleTimer();
+}
+
+void HelperDaemon::onReadyRead(QLocalSocket *socket) {
+    QByteArray &buffer = buffers[socket];
+    buffer.append(socket->readAll());
+
+    QList<HelperMessage> message_list;
+    const bool decode_success = helperMessageDecode(&buffer, &message_list);
+
+    for (const HelperMessage &message : message_list) {
+        switch (message.type) {
+            case HelperMessageType_START: {
+                startJob(socket, message);
+                break;
+            }
+            case HelperMessageType_CANCEL: {
+                cancelJob(socket, message.job);
+                break;
+            }
+            default: break;
+        }
+    }
+
+    if (!decode_success) {
+        socket->abort();
+    }
+}
+
+void HelperDaemon::onDisconnected(QLocalSocket *socket) {
+    // NOTE: nobody is waiting for jobs of this app anymore
+    for (RunningJob &running : jobs) {
+        if (running.socket == socket) {
+            running.socket = nullptr;
+            running.job->cancel();
+        }
+    }
+
+    buffers.remove(socket);
+    socket->deleteLater();
+
+    updateIdleTimer();
+}
+
+void HelperDaemon::startJob(QLocalSocket *socket, const HelperMessage &message) {
+    JobChannel *out = new JobChannel(this);
+    JobChannel *err = new JobChannel(this);
+
+    Job *job = Job::create(message.arguments, out, err);
+
+    if (job == nullptr) {
+        HelperMessage error_message = helperMessage(HelperMessageType_ERROR, message.job);
+        error_message.data = "Helper: Wrong arguments entered";
+        socket->write(helperMessageEncode(error_message));
+
+        HelperMessage finished_message = helperMessage(HelperMessageType_FINISHED, message.job);
+        finished_message.exit_code = 1;
+        socket->write(helperMessageEncode(finished_message));
+
+        delete out;
+        delete err;
+
+        return;
+    }
+
+    connect(
+        out, &JobChannel::written,
+        this,
+        [this, job](const QByteArray &data) {
+            sendForJob(job, HelperMessageType_OUTPUT, data);
+        });
+    connect(
+        err, &JobChannel::written,
+        this,
+        [this, job](const QByteArray &data) {
+            sendForJob(job, HelperMessageType_ERROR, data);
+        });
+
+    QThread *thread = new QThread(this);
+    job->moveToThread(thread);
+
+    connect(
+        thread, &QThread::started,
+        job, &Job::start);
+    connect(
+        job, &Job::finished,
+        this,
+        [this, job](const int exit_code) {
+            onJobFinished(job, exit_code);
+        });
+
+    jobs.append({socket, message.job, job, thread, out, err});
+
+    thread->start();
+
+    updateIdleTimer();
+}
+
+void HelperDaemon::cancelJob(QLocalSocket *socket, const qint32 id) {
+    for (RunningJob &running : jobs) {
+        if (running.socket == socket && running.id == id) {
+            running.job->cancel();
+        }
+    }
+}
+
+// NOTE: output of the job arrives before this, since it's
+// sent from the same thread
+void HelperDaemon::onJobFinished(Job *job, const int exit_code) {
+    const int index = jobIndex(job);
+    if (index == -1) {
+        return;
+    }
+
+    const RunningJob running = jobs.takeAt(index);
+
+    if (running.socket != nullptr) {
+        HelperMessage message = helperMessage(HelperMessageType_FINISHED, running.id);
+        message.exit_code = exit_code;
+        running.socket->write(helperMessageEncode(message));
+    }
+
+    running.thread->quit();
+    running.thread->wait();
+
+    delete running.job;
+    delete running.thread;
+    running.out->deleteLater();
+    running.err->deleteLater();
+
+    updateIdleTimer();
+}
+
+void HelperDaemon::sendForJob(Job *job, const HelperMessageType type, const QByteArray &data) {
+    const int index = jobIndex(job);
+    if (index == -1 || jobs[index].socket == nullptr) {
+        return;
+    }
+
+    HelperMessage message = helperMessage(type, jobs[index].id);
+    message.data = data;
+    jobs[index].socket->write(helperMessageEncode(message));
+}
+
+int HelperDaemon::jobIndex(Job *job) const {
+    for (int i = 0; i < jobs.size(); i++) {
+        if (jobs[i].job == job) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+void HelperDaemon::updateIdleTimer() {
+    const bool idle = (buffers.isEmpty() && jobs.isEmpty());
+
+    if (idle) {
+        idle_timer->start();
+    } else {
+        idle_timer->stop();
+    }
+}
+
+JobChannel::JobChannel(QObject *parent)
+: QIODevice(parent) {
+    open(QIODevice::WriteOnly | QIODevice::Unbuffered);
+}
+
+qint64 JobChannel::readData(char *data, qint64 max_size) {
+    Q_UNUSED(data);
+    Q_UNUSED(max_size);
+
+    return -1;
+}
+
+qint64 JobChannel::writeData(const char *data, qint64 size) {
+    emit written(QByteArray(data, size));
+
+    return size;
+}
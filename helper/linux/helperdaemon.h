@@ -0,0 +1,113 @@
+/*
+ * ALT Media Writer
+ * Copyright (C) 2016-2019 Martin Bříza <mbriza@redhat.com>
+ * Copyright (C) 2020-2022 Dmitry Degtyarev <kevl@basealt.ru>
+ *
+ * ALT Media Writer is a fork of Fedora Media Writer
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef HELPERDAEMON_H
+#define HELPERDAEMON_H
+
+/**
+ * Runs helper jobs for the app over a local socket, see
+ * helperprotocol.h. Daemon stays running between jobs, so
+ * it's started, connected to the system bus and authorized
+ * by polkit once, instead of once per drive. Each job runs
+ * on its own thread, so several drives can be written or
+ * restored at once.
+ *
+ * Socket is only accessible to the user that started the
+ * daemon. Jobs of an app that disconnects are cancelled.
+ * Daemon exits once it had no connections and no jobs for
+ * a while.
+ */
+
+#include "isomd5/helperprotocol.h"
+
+#include <QHash>
+#include <QIODevice>
+#include <QList>
+#include <QObject>
+
+class Job;
+class JobChannel;
+class QLocalServer;
+class QLocalSocket;
+class QThread;
+class QTimer;
+
+class HelperDaemon : public QObject {
+    Q_OBJECT
+public:
+    explicit HelperDaemon(const QString &base_name_arg);
+
+    // Returns false if the socket can't be created or
+    // another daemon is already listening on it
+    bool listen();
+
+private slots:
+    void onNewConnection();
+
+private:
+    struct RunningJob {
+        // Null if the app disconnected
+        QLocalSocket *socket;
+        qint32 id;
+        Job *job;
+        QThread *thread;
+        JobChannel *out;
+        JobChannel *err;
+    };
+
+    QString base_name;
+    QLocalServer *server;
+    QTimer *idle_timer;
+    // Socket => received data that is not a complete
+    // message yet
+    QHash<QLocalSocket *, QByteArray> buffers;
+    QList<RunningJob> jobs;
+
+    void onReadyRead(QLocalSocket *socket);
+    void onDisconnected(QLocalSocket *socket);
+    void startJob(QLocalSocket *socket, const HelperMessage &message);
+    void cancelJob(QLocalSocket *socket, const qint32 id);
+    void onJobFinished(Job *job, const int exit_code);
+    void sendForJob(Job *job, const HelperMessageType type, const QByteArray &data);
+    int jobIndex(Job *job) const;
+    void updateIdleTimer();
+};
+
+/**
+ * Output of a job running in the daemon. Data written on
+ * the job's thread is passed on to the daemon's thread
+ * through written().
+ */
+class JobChannel : public QIODevice {
+    Q_OBJECT
+public:
+    explicit JobChannel(QObject *parent);
+
+signals:
+    void written(const QByteArray &data);
+
+protected:
+    qint64 readData(char *data, qint64 max_size) override;
+    qint64 writeData(const char *data, qint64 size) override;
+};
+
+#endif // HELPERDAEMON_H
@@ -0,0 +1,59 @@
+/*
+ * ALT Media Writer
+ * Copyright (C) 2016-2019 Martin Bříza <mbriza@redhat.com>
+ * Copyright (C) 2020-2022 Dmitry Degtyarev <kevl@basealt.ru>
+ *
+ * ALT Media Writer is a fork of Fedora Media Writer
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include "job.h"
+
+#include "restorejob.h"
+#include "writejob.h"
+
+Job *Job::create(const QStringList &arguments, QIODevice *out, QIODevice *err) {
+    if (arguments.count() == 2 && arguments[0] == "restore") {
+        return new RestoreJob(arguments[1], out, err);
+    } else if (arguments.count() == 4 && arguments[0] == "write") {
+        return new WriteJob(arguments[1], arguments[2], arguments[3], out, err);
+    } else {
+        return nullptr;
+    }
+}
+
+Job::Job(QIODevice *out_arg, QIODevice *err_arg)
+: QObject(nullptr)
+, out_device(out_arg)
+, err_device(err_arg)
+, cancelled(false)
+, exit_code(0) {
+
+}
+
+void Job::cancel() {
+    cancelled = true;
+}
+
+void Job::start() {
+    run();
+
+    emit finished(exit_code);
+}
+
+void Job::setExitCode(const int code) {
+    exit_code = code;
+}
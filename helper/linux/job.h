@@ -0,0 +1,75 @@
+/*
+ * ALT Media Writer
+ * Copyright (C) 2016-2019 Martin Bříza <mbriza@redhat.com>
+ * Copyright (C) 2020-2022 Dmitry Degtyarev <kevl@basealt.ru>
+ *
+ * ALT Media Writer is a fork of Fedora Media Writer
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef JOB_H
+#define JOB_H
+
+/**
+ * Base of helper jobs. A job prints progress to out and
+ * errors to err, which are stdout and stderr when the
+ * helper runs one job, or go to the app over a socket when
+ * the helper runs as a daemon, see HelperDaemon. Job runs
+ * to completion in start(), which then emits finished()
+ * with the exit code that the helper process exits with.
+ */
+
+#include <QIODevice>
+#include <QObject>
+#include <QStringList>
+
+#include <atomic>
+
+class Job : public QObject {
+    Q_OBJECT
+public:
+    // Creates the job given by helper arguments, without
+    // the program name. Returns nullptr if arguments are
+    // wrong.
+    static Job *create(const QStringList &arguments, QIODevice *out, QIODevice *err);
+
+    Job(QIODevice *out_arg, QIODevice *err_arg);
+
+    // Stop the job as soon as possible, can be called from
+    // another thread. Jobs that can't be interrupted
+    // finish normally.
+    virtual void cancel();
+
+public slots:
+    void start();
+
+signals:
+    void finished(const int exit_code);
+
+protected:
+    QIODevice *out_device;
+    QIODevice *err_device;
+    std::atomic<bool> cancelled;
+
+    virtual void run() = 0;
+    // Last call wins, same as for QCoreApplication::exit()
+    void setExitCode(const int code);
+
+private:
+    int exit_code;
+};
+
+#endif // JOB_H
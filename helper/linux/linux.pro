@@ -3,9 +3,10 @@ TEMPLATE = app
 QT += core network dbus
 
 CONFIG += link_pkgconfig
-PKGCONFIG += liblzma
+PKGCONFIG += liblzma zlib libzstd
 
 LIBS += -lisomd5
+include($$top_srcdir/lib/isomd5/digest.pri)
 
 CONFIG += c++11
 CONFIG += console
@@ -18,11 +19,44 @@ target.path = $$LIBEXECDIR
 INSTALLS += target
 
 SOURCES = main.cpp \
+    job.cpp \
+    helperdaemon.cpp \
     writejob.cpp \
-    restorejob.cpp
+    partfilereader.cpp \
+    restorejob.cpp \
+    blockmap.cpp \
+    blockring.cpp \
+    decompressor.cpp \
+    devicewriter.cpp \
+    pagealignedbuffer.cpp \
+    progressreporter.cpp \
+    writedigest.cpp \
+    writeoptions.cpp \
+    zeroscan.cpp
 
 HEADERS += \
+    job.h \
+    helperdaemon.h \
     writejob.h \
-    restorejob.h
+    partfilereader.h \
+    restorejob.h \
+    blockmap.h \
+    blockring.h \
+    decompressor.h \
+    devicewriter.h \
+    pagealignedbuffer.h \
+    progressreporter.h \
+    writedigest.h \
+    writeoptions.h \
+    zeroscan.h
+
+# NOTE: io_uring write engine is optional, without it
+# helper falls back to synchronous writes
+packagesExist(liburing) {
+    PKGCONFIG += liburing
+    DEFINES += HAVE_LIBURING
+    SOURCES += uringdevicewriter.cpp
+    HEADERS += uringdevicewriter.h
+}
 
 RESOURCES += ../../translations/translations.qrc
@@ -21,11 +21,16 @@
  */
 
 #include <QCoreApplication>
+#include <QFile>
 #include <QTextStream>
+#include <QTimer>
 #include <QTranslator>
 
-#include "restorejob.h"
-#include "writejob.h"
+#include <unistd.h>
+
+#include "helperdaemon.h"
+#include "isomd5/digest.h"
+#include "job.h"
 
 int main(int argc, char *argv[]) {
     QCoreApplication app(argc, argv);
@@ -34,14 +39,52 @@ int main(int argc, char *argv[]) {
     translator.load(QLocale(), QString(), QString(), ":/translations");
     app.installTranslator(&translator);
 
-    if (app.arguments().count() == 3 && app.arguments()[1] == "restore") {
-        new RestoreJob(app.arguments()[2]);
-    } else if (app.arguments().count() == 5 && app.arguments()[1] == "write") {
-        new WriteJob(app.arguments()[2], app.arguments()[3], app.arguments()[4]);
-    } else {
+    const QStringList arguments = app.arguments().mid(1);
+
+    if (arguments.count() == 1 && arguments[0] == "selftest") {
+        QString failed_check;
+        const bool self_test_success = digestSelfTest(&failed_check);
+
         QTextStream err(stderr);
-        err << "Helper: Wrong arguments entered";
-        return 1;
+        if (self_test_success) {
+            err << "OK\n";
+            return 0;
+        } else {
+            err << "Helper: Self test failed: " << failed_check << "\n";
+            return 1;
+        }
+    } else if (arguments.count() == 2 && arguments[0] == "daemon") {
+        HelperDaemon *daemon = new HelperDaemon(arguments[1]);
+
+        const bool listen_success = daemon->listen();
+        if (!listen_success) {
+            QTextStream err(stderr);
+            err << "Helper: Failed to start the daemon";
+            return 1;
+        }
+    } else {
+        // NOTE: progress events are written as they come,
+        // without buffering
+        QFile *out = new QFile(&app);
+        out->open(STDOUT_FILENO, QIODevice::WriteOnly | QIODevice::Unbuffered);
+        QFile *err = new QFile(&app);
+        err->open(stderr, QIODevice::WriteOnly);
+
+        Job *job = Job::create(arguments, out, err);
+        if (job == nullptr) {
+            QTextStream err_stream(stderr);
+            err_stream << "Helper: Wrong arguments entered";
+            return 1;
+        }
+
+        QObject::connect(
+            job, &Job::finished,
+            [](const int exit_code) {
+                qApp->exit(exit_code);
+            });
+
+        QTimer::singleShot(0, job, SLOT(start()));
     }
+
     return app.exec();
 }
@@ -0,0 +1,44 @@
+/*
+ * ALT Media Writer
+ * Copyright (C) 2016-2019 Martin Bříza <mbriza@redhat.com>
+ * Copyright (C) 2020-2022 Dmitry Degtyarev <kevl@basealt.ru>
+ *
+ * ALT Media Writer is a fork of Fedora Media Writer
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef PAGEALIGNEDBUFFER_H
+#define PAGEALIGNEDBUFFER_H
+
+#include <stddef.h>
+
+// NOTE: aligned buffers are used for reading and
+// writing to ensure optimal speed
+class PageAlignedBuffer {
+public:
+    PageAlignedBuffer(const size_t page_count = 1024);
+    ~PageAlignedBuffer();
+
+    void *unaligned_buffer;
+    void *buffer;
+    size_t size;
+
+private:
+    PageAlignedBuffer(const PageAlignedBuffer &) = delete;
+    PageAlignedBuffer &operator=(const PageAlignedBuffer &) = delete;
+};
+
+#endif // PAGEALIGNEDBUFFER_H
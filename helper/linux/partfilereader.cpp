@@ -0,0 +1,180 @@
+/*
+ * ALT Media Writer
+ * Copyright (C) 2016-2019 Martin Bříza <mbriza@redhat.com>
+ * Copyright (C) 2020-2022 Dmitry Degtyarev <kevl@basealt.ru>
+ *
+ * ALT Media Writer is a fork of Fedora Media Writer
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include "partfilereader.h"
+
+#include "isomd5/partmap.h"
+
+#include <QFile>
+#include <QThread>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define POLL_INTERVAL_MS 200
+
+PartFileReader::PartFileReader(const QString &image_path_arg)
+: image_path(image_path_arg)
+, fd(-1)
+, streaming(false)
+, finished(false)
+, aborted(false) {
+
+}
+
+PartFileReader::~PartFileReader() {
+    if (fd != -1) {
+        close(fd);
+    }
+}
+
+bool PartFileReader::open() {
+    // NOTE: image is checked before ".part" because it's
+    // renamed from ".part", in the other order the file
+    // could be missed in between
+    const QByteArray image_path_bytes = QFile::encodeName(image_path);
+    fd = ::open(image_path_bytes.constData(), O_RDONLY | O_CLOEXEC);
+
+    if (fd != -1) {
+        finished = true;
+
+        return true;
+    }
+
+    const QByteArray part_path_bytes = QFile::encodeName(image_path + ".part");
+    fd = ::open(part_path_bytes.constData(), O_RDONLY | O_CLOEXEC);
+
+    if (fd != -1) {
+        streaming = true;
+
+        return true;
+    }
+
+    // NOTE: download may have finished after image was
+    // checked
+    fd = ::open(image_path_bytes.constData(), O_RDONLY | O_CLOEXEC);
+    finished = (fd != -1);
+
+    return (fd != -1);
+}
+
+bool PartFileReader::isStreaming() const {
+    return streaming;
+}
+
+int PartFileReader::handle() const {
+    return fd;
+}
+
+qint64 PartFileReader::read(const qint64 offset, char *buffer, const qint64 len) {
+    while (!aborted) {
+        const qint64 available_size = available(nullptr);
+        if (available_size < 0) {
+            return -1;
+        }
+
+        if (finished || available_size >= offset + len) {
+            const qint64 read_len = qMin(len, available_size - offset);
+            if (read_len <= 0) {
+                return 0;
+            }
+
+            const ssize_t result = pread(fd, buffer, read_len, offset);
+
+            // NOTE: if download restarted from scratch,
+            // file is truncated and the data is written
+            // again, so wait for it
+            if (result == read_len || finished) {
+                return result;
+            }
+        }
+
+        QThread::msleep(POLL_INTERVAL_MS);
+    }
+
+    return -1;
+}
+
+qint64 PartFileReader::size() {
+    qint64 total_size = -1;
+    available(&total_size);
+
+    return total_size;
+}
+
+void PartFileReader::abort() {
+    aborted = true;
+}
+
+// Size of the downloaded part, -1 if download failed.
+// Total size is set if it's known.
+qint64 PartFileReader::available(qint64 *total_size) {
+    // NOTE: file's size is taken before looking for part
+    // map, because app saves part map before growing the
+    // file to its full size
+    const bool renamed = finished || QFile::exists(image_path);
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        return -1;
+    }
+
+    if (renamed) {
+        finished = true;
+
+        if (total_size != nullptr) {
+            *total_size = st.st_size;
+        }
+
+        return st.st_size;
+    }
+
+    if (!QFile::exists(image_path + ".part")) {
+        // NOTE: download may have finished right after the
+        // check above
+        if (QFile::exists(image_path)) {
+            return available(total_size);
+        } else {
+            return -1;
+        }
+    }
+
+    PartMap part_map;
+    const bool load_success = part_map.load(image_path + ".partmap");
+
+    if (load_success) {
+        if (total_size != nullptr) {
+            *total_size = part_map.totalSize();
+        }
+
+        const QList<QPair<qint64, qint64>> missing_ranges = part_map.missingRanges();
+
+        if (missing_ranges.isEmpty()) {
+            return part_map.totalSize();
+        } else {
+            return missing_ranges[0].first;
+        }
+    } else {
+        return st.st_size;
+    }
+}
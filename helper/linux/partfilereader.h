@@ -0,0 +1,81 @@
+/*
+ * ALT Media Writer
+ * Copyright (C) 2016-2019 Martin Bříza <mbriza@redhat.com>
+ * Copyright (C) 2020-2022 Dmitry Degtyarev <kevl@basealt.ru>
+ *
+ * ALT Media Writer is a fork of Fedora Media Writer
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef PARTFILEREADER_H
+#define PARTFILEREADER_H
+
+/**
+ * Reads the source image, which may still be downloading.
+ * While the app downloads an image, it's written to a
+ * ".part" file next to it, which is renamed to the image's
+ * name once the download is finished and checked. Reads
+ * wait until requested data is downloaded, so the image is
+ * written to the drive while it's downloaded.
+ *
+ * Downloaded part is the beginning of the ".part" file,
+ * unless there's a ".partmap" next to it, in which case
+ * it's the part before the first missing block, see
+ * PartMap. Renamed file is the same file, so it's read
+ * through the same descriptor. If both files disappear,
+ * the download failed.
+ *
+ * If the image is already downloaded, reads don't wait.
+ */
+
+#include <QString>
+#include <QtGlobal>
+
+#include <atomic>
+
+class PartFileReader {
+public:
+    PartFileReader(const QString &image_path_arg);
+    ~PartFileReader();
+
+    bool open();
+    // Whether the image was still downloading when opened
+    bool isStreaming() const;
+    int handle() const;
+
+    // Read up to len bytes at offset, waits until they are
+    // downloaded. Returns 0 at the end of the image and -1
+    // on error, if download failed or reader was aborted.
+    qint64 read(const qint64 offset, char *buffer, const qint64 len);
+
+    // Size of the image, -1 if it's not known yet
+    qint64 size();
+
+    // Wake up a waiting read, can be called from another
+    // thread
+    void abort();
+
+private:
+    QString image_path;
+    int fd;
+    bool streaming;
+    bool finished;
+    std::atomic<bool> aborted;
+
+    qint64 available(qint64 *total_size);
+};
+
+#endif // PARTFILEREADER_H
@@ -0,0 +1,107 @@
+/*
+ * ALT Media Writer
+ * Copyright (C) 2016-2019 Martin Bříza <mbriza@redhat.com>
+ * Copyright (C) 2020-2022 Dmitry Degtyarev <kevl@basealt.ru>
+ *
+ * ALT Media Writer is a fork of Fedora Media Writer
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include "progressreporter.h"
+
+#define PROGRESS_INTERVAL_MS 100
+
+ProgressReporter::ProgressReporter(QIODevice *out_arg, const int drive_count)
+: out(out_arg)
+, drives(drive_count) {
+    for (DriveState &drive : drives) {
+        drive.stage = HelperStage_WRITE;
+        drive.total = 0;
+        drive.last_done = 0;
+        drive.last_time = Clock::now();
+    }
+}
+
+void ProgressReporter::stage(const HelperStage stage, const qint64 total) {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    const Clock::time_point now = Clock::now();
+
+    for (DriveState &drive : drives) {
+        // NOTE: failed drives stay failed
+        if (drive.stage == HelperStage_FAILED) {
+            continue;
+        }
+
+        drive.stage = stage;
+        drive.total = total;
+        drive.last_done = 0;
+        drive.last_time = now;
+    }
+
+    HelperEvent event = helperEvent(stage, -1);
+    event.bytes_total = total;
+    send(event);
+}
+
+void ProgressReporter::progress(const int drive, const qint64 done) {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    DriveState &state = drives[drive];
+
+    const Clock::time_point now = Clock::now();
+    const qint64 elapsed_ms = std::chrono::duration_cast<std::chrono::milliseconds>(now - state.last_time).count();
+    // NOTE: end of the stage is sent right away, so the
+    // app doesn't show it unfinished
+    const bool finished = (state.total > 0 && done >= state.total && done != state.last_done);
+
+    if (elapsed_ms < PROGRESS_INTERVAL_MS && !finished) {
+        return;
+    }
+
+    HelperEvent event = helperEvent(state.stage, drive);
+    event.bytes_done = done;
+    event.bytes_total = state.total;
+    if (elapsed_ms > 0) {
+        event.rate = (done - state.last_done) * 1000 / elapsed_ms;
+    }
+    send(event);
+
+    state.last_done = done;
+    state.last_time = now;
+}
+
+void ProgressReporter::failed(const int drive, const HelperError error) {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    if (drive != -1) {
+        drives[drive].stage = HelperStage_FAILED;
+    }
+
+    HelperEvent event = helperEvent(HelperStage_FAILED, drive);
+    event.error = error;
+    send(event);
+}
+
+void ProgressReporter::done() {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    send(helperEvent(HelperStage_DONE, -1));
+}
+
+void ProgressReporter::send(const HelperEvent &event) {
+    out->write(helperEventEncode(event));
+}
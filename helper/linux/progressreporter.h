@@ -0,0 +1,74 @@
+/*
+ * ALT Media Writer
+ * Copyright (C) 2016-2019 Martin Bříza <mbriza@redhat.com>
+ * Copyright (C) 2020-2022 Dmitry Degtyarev <kevl@basealt.ru>
+ *
+ * ALT Media Writer is a fork of Fedora Media Writer
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef PROGRESSREPORTER_H
+#define PROGRESSREPORTER_H
+
+/**
+ * Sends progress events of a write job to the app, see
+ * helperevent.h. Progress of a drive is sent at most
+ * every PROGRESS_INTERVAL_MS, so reporting it after every
+ * block costs almost nothing. Stage changes and the end of
+ * a stage are always sent.
+ *
+ * Can be used from several threads at once, drives are
+ * written and reported by their own threads.
+ */
+
+#include <QIODevice>
+
+#include <chrono>
+#include <mutex>
+#include <vector>
+
+#include "isomd5/helperevent.h"
+
+class ProgressReporter {
+public:
+    ProgressReporter(QIODevice *out_arg, const int drive_count);
+
+    // Start a stage for all drives. Total is relative to
+    // the image file, 0 if not known.
+    void stage(const HelperStage stage, const qint64 total);
+    void progress(const int drive, const qint64 done);
+    // Drive -1 means that the whole job failed
+    void failed(const int drive, const HelperError error);
+    void done();
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    struct DriveState {
+        HelperStage stage;
+        qint64 total;
+        qint64 last_done;
+        Clock::time_point last_time;
+    };
+
+    QIODevice *out;
+    std::mutex mutex;
+    std::vector<DriveState> drives;
+
+    void send(const HelperEvent &event);
+};
+
+#endif // PROGRESSREPORTER_H
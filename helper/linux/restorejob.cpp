@@ -22,10 +22,8 @@
 
 #include "restorejob.h"
 
-#include <QCoreApplication>
 #include <QTextStream>
 #include <QThread>
-#include <QTimer>
 
 #include <QDBusInterface>
 #include <QDBusUnixFileDescriptor>
@@ -38,14 +36,14 @@ Q_DECLARE_METATYPE(Properties)
 Q_DECLARE_METATYPE(InterfacesAndProperties)
 Q_DECLARE_METATYPE(DBusIntrospection)
 
-RestoreJob::RestoreJob(const QString &where)
-: QObject(nullptr)
+RestoreJob::RestoreJob(const QString &where, QIODevice *out_arg, QIODevice *err_arg)
+: Job(out_arg, err_arg)
 , where(where) {
-    QTimer::singleShot(0, this, SLOT(work()));
+
 }
 
-void RestoreJob::work() {
-    QTextStream err(stderr);
+void RestoreJob::run() {
+    QTextStream err(err_device);
 
     QDBusInterface device("org.freedesktop.UDisks2", where, "org.freedesktop.UDisks2.Block", QDBusConnection::systemBus(), this);
     QString drivePath = qvariant_cast<QDBusObjectPath>(device.property("Drive")).path();
@@ -72,7 +70,7 @@ void RestoreJob::work() {
     if (!formatReply.isValid() && formatReply.error().type() != QDBusError::NoReply) {
         err << formatReply.error().message() << "\n";
         err.flush();
-        qApp->exit(1);
+        setExitCode(1);
         return;
     }
 
@@ -81,7 +79,7 @@ void RestoreJob::work() {
     if (!partitionReply.isValid()) {
         err << partitionReply.error().message();
         err.flush();
-        qApp->exit(2);
+        setExitCode(2);
         return;
     }
     QString partitionPath = partitionReply.value().path();
@@ -90,10 +88,10 @@ void RestoreJob::work() {
     if (!formatPartitionReply.isValid() && formatPartitionReply.error().type() != QDBusError::NoReply) {
         err << formatPartitionReply.error().message() << "\n";
         err.flush();
-        qApp->exit(3);
+        setExitCode(3);
         return;
     }
     err.flush();
 
-    qApp->exit(0);
+    setExitCode(0);
 }
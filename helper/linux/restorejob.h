@@ -23,14 +23,15 @@
 #ifndef RESTOREJOB_H
 #define RESTOREJOB_H
 
-#include <QObject>
+#include "job.h"
 
-class RestoreJob : public QObject {
+class RestoreJob : public Job {
     Q_OBJECT
 public:
-    explicit RestoreJob(const QString &where);
-public slots:
-    void work();
+    explicit RestoreJob(const QString &where, QIODevice *out_arg, QIODevice *err_arg);
+
+protected:
+    void run() override;
 
 private:
     QString where;
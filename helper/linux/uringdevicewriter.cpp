@@ -0,0 +1,281 @@
+/*
+ * ALT Media Writer
+ * Copyright (C) 2016-2019 Martin Bříza <mbriza@redhat.com>
+ * Copyright (C) 2020-2022 Dmitry Degtyarev <kevl@basealt.ru>
+ *
+ * ALT Media Writer is a fork of Fedora Media Writer
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include "uringdevicewriter.h"
+
+#include <errno.h>
+
+#include <thread>
+
+UringDeviceWriter::UringDeviceWriter(const int fd_arg, const SparseMode sparse_mode_arg, const long long checkpoint_size_arg, const size_t queue_depth_arg)
+: DeviceWriter(fd_arg, sparse_mode_arg, checkpoint_size_arg)
+, queue_depth(qMax(queue_depth_arg, (size_t) 1))
+, retried_eio(false) {
+    const int init_result = io_uring_queue_init(queue_depth, &uring, 0);
+    valid = (init_result == 0);
+}
+
+UringDeviceWriter::~UringDeviceWriter() {
+    if (valid) {
+        io_uring_queue_exit(&uring);
+    }
+}
+
+bool UringDeviceWriter::isValid() const {
+    return valid;
+}
+
+const char *UringDeviceWriter::name() const {
+    return "io_uring";
+}
+
+bool UringDeviceWriter::drain(BlockRing *ring, const int consumer, const BlockWrittenCallback &on_block_written) {
+    // NOTE: keep at least one block free for the producer,
+    // otherwise it could wait for a free block while this
+    // side waits for a filled one
+    const size_t max_in_flight = qMin(queue_depth, qMax(ring->depth() - 1, (size_t) 1));
+
+    retried_eio = false;
+    bool write_failed = false;
+
+    while (!write_failed) {
+        // NOTE: zero blocks are done as soon as they're
+        // submitted, release them before deciding whether
+        // to wait so that there is always a pending write
+        // to wait for
+        if (!releaseDone(ring, consumer, on_block_written)) {
+            write_failed = true;
+            continue;
+        }
+
+        // Collect finished writes, wait only if the queue
+        // is full
+        const bool queue_full = (in_flight.size() >= max_in_flight);
+        const int reaped = complete(queue_full, &write_failed);
+        if (reaped < 0) {
+            write_failed = true;
+        }
+        if (!releaseDone(ring, consumer, on_block_written)) {
+            write_failed = true;
+        }
+
+        if (write_failed || queue_full) {
+            continue;
+        }
+
+        BlockRing::Block *block = ring->beginRead(consumer);
+        if (block == nullptr) {
+            break;
+        }
+
+        if (!submit(block)) {
+            write_failed = true;
+        }
+    }
+
+    // Wait for remaining writes. Note that on failure this
+    // still has to wait because kernel may be using the
+    // buffers.
+    bool cancelled = false;
+    while (!in_flight.empty()) {
+        if (write_failed) {
+            while (!in_flight.empty() && in_flight.front().state != WriteState_PENDING) {
+                in_flight.pop_front();
+            }
+        } else if (!releaseDone(ring, consumer, on_block_written)) {
+            write_failed = true;
+            continue;
+        }
+
+        if (in_flight.empty()) {
+            break;
+        }
+
+        // NOTE: if waiting fails, pending writes are
+        // cancelled and waited for, their buffers can't be
+        // given back to the producer before that. A wait
+        // that never ends is handled by the ring as a
+        // stalled drive.
+        const int reaped = complete(true, &write_failed);
+        if (reaped < 0) {
+            write_failed = true;
+
+            if (!cancelled) {
+                cancelPending();
+                cancelled = true;
+            } else {
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            }
+        }
+    }
+
+    if (write_failed) {
+        ring->detach(consumer);
+
+        return false;
+    }
+
+    return !ring->aborted();
+}
+
+bool UringDeviceWriter::submit(BlockRing::Block *block) {
+    // NOTE: zeroing is done synchronously, block still goes
+    // through the queue so that it's released in order
+    if (writeZeroes(block)) {
+        in_flight.push_back({block, WriteState_DONE});
+
+        return true;
+    }
+
+    in_flight.push_back({block, WriteState_PENDING});
+
+    if (!submitWrite(block)) {
+        in_flight.pop_back();
+
+        return false;
+    }
+
+    return true;
+}
+
+bool UringDeviceWriter::submitWrite(BlockRing::Block *block) {
+    struct io_uring_sqe *sqe = io_uring_get_sqe(&uring);
+    if (sqe == nullptr) {
+        return false;
+    }
+
+    io_uring_prep_write(sqe, fd, block->buffer.buffer, block->size, block->offset);
+    io_uring_sqe_set_data(sqe, block);
+
+    const int submit_result = io_uring_submit(&uring);
+
+    return (submit_result >= 0);
+}
+
+// Ask the kernel to cancel pending writes. Cancel requests
+// have no block, writes that are cancelled still complete
+// with an error.
+void UringDeviceWriter::cancelPending() {
+    for (const InFlight &e : in_flight) {
+        if (e.state != WriteState_PENDING) {
+            continue;
+        }
+
+        struct io_uring_sqe *sqe = io_uring_get_sqe(&uring);
+        if (sqe == nullptr) {
+            break;
+        }
+
+        io_uring_prep_cancel(sqe, e.block, 0);
+        io_uring_sqe_set_data(sqe, nullptr);
+    }
+
+    io_uring_submit(&uring);
+}
+
+// Collect finished writes. If wait is true, waits for at
+// least one write to finish. Returns the number of
+// collected writes or -1 on error.
+int UringDeviceWriter::complete(const bool wait, bool *write_failed) {
+    int reaped = 0;
+
+    while (true) {
+        struct io_uring_cqe *cqe = nullptr;
+
+        const bool should_wait = (wait && reaped == 0);
+        const int result = [&]() {
+            if (should_wait) {
+                return io_uring_wait_cqe(&uring, &cqe);
+            } else {
+                return io_uring_peek_cqe(&uring, &cqe);
+            }
+        }();
+
+        if (result == -EINTR) {
+            continue;
+        }
+        if (result == -EAGAIN) {
+            break;
+        }
+        if (result < 0 || cqe == nullptr) {
+            if (reaped == 0 && should_wait) {
+                return -1;
+            }
+            break;
+        }
+
+        BlockRing::Block *block = (BlockRing::Block *) io_uring_cqe_get_data(cqe);
+        const int res = cqe->res;
+        io_uring_cqe_seen(&uring, cqe);
+
+        // NOTE: completion of a cancel request, the write
+        // it cancels completes by itself
+        if (block == nullptr) {
+            continue;
+        }
+
+        // NOTE: block stays pending while its write is
+        // retried
+        if (res == -EIO && !retried_eio && !*write_failed) {
+            retried_eio = true;
+
+            if (submitWrite(block)) {
+                continue;
+            }
+        }
+
+        const bool write_success = (res >= 0 && (size_t) res == block->size);
+        if (!write_success) {
+            *write_failed = true;
+        }
+
+        reaped++;
+
+        for (InFlight &e : in_flight) {
+            if (e.block == block) {
+                e.state = write_success ? WriteState_DONE : WriteState_FAILED;
+                break;
+            }
+        }
+    }
+
+    return reaped;
+}
+
+// Return finished blocks to the ring in the order they
+// were taken. Returns false if a checkpoint flush failed.
+// NOTE: since blocks are released in order, all blocks
+// before a checkpoint are written by the time it's
+// flushed
+bool UringDeviceWriter::releaseDone(BlockRing *ring, const int consumer, const BlockWrittenCallback &on_block_written) {
+    while (!in_flight.empty() && in_flight.front().state == WriteState_DONE) {
+        if (!blockDone(in_flight.front().block)) {
+            return false;
+        }
+
+        on_block_written(in_flight.front().block);
+        ring->endRead(consumer);
+        in_flight.pop_front();
+    }
+
+    return true;
+}
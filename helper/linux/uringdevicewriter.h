@@ -0,0 +1,72 @@
+/*
+ * ALT Media Writer
+ * Copyright (C) 2016-2019 Martin Bříza <mbriza@redhat.com>
+ * Copyright (C) 2020-2022 Dmitry Degtyarev <kevl@basealt.ru>
+ *
+ * ALT Media Writer is a fork of Fedora Media Writer
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef URINGDEVICEWRITER_H
+#define URINGDEVICEWRITER_H
+
+#include "devicewriter.h"
+
+#include <liburing.h>
+
+#include <deque>
+
+class UringDeviceWriter : public DeviceWriter {
+public:
+    UringDeviceWriter(const int fd, const SparseMode sparse_mode, const long long checkpoint_size, const size_t queue_depth);
+    ~UringDeviceWriter();
+
+    // False if io_uring couldn't be set up, for example
+    // because the kernel is too old or io_uring is
+    // disabled by sysctl
+    bool isValid() const;
+
+    const char *name() const override;
+    bool drain(BlockRing *ring, const int consumer, const BlockWrittenCallback &on_block_written) override;
+
+private:
+    enum WriteState {
+        WriteState_PENDING,
+        WriteState_DONE,
+        WriteState_FAILED,
+    };
+
+    struct InFlight {
+        BlockRing::Block *block;
+        WriteState state;
+    };
+
+    struct io_uring uring;
+    bool valid;
+    size_t queue_depth;
+    std::deque<InFlight> in_flight;
+    // NOTE: one EIO is retried per drive and write, same
+    // as in SyncDeviceWriter
+    bool retried_eio;
+
+    bool submit(BlockRing::Block *block);
+    bool submitWrite(BlockRing::Block *block);
+    void cancelPending();
+    int complete(const bool wait, bool *write_failed);
+    bool releaseDone(BlockRing *ring, const int consumer, const BlockWrittenCallback &on_block_written);
+};
+
+#endif // URINGDEVICEWRITER_H
@@ -0,0 +1,90 @@
+/*
+ * ALT Media Writer
+ * Copyright (C) 2016-2019 Martin Bříza <mbriza@redhat.com>
+ * Copyright (C) 2020-2022 Dmitry Degtyarev <kevl@basealt.ru>
+ *
+ * ALT Media Writer is a fork of Fedora Media Writer
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include "writedigest.h"
+
+WriteDigest::WriteDigest(const DigestAlgorithm algorithm, const long long segment_size, const SegmentManifest *expected_arg)
+: hash(Digest::create(algorithm))
+, segment_manifest(
+    (expected_arg != nullptr) ? expected_arg->algorithm() : QCryptographicHash::Sha256,
+    (expected_arg != nullptr) ? expected_arg->segmentSize() : segment_size)
+, expected(expected_arg)
+, total(0)
+, compared_count(0)
+, bad_segment(-1) {
+
+}
+
+bool WriteDigest::addData(const void *data, const size_t size) {
+    hash->addData(data, size);
+    segment_manifest.addData((const unsigned char *) data, size);
+    total += size;
+
+    return compareSegments();
+}
+
+bool WriteDigest::finish() {
+    segment_manifest.finish();
+
+    const bool segments_match = compareSegments();
+    if (!segments_match) {
+        return false;
+    }
+
+    return (expected == nullptr || expected->size() == total);
+}
+
+qint64 WriteDigest::size() const {
+    return total;
+}
+
+QByteArray WriteDigest::checksum() const {
+    return hash->result();
+}
+
+const SegmentManifest &WriteDigest::segments() const {
+    return segment_manifest;
+}
+
+int WriteDigest::badSegment() const {
+    return bad_segment;
+}
+
+// Compare segments completed since last call
+bool WriteDigest::compareSegments() {
+    if (expected == nullptr) {
+        return true;
+    }
+
+    while (bad_segment == -1 && compared_count < segment_manifest.count()) {
+        const int index = compared_count;
+        const bool match = (index < expected->count() && segment_manifest.checksum(index) == expected->checksum(index));
+
+        if (!match) {
+            bad_segment = index;
+        }
+
+        compared_count++;
+    }
+
+    return (bad_segment == -1);
+}
@@ -0,0 +1,85 @@
+/*
+ * ALT Media Writer
+ * Copyright (C) 2016-2019 Martin Bříza <mbriza@redhat.com>
+ * Copyright (C) 2020-2022 Dmitry Degtyarev <kevl@basealt.ru>
+ *
+ * ALT Media Writer is a fork of Fedora Media Writer
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef WRITEDIGEST_H
+#define WRITEDIGEST_H
+
+/**
+ * Checksum and segment checksums of data written to the drive,
+ * computed while it's written, so that the drive can be
+ * checked by reading it back once and comparing checksums
+ * instead of reading the image again. Segment checksums
+ * allow the check to stop at the first bad segment and
+ * report where it is.
+ *
+ * If the image comes with a segment manifest, segments are
+ * compared to it as soon as they are complete, so that a
+ * corrupted image is found before it's fully written.
+ */
+
+#include "isomd5/digest.h"
+#include "isomd5/segmentmanifest.h"
+
+#include <QByteArray>
+#include <QCryptographicHash>
+
+#include <memory>
+
+class WriteDigest {
+public:
+    // Whole data is hashed with the given algorithm,
+    // segments are hashed like in the expected manifest if
+    // there is one
+    WriteDigest(const DigestAlgorithm algorithm, const long long segment_size, const SegmentManifest *expected_arg = nullptr);
+
+    // Returns false if a completed segment doesn't match
+    // the expected manifest
+    bool addData(const void *data, const size_t size);
+    // Returns false if written data doesn't match the
+    // expected manifest
+    bool finish();
+
+    // Amount of hashed data in bytes
+    qint64 size() const;
+
+    // Hex digest of whole data
+    QByteArray checksum() const;
+
+    const SegmentManifest &segments() const;
+
+    // Index of the segment that didn't match, -1 if all
+    // segments match or size doesn't
+    int badSegment() const;
+
+private:
+    std::unique_ptr<Digest> hash;
+    SegmentManifest segment_manifest;
+    const SegmentManifest *expected;
+    qint64 total;
+    // Number of segments compared to expected manifest
+    int compared_count;
+    int bad_segment;
+
+    bool compareSegments();
+};
+
+#endif // WRITEDIGEST_H
@@ -22,25 +22,37 @@
 
 #include "writejob.h"
 
-#include <QCoreApplication>
+#include <QCryptographicHash>
 #include <QDBusInterface>
 #include <QDBusUnixFileDescriptor>
+#include <QFileInfo>
 #include <QProcess>
 #include <QTextStream>
-#include <QTimer>
 #include <QtDBus>
 #include <QtGlobal>
 
 #include <errno.h>
+#include <string.h>
 #include <sys/fcntl.h>
 #include <unistd.h>
 
+#include <limits>
+#include <mutex>
+#include <thread>
 #include <tuple>
 #include <utility>
 
-#include <lzma.h>
-
+#include "blockmap.h"
+#include "blockring.h"
+#include "decompressor.h"
+#include "devicewriter.h"
+#include "isomd5/digest.h"
 #include "isomd5/libcheckisomd5.h"
+#include "isomd5/segmentmanifest.h"
+#include "pagealignedbuffer.h"
+#include "partfilereader.h"
+#include "progressreporter.h"
+#include "zeroscan.h"
 
 typedef QHash<QString, QVariant> Properties;
 typedef QHash<QString, Properties> InterfacesAndProperties;
@@ -49,52 +61,196 @@ Q_DECLARE_METATYPE(Properties)
 Q_DECLARE_METATYPE(InterfacesAndProperties)
 Q_DECLARE_METATYPE(DBusIntrospection)
 
-// NOTE: aligned buffers are used for reading and
-// writing to ensure optimal speed
-class PageAlignedBuffer {
+// NOTE: only scan for zeroes if the writer is going to
+// do something with zero blocks
+static bool block_is_zero(const BlockRing::Block *block, const WriteOptions &options) {
+    return (options.sparse_mode != SparseMode_OFF && buffer_is_zero(block->buffer.buffer, block->size));
+}
+
+// Copies mapped ranges of decompressed data into ring
+// blocks. Mapped data that is contiguous on the drive is
+// merged into one block to keep writes large.
+class BlockMapCopier {
 public:
-    PageAlignedBuffer(const size_t page_count = 1024);
-    ~PageAlignedBuffer();
+    BlockMapCopier(const BlockMap *block_map_arg, BlockRing *ring_arg, const WriteOptions &options_arg)
+    : block_map(block_map_arg)
+    , ring(ring_arg)
+    , options(options_arg)
+    , range_index(0)
+    , block(nullptr) {
+
+    }
+
+    // Returns false if ring was aborted
+    bool copy(const uint8_t *data, const qint64 data_offset, const qint64 data_size, const qint64 progress) {
+        const QList<BlockMap::Range> &range_list = block_map->ranges();
+        const qint64 data_end = data_offset + data_size;
+
+        while (range_index < range_list.size()) {
+            const BlockMap::Range &range = range_list[range_index];
+            const qint64 range_end = range.offset + range.size;
+
+            if (range.offset >= data_end) {
+                break;
+            }
+
+            qint64 pos = qMax(range.offset, data_offset);
+            const qint64 end = qMin(range_end, data_end);
+
+            while (pos < end) {
+                const bool contiguous = (block != nullptr && block->offset + (qint64) block->size == pos);
+                if (!contiguous) {
+                    flush();
+                }
+
+                if (block == nullptr) {
+                    block = ring->beginWrite();
+                    if (block == nullptr) {
+                        return false;
+                    }
+
+                    block->offset = pos;
+                    block->size = 0;
+                }
+
+                const qint64 len = qMin(end - pos, (qint64) (block->buffer.size - block->size));
+                memcpy((uint8_t *) block->buffer.buffer + block->size, data + (pos - data_offset), len);
+                block->size += len;
+                block->progress = progress;
+                pos += len;
+
+                if (block->size == block->buffer.size) {
+                    flush();
+                }
+            }
+
+            if (range_end <= data_end) {
+                range_index++;
+            } else {
+                break;
+            }
+        }
+
+        return true;
+    }
+
+    // Pass on the last block. Returns false if ring was
+    // aborted.
+    bool finish() {
+        if (block_map == nullptr) {
+            return true;
+        }
+
+        flush();
+
+        return !ring->aborted();
+    }
+
+private:
+    const BlockMap *block_map;
+    BlockRing *ring;
+    const WriteOptions &options;
+    int range_index;
+    BlockRing::Block *block;
+
+    void flush() {
+        if (block != nullptr) {
+            block->zero = block_is_zero(block, options);
+            ring->endWrite();
+            block = nullptr;
+        }
+    }
+};
 
-    void *unaligned_buffer;
-    void *buffer;
-    size_t size;
+// Passed to mediaCheckSegmentsFD() callback by check()
+struct CheckState {
+    ProgressReporter *reporter;
+    int drive;
+    qint64 file_size;
+    const std::atomic<bool> *cancelled;
 };
 
-WriteJob::WriteJob(const QString &what, const QString &where, const QString &md5_arg)
-: QObject(nullptr)
+static int check_on_progress(void *data, long long offset, long long total) {
+    CheckState *state = (CheckState *) data;
+
+    // NOTE: app expects progress relative to file size,
+    // which is different from written size for compressed
+    // images
+    if (total > 0) {
+        state->reporter->progress(state->drive, (qint64) ((double) offset / total * state->file_size));
+    }
+
+    // NOTE: non-zero stops the check
+    return (*state->cancelled ? 1 : 0);
+}
+
+WriteJob::WriteJob(const QString &what, const QString &where, const QString &md5_arg, QIODevice *out_arg, QIODevice *err_arg)
+: Job(out_arg, err_arg)
 , what(what)
 , where(where)
-, md5(md5_arg) {
+, md5(md5_arg)
+, options(write_options_from_env())
+, active_source(nullptr)
+, active_ring(nullptr) {
     qDBusRegisterMetaType<Properties>();
     qDBusRegisterMetaType<InterfacesAndProperties>();
     qDBusRegisterMetaType<DBusIntrospection>();
 
-    fd = QDBusUnixFileDescriptor(-1);
+    // NOTE: treat unsupported checksums like missing ones,
+    // same as the app and mediaCheckFD() do
+    checksum_algorithm = DigestAlgorithm_MD5;
+    if (!md5.isEmpty()) {
+        const bool parse_success = digestParseChecksum(md5.toLatin1(), &checksum_algorithm, &expected_checksum);
 
-    connect(
-        &watcher, &QFileSystemWatcher::fileChanged,
-        this, &WriteJob::onFileChanged);
-    QTimer::singleShot(0, this, SLOT(work()));
-}
+        if (!parse_success || !Digest::isSupported(checksum_algorithm)) {
+            checksum_algorithm = DigestAlgorithm_MD5;
+            expected_checksum.clear();
+        }
+    }
+
+    for (const QString &path : where.split(',', QString::SkipEmptyParts)) {
+        Target target;
+        target.path = path;
+        target.fd = QDBusUnixFileDescriptor(-1);
+        target.failed = false;
+
+        targets.push_back(std::move(target));
+    }
 
-int WriteJob::staticOnMediaCheckAdvanced(void *data, long long offset, long long total) {
-    return ((WriteJob*)data)->onMediaCheckAdvanced(offset, total);
+    reporter.reset(new ProgressReporter(out_device, targets.size()));
 }
 
-int WriteJob::onMediaCheckAdvanced(long long offset, long long total) {
-    QTextStream out(stdout);
+void WriteJob::cancel() {
+    Job::cancel();
 
-    Q_UNUSED(total);
-    out << offset << "\n";
-    out.flush();
-    return 0;
+    std::lock_guard<std::mutex> lock(cancel_mutex);
+    if (active_source != nullptr) {
+        active_source->abort();
+    }
+    if (active_ring != nullptr) {
+        active_ring->abort();
+    }
 }
 
-QDBusUnixFileDescriptor WriteJob::getDescriptor() {
-    QTextStream err(stderr);
+// Remember what cancel() has to abort. If the job was
+// cancelled already, aborts right away.
+void WriteJob::setActive(PartFileReader *source, BlockRing *ring) {
+    std::lock_guard<std::mutex> lock(cancel_mutex);
+    active_source = source;
+    active_ring = ring;
 
-    QDBusInterface device("org.freedesktop.UDisks2", where, "org.freedesktop.UDisks2.Block", QDBusConnection::systemBus(), this);
+    if (cancelled) {
+        if (active_source != nullptr) {
+            active_source->abort();
+        }
+        if (active_ring != nullptr) {
+            active_ring->abort();
+        }
+    }
+}
+
+QDBusUnixFileDescriptor WriteJob::getDescriptor(const int index) {
+    QDBusInterface device("org.freedesktop.UDisks2", targets[index].path, "org.freedesktop.UDisks2.Block", QDBusConnection::systemBus(), this);
     QString drivePath = qvariant_cast<QDBusObjectPath>(device.property("Drive")).path();
     QDBusInterface manager("org.freedesktop.UDisks2", "/org/freedesktop/UDisks2", "org.freedesktop.DBus.ObjectManager", QDBusConnection::systemBus());
     QDBusMessage message = manager.call("GetManagedObjects");
@@ -113,298 +269,824 @@ QDBusUnixFileDescriptor WriteJob::getDescriptor() {
             }
         }
     } else {
-        err << message.errorMessage();
-        err.flush();
-        qApp->exit(2);
+        driveFailed(index, HelperError_DRIVE_UNAVAILABLE, message.errorMessage());
         return QDBusUnixFileDescriptor(-1);
     }
 
-    QDBusReply<QDBusUnixFileDescriptor> reply = device.callWithArgumentList(QDBus::Block, "OpenDevice", {"rw", Properties{{"flags", O_DIRECT | O_SYNC | O_CLOEXEC}, {"writable", true}}});
+    // NOTE: no O_SYNC, writes are flushed at checkpoints
+    // instead, see DeviceWriter
+    QDBusReply<QDBusUnixFileDescriptor> reply = device.callWithArgumentList(QDBus::Block, "OpenDevice", {"rw", Properties{{"flags", O_DIRECT | O_CLOEXEC}, {"writable", true}}});
     QDBusUnixFileDescriptor fd = reply.value();
 
     if (!fd.isValid()) {
-        err << reply.error().message();
-        err.flush();
-        qApp->exit(2);
+        driveFailed(index, HelperError_DRIVE_UNAVAILABLE, reply.error().message());
         return QDBusUnixFileDescriptor(-1);
     }
 
     return fd;
 }
 
-bool WriteJob::write(int fd) {
-    if (what.endsWith(".xz")) {
-        return writeCompressed(fd);
-    } else {
-        return writePlain(fd);
+bool WriteJob::write() {
+    // NOTE: extra files of an image that is still
+    // downloading may not be downloaded yet, so they are
+    // not used and the whole image is written
+    const bool downloading = (!QFile::exists(what) && QFile::exists(what + ".part"));
+
+    if (!downloading) {
+        const bool load_success = loadBlockMap();
+        if (!load_success) {
+            return false;
+        }
+
+        const bool load_segments_success = loadSegmentManifest();
+        if (!load_segments_success) {
+            return false;
+        }
     }
-}
 
-bool WriteJob::writeCompressed(int fd) {
-    QTextStream out(stdout);
-    QTextStream err(stderr);
+    written_digest.reset(new WriteDigest(checksum_algorithm, options.segment_size, segment_manifest.get()));
 
-    qint64 totalRead = 0;
+    for (const int index : liveTargets()) {
+        Target &target = targets[index];
+        target.writer.reset(DeviceWriter::create(options, target.fd.fileDescriptor()));
+    }
 
-    lzma_stream strm = LZMA_STREAM_INIT;
-    lzma_ret ret;
+    const std::unique_ptr<Decompressor> decompressor(Decompressor::create(what, options));
 
-    const PageAlignedBuffer inBuffer;
-    const PageAlignedBuffer outBuffer;
+    if (decompressor != nullptr) {
+        return writeCompressed(decompressor.get());
+    } else {
+        return writePlain();
+    }
+}
 
-    QFile file(what);
-    const bool open_success = file.open(QIODevice::ReadOnly);
+bool WriteJob::writeCompressed(Decompressor *decompressor) {
+    // NOTE: image may still be downloading, in which case
+    // reads wait for the data
+    PartFileReader source(what);
+    const bool open_success = source.open();
     if (!open_success) {
-        err << tr("Source image is not readable") << what;
-        err.flush();
-        qApp->exit(2);
+        jobFailed(HelperError_SOURCE_UNREADABLE, tr("Source image is not readable") + what);
+        setExitCode(2);
         return false;
     }
 
-    ret = lzma_stream_decoder(&strm, MEDIAWRITER_LZMA_LIMIT, LZMA_CONCATENATED);
-    if (ret != LZMA_OK) {
-        err << tr("Failed to start decompressing.");
+    const bool start_success = decompressor->start();
+    if (!start_success) {
+        jobFailed(HelperError_DECOMPRESSION, tr("Failed to start decompressing."));
         return false;
     }
 
-    strm.next_in = (uint8_t *) inBuffer.buffer;
-    strm.avail_in = 0;
-    strm.next_out = (uint8_t *) outBuffer.buffer;
-    strm.avail_out = outBuffer.size;
+    // NOTE: ring is shared with drive threads, which may
+    // outlive this function if their drive stalls
+    const std::shared_ptr<BlockRing> ring = std::make_shared<BlockRing>(options.ring_depth, options.block_size, liveTargets().size(), options.stall_timeout);
 
-    while (true) {
-        if (strm.avail_in == 0) {
-            qint64 len = file.read((char *) inBuffer.buffer, inBuffer.size);
-            totalRead += len;
+    // NOTE: decompression runs on a separate thread and
+    // decompressed blocks are written to the drive while
+    // next blocks are decompressed. Decoder output goes
+    // straight into ring blocks. With a block map, output
+    // goes into a separate buffer instead and only mapped
+    // ranges are copied to ring blocks.
+    bool read_success = true;
+    bool decode_success = true;
+    bool block_map_match = true;
+    bool segments_match = true;
+    const std::unique_ptr<Digest> input_hash(Digest::create(checksum_algorithm));
+    setActive(&source, ring.get());
 
-            strm.next_in = (uint8_t *) inBuffer.buffer;
-            strm.avail_in = len;
+    std::thread decoder(
+        [&]() {
+            const PageAlignedBuffer inBuffer;
+            qint64 totalRead = 0;
+            qint64 totalDecoded = 0;
+            bool input_finished = false;
 
-            out << totalRead << "\n";
-            out.flush();
-        }
-
-        ret = lzma_code(&strm, strm.avail_in == 0 ? LZMA_FINISH : LZMA_RUN);
-        if (ret == LZMA_STREAM_END) {
-            quint64 len = ::write(fd, outBuffer.buffer, outBuffer.size - strm.avail_out);
-            if (len != outBuffer.size - strm.avail_out) {
-                err << tr("Destination drive is not writable");
-                qApp->exit(3);
-                return false;
+            std::unique_ptr<PageAlignedBuffer> mapBuffer;
+            if (block_map != nullptr) {
+                mapBuffer.reset(new PageAlignedBuffer(options.block_size / getpagesize()));
             }
-            return true;
-        }
-        if (ret != LZMA_OK) {
-            switch (ret) {
-                case LZMA_MEM_ERROR:
-                    err << tr("There is not enough memory to decompress the file.");
-                    break;
-                case LZMA_FORMAT_ERROR:
-                case LZMA_DATA_ERROR:
-                case LZMA_BUF_ERROR:
-                    err << tr("The downloaded compressed file is corrupted.");
-                    break;
-                case LZMA_OPTIONS_ERROR:
-                    err << tr("Unsupported compression options.");
-                    break;
-                default:
-                    err << tr("Unknown decompression error.");
-                    break;
+            BlockMapCopier copier(block_map.get(), ring.get(), options);
+
+            BlockRing::Block *block = nullptr;
+
+            DecompressorStream strm;
+            strm.next_in = (const uint8_t *) inBuffer.buffer;
+            strm.avail_in = 0;
+
+            // Point decoder output to next block, returns
+            // false if ring was aborted
+            const auto begin_output =
+                [&]() -> bool {
+                    if (mapBuffer != nullptr) {
+                        strm.next_out = (uint8_t *) mapBuffer->buffer;
+                        strm.avail_out = mapBuffer->size;
+                    } else {
+                        block = ring->beginWrite();
+                        if (block == nullptr) {
+                            return false;
+                        }
+
+                        strm.next_out = (uint8_t *) block->buffer.buffer;
+                        strm.avail_out = block->buffer.size;
+                    }
+
+                    return true;
+                };
+
+            // Pass decoded data on to the writer, returns
+            // false if ring was aborted
+            const auto end_output =
+                [&]() -> bool {
+                    if (mapBuffer != nullptr) {
+                        const qint64 size = mapBuffer->size - strm.avail_out;
+                        const bool copy_success = copier.copy((const uint8_t *) mapBuffer->buffer, totalDecoded, size, totalRead);
+                        totalDecoded += size;
+
+                        return copy_success;
+                    } else {
+                        block->size = block->buffer.size - strm.avail_out;
+                        block->offset = totalDecoded;
+                        block->progress = totalRead;
+                        block->zero = block_is_zero(block, options);
+                        totalDecoded += block->size;
+
+                        segments_match = written_digest->addData(block->buffer.buffer, block->size);
+                        if (!segments_match) {
+                            ring->abort();
+                            return false;
+                        }
+
+                        if (block->size > 0) {
+                            ring->endWrite();
+                        }
+
+                        return true;
+                    }
+                };
+
+            if (!begin_output()) {
+                return;
             }
-            qApp->exit(4);
-            return false;
-        }
 
-        if (strm.avail_out == 0) {
-            quint64 len = ::write(fd, outBuffer.buffer, outBuffer.size - strm.avail_out);
-            if (len != outBuffer.size - strm.avail_out) {
-                err << tr("Destination drive is not writable");
-                qApp->exit(3);
-                return false;
+            while (true) {
+                if (strm.avail_in == 0 && !input_finished) {
+                    const qint64 len = source.read(totalRead, (char *) inBuffer.buffer, inBuffer.size);
+                    if (len < 0) {
+                        read_success = false;
+                        ring->abort();
+                        return;
+                    }
+                    totalRead += len;
+                    input_finished = (len == 0);
+
+                    if (!expected_checksum.isEmpty()) {
+                        input_hash->addData(inBuffer.buffer, len);
+                    }
+
+                    strm.next_in = (const uint8_t *) inBuffer.buffer;
+                    strm.avail_in = len;
+                }
+
+                const Decompressor::Result result = decompressor->decode(&strm, input_finished);
+                if (result == Decompressor::Result_ERROR) {
+                    decode_success = false;
+                    ring->abort();
+                    return;
+                }
+                const bool stream_end = (result == Decompressor::Result_STREAM_END);
+
+                if (strm.avail_out == 0 || stream_end) {
+                    if (!end_output()) {
+                        return;
+                    }
+
+                    if (stream_end) {
+                        if (!copier.finish()) {
+                            return;
+                        }
+
+                        // NOTE: if the image is shorter than
+                        // the block map says, some mapped
+                        // ranges were never written
+                        if (block_map != nullptr && totalDecoded != block_map->imageSize()) {
+                            block_map_match = false;
+                            ring->abort();
+                            return;
+                        }
+
+                        if (block_map == nullptr) {
+                            segments_match = written_digest->finish();
+                            if (!segments_match) {
+                                ring->abort();
+                                return;
+                            }
+                        }
+
+                        ring->close();
+                        return;
+                    }
+
+                    if (!begin_output()) {
+                        return;
+                    }
+                }
             }
-            strm.next_out = (uint8_t *) outBuffer.buffer;
-            strm.avail_out = outBuffer.size;
+        });
+
+    const bool drain_success = drain(ring);
+    // NOTE: decoder may be waiting for the download if
+    // writing failed
+    source.abort();
+    decoder.join();
+    setActive(nullptr, nullptr);
+
+    if (!read_success) {
+        jobFailed(HelperError_SOURCE_UNREADABLE, tr("Source image is not readable"));
+        setExitCode(3);
+        return false;
+    }
+
+    if (!decode_success) {
+        switch (decompressor->error()) {
+            case Decompressor::Error_MEMORY:
+                jobFailed(HelperError_DECOMPRESSION, tr("There is not enough memory to decompress the file."));
+                break;
+            case Decompressor::Error_CORRUPTED:
+                jobFailed(HelperError_SOURCE_CORRUPTED, tr("The downloaded compressed file is corrupted."));
+                break;
+            case Decompressor::Error_OPTIONS:
+                jobFailed(HelperError_DECOMPRESSION, tr("Unsupported compression options."));
+                break;
+            default:
+                jobFailed(HelperError_DECOMPRESSION, tr("Unknown decompression error."));
+                break;
         }
+        setExitCode(4);
+        return false;
     }
-}
 
-bool WriteJob::writePlain(int fd) {
-    QTextStream out(stdout);
-    QTextStream err(stderr);
+    if (!block_map_match) {
+        jobFailed(HelperError_METADATA, tr("Block map doesn't match the image."));
+        setExitCode(4);
+        return false;
+    }
+
+    if (!segments_match) {
+        jobFailed(HelperError_SOURCE_CORRUPTED, tr("The source image is corrupted.") + "\n" + segmentRange(written_digest->badSegment()));
+        setExitCode(4);
+        return false;
+    }
+
+    if (!drain_success) {
+        jobFailed(HelperError_DRIVE_UNWRITABLE, tr("Destination drive is not writable"));
+        setExitCode(3);
+        return false;
+    }
+
+    source_checksum = input_hash->result();
+
+    return true;
+}
 
-    QFile inFile(what);
-    const bool open_success = inFile.open(QIODevice::ReadOnly);
+bool WriteJob::writePlain() {
+    // NOTE: image may still be downloading, in which case
+    // reads wait for the data
+    PartFileReader source(what);
+    const bool open_success = source.open();
     if (!open_success) {
-        err << tr("Source image is not readable") << what;
-        err.flush();
-        qApp->exit(2);
+        jobFailed(HelperError_SOURCE_UNREADABLE, tr("Source image is not readable") + what);
+        setExitCode(2);
         return false;
     }
 
-    const PageAlignedBuffer buffer;
-    qint64 total = 0;
+    // NOTE: size of an image that is downloading may not be
+    // known yet, then it's checked after reading
+    const qint64 known_size = source.size();
+
+    const bool block_map_match = (block_map == nullptr || known_size == -1 || block_map->imageSize() == known_size);
+    if (!block_map_match) {
+        jobFailed(HelperError_METADATA, tr("Block map doesn't match the image."));
+        setExitCode(4);
+        return false;
+    }
+
+    // NOTE: with a block map only mapped ranges are read,
+    // otherwise the whole file is one range, which is read
+    // until the end if size is not known
+    const QList<BlockMap::Range> range_list = [&]() {
+        if (block_map != nullptr) {
+            return block_map->ranges();
+        } else {
+            const qint64 whole_size = (known_size != -1) ? known_size : std::numeric_limits<qint64>::max();
+            const BlockMap::Range whole_file = {0, whole_size, QByteArray()};
+
+            return QList<BlockMap::Range>({whole_file});
+        }
+    }();
 
-    while (!inFile.atEnd()) {
-        qint64 len = inFile.read((char *) buffer.buffer, buffer.size);
-        if (len < 0) {
-            err << tr("Source image is not readable");
-            err.flush();
-            qApp->exit(3);
+    const qint64 range_total = [&]() {
+        qint64 out = 0;
+        for (const BlockMap::Range &range : range_list) {
+            out += range.size;
+        }
+        return out;
+    }();
+
+    // NOTE: ring is shared with drive threads, which may
+    // outlive this function if their drive stalls
+    const std::shared_ptr<BlockRing> ring = std::make_shared<BlockRing>(options.ring_depth, options.block_size, liveTargets().size(), options.stall_timeout);
+
+    // Returns true if the range is a hole in the source
+    // file, in which case it doesn't need to be read
+    const auto is_hole = [&](const qint64 offset, const qint64 len) -> bool {
+        // NOTE: parts of a downloading image that are not
+        // downloaded yet look like holes
+        if (options.sparse_mode == SparseMode_OFF || source.isStreaming()) {
             return false;
         }
-    try_again:
-        qint64 written = ::write(fd, buffer.buffer, len);
-        if (written != len) {
-            if (written < 0) {
-                if (errno == EIO) {
-                    static int skip_once = 0;
-                    if (!skip_once) {
-                        skip_once = 1;
-                        goto try_again;
+
+        const int file_fd = source.handle();
+        const off_t data_offset = lseek(file_fd, offset, SEEK_DATA);
+        const int lseek_errno = errno;
+        lseek(file_fd, offset, SEEK_SET);
+
+        if (data_offset < 0) {
+            // NOTE: ENXIO means there is no data past
+            // offset, other errors mean that SEEK_DATA is
+            // not supported by the filesystem
+            return (lseek_errno == ENXIO);
+        } else {
+            return (data_offset >= offset + len);
+        }
+    };
+
+    // NOTE: source is read on a separate thread so that
+    // reading next blocks overlaps with writing current
+    // block to the drive
+    bool read_success = true;
+    bool segments_match = true;
+    setActive(&source, ring.get());
+
+    std::thread reader(
+        [&]() {
+            qint64 total = 0;
+
+            for (const BlockMap::Range &range : range_list) {
+                qint64 pos = range.offset;
+                const qint64 range_end = range.offset + range.size;
+
+                while (pos < range_end) {
+                    BlockRing::Block *block = ring->beginWrite();
+                    if (block == nullptr) {
+                        return;
+                    }
+
+                    const qint64 wanted_len = qMin((qint64) block->buffer.size, range_end - pos);
+                    const bool hole = is_hole(pos, wanted_len);
+                    const qint64 len = [&]() -> qint64 {
+                        if (hole) {
+                            // NOTE: buffer still has to contain
+                            // the data in case the writer falls
+                            // back to writing it
+                            memset(block->buffer.buffer, 0, wanted_len);
+
+                            return wanted_len;
+                        } else {
+                            return source.read(pos, (char *) block->buffer.buffer, wanted_len);
+                        }
+                    }();
+
+                    // NOTE: whole file of unknown size ends
+                    // when the image ends
+                    if (len == 0 && known_size == -1 && block_map == nullptr) {
+                        break;
+                    }
+
+                    // NOTE: file ending before its size was
+                    // reached is also an error
+                    if (len <= 0) {
+                        read_success = false;
+                        ring->abort();
+                        return;
                     }
+
+                    block->size = len;
+                    block->zero = (hole || block_is_zero(block, options));
+                    block->offset = pos;
+                    pos += len;
+                    total += len;
+
+                    // NOTE: with a block map the check uses
+                    // checksums from the block map instead
+                    if (block_map == nullptr) {
+                        segments_match = written_digest->addData(block->buffer.buffer, block->size);
+                        if (!segments_match) {
+                            ring->abort();
+                            return;
+                        }
+                    }
+
+                    // NOTE: app expects progress relative to
+                    // file size, scale it if only some
+                    // ranges are written
+                    if (block_map == nullptr) {
+                        block->progress = total;
+                    } else {
+                        block->progress = (qint64) ((double) total / range_total * block_map->imageSize());
+                    }
+
+                    ring->endWrite();
                 }
             }
-            err << tr("Destination drive is not writable");
-            err.flush();
-            qApp->exit(3);
-            return false;
-        }
-        total += len;
-        out << total << '\n';
-        out.flush();
+
+            if (block_map == nullptr) {
+                segments_match = written_digest->finish();
+                if (!segments_match) {
+                    ring->abort();
+                    return;
+                }
+            }
+
+            ring->close();
+        });
+
+    const bool drain_success = drain(ring);
+    // NOTE: reader may be waiting for the download if
+    // writing failed
+    source.abort();
+    reader.join();
+    setActive(nullptr, nullptr);
+
+    if (block_map != nullptr && source.size() != block_map->imageSize()) {
+        jobFailed(HelperError_METADATA, tr("Block map doesn't match the image."));
+        setExitCode(4);
+        return false;
     }
 
-    inFile.close();
-    sync();
+    if (!read_success) {
+        jobFailed(HelperError_SOURCE_UNREADABLE, tr("Source image is not readable"));
+        setExitCode(3);
+        return false;
+    }
+
+    if (!segments_match) {
+        jobFailed(HelperError_SOURCE_CORRUPTED, tr("The source image is corrupted.") + "\n" + segmentRange(written_digest->badSegment()));
+        setExitCode(4);
+        return false;
+    }
+
+    if (!drain_success) {
+        jobFailed(HelperError_DRIVE_UNWRITABLE, tr("Destination drive is not writable"));
+        setExitCode(3);
+        return false;
+    }
+
+    // NOTE: plain image is written as is, so its checksum
+    // is the same as checksum of written data
+    source_checksum = written_digest->checksum();
 
     return true;
 }
 
-bool WriteJob::check(int fd) {
-    QTextStream out(stdout);
-    QTextStream err(stderr);
-
-    if (what.endsWith(".xz")) {
-        out << "NOT CHECKING BECAUSE IMAGE IS ZIPPED\n";
-        out << "DONE\n";
-        out.flush();
-        err << "OK\n";
-        err.flush();
-        qApp->exit(0);
-        return false;
+// Write blocks from the ring to drives until the ring is
+// closed and empty, then flush them. Each drive is written
+// by its own thread and progress is reported after each
+// block, see ProgressReporter. Drives that fail or stall
+// are marked as failed. Returns true if at least one drive
+// was written.
+bool WriteJob::drain(const std::shared_ptr<BlockRing> &ring) {
+    const std::vector<int> live = liveTargets();
+
+    // NOTE: thread of a stalled drive is left behind, so it
+    // only uses what it holds itself and stops reporting
+    // progress once the job gives up on it
+    struct Shared {
+        std::mutex mutex;
+        bool gave_up = false;
+    };
+    const std::shared_ptr<Shared> shared = std::make_shared<Shared>();
+    ProgressReporter *job_reporter = reporter.get();
+
+    std::vector<std::thread> thread_list;
+    for (size_t consumer = 0; consumer < live.size(); consumer++) {
+        const int index = live[consumer];
+        const std::shared_ptr<DeviceWriter> writer = targets[index].writer;
+        const QDBusUnixFileDescriptor fd = targets[index].fd;
+
+        thread_list.emplace_back(
+            [ring, shared, job_reporter, consumer, index, writer, fd]() {
+                const bool drain_success = writer->drain(ring.get(), consumer,
+                    [&](const BlockRing::Block *block) {
+                        std::lock_guard<std::mutex> lock(shared->mutex);
+                        if (!shared->gave_up) {
+                            job_reporter->progress(index, block->progress);
+                        }
+                    });
+
+                if (drain_success && !writer->finish()) {
+                    ring->detach(consumer);
+                }
+
+                ring->finishRead(consumer);
+            });
+    }
+
+    ring->waitFinished();
+
+    {
+        std::lock_guard<std::mutex> lock(shared->mutex);
+        shared->gave_up = true;
+    }
+
+    for (size_t consumer = 0; consumer < live.size(); consumer++) {
+        if (ring->stalled(consumer)) {
+            thread_list[consumer].detach();
+        } else {
+            thread_list[consumer].join();
+        }
+    }
+
+    // NOTE: with one drive, write failure is reported
+    // together with other write errors
+    if (targets.size() > 1) {
+        for (size_t consumer = 0; consumer < live.size(); consumer++) {
+            if (ring->stalled(consumer)) {
+                driveFailed(live[consumer], HelperError_DRIVE_UNWRITABLE, tr("Destination drive stopped responding") + "\n");
+            } else if (ring->detached(consumer)) {
+                driveFailed(live[consumer], HelperError_DRIVE_UNWRITABLE, tr("Destination drive is not writable") + "\n");
+            }
+        }
     }
 
-    if (md5.isEmpty()) {
-        out << "NOT CHECKING BECAUSE NO MD5 IS PROVIDED\n";
-        out << "DONE\n";
-        out.flush();
-        err << "OK\n";
-        err.flush();
-        qApp->exit(0);
+    const bool any_written = [&]() {
+        for (size_t consumer = 0; consumer < live.size(); consumer++) {
+            if (!ring->detached(consumer)) {
+                return true;
+            }
+        }
         return false;
+    }();
+
+    return (any_written && !ring->aborted());
+}
+
+// Load block map if there is one next to the image
+bool WriteJob::loadBlockMap() {
+    const QString block_map_path = BlockMap::find(what);
+    if (block_map_path.isEmpty()) {
+        return true;
     }
 
-    out << "CHECK\n";
-    out.flush();
-    switch (mediaCheckFD(fd, md5.toLocal8Bit().data(), &WriteJob::staticOnMediaCheckAdvanced, this)) {
-    case ISOMD5SUM_CHECK_NOT_FOUND:
-    case ISOMD5SUM_CHECK_PASSED:
-        out << "DONE\n";
-        out.flush();
-        err << "OK\n";
-        err.flush();
-        qApp->exit(0);
+    block_map.reset(new BlockMap());
+
+    const bool load_success = block_map->load(block_map_path);
+    if (!load_success) {
+        jobFailed(HelperError_METADATA, block_map->errorString());
+        setExitCode(2);
         return false;
-    case ISOMD5SUM_CHECK_FAILED:
-        err << tr("Your drive is probably damaged.") << "\n";
-        err.flush();
-        qApp->exit(1);
+    }
+
+    return true;
+}
+
+// Load segment manifest if there is one next to the
+// image. With a block map, the manifest is not used since
+// only mapped ranges are written.
+bool WriteJob::loadSegmentManifest() {
+    const QString manifest_path = what + ".segments";
+    if (block_map != nullptr || !QFile::exists(manifest_path)) {
+        return true;
+    }
+
+    QFile manifest_file(manifest_path);
+    const bool open_success = manifest_file.open(QIODevice::ReadOnly);
+    if (!open_success) {
+        jobFailed(HelperError_METADATA, tr("Failed to open segment manifest."));
+        setExitCode(2);
         return false;
-    default:
-        err << tr("Unexpected error occurred during media check.") << "\n";
-        err.flush();
-        qApp->exit(1);
+    }
+
+    segment_manifest.reset(new SegmentManifest());
+
+    const bool parse_success = segment_manifest->fromText(manifest_file.readAll());
+    if (!parse_success) {
+        jobFailed(HelperError_METADATA, tr("Segment manifest is malformed."));
+        setExitCode(2);
         return false;
     }
+
     return true;
 }
 
-void WriteJob::work() {
-    QTextStream out(stdout);
-    QTextStream err(stderr);
+// Check written drives and report the result. Drives that
+// fail the check are reported by their own FAILED events,
+// same as drives that fail while writing, so exit code is
+// 0 if at least one drive passed.
+void WriteJob::check() {
+    QTextStream err(err_device);
+
+    reporter->stage(HelperStage_CHECK, QFileInfo(what).size());
 
-    // have to keep the QDBus wrapper, otherwise the file gets closed
-    fd = getDescriptor();
-    if (fd.fileDescriptor() < 0) {
+    // NOTE: checksum from MD5SUM is of the source file,
+    // which was hashed while writing. With a block map,
+    // only mapped ranges were read, so it can't be
+    // compared.
+    if (block_map == nullptr && !expected_checksum.isEmpty() && source_checksum != expected_checksum) {
+        jobFailed(HelperError_SOURCE_CORRUPTED, tr("The source image is corrupted.") + "\n");
+        setExitCode(1);
         return;
     }
 
-    const bool delayed_write = [&]() {
-        const QString part_path = what + ".part";
+    bool any_passed = false;
 
-        return (QFile::exists(part_path) && !QFile::exists(what));
-    }();
+    // NOTE: with a block map, only mapped ranges were
+    // written, so the whole image can't be checked
+    for (const int index : liveTargets()) {
+        const bool check_success = [&]() {
+            if (block_map != nullptr) {
+                return checkBlockMap(index);
+            } else {
+                return checkSegments(index);
+            }
+        }();
 
-    if (delayed_write) {
-        watcher.addPath(what + ".part");
+        if (check_success) {
+            any_passed = true;
+        }
+    }
 
+    if (!any_passed) {
+        setExitCode(1);
         return;
     }
 
-    // NOTE: let the app know that writing started
-    out << "WRITE\n";
-    out.flush();
+    reporter->done();
+    err << "OK\n";
+    err.flush();
+    setExitCode(0);
+}
 
-    const bool write_success = write(fd.fileDescriptor());
+// Check the drive against segments hashed while writing,
+// so the check can stop at the first bad segment. See
+// mediaCheckSegmentsFD() for how reading overlaps with
+// hashing.
+bool WriteJob::checkSegments(const int index) {
+    CheckState state;
+    state.reporter = reporter.get();
+    state.drive = index;
+    state.file_size = QFileInfo(what).size();
+    state.cancelled = &cancelled;
 
-    if (write_success) {
-        check(fd.fileDescriptor());
-    } else {
-        qApp->exit(4);
+    int bad_segment = -1;
+    const int check_result = mediaCheckSegmentsFD(targets[index].fd.fileDescriptor(), written_digest->segments(), options.block_size, options.verify_threads, &check_on_progress, &state, &bad_segment);
+
+    if (check_result == ISOMD5SUM_CHECK_FAILED) {
+        driveFailed(index, HelperError_CHECK_MISMATCH, tr("Your drive is probably damaged.") + "\n" + segmentRange(bad_segment));
+        return false;
+    } else if (check_result != ISOMD5SUM_CHECK_PASSED) {
+        driveFailed(index, HelperError_CHECK_FAILED, tr("Unexpected error occurred during media check.") + "\n");
+        return false;
+    }
+
+    return true;
+}
+
+// Describe which bytes of the image a bad segment covers
+QString WriteJob::segmentRange(const int index) const {
+    if (index < 0) {
+        return QString();
     }
+
+    const SegmentManifest &segments = written_digest->segments();
+    const qint64 first = segments.segmentOffset(index);
+    const qint64 last = first + segments.segmentLength(index) - 1;
+
+    return tr("Mismatch in bytes %1-%2 of the image.").arg(first).arg(last) + "\n";
 }
 
-void WriteJob::onFileChanged(const QString &path) {
-    QTextStream out(stdout);
-    QTextStream err(stderr);
+// Check mapped ranges on the drive against checksums from
+// the block map. Works for compressed images too, since
+// checksums are of decompressed data.
+bool WriteJob::checkBlockMap(const int index) {
+    const int fd = targets[index].fd.fileDescriptor();
+    const qint64 file_size = QFileInfo(what).size();
+    const qint64 mapped_size = block_map->mappedSize();
+    static const qint64 page_size = getpagesize();
+    const PageAlignedBuffer buffer(options.block_size / page_size);
+    qint64 total = 0;
 
-    const bool still_downloading = QFile::exists(path);
-    if (still_downloading) {
-        return;
+    for (const BlockMap::Range &range : block_map->ranges()) {
+        if (range.checksum.isEmpty()) {
+            total += range.size;
+            continue;
+        }
+
+        QCryptographicHash hash(block_map->checksumType());
+        qint64 pos = range.offset;
+        const qint64 range_end = range.offset + range.size;
+
+        while (pos < range_end) {
+            if (cancelled) {
+                return false;
+            }
+
+            const qint64 len = qMin((qint64) buffer.size, range_end - pos);
+
+            // NOTE: drive is opened with O_DIRECT, so read
+            // size has to be aligned. Only the last range
+            // can end in the middle of a page.
+            const qint64 aligned_len = ((len + page_size - 1) / page_size) * page_size;
+            const qint64 read_len = ::pread(fd, buffer.buffer, aligned_len, pos);
+            if (read_len < len) {
+                driveFailed(index, HelperError_CHECK_FAILED, tr("Unexpected error occurred during media check.") + "\n");
+                return false;
+            }
+
+            hash.addData((const char *) buffer.buffer, len);
+            pos += len;
+            total += len;
+
+            reporter->progress(index, (qint64) ((double) total / mapped_size * file_size));
+        }
+
+        if (hash.result().toHex() != range.checksum) {
+            driveFailed(index, HelperError_CHECK_MISMATCH, tr("Your drive is probably damaged.") + "\n");
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void WriteJob::run() {
+    for (size_t i = 0; i < targets.size(); i++) {
+        targets[i].fd = getDescriptor(i);
     }
 
-    const bool downloaded_file_exists = QFile::exists(what);
-    if (!downloaded_file_exists) {
-        qApp->exit(4);
+    // NOTE: with several drives, drives that couldn't be
+    // opened are skipped
+    if (liveTargets().empty()) {
+        setExitCode(2);
         return;
     }
 
-    out << "WRITE\n";
-    out.flush();
+    // NOTE: if the image is still downloading, it's written
+    // as it's downloaded, see PartFileReader. Writing
+    // finishes once the download does.
+
+    // NOTE: let the app know that writing started. Size of
+    // an image that is still downloading is not known yet.
+    reporter->stage(HelperStage_WRITE, QFileInfo(what).size());
 
-    const bool write_success = write(fd.fileDescriptor());
+    const bool write_success = write();
 
     if (write_success) {
-        check(fd.fileDescriptor());
+        check();
+    } else {
+        setExitCode(4);
+    }
+}
+
+// Report an error of one drive and stop using it. With
+// several drives, the error is prefixed by the drive path.
+void WriteJob::driveFailed(const int index, const HelperError error, const QString &message) {
+    QTextStream err(err_device);
+
+    Target &target = targets[index];
+    target.failed = true;
+
+    reporter->failed(index, error);
+
+    if (targets.size() > 1) {
+        err << target.path << ": " << message;
+        if (!message.endsWith('\n')) {
+            err << "\n";
+        }
     } else {
-        qApp->exit(4);
+        err << message;
     }
+    err.flush();
 }
 
-PageAlignedBuffer::PageAlignedBuffer(const size_t page_count) {
-    static const size_t page_size = getpagesize();
-    size = page_count * page_size;
-    const size_t unaligned_size = size + page_size;
-    unaligned_buffer = malloc(unaligned_size * sizeof(uint8_t));
+// Report an error that stops writing to all drives
+void WriteJob::jobFailed(const HelperError error, const QString &message) {
+    QTextStream err(err_device);
 
-    // NOTE: align() modifies space and ptr args to
-    // return values for aligned buffer
-    void *ptr_arg = unaligned_buffer;
-    size_t space_arg = unaligned_size;
+    reporter->failed(-1, error);
 
-    buffer = std::align(page_size, size, ptr_arg, space_arg);
+    err << message;
+    err.flush();
 }
 
-PageAlignedBuffer::~PageAlignedBuffer() {
-    free(unaligned_buffer);
+// Indexes of drives that didn't fail so far
+std::vector<int> WriteJob::liveTargets() const {
+    std::vector<int> out;
+
+    for (size_t i = 0; i < targets.size(); i++) {
+        if (!targets[i].failed) {
+            out.push_back(i);
+        }
+    }
+
+    return out;
 }
@@ -25,45 +25,105 @@
 
 #include <QDBusUnixFileDescriptor>
 #include <QFile>
-#include <QFileSystemWatcher>
 #include <QObject>
 #include <QProcess>
 
 #include <unistd.h>
 
 #include <memory>
+#include <mutex>
 #include <tuple>
 #include <utility>
+#include <vector>
 
-#ifndef MEDIAWRITER_LZMA_LIMIT
-// 256MB memory limit for the decompressor
-#define MEDIAWRITER_LZMA_LIMIT (1024 * 1024 * 256)
-#endif
+#include "blockmap.h"
+#include "job.h"
+#include "progressreporter.h"
+#include "writedigest.h"
+#include "writeoptions.h"
 
-class WriteJob : public QObject {
+class BlockRing;
+class Decompressor;
+class DeviceWriter;
+class PartFileReader;
+
+/**
+ * Writes an image to one or more drives. Where is a comma
+ * separated list of UDisks block device paths. With
+ * several drives, the image is read and decompressed once
+ * and every block is written to all of them, see
+ * BlockRing.
+ *
+ * Progress is reported with binary events, see
+ * ProgressReporter. With several drives, events carry the
+ * index of the drive in the list and a drive that fails is
+ * reported with a failed event, while other drives
+ * continue. A drive that hangs is given up on after the
+ * stall timeout, see WriteOptions.
+ *
+ * Cancelling the job aborts writing and checking, drives
+ * are left partially written.
+ */
+class WriteJob : public Job {
     Q_OBJECT
 public:
-    explicit WriteJob(const QString &what, const QString &where, const QString &md5_arg);
+    explicit WriteJob(const QString &what, const QString &where, const QString &md5_arg, QIODevice *out_arg, QIODevice *err_arg);
 
-    static int staticOnMediaCheckAdvanced(void *data, long long offset, long long total);
-    int onMediaCheckAdvanced(long long offset, long long total);
+    void cancel() override;
 
-    QDBusUnixFileDescriptor getDescriptor();
-    bool write(int fd);
-    bool writeCompressed(int fd);
-    bool writePlain(int fd);
-    bool check(int fd);
-public slots:
-    void work();
-private slots:
-    void onFileChanged(const QString &path);
+    QDBusUnixFileDescriptor getDescriptor(const int index);
+    bool write();
+    bool writeCompressed(Decompressor *decompressor);
+    bool writePlain();
+    bool drain(const std::shared_ptr<BlockRing> &ring);
+    bool loadBlockMap();
+    bool loadSegmentManifest();
+    void check();
+    bool checkSegments(const int index);
+    bool checkBlockMap(const int index);
+    QString segmentRange(const int index) const;
+    void driveFailed(const int index, const HelperError error, const QString &message);
+    void jobFailed(const HelperError error, const QString &message);
+    std::vector<int> liveTargets() const;
+
+protected:
+    void run() override;
 
 private:
+    struct Target {
+        QString path;
+        // have to keep the QDBus wrapper, otherwise the file gets closed
+        QDBusUnixFileDescriptor fd;
+        // Shared with the drive's write thread, see drain()
+        std::shared_ptr<DeviceWriter> writer;
+        bool failed;
+    };
+
     QString what;
     QString where;
     QString md5;
-    QDBusUnixFileDescriptor fd;
-    QFileSystemWatcher watcher;
+    // Parsed md5 argument, which may be a checksum of
+    // other algorithm, see digest.h. Empty if there is no
+    // checksum or it can't be checked.
+    DigestAlgorithm checksum_algorithm;
+    QByteArray expected_checksum;
+    WriteOptions options;
+    std::unique_ptr<BlockMap> block_map;
+    // Segment manifest shipped with the image, if any
+    std::unique_ptr<SegmentManifest> segment_manifest;
+    // Digest of data written to the drive and checksum of
+    // the source file, both computed while writing
+    std::unique_ptr<WriteDigest> written_digest;
+    QByteArray source_checksum;
+    std::vector<Target> targets;
+    std::unique_ptr<ProgressReporter> reporter;
+    // Source and ring of the write in progress, aborted
+    // by cancel()
+    std::mutex cancel_mutex;
+    PartFileReader *active_source;
+    BlockRing *active_ring;
+
+    void setActive(PartFileReader *source, BlockRing *ring);
 };
 
 #endif // WRITEJOB_H
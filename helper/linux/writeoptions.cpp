@@ -0,0 +1,160 @@
+/*
+ * ALT Media Writer
+ * Copyright (C) 2016-2019 Martin Bříza <mbriza@redhat.com>
+ * Copyright (C) 2020-2022 Dmitry Degtyarev <kevl@basealt.ru>
+ *
+ * ALT Media Writer is a fork of Fedora Media Writer
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include "writeoptions.h"
+
+#include "isomd5/segmentmanifest.h"
+
+#include <QByteArray>
+#include <QtGlobal>
+
+#include <unistd.h>
+
+WriteOptions write_options_from_env() {
+    WriteOptions out;
+
+    const size_t page_size = getpagesize();
+
+    out.block_size = [page_size]() -> size_t {
+        bool ok = false;
+        const qint64 value = qgetenv("MEDIAWRITER_BLOCK_SIZE_ENV").toLongLong(&ok);
+        const size_t block_size = (ok && value > 0) ? (size_t) value : MEDIAWRITER_BLOCK_SIZE;
+
+        // NOTE: O_DIRECT writes need to be aligned, so
+        // block size has to be a multiple of page size
+        const size_t aligned = block_size - block_size % page_size;
+
+        return qMax(aligned, page_size);
+    }();
+
+    out.ring_depth = []() -> size_t {
+        bool ok = false;
+        const int value = qEnvironmentVariableIntValue("MEDIAWRITER_RING_DEPTH_ENV", &ok);
+
+        // NOTE: need at least 2 blocks for reading and
+        // writing to overlap
+        if (ok && value >= 2) {
+            return value;
+        } else {
+            return MEDIAWRITER_RING_DEPTH;
+        }
+    }();
+
+    out.engine = []() {
+        const QByteArray value = qgetenv("MEDIAWRITER_WRITE_ENGINE_ENV");
+
+        if (value == "sync") {
+            return WriteEngine_SYNC;
+        } else if (value == "io_uring") {
+            return WriteEngine_IO_URING;
+        } else {
+            return WriteEngine_AUTO;
+        }
+    }();
+
+    out.queue_depth = []() -> size_t {
+        bool ok = false;
+        const int value = qEnvironmentVariableIntValue("MEDIAWRITER_QUEUE_DEPTH_ENV", &ok);
+
+        if (ok && value >= 1) {
+            return value;
+        } else {
+            return MEDIAWRITER_QUEUE_DEPTH;
+        }
+    }();
+
+    out.decoder_threads = []() -> unsigned int {
+        bool ok = false;
+        const int value = qEnvironmentVariableIntValue("MEDIAWRITER_DECODER_THREADS_ENV", &ok);
+
+        if (ok && value >= 0) {
+            return value;
+        } else {
+            return 0;
+        }
+    }();
+
+    out.sparse_mode = []() {
+        const QByteArray value = qgetenv("MEDIAWRITER_SPARSE_MODE_ENV");
+
+        if (value == "zeroout") {
+            return SparseMode_ZEROOUT;
+        } else if (value == "discard") {
+            return SparseMode_DISCARD;
+        } else if (value == "skip") {
+            return SparseMode_SKIP;
+        } else {
+            return SparseMode_OFF;
+        }
+    }();
+
+    out.segment_size = []() -> long long {
+        bool ok = false;
+        const qint64 value = qgetenv("MEDIAWRITER_SEGMENT_SIZE_ENV").toLongLong(&ok);
+        const qint64 segment_size = (ok && value > 0) ? value : SEGMENT_MANIFEST_DEFAULT_SEGMENT_SIZE;
+
+        // NOTE: segments are read from the drive with
+        // O_DIRECT, so they have to be aligned
+        const qint64 aligned = segment_size - segment_size % 4096;
+
+        return qMax(aligned, (qint64) 4096);
+    }();
+
+    out.verify_threads = []() -> int {
+        bool ok = false;
+        const int value = qEnvironmentVariableIntValue("MEDIAWRITER_VERIFY_THREADS_ENV", &ok);
+
+        if (ok && value >= 1) {
+            return value;
+        } else {
+            return MEDIAWRITER_VERIFY_THREADS;
+        }
+    }();
+
+    out.checkpoint_size = []() -> long long {
+        bool ok = false;
+        const qint64 value = qgetenv("MEDIAWRITER_CHECKPOINT_SIZE_ENV").toLongLong(&ok);
+
+        if (ok && value >= 0) {
+            return value;
+        } else {
+            return MEDIAWRITER_CHECKPOINT_SIZE;
+        }
+    }();
+
+    out.stall_timeout = []() -> int {
+        bool ok = false;
+        const int value = qEnvironmentVariableIntValue("MEDIAWRITER_STALL_TIMEOUT_ENV", &ok);
+
+        if (ok && value >= 0) {
+            return value;
+        } else {
+            return MEDIAWRITER_STALL_TIMEOUT;
+        }
+    }();
+
+    // NOTE: ring has to be deeper than the write queue so
+    // that the source can be read while the queue is full
+    out.ring_depth = qMax(out.ring_depth, out.queue_depth + 2);
+
+    return out;
+}
@@ -0,0 +1,129 @@
+/*
+ * ALT Media Writer
+ * Copyright (C) 2016-2019 Martin Bříza <mbriza@redhat.com>
+ * Copyright (C) 2020-2022 Dmitry Degtyarev <kevl@basealt.ru>
+ *
+ * ALT Media Writer is a fork of Fedora Media Writer
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef WRITEOPTIONS_H
+#define WRITEOPTIONS_H
+
+/**
+ * Tunables of the write pipeline. Defaults can be changed
+ * at build time through the defines below and at runtime
+ * through environment variables, which the app passes on
+ * to the helper:
+ *
+ * MEDIAWRITER_BLOCK_SIZE_ENV - size of one block in bytes,
+ *     rounded down to a multiple of page size
+ * MEDIAWRITER_RING_DEPTH_ENV - number of blocks that can be
+ *     read ahead of the drive
+ * MEDIAWRITER_WRITE_ENGINE_ENV - "sync", "io_uring" or
+ *     "auto", see DeviceWriter
+ * MEDIAWRITER_QUEUE_DEPTH_ENV - max number of writes in
+ *     flight for engines that support it
+ * MEDIAWRITER_DECODER_THREADS_ENV - number of threads used
+ *     to decompress images, 0 means one per CPU core
+ * MEDIAWRITER_SPARSE_MODE_ENV - what to do with blocks of
+ *     the image that are all zeroes:
+ *     "off" - write them like any other block (default)
+ *     "zeroout" - zero the range with BLKZEROOUT, which
+ *         lets the drive skip transferring the zeroes
+ *     "discard" - unmap the range by punching a hole in
+ *         the drive with fallocate(), which only succeeds
+ *         if the drive guarantees that unmapped blocks read
+ *         back as zeroes, otherwise same as "zeroout"
+ *     "skip" - don't touch the range at all. Only safe if
+ *         the drive was already zeroed, otherwise old data
+ *         remains and the check will fail.
+ * MEDIAWRITER_SEGMENT_SIZE_ENV - size of segments that
+ *     written data is hashed in, rounded down to a multiple
+ *     of 4096. Ignored if the image comes with a segment
+ *     manifest, see SegmentManifest.
+ * MEDIAWRITER_VERIFY_THREADS_ENV - number of threads that
+ *     check segments on the drive in parallel
+ * MEDIAWRITER_CHECKPOINT_SIZE_ENV - amount of data in bytes
+ *     written to a drive between flushes of the drive's
+ *     write cache, 0 flushes only once writing is done,
+ *     see DeviceWriter
+ * MEDIAWRITER_STALL_TIMEOUT_ENV - seconds a drive may go
+ *     without finishing a write or a flush before it's
+ *     given up on and reported as failed, so that it
+ *     doesn't hold back other drives, 0 disables the
+ *     timeout, see BlockRing. Has to be longer than a
+ *     flush of one checkpoint takes on a slow drive.
+ */
+
+#include <stddef.h>
+
+#ifndef MEDIAWRITER_BLOCK_SIZE
+// 4MB blocks
+#define MEDIAWRITER_BLOCK_SIZE (1024 * 1024 * 4)
+#endif
+
+#ifndef MEDIAWRITER_RING_DEPTH
+#define MEDIAWRITER_RING_DEPTH 6
+#endif
+
+#ifndef MEDIAWRITER_QUEUE_DEPTH
+#define MEDIAWRITER_QUEUE_DEPTH 4
+#endif
+
+#ifndef MEDIAWRITER_VERIFY_THREADS
+#define MEDIAWRITER_VERIFY_THREADS 1
+#endif
+
+#ifndef MEDIAWRITER_CHECKPOINT_SIZE
+// 256MB between flushes
+#define MEDIAWRITER_CHECKPOINT_SIZE (1024LL * 1024 * 256)
+#endif
+
+#ifndef MEDIAWRITER_STALL_TIMEOUT
+// 5 minutes
+#define MEDIAWRITER_STALL_TIMEOUT 300
+#endif
+
+enum WriteEngine {
+    WriteEngine_AUTO,
+    WriteEngine_SYNC,
+    WriteEngine_IO_URING,
+};
+
+enum SparseMode {
+    SparseMode_OFF,
+    SparseMode_ZEROOUT,
+    SparseMode_DISCARD,
+    SparseMode_SKIP,
+};
+
+struct WriteOptions {
+    size_t block_size;
+    size_t ring_depth;
+    WriteEngine engine;
+    size_t queue_depth;
+    unsigned int decoder_threads;
+    SparseMode sparse_mode;
+    long long segment_size;
+    int verify_threads;
+    long long checkpoint_size;
+    int stall_timeout;
+};
+
+WriteOptions write_options_from_env();
+
+#endif // WRITEOPTIONS_H
@@ -0,0 +1,72 @@
+/*
+ * ALT Media Writer
+ * Copyright (C) 2016-2019 Martin Bříza <mbriza@redhat.com>
+ * Copyright (C) 2020-2022 Dmitry Degtyarev <kevl@basealt.ru>
+ *
+ * ALT Media Writer is a fork of Fedora Media Writer
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include "zeroscan.h"
+
+#include <stdint.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+bool buffer_is_zero(const void *buffer, const size_t size) {
+    const uint8_t *ptr = (const uint8_t *) buffer;
+    size_t i = 0;
+
+#if defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+
+    for (; i + 64 <= size; i += 64) {
+        const __m128i a = _mm_loadu_si128((const __m128i *) (ptr + i));
+        const __m128i b = _mm_loadu_si128((const __m128i *) (ptr + i + 16));
+        const __m128i c = _mm_loadu_si128((const __m128i *) (ptr + i + 32));
+        const __m128i d = _mm_loadu_si128((const __m128i *) (ptr + i + 48));
+        const __m128i combined = _mm_or_si128(_mm_or_si128(a, b), _mm_or_si128(c, d));
+
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(combined, zero)) != 0xFFFF) {
+            return false;
+        }
+    }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    for (; i + 64 <= size; i += 64) {
+        const uint8x16_t a = vld1q_u8(ptr + i);
+        const uint8x16_t b = vld1q_u8(ptr + i + 16);
+        const uint8x16_t c = vld1q_u8(ptr + i + 32);
+        const uint8x16_t d = vld1q_u8(ptr + i + 48);
+        const uint8x16_t combined = vorrq_u8(vorrq_u8(a, b), vorrq_u8(c, d));
+
+        if (vmaxvq_u8(combined) != 0) {
+            return false;
+        }
+    }
+#endif
+
+    for (; i < size; i++) {
+        if (ptr[i] != 0) {
+            return false;
+        }
+    }
+
+    return true;
+}
@@ -5,6 +5,7 @@ include($$top_srcdir/deployment.pri)
 QT += core network
 
 LIBS += -lisomd5 -llzma
+include($$top_srcdir/lib/isomd5/digest.pri)
 
 CONFIG += c++11
 CONFIG += console
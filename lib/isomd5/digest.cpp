@@ -0,0 +1,624 @@
+/*
+ * ALT Media Writer
+ * Copyright (C) 2016-2019 Martin Bříza <mbriza@redhat.com>
+ * Copyright (C) 2020-2022 Dmitry Degtyarev <kevl@basealt.ru>
+ *
+ * ALT Media Writer is a fork of Fedora Media Writer
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include "digest.h"
+
+#include <QDataStream>
+#include <QList>
+#include <QtGlobal>
+
+#include <stdint.h>
+#include <string.h>
+
+#include <memory>
+#include <vector>
+
+#ifdef HAVE_BLAKE3
+#include <blake3.h>
+#endif
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_SHA_NI
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+namespace {
+
+// Bumped when layout of saved state changes
+const quint32 DIGEST_STATE_VERSION = 1;
+
+// Base for hashes that process data in 64 byte blocks and
+// pad it with a 64-bit length, which are MD5 and SHA-256.
+// State of these is a few words, so it can be saved.
+class BlockDigest : public Digest {
+public:
+    BlockDigest(const DigestAlgorithm algorithm_arg, const uint32_t *initial_state, const int state_size_arg, const bool big_endian_arg)
+    : algorithm(algorithm_arg)
+    , state_size(state_size_arg)
+    , big_endian(big_endian_arg)
+    , buffer_size(0)
+    , total(0) {
+        memcpy(state, initial_state, state_size * sizeof(uint32_t));
+    }
+
+    void addData(const void *data_arg, long long size) override {
+        const uint8_t *data = (const uint8_t *) data_arg;
+        total += size;
+
+        if (buffer_size > 0) {
+            const long long len = qMin(size, (long long) (64 - buffer_size));
+            memcpy(buffer + buffer_size, data, len);
+            buffer_size += len;
+            data += len;
+            size -= len;
+
+            if (buffer_size < 64) {
+                return;
+            }
+
+            compress(state, buffer, 1);
+            buffer_size = 0;
+        }
+
+        const size_t block_count = size / 64;
+        if (block_count > 0) {
+            compress(state, data, block_count);
+        }
+        data += block_count * 64;
+        size -= block_count * 64;
+
+        memcpy(buffer, data, size);
+        buffer_size = size;
+    }
+
+    QByteArray result() const override {
+        // NOTE: pad a copy of the state, so that more data
+        // can be added after
+        uint32_t final_state[8];
+        memcpy(final_state, state, sizeof(state));
+
+        uint8_t padding[128] = {0};
+        memcpy(padding, buffer, buffer_size);
+        padding[buffer_size] = 0x80;
+
+        const size_t padded_size = (buffer_size < 56) ? 64 : 128;
+        const uint64_t bit_count = total * 8;
+        for (int i = 0; i < 8; i++) {
+            const uint8_t length_byte = (uint8_t) (bit_count >> (i * 8));
+
+            if (big_endian) {
+                padding[padded_size - 1 - i] = length_byte;
+            } else {
+                padding[padded_size - 8 + i] = length_byte;
+            }
+        }
+
+        compress(final_state, padding, padded_size / 64);
+
+        QByteArray out(state_size * 4, '\0');
+        for (int i = 0; i < state_size; i++) {
+            for (int j = 0; j < 4; j++) {
+                const int shift = big_endian ? (24 - j * 8) : (j * 8);
+                out[i * 4 + j] = (char) (final_state[i] >> shift);
+            }
+        }
+
+        return out.toHex();
+    }
+
+    QByteArray saveState() const override {
+        QByteArray out;
+        QDataStream stream(&out, QIODevice::WriteOnly);
+
+        stream << DIGEST_STATE_VERSION << (quint32) algorithm << (quint64) total;
+        for (int i = 0; i < state_size; i++) {
+            stream << (quint32) state[i];
+        }
+        stream << QByteArray((const char *) buffer, buffer_size);
+
+        return out;
+    }
+
+    bool restoreState(const QByteArray &saved) override {
+        QDataStream stream(saved);
+
+        quint32 version;
+        quint32 saved_algorithm;
+        quint64 saved_total;
+        stream >> version >> saved_algorithm >> saved_total;
+
+        if (version != DIGEST_STATE_VERSION || saved_algorithm != (quint32) algorithm) {
+            return false;
+        }
+
+        uint32_t saved_state[8];
+        for (int i = 0; i < state_size; i++) {
+            quint32 word;
+            stream >> word;
+            saved_state[i] = word;
+        }
+
+        QByteArray saved_buffer;
+        stream >> saved_buffer;
+
+        const bool buffer_valid = (saved_buffer.size() < 64 && (quint64) saved_buffer.size() == saved_total % 64);
+        if (stream.status() != QDataStream::Ok || !buffer_valid) {
+            return false;
+        }
+
+        memcpy(state, saved_state, state_size * sizeof(uint32_t));
+        memcpy(buffer, saved_buffer.constData(), saved_buffer.size());
+        buffer_size = saved_buffer.size();
+        total = saved_total;
+
+        return true;
+    }
+
+protected:
+    virtual void compress(uint32_t *state, const uint8_t *data, size_t block_count) const = 0;
+
+private:
+    const DigestAlgorithm algorithm;
+    const int state_size;
+    const bool big_endian;
+    uint32_t state[8];
+    uint8_t buffer[64];
+    size_t buffer_size;
+    uint64_t total;
+};
+
+inline uint32_t rotate_left(const uint32_t x, const int n) {
+    return (x << n) | (x >> (32 - n));
+}
+
+inline uint32_t rotate_right(const uint32_t x, const int n) {
+    return (x >> n) | (x << (32 - n));
+}
+
+class Md5Digest : public BlockDigest {
+public:
+    Md5Digest()
+    : BlockDigest(DigestAlgorithm_MD5, initial_state, 4, false) {
+
+    }
+
+protected:
+    void compress(uint32_t *state, const uint8_t *data, size_t block_count) const override {
+        static const uint32_t k[64] = {
+            0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+            0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be, 0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+            0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa, 0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+            0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed, 0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+            0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c, 0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+            0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05, 0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+            0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+            0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1, 0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391,
+        };
+        static const int shift[16] = {7, 12, 17, 22, 5, 9, 14, 20, 4, 11, 16, 23, 6, 10, 15, 21};
+
+        for (size_t block = 0; block < block_count; block++) {
+            const uint8_t *block_data = data + block * 64;
+
+            uint32_t m[16];
+            for (int i = 0; i < 16; i++) {
+                m[i] = (uint32_t) block_data[i * 4] | ((uint32_t) block_data[i * 4 + 1] << 8) | ((uint32_t) block_data[i * 4 + 2] << 16) | ((uint32_t) block_data[i * 4 + 3] << 24);
+            }
+
+            uint32_t a = state[0];
+            uint32_t b = state[1];
+            uint32_t c = state[2];
+            uint32_t d = state[3];
+
+            for (int i = 0; i < 64; i++) {
+                const int round = i / 16;
+                uint32_t f;
+                int g;
+
+                if (round == 0) {
+                    f = (b & c) | (~b & d);
+                    g = i;
+                } else if (round == 1) {
+                    f = (d & b) | (~d & c);
+                    g = (5 * i + 1) % 16;
+                } else if (round == 2) {
+                    f = b ^ c ^ d;
+                    g = (3 * i + 5) % 16;
+                } else {
+                    f = c ^ (b | ~d);
+                    g = (7 * i) % 16;
+                }
+
+                const uint32_t next_b = b + rotate_left(a + f + k[i] + m[g], shift[round * 4 + i % 4]);
+                a = d;
+                d = c;
+                c = b;
+                b = next_b;
+            }
+
+            state[0] += a;
+            state[1] += b;
+            state[2] += c;
+            state[3] += d;
+        }
+    }
+
+private:
+    static const uint32_t initial_state[4];
+};
+
+const uint32_t Md5Digest::initial_state[4] = {
+    0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476,
+};
+
+const uint32_t sha256_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+void sha256_compress_portable(uint32_t state[8], const uint8_t *data, size_t block_count) {
+    for (size_t block = 0; block < block_count; block++) {
+        const uint8_t *block_data = data + block * 64;
+
+        uint32_t w[64];
+        for (int i = 0; i < 16; i++) {
+            w[i] = ((uint32_t) block_data[i * 4] << 24) | ((uint32_t) block_data[i * 4 + 1] << 16) | ((uint32_t) block_data[i * 4 + 2] << 8) | (uint32_t) block_data[i * 4 + 3];
+        }
+        for (int i = 16; i < 64; i++) {
+            const uint32_t s0 = rotate_right(w[i - 15], 7) ^ rotate_right(w[i - 15], 18) ^ (w[i - 15] >> 3);
+            const uint32_t s1 = rotate_right(w[i - 2], 17) ^ rotate_right(w[i - 2], 19) ^ (w[i - 2] >> 10);
+            w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+        }
+
+        uint32_t v[8];
+        memcpy(v, state, sizeof(v));
+
+        for (int i = 0; i < 64; i++) {
+            const uint32_t s1 = rotate_right(v[4], 6) ^ rotate_right(v[4], 11) ^ rotate_right(v[4], 25);
+            const uint32_t ch = (v[4] & v[5]) ^ (~v[4] & v[6]);
+            const uint32_t temp1 = v[7] + s1 + ch + sha256_k[i] + w[i];
+            const uint32_t s0 = rotate_right(v[0], 2) ^ rotate_right(v[0], 13) ^ rotate_right(v[0], 22);
+            const uint32_t maj = (v[0] & v[1]) ^ (v[0] & v[2]) ^ (v[1] & v[2]);
+            const uint32_t temp2 = s0 + maj;
+
+            v[7] = v[6];
+            v[6] = v[5];
+            v[5] = v[4];
+            v[4] = v[3] + temp1;
+            v[3] = v[2];
+            v[2] = v[1];
+            v[1] = v[0];
+            v[0] = temp1 + temp2;
+        }
+
+        for (int i = 0; i < 8; i++) {
+            state[i] += v[i];
+        }
+    }
+}
+
+#ifdef HAVE_SHA_NI
+
+bool cpu_has_sha_ni() {
+    unsigned int eax, ebx, ecx, edx;
+
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+        return false;
+    }
+    const bool has_ssse3 = (ecx & bit_SSSE3);
+    const bool has_sse41 = (ecx & bit_SSE4_1);
+
+    if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)) {
+        return false;
+    }
+    const bool has_sha = (ebx & bit_SHA);
+
+    return (has_ssse3 && has_sse41 && has_sha);
+}
+
+// Process 64 byte blocks using SHA extensions. Each
+// iteration of the round loop does 4 rounds, message
+// schedule for the next 4 rounds is computed from the last
+// 16 words, which are kept in msg[].
+__attribute__((target("sha,sse4.1")))
+void sha256_compress_ni(uint32_t state[8], const uint8_t *data, size_t block_count) {
+    const __m128i byte_swap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+
+    // NOTE: sha256rnds2 wants state as ABEF and CDGH
+    __m128i tmp = _mm_loadu_si128((const __m128i *) &state[0]);
+    __m128i state1 = _mm_loadu_si128((const __m128i *) &state[4]);
+    tmp = _mm_shuffle_epi32(tmp, 0xB1);
+    state1 = _mm_shuffle_epi32(state1, 0x1B);
+    __m128i state0 = _mm_alignr_epi8(tmp, state1, 8);
+    state1 = _mm_blend_epi16(state1, tmp, 0xF0);
+
+    for (size_t block = 0; block < block_count; block++) {
+        const uint8_t *block_data = data + block * 64;
+        const __m128i abef_save = state0;
+        const __m128i cdgh_save = state1;
+        __m128i msg[4];
+
+        for (int i = 0; i < 16; i++) {
+            if (i < 4) {
+                msg[i] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (block_data + i * 16)), byte_swap);
+            } else {
+                __m128i w = _mm_sha256msg1_epu32(msg[i % 4], msg[(i + 1) % 4]);
+                w = _mm_add_epi32(w, _mm_alignr_epi8(msg[(i + 3) % 4], msg[(i + 2) % 4], 4));
+                msg[i % 4] = _mm_sha256msg2_epu32(w, msg[(i + 3) % 4]);
+            }
+
+            __m128i round_msg = _mm_add_epi32(msg[i % 4], _mm_loadu_si128((const __m128i *) &sha256_k[i * 4]));
+            state1 = _mm_sha256rnds2_epu32(state1, state0, round_msg);
+            round_msg = _mm_shuffle_epi32(round_msg, 0x0E);
+            state0 = _mm_sha256rnds2_epu32(state0, state1, round_msg);
+        }
+
+        state0 = _mm_add_epi32(state0, abef_save);
+        state1 = _mm_add_epi32(state1, cdgh_save);
+    }
+
+    tmp = _mm_shuffle_epi32(state0, 0x1B);
+    state1 = _mm_shuffle_epi32(state1, 0xB1);
+    state0 = _mm_blend_epi16(tmp, state1, 0xF0);
+    state1 = _mm_alignr_epi8(state1, tmp, 8);
+
+    _mm_storeu_si128((__m128i *) &state[0], state0);
+    _mm_storeu_si128((__m128i *) &state[4], state1);
+}
+
+#endif // HAVE_SHA_NI
+
+class Sha256Digest : public BlockDigest {
+public:
+    // Portable digest doesn't use SHA extensions, so that
+    // digestSelfTest() can check both implementations
+    Sha256Digest(const bool portable_arg = false)
+    : BlockDigest(DigestAlgorithm_SHA256, initial_state, 8, true)
+    , portable(portable_arg) {
+
+    }
+
+protected:
+    void compress(uint32_t *state, const uint8_t *data, size_t block_count) const override {
+#ifdef HAVE_SHA_NI
+        static const bool has_sha_ni = cpu_has_sha_ni();
+        if (has_sha_ni && !portable) {
+            sha256_compress_ni(state, data, block_count);
+            return;
+        }
+#endif
+
+        sha256_compress_portable(state, data, block_count);
+    }
+
+private:
+    static const uint32_t initial_state[8];
+    const bool portable;
+};
+
+const uint32_t Sha256Digest::initial_state[8] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+};
+
+#ifdef HAVE_BLAKE3
+
+class Blake3Digest : public Digest {
+public:
+    Blake3Digest() {
+        blake3_hasher_init(&hasher);
+    }
+
+    void addData(const void *data, long long size) override {
+        blake3_hasher_update(&hasher, data, size);
+    }
+
+    QByteArray result() const override {
+        // NOTE: finalizing doesn't modify the hasher
+        QByteArray out(BLAKE3_OUT_LEN, '\0');
+        blake3_hasher_finalize(&hasher, (uint8_t *) out.data(), out.size());
+
+        return out.toHex();
+    }
+
+private:
+    blake3_hasher hasher;
+};
+
+#endif // HAVE_BLAKE3
+
+// Hash input in pieces of different sizes, so that data
+// goes through the buffer and through whole blocks in
+// different ways. With save_restore, state is saved half
+// way and hashing continues in a new digest.
+QByteArray self_test_hash(Digest *(*create)(), const QByteArray &input, const bool save_restore) {
+    static const int piece_size_list[] = {1, 63, 65, 4096, 7};
+    static const int piece_size_count = sizeof(piece_size_list) / sizeof(piece_size_list[0]);
+
+    std::unique_ptr<Digest> digest(create());
+    bool restored = false;
+
+    const auto restore =
+        [&]() -> bool {
+            const QByteArray state = digest->saveState();
+            digest.reset(create());
+            restored = true;
+
+            return digest->restoreState(state);
+        };
+
+    int pos = 0;
+    int piece = 0;
+    while (pos < input.size()) {
+        if (save_restore && !restored && pos >= input.size() / 2) {
+            if (!restore()) {
+                return QByteArray();
+            }
+        }
+
+        const int len = qMin(piece_size_list[piece % piece_size_count], input.size() - pos);
+        digest->addData(input.constData() + pos, len);
+        pos += len;
+        piece++;
+    }
+
+    // NOTE: empty input is restored before the result
+    if (save_restore && !restored) {
+        if (!restore()) {
+            return QByteArray();
+        }
+    }
+
+    return digest->result();
+}
+
+}
+
+Digest *Digest::create(const DigestAlgorithm algorithm) {
+    switch (algorithm) {
+        case DigestAlgorithm_MD5: return new Md5Digest();
+        case DigestAlgorithm_SHA256: return new Sha256Digest();
+        case DigestAlgorithm_BLAKE3: {
+#ifdef HAVE_BLAKE3
+            return new Blake3Digest();
+#else
+            return nullptr;
+#endif
+        }
+    }
+
+    return nullptr;
+}
+
+bool Digest::isSupported(const DigestAlgorithm algorithm) {
+    const std::unique_ptr<Digest> digest(create(algorithm));
+
+    return (digest != nullptr);
+}
+
+Digest::~Digest() {
+
+}
+
+QByteArray Digest::saveState() const {
+    return QByteArray();
+}
+
+bool Digest::restoreState(const QByteArray &) {
+    return false;
+}
+
+bool digestParseChecksum(const QByteArray &checksum, DigestAlgorithm *algorithm, QByteArray *hex) {
+    const int separator = checksum.indexOf(':');
+
+    if (separator == -1) {
+        *algorithm = DigestAlgorithm_MD5;
+        *hex = checksum.trimmed().toLower();
+
+        return true;
+    }
+
+    const QByteArray name = checksum.left(separator).toLower();
+    *hex = checksum.mid(separator + 1).trimmed().toLower();
+
+    if (name == "md5") {
+        *algorithm = DigestAlgorithm_MD5;
+    } else if (name == "sha256") {
+        *algorithm = DigestAlgorithm_SHA256;
+    } else if (name == "blake3") {
+        *algorithm = DigestAlgorithm_BLAKE3;
+    } else {
+        return false;
+    }
+
+    return true;
+}
+
+QByteArray digestFormatChecksum(const DigestAlgorithm algorithm, const QByteArray &hex) {
+    switch (algorithm) {
+        case DigestAlgorithm_MD5: return hex;
+        case DigestAlgorithm_SHA256: return "sha256:" + hex;
+        case DigestAlgorithm_BLAKE3: return "blake3:" + hex;
+    }
+
+    return hex;
+}
+
+bool digestSelfTest(QString *failed_check) {
+    // NOTE: known answers are from RFC 1321 and FIPS 180-2,
+    // last input takes many blocks
+    const QList<QByteArray> input_list = {
+        QByteArray(),
+        "abc",
+        "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq",
+        QByteArray(1000000, 'a'),
+    };
+    const QList<QByteArray> md5_answers = {
+        "d41d8cd98f00b204e9800998ecf8427e",
+        "900150983cd24fb0d6963f7d28e17f72",
+        "8215ef0796a20bcaaae116d3876c664a",
+        "7707d6ae4e027c70eea2a935c2296f21",
+    };
+    const QList<QByteArray> sha256_answers = {
+        "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855",
+        "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad",
+        "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1",
+        "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0",
+    };
+
+    struct Implementation {
+        QString name;
+        Digest *(*create)();
+        QList<QByteArray> answers;
+    };
+
+    std::vector<Implementation> implementation_list = {
+        {"MD5", []() -> Digest * { return new Md5Digest(); }, md5_answers},
+        {"SHA-256", []() -> Digest * { return new Sha256Digest(true); }, sha256_answers},
+    };
+#ifdef HAVE_SHA_NI
+    if (cpu_has_sha_ni()) {
+        implementation_list.push_back({"SHA-256 (SHA extensions)", []() -> Digest * { return new Sha256Digest(false); }, sha256_answers});
+    }
+#endif
+
+    for (const Implementation &implementation : implementation_list) {
+        for (int i = 0; i < input_list.size(); i++) {
+            for (const bool save_restore : {false, true}) {
+                const QByteArray result = self_test_hash(implementation.create, input_list[i], save_restore);
+
+                if (result != implementation.answers[i]) {
+                    *failed_check = QString("%1 of input %2%3").arg(implementation.name).arg(i).arg(save_restore ? " with saved state" : "");
+
+                    return false;
+                }
+            }
+        }
+    }
+
+    return true;
+}
@@ -0,0 +1,84 @@
+/*
+ * ALT Media Writer
+ * Copyright (C) 2016-2019 Martin Bříza <mbriza@redhat.com>
+ * Copyright (C) 2020-2022 Dmitry Degtyarev <kevl@basealt.ru>
+ *
+ * ALT Media Writer is a fork of Fedora Media Writer
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef DIGEST_H
+#define DIGEST_H
+
+/*
+ * Streaming hash of image data. Image checksums from
+ * metadata are written as "<algorithm>:<hex>", a bare hex
+ * checksum is MD5 for compatibility with MD5SUM files:
+ *
+ * 0123abcd...                 - MD5
+ * sha256:0123abcd...          - SHA-256
+ * blake3:0123abcd...          - BLAKE3
+ *
+ * SHA-256 uses SHA extensions on x86 CPUs that have them.
+ * BLAKE3 is only available if built with libblake3, which
+ * picks the widest SIMD instructions the CPU supports.
+ *
+ * State of MD5 and SHA-256 can be saved and restored, so
+ * that hashing of a partially downloaded file can continue
+ * where it stopped.
+ */
+
+#include <QByteArray>
+#include <QString>
+
+// NOTE: ordered from weakest to strongest
+enum DigestAlgorithm {
+    DigestAlgorithm_MD5,
+    DigestAlgorithm_SHA256,
+    DigestAlgorithm_BLAKE3,
+};
+
+class Digest {
+public:
+    // Returns nullptr if algorithm is not supported by this
+    // build
+    static Digest *create(const DigestAlgorithm algorithm);
+    static bool isSupported(const DigestAlgorithm algorithm);
+
+    virtual ~Digest();
+
+    virtual void addData(const void *data, long long size) = 0;
+    // Hex digest of data added so far
+    virtual QByteArray result() const = 0;
+
+    // Returns empty array if not supported
+    virtual QByteArray saveState() const;
+    // Returns false if state is invalid or not supported,
+    // in which case digest is unchanged
+    virtual bool restoreState(const QByteArray &state);
+};
+
+// Splits a checksum into algorithm and hex digest, returns
+// false if algorithm is unknown
+bool digestParseChecksum(const QByteArray &checksum, DigestAlgorithm *algorithm, QByteArray *hex);
+QByteArray digestFormatChecksum(const DigestAlgorithm algorithm, const QByteArray &hex);
+// Checks MD5 and SHA-256, including SHA extensions if the
+// CPU has them and saving state, against known answers.
+// Run by "helper selftest" at build time. Returns false
+// and describes the failed check if any digest is wrong.
+bool digestSelfTest(QString *failed_check);
+
+#endif // DIGEST_H
@@ -0,0 +1,8 @@
+# NOTE: BLAKE3 checksums are optional, without libblake3
+# images with BLAKE3 checksums are not verified. Included
+# by isomd5 and by everything that links to it.
+packagesExist(libblake3) {
+    CONFIG += link_pkgconfig
+    PKGCONFIG += libblake3
+    DEFINES += HAVE_BLAKE3
+}
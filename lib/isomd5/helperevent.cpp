@@ -0,0 +1,91 @@
+/*
+ * ALT Media Writer
+ * Copyright (C) 2016-2019 Martin Bříza <mbriza@redhat.com>
+ * Copyright (C) 2020-2022 Dmitry Degtyarev <kevl@basealt.ru>
+ *
+ * ALT Media Writer is a fork of Fedora Media Writer
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include "helperevent.h"
+
+#include <QDataStream>
+
+HelperEvent helperEvent(const HelperStage stage, const qint32 drive) {
+    HelperEvent out;
+    out.stage = stage;
+    out.drive = drive;
+    out.bytes_done = 0;
+    out.bytes_total = 0;
+    out.rate = 0;
+    out.error = HelperError_NONE;
+
+    return out;
+}
+
+QByteArray helperEventEncode(const HelperEvent &event) {
+    QByteArray out;
+    out.reserve(HELPER_EVENT_SIZE);
+
+    QDataStream stream(&out, QIODevice::WriteOnly);
+    stream.setByteOrder(QDataStream::BigEndian);
+    stream << (quint8) HELPER_EVENT_VERSION;
+    stream << (quint8) event.stage;
+    stream << event.drive;
+    stream << event.bytes_done;
+    stream << event.bytes_total;
+    stream << event.rate;
+    stream << (quint16) event.error;
+
+    return out;
+}
+
+bool helperEventDecode(QByteArray *buffer, QList<HelperEvent> *out) {
+    int pos = 0;
+
+    while (buffer->size() - pos >= HELPER_EVENT_SIZE) {
+        QDataStream stream(buffer->mid(pos, HELPER_EVENT_SIZE));
+        stream.setByteOrder(QDataStream::BigEndian);
+        pos += HELPER_EVENT_SIZE;
+
+        quint8 version;
+        quint8 stage;
+        quint16 error;
+        HelperEvent event;
+        stream >> version;
+        stream >> stage;
+        stream >> event.drive;
+        stream >> event.bytes_done;
+        stream >> event.bytes_total;
+        stream >> event.rate;
+        stream >> error;
+
+        const bool stage_valid = (stage <= HelperStage_FAILED);
+        const bool error_valid = (error <= HelperError_CHECK_FAILED);
+        if (version != HELPER_EVENT_VERSION || !stage_valid || !error_valid) {
+            buffer->remove(0, pos);
+            return false;
+        }
+        event.stage = (HelperStage) stage;
+        event.error = (HelperError) error;
+
+        out->append(event);
+    }
+
+    buffer->remove(0, pos);
+
+    return true;
+}
@@ -0,0 +1,100 @@
+/*
+ * ALT Media Writer
+ * Copyright (C) 2016-2019 Martin Bříza <mbriza@redhat.com>
+ * Copyright (C) 2020-2022 Dmitry Degtyarev <kevl@basealt.ru>
+ *
+ * ALT Media Writer is a fork of Fedora Media Writer
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef HELPEREVENT_H
+#define HELPEREVENT_H
+
+/**
+ * Progress events that the Linux helper writes to stdout
+ * while writing an image, instead of printing text. Errors
+ * are still printed to stderr as text, events only carry
+ * error codes.
+ *
+ * Every event is a fixed size record, starting with the
+ * version of the format, so the app can read them without
+ * parsing text and detect a helper from a different
+ * version. Numbers are big endian.
+ *
+ * Helper sends an event when a stage starts, when a stage
+ * ends for a drive (done or failed) and while a stage is
+ * in progress, at most a few times a second per drive.
+ * Drive is the index of the drive in the list of drives
+ * given to the helper, or -1 for events about all drives.
+ */
+
+#include <QByteArray>
+#include <QList>
+
+// Bumped when events change
+#define HELPER_EVENT_VERSION 1
+
+// Size of an encoded event in bytes
+#define HELPER_EVENT_SIZE 32
+
+enum HelperStage {
+    HelperStage_WRITE = 0,
+    HelperStage_CHECK,
+    HelperStage_DONE,
+    HelperStage_FAILED,
+};
+
+enum HelperError {
+    HelperError_NONE = 0,
+    // Drive couldn't be opened
+    HelperError_DRIVE_UNAVAILABLE,
+    HelperError_DRIVE_UNWRITABLE,
+    HelperError_SOURCE_UNREADABLE,
+    // Source doesn't match its checksum or segment
+    // manifest, or compressed data is corrupted
+    HelperError_SOURCE_CORRUPTED,
+    // Block map or segment manifest can't be used
+    HelperError_METADATA,
+    HelperError_DECOMPRESSION,
+    // Data read back from the drive doesn't match
+    HelperError_CHECK_MISMATCH,
+    // Drive couldn't be read back
+    HelperError_CHECK_FAILED,
+};
+
+struct HelperEvent {
+    HelperStage stage;
+    qint32 drive;
+    // Progress within the stage, relative to the size of
+    // the image file. Total is 0 if the size is not known
+    // yet, for an image that is still downloading.
+    qint64 bytes_done;
+    qint64 bytes_total;
+    // Bytes per second since the previous event of the
+    // drive
+    qint64 rate;
+    HelperError error;
+};
+
+HelperEvent helperEvent(const HelperStage stage, const qint32 drive);
+QByteArray helperEventEncode(const HelperEvent &event);
+// Takes complete events from the start of buffer, leaving
+// an incomplete one there. Returns false if buffer
+// contains an event of a different version or a malformed
+// one.
+bool helperEventDecode(QByteArray *buffer, QList<HelperEvent> *out);
+
+#endif // HELPEREVENT_H
@@ -0,0 +1,133 @@
+/*
+ * ALT Media Writer
+ * Copyright (C) 2016-2019 Martin Bříza <mbriza@redhat.com>
+ * Copyright (C) 2020-2022 Dmitry Degtyarev <kevl@basealt.ru>
+ *
+ * ALT Media Writer is a fork of Fedora Media Writer
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include "helperprotocol.h"
+
+#include <QDataStream>
+#include <QDir>
+#include <QStandardPaths>
+#include <QtEndian>
+
+#ifdef __linux__
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <unistd.h>
+#endif
+
+// NOTE: messages larger than this are treated as
+// malformed, output of a job arrives in small pieces
+#define MAX_MESSAGE_SIZE (16 * 1024 * 1024)
+
+// NOTE: runtime location is $XDG_RUNTIME_DIR, if it's not
+// set Qt makes a private directory instead
+QString helperSocketName(const QString &base_name) {
+    const QString runtime_dir = QStandardPaths::writableLocation(QStandardPaths::RuntimeLocation);
+    if (runtime_dir.isEmpty()) {
+        return QString();
+    }
+
+    const QString file_name = QString("%1-%2").arg(base_name).arg(HELPER_PROTOCOL_VERSION);
+
+    return QDir(runtime_dir).absoluteFilePath(file_name);
+}
+
+bool helperPeerIsTrusted(const qintptr socket_descriptor) {
+#ifdef __linux__
+    struct ucred credentials;
+    socklen_t credentials_size = sizeof(credentials);
+
+    const int result = getsockopt(socket_descriptor, SOL_SOCKET, SO_PEERCRED, &credentials, &credentials_size);
+    if (result != 0) {
+        return false;
+    }
+
+    return (credentials.uid == getuid());
+#else
+    Q_UNUSED(socket_descriptor);
+
+    return false;
+#endif
+}
+
+HelperMessage helperMessage(const HelperMessageType type, const qint32 job) {
+    HelperMessage out;
+    out.type = type;
+    out.job = job;
+    out.exit_code = 0;
+
+    return out;
+}
+
+QByteArray helperMessageEncode(const HelperMessage &message) {
+    QByteArray payload;
+    QDataStream stream(&payload, QIODevice::WriteOnly);
+    stream.setVersion(QDataStream::Qt_5_0);
+    stream << (qint32) message.type;
+    stream << message.job;
+    stream << message.arguments;
+    stream << message.data;
+    stream << message.exit_code;
+
+    QByteArray out(sizeof(quint32), 0);
+    qToBigEndian((quint32) payload.size(), (uchar *) out.data());
+    out.append(payload);
+
+    return out;
+}
+
+bool helperMessageDecode(QByteArray *buffer, QList<HelperMessage> *out) {
+    while (buffer->size() >= (int) sizeof(quint32)) {
+        const quint32 size = qFromBigEndian<quint32>((const uchar *) buffer->constData());
+        if (size > MAX_MESSAGE_SIZE) {
+            return false;
+        }
+
+        const int message_end = sizeof(quint32) + size;
+        if (buffer->size() < message_end) {
+            break;
+        }
+
+        const QByteArray payload = buffer->mid(sizeof(quint32), size);
+        buffer->remove(0, message_end);
+
+        QDataStream stream(payload);
+        stream.setVersion(QDataStream::Qt_5_0);
+
+        qint32 type;
+        HelperMessage message;
+        stream >> type;
+        stream >> message.job;
+        stream >> message.arguments;
+        stream >> message.data;
+        stream >> message.exit_code;
+
+        const bool type_valid = (type >= HelperMessageType_START && type <= HelperMessageType_FINISHED);
+        if (stream.status() != QDataStream::Ok || !type_valid) {
+            return false;
+        }
+        message.type = (HelperMessageType) type;
+
+        out->append(message);
+    }
+
+    return true;
+}
@@ -0,0 +1,100 @@
+/*
+ * ALT Media Writer
+ * Copyright (C) 2016-2019 Martin Bříza <mbriza@redhat.com>
+ * Copyright (C) 2020-2022 Dmitry Degtyarev <kevl@basealt.ru>
+ *
+ * ALT Media Writer is a fork of Fedora Media Writer
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef HELPERPROTOCOL_H
+#define HELPERPROTOCOL_H
+
+/**
+ * Messages between the app and the Linux helper daemon.
+ * Daemon runs helper jobs for the app over a local
+ * socket, so that a new helper doesn't have to be started
+ * and authorized for every drive.
+ *
+ * App sends:
+ * start - start a job, arguments are the same as for a
+ *     helper process, for example "write", image, drive,
+ *     checksum
+ * cancel - stop a job as soon as possible
+ *
+ * Daemon sends:
+ * output - data that a helper process would print to
+ *     stdout
+ * error - same for stderr
+ * finished - job finished, with the exit code that a
+ *     helper process would exit with
+ *
+ * Jobs are identified by ids chosen by the app, several
+ * jobs may run at once over one connection. Each message
+ * is a 32 bit size followed by the message serialized
+ * with QDataStream.
+ *
+ * Socket name includes the protocol version, so an app
+ * never talks to a daemon from a different version.
+ *
+ * Socket is created in the user's runtime directory, which
+ * other users can't access, instead of the shared /tmp.
+ * Both sides also check that the other end of the socket
+ * belongs to the same user, so another user can't
+ * impersonate the daemon or the app.
+ */
+
+#include <QByteArray>
+#include <QList>
+#include <QString>
+#include <QStringList>
+
+// Bumped when messages change
+#define HELPER_PROTOCOL_VERSION 1
+
+enum HelperMessageType {
+    HelperMessageType_START = 0,
+    HelperMessageType_CANCEL,
+    HelperMessageType_OUTPUT,
+    HelperMessageType_ERROR,
+    HelperMessageType_FINISHED,
+};
+
+struct HelperMessage {
+    HelperMessageType type;
+    qint32 job;
+    // Arguments of start
+    QStringList arguments;
+    // Data of output and error
+    QByteArray data;
+    // Exit code of finished
+    qint32 exit_code;
+};
+
+// Absolute path of the socket, empty if there is no
+// runtime directory
+QString helperSocketName(const QString &base_name);
+// Whether the process on the other end of the connected
+// local socket runs as the same user as this one
+bool helperPeerIsTrusted(const qintptr socket_descriptor);
+HelperMessage helperMessage(const HelperMessageType type, const qint32 job);
+QByteArray helperMessageEncode(const HelperMessage &message);
+// Takes complete messages from the start of buffer,
+// leaving an incomplete one there. Returns false if
+// buffer contains a malformed message.
+bool helperMessageDecode(QByteArray *buffer, QList<HelperMessage> *out);
+
+#endif // HELPERPROTOCOL_H
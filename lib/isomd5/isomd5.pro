@@ -4,10 +4,24 @@ CONFIG += staticlib
 
 QT += core
 
+CONFIG += c++11
+
 DESTDIR = ../
 
-HEADERS += libcheckisomd5.h
+HEADERS += libcheckisomd5.h \
+    digest.h \
+    segmentmanifest.h \
+    partmap.h \
+    helperprotocol.h \
+    helperevent.h
+
+SOURCES += libcheckisomd5.cpp \
+    digest.cpp \
+    segmentmanifest.cpp \
+    partmap.cpp \
+    helperprotocol.cpp \
+    helperevent.cpp
 
-SOURCES += libcheckisomd5.cpp
+include(digest.pri)
 
 QMAKE_MACOSX_DEPLOYMENT_TARGET = 10.9
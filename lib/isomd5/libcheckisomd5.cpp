@@ -31,10 +31,17 @@
 #include <fcntl.h>
 #include <string.h>
 #include <inttypes.h>
+#include <errno.h>
 
-#include <QCryptographicHash>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QThread>
+#include <QWaitCondition>
 
 #include "libcheckisomd5.h"
+#include "digest.h"
+
+#include <memory>
 
 #ifdef __APPLE__
 #define lseek64 lseek
@@ -52,59 +59,264 @@ size_t getpagesize () {
 #define MAX(x, y)  ((x > y) ? x : y)
 #define MIN(x, y)  ((x < y) ? x : y)
 
-static int checkmd5sum(int fd, const char *mediasum, checkCallback cb, void *cbdata, long long size) {
-    // Md5 is empty, therefore md5 check not needed
-    if (mediasum[0] == '\0') {
-        return ISOMD5SUM_CHECK_PASSED;
+#ifdef _WIN32
+#define pread_compat(fd, buf, count, offset) (lseek64(fd, offset, SEEK_SET) == -1 ? -1 : read(fd, buf, count))
+#else
+#define pread_compat(fd, buf, count, offset) pread(fd, buf, count, offset)
+#endif
+
+/* number of chunks that can be read ahead of the consumer */
+#define CHUNK_COUNT 3
+
+/*
+ * Reads chunks of a file on a separate thread into a small
+ * ring of aligned buffers. Reads are aligned to page size
+ * so that they work on fd's opened with O_DIRECT and on raw
+ * drives on Windows.
+ */
+class ChunkReader : public QThread {
+public:
+    ChunkReader(int fd_arg, long long size_arg, size_t chunk_size_arg)
+    : fd(fd_arg)
+    , size(size_arg)
+    , read_count(0)
+    , release_count(0)
+    , stopped(false)
+    , failed(false) {
+        const size_t pagesize = getpagesize();
+
+        if (chunk_size_arg == 0) {
+            chunk_size_arg = ISOMD5SUM_DEFAULT_CHUNK_SIZE;
+        }
+        chunk_size = ((chunk_size_arg + pagesize - 1) / pagesize) * pagesize;
+
+        for (int i = 0; i < CHUNK_COUNT; i++) {
+            buf_unaligned[i] = (unsigned char *) malloc((chunk_size + pagesize) * sizeof(unsigned char));
+            buf[i] = (buf_unaligned[i] + (pagesize - ((uintptr_t) buf_unaligned[i] % pagesize)));
+            buf_size[i] = 0;
+        }
     }
-    
-    int pagesize = getpagesize();
-    unsigned char *buf_unaligned = (unsigned char *) malloc((BUFSIZE + pagesize) * sizeof(unsigned char));
-    unsigned char *buf = (buf_unaligned + (pagesize - ((uintptr_t) buf_unaligned % pagesize)));
 
-    // Rewind
-    long long offset = lseek64(fd, 0LL, SEEK_SET);
+    ~ChunkReader() {
+        stop();
+        wait();
+
+        for (int i = 0; i < CHUNK_COUNT; i++) {
+            free(buf_unaligned[i]);
+        }
+    }
+
+    /* returns size of next chunk, 0 at the end or on error */
+    long long next(const unsigned char **data) {
+        QMutexLocker locker(&mutex);
+
+        while (release_count == read_count && !stopped) {
+            condition.wait(&mutex);
+        }
+
+        if (release_count == read_count) {
+            return 0;
+        }
+
+        const int index = release_count % CHUNK_COUNT;
+        *data = buf[index];
+
+        return buf_size[index];
+    }
+
+    void release() {
+        QMutexLocker locker(&mutex);
+        release_count++;
+        condition.wakeAll();
+    }
+
+    void stop() {
+        QMutexLocker locker(&mutex);
+        stopped = true;
+        condition.wakeAll();
+    }
+
+    bool hasFailed() {
+        QMutexLocker locker(&mutex);
+        return failed;
+    }
+
+protected:
+    void run() override {
+        const size_t pagesize = getpagesize();
+
+#ifdef __linux__
+        posix_fadvise(fd, 0, size, POSIX_FADV_SEQUENTIAL);
+#endif
+
+        for (long long offset = 0; offset < size; offset += chunk_size) {
+            int index;
+            {
+                QMutexLocker locker(&mutex);
+
+                while (read_count - release_count == CHUNK_COUNT && !stopped) {
+                    condition.wait(&mutex);
+                }
+
+                if (stopped) {
+                    return;
+                }
+
+                index = read_count % CHUNK_COUNT;
+            }
 
-    // Compute md5
-    QCryptographicHash hash(QCryptographicHash::Md5);
+            const long long wanted = MIN(size - offset, (long long) chunk_size);
+            const long long aligned = ((wanted + pagesize - 1) / pagesize) * pagesize;
+
+#ifdef __linux__
+            /* ask the kernel to start reading next chunk while this one is read */
+            if (offset + wanted < size) {
+                posix_fadvise(fd, offset + wanted, MIN(size - offset - wanted, (long long) chunk_size), POSIX_FADV_WILLNEED);
+            }
+#endif
+
+            long long nread = 0;
+            while (nread < wanted) {
+                const ssize_t rc = pread_compat(fd, buf[index] + nread, aligned - nread, offset + nread);
+
+                if (rc < 0 && errno == EINTR) {
+                    continue;
+                }
+                if (rc <= 0) {
+                    break;
+                }
+
+                nread += rc;
+            }
+
+            QMutexLocker locker(&mutex);
+
+            if (nread < wanted) {
+                failed = true;
+                stopped = true;
+                condition.wakeAll();
+
+                return;
+            }
+
+            buf_size[index] = wanted;
+            read_count++;
+            condition.wakeAll();
+        }
+
+        QMutexLocker locker(&mutex);
+        stopped = true;
+        condition.wakeAll();
+    }
+
+private:
+    const int fd;
+    const long long size;
+    size_t chunk_size;
+    unsigned char *buf_unaligned[CHUNK_COUNT];
+    unsigned char *buf[CHUNK_COUNT];
+    long long buf_size[CHUNK_COUNT];
+    QMutex mutex;
+    QWaitCondition condition;
+    long long read_count;
+    long long release_count;
+    bool stopped;
+    bool failed;
+};
+
+int mediaReadFD(int fd, long long size, size_t chunk_size, dataCallback data_cb, checkCallback cb, void *cbdata) {
+    if (fd < 0) {
+        return ISOMD5SUM_FILE_NOT_FOUND;
+    }
+
+    ChunkReader reader(fd, size, chunk_size);
+    reader.start();
 
     if (cb) {
         cb(cbdata, 0, size);
     }
 
-    while (offset < size) {
-        ssize_t nattempt = MIN(size - offset, BUFSIZE);
+    long long offset = 0;
 
-        ssize_t nread = read(fd, buf, nattempt);
-        if (nread <= 0)
+    while (true) {
+        const unsigned char *data = NULL;
+        const long long nread = reader.next(&data);
+        if (nread == 0) {
             break;
-
-        if (nread > nattempt) {
-            nread = nattempt;
-            lseek64(fd, offset + nread, SEEK_SET);
         }
 
-        hash.addData((const char *) buf, nread);
+        data_cb(cbdata, data, nread);
+        reader.release();
 
-        offset = offset + nread;
-        if (cb && offset / nread % 256 == 0) {
-            if (cb(cbdata, offset, size)) {
-                free(buf_unaligned);
-                return ISOMD5SUM_CHECK_ABORTED;
-            }
+#ifdef __linux__
+        /* verified data won't be needed again */
+        posix_fadvise(fd, offset, nread, POSIX_FADV_DONTNEED);
+#endif
+
+        offset += nread;
+
+        if (cb && cb(cbdata, offset, size)) {
+            return ISOMD5SUM_CHECK_ABORTED;
         }
     }
 
-    if (cb) {
-        cb(cbdata, size, size);
+    if (reader.hasFailed() || offset < size) {
+        return ISOMD5SUM_READ_ERROR;
     }
 
-    free(buf_unaligned);
+    return ISOMD5SUM_CHECK_PASSED;
+}
+
+struct Md5Data {
+    Digest *hash;
+    checkCallback cb;
+    void *cbdata;
+};
 
-    const QByteArray computedsum_bytes = hash.result().toHex();
-    const char *computed_sum = computedsum_bytes.constData();
+static void md5DataCallback(void *data, const unsigned char *buf, long long size) {
+    Md5Data *md5_data = (Md5Data *) data;
+    md5_data->hash->addData(buf, size);
+}
 
-    const bool sums_match = (memcmp(computed_sum, mediasum, computedsum_bytes.size()) == 0);
+static int md5CheckCallback(void *data, long long offset, long long total) {
+    Md5Data *md5_data = (Md5Data *) data;
+
+    if (md5_data->cb) {
+        return md5_data->cb(md5_data->cbdata, offset, total);
+    } else {
+        return 0;
+    }
+}
+
+static int checkmd5sum(int fd, const char *mediasum, size_t chunk_size, checkCallback cb, void *cbdata, long long size) {
+    // Md5 is empty, therefore md5 check not needed
+    if (mediasum[0] == '\0') {
+        return ISOMD5SUM_CHECK_PASSED;
+    }
+
+    // NOTE: checksum may be of other algorithm than md5,
+    // see digest.h. Treat unsupported checksums like
+    // missing ones.
+    DigestAlgorithm algorithm;
+    QByteArray expected_sum;
+    const bool parse_success = digestParseChecksum(QByteArray(mediasum), &algorithm, &expected_sum);
+    if (!parse_success) {
+        return ISOMD5SUM_CHECK_NOT_FOUND;
+    }
+
+    const std::unique_ptr<Digest> hash(Digest::create(algorithm));
+    if (hash == nullptr) {
+        return ISOMD5SUM_CHECK_NOT_FOUND;
+    }
+
+    Md5Data md5_data = {hash.get(), cb, cbdata};
+
+    const int rc = mediaReadFD(fd, size, chunk_size, md5DataCallback, md5CheckCallback, &md5_data);
+    if (rc != ISOMD5SUM_CHECK_PASSED) {
+        return rc;
+    }
+
+    const bool sums_match = (hash->result() == expected_sum);
 
     if (sums_match) {
         return ISOMD5SUM_CHECK_PASSED;
@@ -118,6 +330,13 @@ int mediaCheckFile(const char *file, const char *md5,checkCallback cb, void *cbd
 
 #ifdef _WIN32
     fd = open(file, O_RDONLY | O_BINARY);
+#elif defined(__linux__)
+    // NOTE: bypass page cache, some filesystems don't
+    // support O_DIRECT so fall back to normal reads
+    fd = open(file, O_RDONLY | O_DIRECT);
+    if (fd < 0) {
+        fd = open(file, O_RDONLY);
+    }
 #else
     fd = open(file, O_RDONLY);
 #endif
@@ -129,7 +348,7 @@ int mediaCheckFile(const char *file, const char *md5,checkCallback cb, void *cbd
     // Calculate file size
     long long size = lseek64(fd, 0L, SEEK_END);
 
-    int rc = checkmd5sum(fd, md5, cb, cbdata, size);
+    int rc = checkmd5sum(fd, md5, 0, cb, cbdata, size);
 
     close(fd);
 
@@ -137,6 +356,10 @@ int mediaCheckFile(const char *file, const char *md5,checkCallback cb, void *cbd
 }
 
 int mediaCheckFD(int fd, const char *md5, checkCallback cb, void *cbdata) {
+    return mediaCheckFDChunked(fd, md5, 0, cb, cbdata);
+}
+
+int mediaCheckFDChunked(int fd, const char *md5, size_t chunk_size, checkCallback cb, void *cbdata) {
     if (fd < 0) {
         return ISOMD5SUM_FILE_NOT_FOUND;
     }
@@ -174,7 +397,7 @@ int mediaCheckFD(int fd, const char *md5, checkCallback cb, void *cbdata) {
 
     free(buf_unaligned);
 
-    int rc = checkmd5sum(fd, md5, cb, cbdata, size);
+    int rc = checkmd5sum(fd, md5, chunk_size, cb, cbdata, size);
 
     return rc;
 }
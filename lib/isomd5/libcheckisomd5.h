@@ -1,17 +1,36 @@
 #ifndef __LIBCHECKISOMD5_H__
 #define  __LIBCHECKISOMD5_H__
 
+#include <stddef.h>
+
 #define ISOMD5SUM_CHECK_PASSED          1
 #define ISOMD5SUM_CHECK_FAILED          0
 #define ISOMD5SUM_CHECK_ABORTED         2
 #define ISOMD5SUM_CHECK_NOT_FOUND       -1
 #define ISOMD5SUM_FILE_NOT_FOUND        -2
+#define ISOMD5SUM_READ_ERROR            -3
+
+/* size of one read, chunk_size of 0 means default */
+#define ISOMD5SUM_DEFAULT_CHUNK_SIZE    (4 * 1024 * 1024)
 
 /* for non-zero return value, check is aborted */
 typedef int (*checkCallback)(void *, long long offset, long long total);
 
+/* called for each chunk of data in order */
+typedef void (*dataCallback)(void *, const unsigned char *data, long long size);
+
 int mediaCheckFile(const char *iso, const char *md5, checkCallback cb, void *cbdata);
 int mediaCheckFD(int fd, const char *md5, checkCallback cb, void *cbdata);
+int mediaCheckFDChunked(int fd, const char *md5, size_t chunk_size, checkCallback cb, void *cbdata);
+
+/*
+ * Reads first size bytes of fd and passes them to data_cb.
+ * Reading runs on a separate thread, ahead of data_cb, so
+ * that reading and hashing overlap. Both callbacks are
+ * called from the calling thread. Returns
+ * ISOMD5SUM_CHECK_PASSED if all data was read.
+ */
+int mediaReadFD(int fd, long long size, size_t chunk_size, dataCallback data_cb, checkCallback cb, void *cbdata);
 int printMD5SUM(char *file);
 
 #endif
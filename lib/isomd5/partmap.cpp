@@ -0,0 +1,175 @@
+/*
+ * ALT Media Writer
+ * Copyright (C) 2016-2019 Martin Bříza <mbriza@redhat.com>
+ * Copyright (C) 2020-2022 Dmitry Degtyarev <kevl@basealt.ru>
+ *
+ * ALT Media Writer is a fork of Fedora Media Writer
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include "partmap.h"
+
+#include <QDataStream>
+#include <QFile>
+#include <QSaveFile>
+
+// Bumped when layout of saved map changes
+#define PART_MAP_VERSION 1
+
+PartMap::PartMap()
+: m_totalSize(-1) {
+
+}
+
+PartMap::PartMap(const qint64 totalSize_arg)
+: m_totalSize(totalSize_arg) {
+    done.resize(blockCount());
+    fill.fill(0, blockCount());
+}
+
+bool PartMap::load(const QString &path) {
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+
+    QDataStream stream(&file);
+    qint32 version;
+    qint64 blockSize;
+    qint64 loadedTotalSize;
+    QBitArray loadedDone;
+    stream >> version >> blockSize >> loadedTotalSize >> loadedDone;
+
+    const bool valid = (stream.status() == QDataStream::Ok && version == PART_MAP_VERSION && blockSize == PART_MAP_BLOCK_SIZE && loadedTotalSize >= 0);
+    if (!valid) {
+        return false;
+    }
+
+    *this = PartMap(loadedTotalSize);
+    if (loadedDone.size() != done.size()) {
+        *this = PartMap();
+
+        return false;
+    }
+
+    done = loadedDone;
+
+    // NOTE: partially written blocks are written again
+    // from the start, so their fill is not saved
+    for (int block = 0; block < blockCount(); block++) {
+        if (done.testBit(block)) {
+            fill[block] = blockLength(block);
+        }
+    }
+
+    return true;
+}
+
+bool PartMap::save(const QString &path) const {
+    // NOTE: helper may read the map while it's saved, so
+    // it's replaced in one go
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly)) {
+        return false;
+    }
+
+    QDataStream stream(&file);
+    stream << (qint32) PART_MAP_VERSION << (qint64) PART_MAP_BLOCK_SIZE << m_totalSize << done;
+
+    return (stream.status() == QDataStream::Ok && file.commit());
+}
+
+bool PartMap::isEmpty() const {
+    return (m_totalSize < 0);
+}
+
+qint64 PartMap::totalSize() const {
+    return m_totalSize;
+}
+
+qint64 PartMap::writtenSize() const {
+    qint64 out = 0;
+    for (const qint64 block_fill : fill) {
+        out += block_fill;
+    }
+
+    return out;
+}
+
+bool PartMap::isComplete() const {
+    return (done.count(true) == done.size());
+}
+
+void PartMap::markWritten(const qint64 offset, const qint64 size) {
+    qint64 pos = offset;
+    const qint64 end = qMin(offset + size, m_totalSize);
+
+    while (pos < end) {
+        const int block = pos / PART_MAP_BLOCK_SIZE;
+        const qint64 block_end = qMin((qint64) (block + 1) * PART_MAP_BLOCK_SIZE, end);
+
+        fill[block] += block_end - pos;
+        if (fill[block] >= blockLength(block)) {
+            fill[block] = blockLength(block);
+            done.setBit(block);
+        }
+
+        pos = block_end;
+    }
+}
+
+bool PartMap::isDone(const qint64 offset) const {
+    const int block = offset / PART_MAP_BLOCK_SIZE;
+
+    return (block < done.size() && done.testBit(block));
+}
+
+QList<QPair<qint64, qint64>> PartMap::missingRanges() const {
+    QList<QPair<qint64, qint64>> out;
+
+    int block = 0;
+    while (block < blockCount()) {
+        if (done.testBit(block)) {
+            block++;
+            continue;
+        }
+
+        const int first = block;
+        while (block < blockCount() && !done.testBit(block)) {
+            block++;
+        }
+
+        const qint64 range_offset = (qint64) first * PART_MAP_BLOCK_SIZE;
+        const qint64 range_end = qMin((qint64) block * PART_MAP_BLOCK_SIZE, m_totalSize);
+        out.append({range_offset, range_end});
+    }
+
+    return out;
+}
+
+int PartMap::blockCount() const {
+    if (m_totalSize < 0) {
+        return 0;
+    } else {
+        return (m_totalSize + PART_MAP_BLOCK_SIZE - 1) / PART_MAP_BLOCK_SIZE;
+    }
+}
+
+qint64 PartMap::blockLength(const int block) const {
+    const qint64 block_offset = (qint64) block * PART_MAP_BLOCK_SIZE;
+
+    return qMin((qint64) PART_MAP_BLOCK_SIZE, m_totalSize - block_offset);
+}
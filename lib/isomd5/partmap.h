@@ -0,0 +1,85 @@
+/*
+ * ALT Media Writer
+ * Copyright (C) 2016-2019 Martin Bříza <mbriza@redhat.com>
+ * Copyright (C) 2020-2022 Dmitry Degtyarev <kevl@basealt.ru>
+ *
+ * ALT Media Writer is a fork of Fedora Media Writer
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef PARTMAP_H
+#define PARTMAP_H
+
+/**
+ * Tracks which parts of a ".part" file were written when
+ * an image is downloaded in several segments at once. File
+ * is split into blocks of PART_MAP_BLOCK_SIZE bytes, a block
+ * is done once all of its bytes are written. Map is saved
+ * next to the image so that an interrupted download
+ * resumes with the blocks that are not done.
+ *
+ * Each block is written by one segment in order, so it's
+ * enough to count written bytes per block. Blocks that were
+ * partially written when the map was saved are downloaded
+ * again from the start.
+ *
+ * Map is saved atomically and only covers data that is in
+ * the file, so the Linux helper also uses it to find how
+ * much of the image it can write while the image is still
+ * downloading.
+ */
+
+#include <QBitArray>
+#include <QList>
+#include <QPair>
+#include <QString>
+#include <QVector>
+
+#define PART_MAP_BLOCK_SIZE (1024L * 1024L)
+
+class PartMap {
+public:
+    // Empty map, for downloads of unknown size
+    PartMap();
+    PartMap(const qint64 totalSize_arg);
+
+    bool load(const QString &path);
+    bool save(const QString &path) const;
+
+    bool isEmpty() const;
+    qint64 totalSize() const;
+    // Amount of data in done blocks and written parts of
+    // other blocks
+    qint64 writtenSize() const;
+    bool isComplete() const;
+
+    void markWritten(const qint64 offset, const qint64 size);
+    // Whether the block containing offset is done
+    bool isDone(const qint64 offset) const;
+    // Offset and end of each run of blocks that are not
+    // done
+    QList<QPair<qint64, qint64>> missingRanges() const;
+
+private:
+    qint64 m_totalSize;
+    QBitArray done;
+    QVector<qint64> fill;
+
+    int blockCount() const;
+    qint64 blockLength(const int block) const;
+};
+
+#endif // PARTMAP_H
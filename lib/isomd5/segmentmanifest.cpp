@@ -0,0 +1,430 @@
+/*
+ * ALT Media Writer
+ * Copyright (C) 2016-2019 Martin Bříza <mbriza@redhat.com>
+ * Copyright (C) 2020-2022 Dmitry Degtyarev <kevl@basealt.ru>
+ *
+ * ALT Media Writer is a fork of Fedora Media Writer
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include "segmentmanifest.h"
+
+#include <QMutex>
+#include <QMutexLocker>
+#include <QThread>
+
+#include <atomic>
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+SegmentManifest::SegmentManifest(QCryptographicHash::Algorithm algorithm_arg, long long segment_size_arg)
+: m_algorithm(algorithm_arg)
+, segment_size(segment_size_arg)
+, total_size(0)
+, hashed_in_segment(0) {
+
+}
+
+bool SegmentManifest::fromText(const QByteArray &text) {
+    QList<QByteArray> line_list;
+    for (const QByteArray &line : text.split('\n')) {
+        const QByteArray trimmed = line.trimmed();
+
+        if (!trimmed.isEmpty()) {
+            line_list.append(trimmed);
+        }
+    }
+
+    if (line_list.size() < 4 || line_list[0] != "segment-manifest 1") {
+        return false;
+    }
+
+    // Returns value of "key value" line
+    const auto get_value =
+        [&](const int index, const QByteArray &key) -> QByteArray {
+            const QList<QByteArray> elements = line_list[index].split(' ');
+
+            if (elements.size() == 2 && elements[0] == key) {
+                return elements[1];
+            } else {
+                return QByteArray();
+            }
+        };
+
+    const QByteArray algorithm_string = get_value(1, "algorithm");
+    if (algorithm_string == "md5") {
+        m_algorithm = QCryptographicHash::Md5;
+    } else if (algorithm_string == "sha1") {
+        m_algorithm = QCryptographicHash::Sha1;
+    } else if (algorithm_string == "sha256") {
+        m_algorithm = QCryptographicHash::Sha256;
+    } else {
+        return false;
+    }
+
+    bool segment_size_ok = false;
+    segment_size = get_value(2, "segment-size").toLongLong(&segment_size_ok);
+    if (!segment_size_ok || segment_size <= 0 || segment_size % 4096 != 0) {
+        return false;
+    }
+
+    bool size_ok = false;
+    total_size = get_value(3, "size").toLongLong(&size_ok);
+    if (!size_ok || total_size < 0) {
+        return false;
+    }
+
+    checksum_list = line_list.mid(4);
+    for (QByteArray &checksum : checksum_list) {
+        checksum = checksum.toLower();
+    }
+
+    const long long expected_count = (total_size + segment_size - 1) / segment_size;
+    if (checksum_list.size() != expected_count) {
+        return false;
+    }
+
+    hash.reset();
+    hashed_in_segment = 0;
+
+    return true;
+}
+
+QByteArray SegmentManifest::toText() const {
+    const QByteArray algorithm_string = [this]() {
+        switch (m_algorithm) {
+            case QCryptographicHash::Md5: return "md5";
+            case QCryptographicHash::Sha1: return "sha1";
+            default: return "sha256";
+        }
+    }();
+
+    QByteArray out;
+    out += "segment-manifest 1\n";
+    out += "algorithm " + algorithm_string + "\n";
+    out += "segment-size " + QByteArray::number(segment_size) + "\n";
+    out += "size " + QByteArray::number(total_size) + "\n";
+
+    for (const QByteArray &checksum : checksum_list) {
+        out += checksum + "\n";
+    }
+
+    return out;
+}
+
+QCryptographicHash::Algorithm SegmentManifest::algorithm() const {
+    return m_algorithm;
+}
+
+long long SegmentManifest::segmentSize() const {
+    return segment_size;
+}
+
+long long SegmentManifest::size() const {
+    return total_size;
+}
+
+int SegmentManifest::count() const {
+    return checksum_list.size();
+}
+
+QByteArray SegmentManifest::checksum(const int index) const {
+    return checksum_list[index];
+}
+
+long long SegmentManifest::segmentOffset(const int index) const {
+    return index * segment_size;
+}
+
+long long SegmentManifest::segmentLength(const int index) const {
+    const long long offset = segmentOffset(index);
+
+    if (offset + segment_size < total_size) {
+        return segment_size;
+    } else {
+        return total_size - offset;
+    }
+}
+
+void SegmentManifest::addData(const unsigned char *data, long long data_size) {
+    while (data_size > 0) {
+        if (hash == nullptr) {
+            hash.reset(new QCryptographicHash(m_algorithm));
+        }
+
+        const long long len = qMin(data_size, segment_size - hashed_in_segment);
+        hash->addData((const char *) data, len);
+        data += len;
+        data_size -= len;
+        hashed_in_segment += len;
+        total_size += len;
+
+        if (hashed_in_segment == segment_size) {
+            checksum_list.append(hash->result().toHex());
+            hash->reset();
+            hashed_in_segment = 0;
+        }
+    }
+}
+
+void SegmentManifest::finish() {
+    if (hashed_in_segment > 0) {
+        checksum_list.append(hash->result().toHex());
+        hash->reset();
+        hashed_in_segment = 0;
+    }
+}
+
+// State of a check that goes through the media in order
+struct SequentialCheck {
+    const SegmentManifest *reference;
+    SegmentManifest *computed;
+    int checked_count;
+    int bad_segment;
+    checkCallback cb;
+    void *cbdata;
+};
+
+// Compare segments that were completed since last call
+static bool sequential_compare(SequentialCheck *check) {
+    while (check->checked_count < check->computed->count()) {
+        const int index = check->checked_count;
+
+        if (check->computed->checksum(index) != check->reference->checksum(index)) {
+            check->bad_segment = index;
+
+            return false;
+        }
+
+        check->checked_count++;
+    }
+
+    return true;
+}
+
+static void sequential_on_data(void *data, const unsigned char *buf, long long size) {
+    SequentialCheck *check = (SequentialCheck *) data;
+
+    check->computed->addData(buf, size);
+}
+
+static int sequential_on_progress(void *data, long long offset, long long total) {
+    SequentialCheck *check = (SequentialCheck *) data;
+
+    // NOTE: stop reading at the first bad segment
+    if (!sequential_compare(check)) {
+        return 1;
+    }
+
+    if (check->cb) {
+        return check->cb(check->cbdata, offset, total);
+    } else {
+        return 0;
+    }
+}
+
+static int check_sequential(int fd, const SegmentManifest &manifest, size_t chunk_size, checkCallback cb, void *cbdata, int *bad_segment) {
+    SegmentManifest computed(manifest.algorithm(), manifest.segmentSize());
+
+    SequentialCheck check;
+    check.reference = &manifest;
+    check.computed = &computed;
+    check.checked_count = 0;
+    check.bad_segment = -1;
+    check.cb = cb;
+    check.cbdata = cbdata;
+
+    const int rc = mediaReadFD(fd, manifest.size(), chunk_size, &sequential_on_data, &sequential_on_progress, &check);
+
+    if (check.bad_segment == -1 && rc == ISOMD5SUM_CHECK_PASSED) {
+        computed.finish();
+        sequential_compare(&check);
+    }
+
+    if (check.bad_segment != -1) {
+        *bad_segment = check.bad_segment;
+
+        return ISOMD5SUM_CHECK_FAILED;
+    }
+
+    return rc;
+}
+
+#ifndef _WIN32
+
+// State shared by workers of a parallel check
+struct ParallelCheck {
+    int fd;
+    const SegmentManifest *manifest;
+    size_t chunk_size;
+    std::atomic<int> next_segment;
+    std::atomic<long long> done_size;
+    std::atomic<bool> stopped;
+    std::atomic<bool> read_failed;
+    QMutex mutex;
+    int bad_segment;
+};
+
+// Takes next unchecked segment until all segments are
+// checked or one of them is bad
+class SegmentCheckWorker : public QThread {
+public:
+    SegmentCheckWorker(ParallelCheck *check_arg)
+    : check(check_arg) {
+
+    }
+
+protected:
+    void run() override {
+        const size_t pagesize = getpagesize();
+        unsigned char *buf_unaligned = (unsigned char *) malloc((check->chunk_size + pagesize) * sizeof(unsigned char));
+        unsigned char *buf = (buf_unaligned + (pagesize - ((uintptr_t) buf_unaligned % pagesize)));
+
+        const SegmentManifest *manifest = check->manifest;
+
+        while (!check->stopped) {
+            const int index = check->next_segment++;
+            if (index >= manifest->count()) {
+                break;
+            }
+
+            QCryptographicHash hash(manifest->algorithm());
+            const long long segment_offset = manifest->segmentOffset(index);
+            const long long segment_length = manifest->segmentLength(index);
+
+            for (long long pos = 0; pos < segment_length && !check->stopped;) {
+                const long long wanted = qMin(segment_length - pos, (long long) check->chunk_size);
+                const long long aligned = ((wanted + pagesize - 1) / pagesize) * pagesize;
+
+                const ssize_t rc = pread(check->fd, buf, aligned, segment_offset + pos);
+                if (rc < 0 && errno == EINTR) {
+                    continue;
+                }
+                if (rc < wanted) {
+                    check->read_failed = true;
+                    check->stopped = true;
+                    break;
+                }
+
+                hash.addData((const char *) buf, wanted);
+                pos += wanted;
+                check->done_size += wanted;
+            }
+
+            if (check->stopped) {
+                break;
+            }
+
+            if (hash.result().toHex() != manifest->checksum(index)) {
+                QMutexLocker locker(&check->mutex);
+
+                if (check->bad_segment == -1 || index < check->bad_segment) {
+                    check->bad_segment = index;
+                }
+                check->stopped = true;
+            }
+        }
+
+        free(buf_unaligned);
+    }
+
+private:
+    ParallelCheck *check;
+};
+
+static int check_parallel(int fd, const SegmentManifest &manifest, size_t chunk_size, int thread_count, checkCallback cb, void *cbdata, int *bad_segment) {
+    const size_t pagesize = getpagesize();
+
+    ParallelCheck check;
+    check.fd = fd;
+    check.manifest = &manifest;
+    check.chunk_size = ((chunk_size + pagesize - 1) / pagesize) * pagesize;
+    check.next_segment = 0;
+    check.done_size = 0;
+    check.stopped = false;
+    check.read_failed = false;
+    check.bad_segment = -1;
+
+    QList<SegmentCheckWorker *> worker_list;
+    for (int i = 0; i < thread_count; i++) {
+        SegmentCheckWorker *worker = new SegmentCheckWorker(&check);
+        worker->start();
+        worker_list.append(worker);
+    }
+
+    bool aborted = false;
+
+    // NOTE: progress is reported from this thread while
+    // waiting for workers
+    for (SegmentCheckWorker *worker : worker_list) {
+        while (!worker->wait(100)) {
+            if (cb && cb(cbdata, check.done_size, manifest.size())) {
+                aborted = true;
+                check.stopped = true;
+            }
+        }
+    }
+
+    qDeleteAll(worker_list);
+
+    if (check.bad_segment != -1) {
+        *bad_segment = check.bad_segment;
+
+        return ISOMD5SUM_CHECK_FAILED;
+    } else if (aborted) {
+        return ISOMD5SUM_CHECK_ABORTED;
+    } else if (check.read_failed) {
+        return ISOMD5SUM_READ_ERROR;
+    }
+
+    if (cb) {
+        cb(cbdata, manifest.size(), manifest.size());
+    }
+
+    return ISOMD5SUM_CHECK_PASSED;
+}
+
+#endif
+
+int mediaCheckSegmentsFD(int fd, const SegmentManifest &manifest, size_t chunk_size, int thread_count, checkCallback cb, void *cbdata, int *bad_segment) {
+    if (fd < 0) {
+        return ISOMD5SUM_FILE_NOT_FOUND;
+    }
+
+    if (chunk_size == 0) {
+        chunk_size = ISOMD5SUM_DEFAULT_CHUNK_SIZE;
+    }
+
+    *bad_segment = -1;
+
+    // NOTE: there's no pread() on Windows, so segments
+    // can't be read in parallel from one fd
+#ifdef _WIN32
+    thread_count = 1;
+#endif
+
+    if (thread_count <= 1 || manifest.count() <= 1) {
+        return check_sequential(fd, manifest, chunk_size, cb, cbdata, bad_segment);
+    }
+
+#ifndef _WIN32
+    return check_parallel(fd, manifest, chunk_size, qMin(thread_count, manifest.count()), cb, cbdata, bad_segment);
+#else
+    return ISOMD5SUM_READ_ERROR;
+#endif
+}
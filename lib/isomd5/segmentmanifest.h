@@ -0,0 +1,98 @@
+/*
+ * ALT Media Writer
+ * Copyright (C) 2016-2019 Martin Bříza <mbriza@redhat.com>
+ * Copyright (C) 2020-2022 Dmitry Degtyarev <kevl@basealt.ru>
+ *
+ * ALT Media Writer is a fork of Fedora Media Writer
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef SEGMENTMANIFEST_H
+#define SEGMENTMANIFEST_H
+
+/*
+ * Checksums of consecutive segments of an image. All
+ * segments except the last one are segment size bytes
+ * long. With a manifest, a check can stop at the first bad
+ * segment, report which part of the media is bad and check
+ * segments in parallel.
+ *
+ * A manifest can be shipped next to the image or computed
+ * while the image is written, by passing written data to
+ * addData(). Text format of a manifest:
+ *
+ * segment-manifest 1
+ * algorithm sha256
+ * segment-size 67108864
+ * size 1610612736
+ * <checksum of first segment>
+ * <checksum of second segment>
+ * ...
+ *
+ * Algorithm can be "md5", "sha1" or "sha256". Segment size
+ * has to be a multiple of 4096.
+ */
+
+#include "libcheckisomd5.h"
+
+#include <QByteArray>
+#include <QCryptographicHash>
+#include <QList>
+
+#include <memory>
+
+#define SEGMENT_MANIFEST_DEFAULT_SEGMENT_SIZE (64LL * 1024LL * 1024LL)
+
+class SegmentManifest {
+public:
+    SegmentManifest(QCryptographicHash::Algorithm algorithm = QCryptographicHash::Sha256, long long segment_size = SEGMENT_MANIFEST_DEFAULT_SEGMENT_SIZE);
+
+    bool fromText(const QByteArray &text);
+    QByteArray toText() const;
+
+    QCryptographicHash::Algorithm algorithm() const;
+    long long segmentSize() const;
+    // Total size of all segments
+    long long size() const;
+    int count() const;
+    QByteArray checksum(const int index) const;
+    long long segmentOffset(const int index) const;
+    long long segmentLength(const int index) const;
+
+    // Hash data in order, checksum of a segment is added
+    // once it's complete
+    void addData(const unsigned char *data, long long data_size);
+    // Add checksum of the last partial segment
+    void finish();
+
+private:
+    QCryptographicHash::Algorithm m_algorithm;
+    long long segment_size;
+    long long total_size;
+    QList<QByteArray> checksum_list;
+    std::unique_ptr<QCryptographicHash> hash;
+    long long hashed_in_segment;
+};
+
+/*
+ * Checks media against a manifest. With thread_count above
+ * 1, segments are checked in parallel, otherwise in order
+ * using mediaReadFD(). Check stops at the first bad
+ * segment, in which case bad_segment is set to its index.
+ */
+int mediaCheckSegmentsFD(int fd, const SegmentManifest &manifest, size_t chunk_size, int thread_count, checkCallback cb, void *cbdata, int *bad_segment);
+
+#endif // SEGMENTMANIFEST_H